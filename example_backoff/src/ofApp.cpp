@@ -0,0 +1,271 @@
+//
+// Copyright (c) 2017 Christopher Baker <https://christopherbaker.net>
+//
+// SPDX-License-Identifier:	MIT
+//
+
+
+#include "ofApp.h"
+#include <chrono>
+#include <thread>
+
+
+const uint64_t ofApp::POLLING_INTERVAL = 10;
+const uint64_t ofApp::THROTTLE_DURATION = 2500;
+const uint64_t ofApp::OUTAGE_DURATION = 3000;
+const uint64_t ofApp::RUN_DURATION = 6000;
+const std::size_t ofApp::MAX_THROTTLED_RUNS = 10;
+
+
+void ofApp::setup()
+{
+    // Every successful poll is logged, a hundred times a second.
+    ofSetLogLevel("HashtagClient::_loot", OF_LOG_WARNING);
+
+    std::filesystem::path storePath = ofToDataPath("store", true);
+    std::filesystem::remove_all(storePath);
+
+    ofxInstaLooter::BackoffPolicy backoffPolicy;
+    backoffPolicy.initialDelay = 100;
+    backoffPolicy.maxDelay = 800;
+    backoffPolicy.multiplier = 2.0;
+    backoffPolicy.jitter = 0.5;
+
+    auto sharedBreaker = std::make_shared<ofxInstaLooter::CircuitBreaker>("shared", 3, 1000, 4000);
+    auto otherBreaker = std::make_shared<ofxInstaLooter::CircuitBreaker>("other", 3, 1000, 4000);
+
+    uint64_t startTime = ofGetElapsedTimeMillis();
+    uint64_t throttledUntil = startTime + THROTTLE_DURATION;
+
+    Runs runs[3];
+
+    std::vector<std::unique_ptr<ofxInstaLooter::HashtagClient>> clients;
+
+    clients.push_back(makeClient("throttled_a",
+                                 backoffPolicy,
+                                 sharedBreaker,
+                                 throttledUntil,
+                                 "requests.exceptions.HTTPError: 429 Client Error: Too Many Requests",
+                                 runs[0]));
+    clients.push_back(makeClient("throttled_b",
+                                 backoffPolicy,
+                                 sharedBreaker,
+                                 throttledUntil,
+                                 "requests.exceptions.HTTPError: 429 Client Error: Too Many Requests",
+                                 runs[1]));
+    clients.push_back(makeClient("unreachable",
+                                 backoffPolicy,
+                                 otherBreaker,
+                                 startTime + OUTAGE_DURATION,
+                                 "requests.exceptions.ConnectionError: Max retries exceeded with url: /explore/tags/",
+                                 runs[2]));
+
+    bool sawPaused[3] = { false, false, false };
+    bool sawBackingOff[3] = { false, false, false };
+
+    while (ofGetElapsedTimeMillis() < startTime + RUN_DURATION)
+    {
+        for (std::size_t i = 0; i < clients.size(); ++i)
+        {
+            auto state = clients[i]->getState();
+
+            if (state.status == ofxInstaLooter::HashtagClient::Status::PAUSED) sawPaused[i] = true;
+            if (state.status == ofxInstaLooter::HashtagClient::Status::BACKING_OFF) sawBackingOff[i] = true;
+        }
+
+        std::this_thread::sleep_for(std::chrono::milliseconds(POLLING_INTERVAL / 2));
+    }
+
+    std::vector<ofxInstaLooter::HashtagClient::State> states;
+
+    for (auto& client: clients)
+    {
+        states.push_back(client->getState());
+        client->cancel();
+    }
+
+    clients.clear();
+
+    bool passed = checkOutcomes();
+
+    // The throttled clients.
+    std::size_t throttledRuns = 0;
+    bool resumed[2] = { false, false };
+
+    for (std::size_t i = 0; i < 2; ++i)
+    {
+        for (std::size_t j = 0; j < runs[i].times.size(); ++j)
+        {
+            if (runs[i].failed[j]) ++throttledRuns;
+            else if (runs[i].times[j] >= throttledUntil) resumed[i] = true;
+        }
+    }
+
+    ofLogNotice("ofApp::setup") << "Throttled for " << THROTTLE_DURATION << " ms: " << throttledRuns << " runs, against " << 2 * THROTTLE_DURATION / POLLING_INTERVAL << " polls at a fixed interval. The breaker opened " << sharedBreaker->trips() << " times.";
+
+    if (sharedBreaker->trips() == 0 || throttledRuns > MAX_THROTTLED_RUNS)
+    {
+        ofLogError("ofApp::setup") << "The shared breaker did not stop the throttled runs.";
+        passed = false;
+    }
+
+    for (std::size_t i = 0; i < 2; ++i)
+    {
+        ofLogNotice("ofApp::setup") << ofxInstaLooter::HashtagClient::State::toJSON(states[i]).dump();
+
+        if (!sawPaused[i] || !resumed[i] || states[i].consecutiveFailures != 0)
+        {
+            ofLogError("ofApp::setup") << "#" << states[i].hashtag << " was not paused and resumed.";
+            passed = false;
+        }
+    }
+
+    if (sharedBreaker->state(ofGetElapsedTimeMillis()) != ofxInstaLooter::CircuitBreaker::State::CLOSED)
+    {
+        ofLogError("ofApp::setup") << "The shared breaker did not close.";
+        passed = false;
+    }
+
+    // The client with network errors.
+    std::vector<uint64_t> gaps;
+
+    for (std::size_t j = 1; j < runs[2].times.size(); ++j)
+    {
+        if (runs[2].failed[j - 1]) gaps.push_back(runs[2].times[j] - runs[2].times[j - 1]);
+    }
+
+    std::stringstream ss;
+
+    for (auto gap: gaps) ss << gap << " ";
+
+    ofLogNotice("ofApp::setup") << "Delays after network errors, in ms: " << ss.str();
+    ofLogNotice("ofApp::setup") << ofxInstaLooter::HashtagClient::State::toJSON(states[2]).dump();
+
+    // Each delay is the policy's delay for that many failures, less up to
+    // its jitter, give or take a poll.
+    for (std::size_t j = 0; j < gaps.size(); ++j)
+    {
+        uint64_t shortest = backoffPolicy.delay(j + 1, 1.0);
+        uint64_t longest = backoffPolicy.delay(j + 1, 0.0) + 2 * POLLING_INTERVAL;
+
+        if (gaps[j] + POLLING_INTERVAL < shortest || gaps[j] > longest)
+        {
+            ofLogError("ofApp::setup") << "Delay " << j + 1 << " was " << gaps[j] << " ms, not " << shortest << " to " << longest << " ms.";
+            passed = false;
+        }
+    }
+
+    if (gaps.size() < 3 || !sawBackingOff[2] || states[2].consecutiveFailures != 0 || otherBreaker->trips() != 0)
+    {
+        ofLogError("ofApp::setup") << "#" << states[2].hashtag << " did not back off and recover without its breaker.";
+        passed = false;
+    }
+
+    std::filesystem::remove_all(storePath);
+
+    ofExit(passed ? 0 : 1);
+}
+
+
+bool ofApp::checkOutcomes()
+{
+    using Outcome = ofxInstaLooter::FetchResult::Outcome;
+
+    struct Case
+    {
+        int exitCode;
+        std::string line;
+        Outcome outcome;
+    };
+
+    const std::vector<Case> cases = {
+        { 0, "Downloaded 1451944358173325122.221088125.2017-2-16 22h21m17s0.jpg", Outcome::SUCCESS },
+        { 0, "Saved 429 new posts of #cats.", Outcome::SUCCESS },
+        { 0, "Resuming the search from its last checkpoint.", Outcome::SUCCESS },
+        { 0, "urllib.error.HTTPError: HTTP Error 429: Too Many Requests", Outcome::THROTTLED },
+        { 0, "Query failed with status 429.", Outcome::THROTTLED },
+        { 0, "Please wait a few minutes before you try again.", Outcome::THROTTLED },
+        { 0, "{\"message\": \"checkpoint_required\", \"status\": \"fail\"}", Outcome::AUTH_FAILED },
+        { 1, "requests.exceptions.HTTPError: 429 Client Error: Too Many Requests", Outcome::THROTTLED },
+        { 1, "Login failed: incorrect password.", Outcome::AUTH_FAILED },
+        { 1, "requests.exceptions.ConnectionError: Max retries exceeded with url: /explore/tags/", Outcome::NETWORK_ERROR },
+        { 1, "Saved 429 new posts of #cats.", Outcome::FAILED }
+    };
+
+    bool passed = true;
+
+    for (const auto& c: cases)
+    {
+        ofxInstaLooter::OutputMonitor output;
+        output.writeLine(c.line);
+        output.flush();
+
+        ofxInstaLooter::FetchResult result;
+        result.exitCode = c.exitCode;
+        result.progress = output.progress();
+
+        Outcome outcome = result.outcome();
+
+        if (outcome != c.outcome)
+        {
+            ofLogError("ofApp::checkOutcomes") << "\"" << c.line << "\" with exit code " << c.exitCode << " was " << ofxInstaLooter::FetchResult::toString(outcome) << ", not " << ofxInstaLooter::FetchResult::toString(c.outcome) << ".";
+            passed = false;
+        }
+    }
+
+    return passed;
+}
+
+
+std::unique_ptr<ofxInstaLooter::HashtagClient> ofApp::makeClient(const std::string& hashtag,
+                                                                 const ofxInstaLooter::BackoffPolicy& backoffPolicy,
+                                                                 std::shared_ptr<ofxInstaLooter::CircuitBreaker> circuitBreaker,
+                                                                 uint64_t failUntil,
+                                                                 const std::string& error,
+                                                                 Runs& runs)
+{
+    // Started once the fetcher is set, so every poll runs it.
+    auto client = std::make_unique<ofxInstaLooter::HashtagClient>(hashtag,
+                                                                  "",
+                                                                  "",
+                                                                  ofToDataPath("store", true),
+                                                                  POLLING_INTERVAL,
+                                                                  ofxInstaLooter::HashtagClient::DEFAULT_NUM_IMAGES_TO_DOWNLOAD,
+                                                                  "/usr/bin/true",
+                                                                  nullptr,
+                                                                  false);
+
+    client->setBackoffPolicy(backoffPolicy);
+    client->setCircuitBreaker(circuitBreaker);
+
+    client->setFetcher([failUntil, error, &runs](const ofxInstaLooter::FetchJob&,
+                                                 const ofxInstaLooter::CancellationToken&,
+                                                 ofxInstaLooter::OutputMonitor& output) {
+        uint64_t now = ofGetElapsedTimeMillis();
+        bool failed = now < failUntil;
+
+        {
+            std::unique_lock<std::mutex> lock(runs.mutex);
+            runs.times.push_back(now);
+            runs.failed.push_back(failed);
+        }
+
+        ofxInstaLooter::FetchResult result;
+
+        if (failed)
+        {
+            output.writeLine(error);
+            result.exitCode = 1;
+        }
+        else
+        {
+            result.exitCode = 0;
+        }
+
+        return result;
+    });
+
+    client->start();
+
+    return client;
+}
@@ -0,0 +1,88 @@
+//
+// Copyright (c) 2017 Christopher Baker <https://christopherbaker.net>
+//
+// SPDX-License-Identifier:	MIT
+//
+
+
+#pragma once
+
+
+#include "ofMain.h"
+#include "ofxIO.h"
+#include "ofxInstaLooter.h"
+
+
+/// \brief Checks that clients back off and pause when searches fail.
+///
+/// Three clients run searches with a stub fetcher instead of instaLooter.
+/// A fake Instagram throttles the credentials of the first two for a few
+/// seconds. They share a CircuitBreaker, which should pause both after a
+/// few throttled runs and resume them once a probe gets through. The third
+/// client uses other credentials and fails with network errors for a while.
+/// It should back off with growing delays without tripping its breaker.
+///
+/// The state of each client is sampled while they run, and the throttled
+/// runs are compared with the polls a fixed interval would have launched.
+///
+/// The app also checks how runs are classified by their exit code and
+/// output, e.g. that a run that exits with 0 is only throttled if its output
+/// reports a 429 status, not if it only mentions the number.
+///
+/// The app logs an error and exits with a failure if the clients do not
+/// behave.
+class ofApp: public ofBaseApp
+{
+public:
+    /// \brief The runs of one client.
+    struct Runs
+    {
+        /// \brief The time of each run, in milliseconds.
+        std::vector<uint64_t> times;
+
+        /// \brief True for each run that failed.
+        std::vector<bool> failed;
+
+        /// \brief Guards the runs.
+        std::mutex mutex;
+    };
+
+    void setup();
+
+    /// \brief Create a client that searches with a stub.
+    /// \param hashtag The hashtag.
+    /// \param backoffPolicy The delays after failures.
+    /// \param circuitBreaker The breaker of its credentials.
+    /// \param failUntil The time the stub stops failing, in milliseconds.
+    /// \param error The error line printed by failed runs.
+    /// \param runs Records the runs.
+    /// \returns the client.
+    std::unique_ptr<ofxInstaLooter::HashtagClient> makeClient(const std::string& hashtag,
+                                                              const ofxInstaLooter::BackoffPolicy& backoffPolicy,
+                                                              std::shared_ptr<ofxInstaLooter::CircuitBreaker> circuitBreaker,
+                                                              uint64_t failUntil,
+                                                              const std::string& error,
+                                                              Runs& runs);
+
+    /// \brief Check the outcome of runs with known exit codes and output.
+    /// \returns true if every run is classified as expected.
+    static bool checkOutcomes();
+
+    /// \brief The time in milliseconds between polls of each client.
+    static const uint64_t POLLING_INTERVAL;
+
+    /// \brief How long the shared credentials are throttled, in
+    /// milliseconds.
+    static const uint64_t THROTTLE_DURATION;
+
+    /// \brief How long the network is down for the third client, in
+    /// milliseconds.
+    static const uint64_t OUTAGE_DURATION;
+
+    /// \brief How long the clients run, in milliseconds.
+    static const uint64_t RUN_DURATION;
+
+    /// \brief The most throttled runs allowed.
+    static const std::size_t MAX_THROTTLED_RUNS;
+
+};
@@ -0,0 +1,96 @@
+//
+// Copyright (c) 2017 Christopher Baker <https://christopherbaker.net>
+//
+// SPDX-License-Identifier:	MIT
+//
+
+
+#include "ofApp.h"
+#include "ofx/IO/ThreadChannel.h"
+
+
+void ofApp::setup()
+{
+    const std::size_t numValues = 2000000;
+
+    ofLogNotice("ofApp::setup") << "Values per second, " << numValues << " values per run, " << std::thread::hardware_concurrency() << " cores.";
+    ofLogNotice("ofApp::setup") << "producers\tThreadChannel\tBatchChannel\tRingChannel SPSC\tRingChannel MPSC";
+
+    for (std::size_t numProducers: { 1, 2, 4, 8, 16 })
+    {
+        std::stringstream ss;
+        ss << numProducers;
+
+        {
+            ofx::IO::ThreadChannel<std::string> channel;
+            ss << "\t" << run(channel, numProducers, numValues);
+        }
+
+        {
+            ofxInstaLooter::BatchChannel<std::string> channel;
+            ss << "\t" << run(channel, numProducers, numValues);
+        }
+
+        if (numProducers == 1)
+        {
+            ofxInstaLooter::RingChannel<std::string, false> channel;
+            ss << "\t" << run(channel, numProducers, numValues);
+        }
+        else
+        {
+            ss << "\t-";
+        }
+
+        {
+            ofxInstaLooter::RingChannel<std::string, true> channel;
+            ss << "\t" << run(channel, numProducers, numValues);
+        }
+
+        ofLogNotice("ofApp::setup") << ss.str();
+    }
+
+    ofExit();
+}
+
+
+template<typename Channel>
+double ofApp::run(Channel& channel,
+                  std::size_t numProducers,
+                  std::size_t numValues)
+{
+    std::size_t valuesPerProducer = numValues / numProducers;
+
+    auto start = std::chrono::steady_clock::now();
+
+    std::vector<std::thread> producers;
+
+    for (std::size_t i = 0; i < numProducers; ++i)
+    {
+        producers.emplace_back([&, i]() {
+            for (std::size_t j = 0; j < valuesPerProducer; ++j)
+            {
+                // Long enough to need an allocation, like a Post.
+                channel.send("value " + std::to_string(i) + " " + std::to_string(j) + " with some padding");
+            }
+        });
+    }
+
+    std::thread closer([&]() {
+        for (auto& producer: producers) producer.join();
+        channel.close();
+    });
+
+    std::size_t received = 0;
+    std::string value;
+
+    while (channel.receive(value))
+    {
+        ++received;
+    }
+
+    closer.join();
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    return received / seconds;
+}
@@ -0,0 +1,36 @@
+//
+// Copyright (c) 2017 Christopher Baker <https://christopherbaker.net>
+//
+// SPDX-License-Identifier:	MIT
+//
+
+
+#pragma once
+
+
+#include "ofMain.h"
+#include "ofxIO.h"
+#include "ofxInstaLooter.h"
+
+
+/// \brief Compares the thread channels under contention.
+///
+/// Each run has a number of producer threads sending small strings to one
+/// consumer, which receives them one at a time like the manager and app do.
+/// The results are logged and the app exits.
+class ofApp: public ofBaseApp
+{
+public:
+    void setup();
+
+    /// \brief Time one run.
+    /// \param channel The channel.
+    /// \param numProducers The number of sending threads.
+    /// \param numValues The total number of values to send.
+    /// \returns the values received per second.
+    template<typename Channel>
+    static double run(Channel& channel,
+                      std::size_t numProducers,
+                      std::size_t numValues);
+
+};
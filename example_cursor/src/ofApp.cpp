@@ -0,0 +1,271 @@
+//
+// Copyright (c) 2017 Christopher Baker <https://christopherbaker.net>
+//
+// SPDX-License-Identifier:	MIT
+//
+
+
+#include "ofApp.h"
+#include <algorithm>
+#include <fstream>
+
+
+const uint64_t ofApp::POLLING_INTERVAL = 10;
+const uint64_t ofApp::TIMEOUT = 2000;
+const std::string ofApp::HASHTAG = "cursor";
+const uint64_t ofApp::FIRST_ID = 1451944358173325100;
+
+
+ofApp::FailingFileSink::FailingFileSink(Search& search): _search(search)
+{
+}
+
+
+void ofApp::FailingFileSink::submit(ofxInstaLooter::FileTask&& task)
+{
+    uint64_t failingId = 0;
+
+    {
+        std::unique_lock<std::mutex> lock(_search.mutex);
+        failingId = _search.failingId;
+    }
+
+    for (const auto& operation: task.operations)
+    {
+        if (failingId != 0 &&
+            operation.type == ofxInstaLooter::FileOperation::COPY &&
+            operation.path.filename().string().find(std::to_string(failingId) + ".") == 0)
+        {
+            task.success = false;
+            task.error = "Stub copy failure.";
+            _failed.push_back(std::move(task));
+            return;
+        }
+    }
+
+    _sink.submit(std::move(task));
+}
+
+
+std::size_t ofApp::FailingFileSink::complete(std::vector<ofxInstaLooter::FileTask>& tasks, bool wait)
+{
+    std::size_t count = _failed.size();
+
+    std::move(_failed.begin(), _failed.end(), std::back_inserter(tasks));
+    _failed.clear();
+
+    return count + _sink.complete(tasks, wait && count == 0);
+}
+
+
+std::size_t ofApp::FailingFileSink::inFlight() const
+{
+    return _failed.size() + _sink.inFlight();
+}
+
+
+std::string ofApp::FailingFileSink::name() const
+{
+    return "failing";
+}
+
+
+void ofApp::setup()
+{
+    // Every poll is logged, a hundred times a second.
+    ofSetLogLevel("HashtagClient::_loot", OF_LOG_WARNING);
+
+    std::filesystem::path storePath = ofToDataPath("store", true);
+    std::filesystem::remove_all(storePath);
+
+    Search search;
+
+    // Ids as long as Instagram's, which the store layout expects.
+    auto id = [](uint64_t n) { return FIRST_ID + n; };
+
+    {
+        auto client = makeClient(search);
+
+        // The store takes in the first posts.
+        {
+            std::unique_lock<std::mutex> lock(search.mutex);
+            search.ids = { id(1), id(2), id(3) };
+        }
+
+        std::vector<uint64_t> received = receive(*client, TIMEOUT, true, id(3));
+
+        check(received == std::vector<uint64_t>({ id(1), id(2), id(3) }), "The first posts were not sent.");
+        check(client->getCursor().id == id(3), "The cursor did not follow the stored posts.");
+
+        // Then the app crashes before the store takes in the next ones.
+        {
+            std::unique_lock<std::mutex> lock(search.mutex);
+            search.ids.push_back(id(4));
+            search.ids.push_back(id(5));
+        }
+
+        received = receive(*client, 20 * POLLING_INTERVAL, false);
+
+        check(received == std::vector<uint64_t>({ id(4), id(5) }), "The next posts were not sent.");
+        check(client->getCursor().id == id(3), "The cursor passed posts the store never took in.");
+    }
+
+    {
+        // The restarted client resends what the store never took in, and
+        // nothing it did.
+        auto client = makeClient(search);
+
+        check(client->getCursor().id == id(3), "The restarted client did not load the cursor.");
+
+        std::vector<uint64_t> received = receive(*client, TIMEOUT, true, id(5));
+
+        check(received == std::vector<uint64_t>({ id(4), id(5) }), "The restarted client did not resend only the unstored posts.");
+        check(client->getCursor().id == id(5), "The cursor did not follow the resent posts.");
+
+        // A failed copy holds the cursor back until it succeeds.
+        {
+            std::unique_lock<std::mutex> lock(search.mutex);
+            search.ids.push_back(id(6));
+            search.ids.push_back(id(7));
+            search.ids.push_back(id(8));
+            search.failingId = id(7);
+        }
+
+        received = receive(*client, 20 * POLLING_INTERVAL, true);
+
+        check(received == std::vector<uint64_t>({ id(6), id(8) }), "The posts around the failed copy were not sent.");
+        check(client->getCursor().id == id(6), "The cursor passed a failed copy.");
+
+        {
+            std::unique_lock<std::mutex> lock(search.mutex);
+            search.failingId = 0;
+        }
+
+        received = receive(*client, TIMEOUT, true, id(8));
+
+        check(received == std::vector<uint64_t>({ id(7) }), "The failed copy was not tried again.");
+        check(client->getCursor().id == id(8), "The cursor did not pass the retried copy.");
+
+        // A post the store fails to take in is staged and sent again.
+        {
+            std::unique_lock<std::mutex> lock(search.mutex);
+            search.ids.push_back(id(9));
+            search.ids.push_back(id(10));
+        }
+
+        received = receive(*client, TIMEOUT, true, id(10), id(9));
+
+        check(received == std::vector<uint64_t>({ id(9), id(9), id(10) }), "The post the store failed to take in was not sent again.");
+        check(client->getCursor().id == id(10), "The cursor did not pass the post once it was stored.");
+    }
+
+    std::stringstream ss;
+
+    for (auto cursor: search.cursors) ss << cursor << " ";
+
+    ofLogNotice("ofApp::setup") << "Cursors passed to the fetcher: " << ss.str();
+
+    std::filesystem::remove_all(storePath);
+
+    ofExit(_passed ? 0 : 1);
+}
+
+
+std::unique_ptr<ofxInstaLooter::HashtagClient> ofApp::makeClient(Search& search)
+{
+    // Started once the fetcher is set, so every poll runs it.
+    auto client = std::make_unique<ofxInstaLooter::HashtagClient>(HASHTAG,
+                                                                  "",
+                                                                  "",
+                                                                  ofToDataPath("store", true),
+                                                                  POLLING_INTERVAL,
+                                                                  ofxInstaLooter::HashtagClient::DEFAULT_NUM_IMAGES_TO_DOWNLOAD,
+                                                                  "/usr/bin/true",
+                                                                  nullptr,
+                                                                  false);
+
+    client->setFileSink(std::make_shared<FailingFileSink>(search));
+
+    client->setFetcher([&search](const ofxInstaLooter::FetchJob& job,
+                                 const ofxInstaLooter::CancellationToken&,
+                                 ofxInstaLooter::OutputMonitor&) {
+        std::unique_lock<std::mutex> lock(search.mutex);
+
+        search.cursors.push_back(job.cursor.id);
+
+        // Downloads are left as instaLooter names them.
+        for (auto id: search.ids)
+        {
+            std::filesystem::path path = job.downloadPath / (std::to_string(id) + ".1.2017-2-16 22h21m17s0.jpg");
+
+            if (!std::filesystem::exists(path))
+            {
+                std::ofstream(path.string()) << "image " << id;
+            }
+        }
+
+        ofxInstaLooter::FetchResult result;
+        result.exitCode = 0;
+        return result;
+    });
+
+    client->start();
+
+    return client;
+}
+
+
+std::vector<uint64_t> ofApp::receive(ofxInstaLooter::HashtagClient& client,
+                                     uint64_t duration,
+                                     bool store,
+                                     uint64_t until,
+                                     uint64_t reject)
+{
+    std::vector<uint64_t> ids;
+
+    uint64_t endTime = ofGetElapsedTimeMillis() + duration;
+
+    while (ofGetElapsedTimeMillis() < endTime)
+    {
+        if (until != 0 && client.getCursor().id >= until)
+        {
+            break;
+        }
+
+        ofxInstaLooter::Post post;
+
+        if (client.posts.tryReceive(post, POLLING_INTERVAL))
+        {
+            ids.push_back(post.id());
+
+            if (store && post.id() == reject)
+            {
+                // As the write queue does when a post cannot be written.
+                // The cursor must not pass it meanwhile.
+                check(client.getCursor().id < reject, "The cursor passed a post the store had not taken in.");
+                client.storeFailed(post.id());
+                reject = 0;
+            }
+            else if (store)
+            {
+                // The write queue removes the staged copy once the post is
+                // in the store.
+                std::filesystem::remove(post.path());
+            }
+        }
+    }
+
+    std::sort(ids.begin(), ids.end());
+
+    return ids;
+}
+
+
+void ofApp::check(bool condition, const std::string& message)
+{
+    if (!condition)
+    {
+        ofLogError("ofApp::check") << message;
+        _passed = false;
+    }
+}
@@ -0,0 +1,120 @@
+//
+// Copyright (c) 2017 Christopher Baker <https://christopherbaker.net>
+//
+// SPDX-License-Identifier:	MIT
+//
+
+
+#pragma once
+
+
+#include "ofMain.h"
+#include "ofxIO.h"
+#include "ofxInstaLooter.h"
+
+
+/// \brief Checks that the cursor of a search only passes stored posts.
+///
+/// A client runs a search with a stub fetcher that leaves downloads where
+/// instaLooter would. The app stands in for the store: it takes the posts
+/// the client sends and removes their staged copies, as the write queue
+/// does once a post is in the store.
+///
+/// The app checks that
+///
+/// - the cursor follows the posts the store took in,
+/// - it does not pass posts the store never took in, e.g. because the app
+///   crashed, and that a restarted client sends those again,
+/// - a restarted client does not send posts that were already stored,
+/// - it does not pass a post whose copy failed, until the copy succeeds,
+/// - a post the store failed to take in is sent again without a restart,
+///   and the cursor does not pass it until it is stored.
+///
+/// The app logs an error and exits with a failure if the client does not
+/// behave.
+class ofApp: public ofBaseApp
+{
+public:
+    /// \brief The shared state of the stub fetcher, the sink and the store.
+    struct Search
+    {
+        /// \brief The ids of the posts the fetcher downloads.
+        std::vector<uint64_t> ids;
+
+        /// \brief The cursor passed with each job.
+        std::vector<uint64_t> cursors;
+
+        /// \brief The id whose copy fails, or 0.
+        uint64_t failingId = 0;
+
+        /// \brief Guards the search.
+        std::mutex mutex;
+    };
+
+    /// \brief A sink whose copies of one post fail.
+    class FailingFileSink: public ofxInstaLooter::FileSink
+    {
+    public:
+        FailingFileSink(Search& search);
+
+        void submit(ofxInstaLooter::FileTask&& task) override;
+        std::size_t complete(std::vector<ofxInstaLooter::FileTask>& tasks, bool wait) override;
+        std::size_t inFlight() const override;
+        std::string name() const override;
+
+    private:
+        /// \brief The shared state of the search.
+        Search& _search;
+
+        /// \brief Runs the tasks that do not fail.
+        ofxInstaLooter::SynchronousFileSink _sink;
+
+        /// \brief Failed tasks that have not been collected.
+        std::vector<ofxInstaLooter::FileTask> _failed;
+
+    };
+
+    void setup();
+
+    /// \brief Create a client that searches with a stub.
+    /// \param search The shared state of the search.
+    /// \returns the client.
+    std::unique_ptr<ofxInstaLooter::HashtagClient> makeClient(Search& search);
+
+    /// \brief Take the posts a client sent for a while.
+    /// \param client The client.
+    /// \param duration How long to take posts, in milliseconds.
+    /// \param store If true, store the posts, otherwise drop them as a
+    ///     crash would.
+    /// \param until Stop early once the cursor reaches this id, if not 0.
+    /// \param reject The id of a post the store fails to take in the first
+    ///     time, if not 0.
+    /// \returns the ids of the posts taken.
+    std::vector<uint64_t> receive(ofxInstaLooter::HashtagClient& client,
+                                  uint64_t duration,
+                                  bool store,
+                                  uint64_t until = 0,
+                                  uint64_t reject = 0);
+
+    /// \brief Check a condition and log an error if it does not hold.
+    /// \param condition The condition.
+    /// \param message The error.
+    void check(bool condition, const std::string& message);
+
+    /// \brief The time in milliseconds between polls of the client.
+    static const uint64_t POLLING_INTERVAL;
+
+    /// \brief How long to wait for the client, in milliseconds.
+    static const uint64_t TIMEOUT;
+
+    /// \brief The search hashtag.
+    static const std::string HASHTAG;
+
+    /// \brief The id before those of the posts found.
+    static const uint64_t FIRST_ID;
+
+private:
+    /// \brief True while every check holds.
+    bool _passed = true;
+
+};
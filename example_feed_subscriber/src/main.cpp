@@ -0,0 +1,21 @@
+#include "ofApp.h"
+#include "ofAppNoWindow.h"
+
+
+int main(int argc, char* argv[])
+{
+    auto app = std::make_shared<ofApp>();
+
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+
+        if (arg == "--latest") app->policy = ofxInstaLooter::FeedSubscriber::LagPolicy::LATEST;
+        else if (arg == "--delay" && i + 1 < argc) app->delay = std::stoull(argv[++i]);
+        else app->path = arg;
+    }
+
+    ofAppNoWindow window;
+    ofSetupOpenGL(&window, 1024, 768, OF_WINDOW);
+    return ofRunApp(app);
+}
@@ -0,0 +1,51 @@
+//
+// Copyright (c) 2017 Christopher Baker <https://christopherbaker.net>
+//
+// SPDX-License-Identifier:	MIT
+//
+
+
+#include "ofApp.h"
+
+
+void ofApp::setup()
+{
+    ofSetFrameRate(60);
+
+    _subscriber = std::make_unique<ofxInstaLooter::FeedSubscriber>(path, policy);
+
+    if (!_subscriber->isOpen())
+    {
+        ofLogNotice("ofApp::setup") << "Waiting for a feed in " << path << ".";
+    }
+}
+
+
+void ofApp::update()
+{
+    ofxInstaLooter::SharedFeed::Kind kind;
+
+    while (_subscriber->receive(_post, kind))
+    {
+        ++_received;
+
+        std::string label = "new ";
+
+        if (kind == ofxInstaLooter::SharedFeed::Kind::UPDATED) label = "updated ";
+        else if (kind == ofxInstaLooter::SharedFeed::Kind::REMOVED) label = "removed ";
+
+        ofLogNotice("ofApp::update") << label << _post.id() << " " << _post.path();
+
+        if (delay > 0)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(delay));
+            break;
+        }
+    }
+
+    if (ofGetElapsedTimeMillis() >= _lastReport + 1000)
+    {
+        _lastReport = ofGetElapsedTimeMillis();
+        ofLogNotice("ofApp::update") << "received " << _received << ", lag " << _subscriber->lag() << ", dropped " << _subscriber->dropped();
+    }
+}
@@ -0,0 +1,51 @@
+//
+// Copyright (c) 2017 Christopher Baker <https://christopherbaker.net>
+//
+// SPDX-License-Identifier:	MIT
+//
+
+
+#pragma once
+
+
+#include "ofMain.h"
+#include "ofxIO.h"
+#include "ofxInstaLooter.h"
+
+
+/// \brief Reads the shared feed of a running example_multiple.
+///
+/// Enable "shared_feed" in example_multiple's settings, run it, then start
+/// any number of these:
+///
+///     example_feed_subscriber [path] [--latest] [--delay ms]
+///
+/// Each logs the posts it receives and, every second, its lag and the posts
+/// it dropped. --delay sleeps after each post to play a slow consumer, and
+/// --latest makes it skip ahead instead of resuming from the oldest post.
+class ofApp: public ofBaseApp
+{
+public:
+    void setup();
+    void update();
+
+    /// \brief The path of the feed.
+    std::string path = ofxInstaLooter::SharedFeed::DEFAULT_PATH;
+
+    /// \brief What to do after falling behind.
+    ofxInstaLooter::FeedSubscriber::LagPolicy policy = ofxInstaLooter::FeedSubscriber::LagPolicy::OLDEST;
+
+    /// \brief The time in milliseconds to sleep after each post.
+    uint64_t delay = 0;
+
+private:
+    std::unique_ptr<ofxInstaLooter::FeedSubscriber> _subscriber;
+
+    /// \brief Reused for every post.
+    ofxInstaLooter::Post _post;
+
+    uint64_t _received = 0;
+
+    uint64_t _lastReport = 0;
+
+};
@@ -0,0 +1,23 @@
+#include "ofApp.h"
+#include "ofAppNoWindow.h"
+
+
+int main(int argc, char* argv[])
+{
+    auto app = std::make_shared<ofApp>();
+
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+
+        if (arg == "--files" && i + 1 < argc) app->numFiles = std::stoull(argv[++i]);
+        else if (arg == "--size" && i + 1 < argc) app->fileSize = std::stoull(argv[++i]) * 1024;
+        else if (arg == "--threads" && i + 1 < argc) app->numThreads = std::stoull(argv[++i]);
+        else if (arg == "--queue-depth" && i + 1 < argc) app->queueDepth = std::stoull(argv[++i]);
+        else app->path = arg;
+    }
+
+    ofAppNoWindow window;
+    ofSetupOpenGL(&window, 1024, 768, OF_WINDOW);
+    return ofRunApp(app);
+}
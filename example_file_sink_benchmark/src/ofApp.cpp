@@ -0,0 +1,174 @@
+//
+// Copyright (c) 2017 Christopher Baker <https://christopherbaker.net>
+//
+// SPDX-License-Identifier:	MIT
+//
+
+
+#include "ofApp.h"
+#include "ofx/InstaLooter/IoUringFileSink.h"
+#include <fstream>
+#include <unistd.h>
+
+
+const std::size_t ofApp::BATCH_SIZE = 50;
+const std::size_t ofApp::NUM_DIRECTORIES = 100;
+
+
+void ofApp::setup()
+{
+    std::filesystem::path root = path.empty() ? ofToDataPath("", true) : path;
+    root /= "file_sink_benchmark";
+
+    std::filesystem::remove_all(root);
+
+    std::filesystem::path sourcePath = root / "source";
+    std::filesystem::create_directories(sourcePath);
+
+    // The downloads every run copies from.
+    std::string image(fileSize, 'x');
+
+    for (std::size_t i = 0; i < numFiles; ++i)
+    {
+        std::ofstream((sourcePath / (std::to_string(i) + ".jpg")).string(), std::ios::binary) << image;
+    }
+
+    ::sync();
+
+    ofJson sidecar = {
+        { "id", 1451944358173325100 },
+        { "user_id", 1 },
+        { "timestamp", 1487283677 },
+        { "width", 640 },
+        { "height", 640 },
+        { "hashtags", { "hashtag" } }
+    };
+
+    uint64_t imageBytes = uint64_t(numFiles) * fileSize;
+    uint64_t sidecarBytes = uint64_t(numFiles) * sidecar.dump().size();
+
+    ofLogNotice("ofApp::setup") << numFiles << " files of " << fileSize / 1024 << " KB in " << root << ".";
+    ofLogNotice("ofApp::setup") << "backend\tcopy files/s\tcopy MB/s\tmove files/s\tmove MB/s\twrite files/s\twrite MB/s";
+
+    for (std::string backend: { "sync", "threads", "io_uring" })
+    {
+        if (backend == "io_uring" && !ofxInstaLooter::IoUringFileSink::isAvailable())
+        {
+            ofLogNotice("ofApp::setup") << "io_uring is not available.";
+            continue;
+        }
+
+        auto sink = ofxInstaLooter::FileSink::fromJSON({
+            { "backend", backend },
+            { "threads", numThreads },
+            { "queue_depth", queueDepth }
+        });
+
+        std::filesystem::path stagedPath = root / "staged";
+        std::filesystem::path storePath = root / "store";
+
+        std::filesystem::create_directories(stagedPath);
+
+        std::vector<ofxInstaLooter::FileTask> tasks;
+
+        for (std::size_t i = 0; i < numFiles; ++i)
+        {
+            ofxInstaLooter::FileTask task;
+            task.operations.push_back(ofxInstaLooter::FileOperation::copy(sourcePath / (std::to_string(i) + ".jpg"),
+                                                                          stagedPath / (std::to_string(i) + ".jpg")));
+            tasks.push_back(std::move(task));
+        }
+
+        Throughput copy = run(*sink, tasks, imageBytes);
+
+        for (std::size_t i = 0; i < numFiles; ++i)
+        {
+            std::filesystem::path directory = storePath / std::to_string(i % NUM_DIRECTORIES);
+
+            ofxInstaLooter::FileTask task;
+            task.operations.push_back(ofxInstaLooter::FileOperation::createDirectories(directory));
+            task.operations.push_back(ofxInstaLooter::FileOperation::move(stagedPath / (std::to_string(i) + ".jpg"),
+                                                                          directory / (std::to_string(i) + ".jpg")));
+            tasks.push_back(std::move(task));
+        }
+
+        Throughput move = run(*sink, tasks, imageBytes);
+
+        for (std::size_t i = 0; i < numFiles; ++i)
+        {
+            std::filesystem::path directory = storePath / std::to_string(i % NUM_DIRECTORIES);
+
+            ofxInstaLooter::FileTask task;
+            task.operations.push_back(ofxInstaLooter::FileOperation::write(directory / (std::to_string(i) + ".json"),
+                                                                           sidecar.dump()));
+            tasks.push_back(std::move(task));
+        }
+
+        Throughput write = run(*sink, tasks, sidecarBytes);
+
+        ofLogNotice("ofApp::setup") << sink->name()
+                                    << "\t" << copy.filesPerSecond << "\t" << copy.megabytesPerSecond
+                                    << "\t" << move.filesPerSecond << "\t" << move.megabytesPerSecond
+                                    << "\t" << write.filesPerSecond << "\t" << write.megabytesPerSecond;
+
+        std::filesystem::remove_all(stagedPath);
+        std::filesystem::remove_all(storePath);
+    }
+
+    std::filesystem::remove_all(root);
+
+    ofExit();
+}
+
+
+ofApp::Throughput ofApp::run(ofxInstaLooter::FileSink& sink,
+                             std::vector<ofxInstaLooter::FileTask>& tasks,
+                             uint64_t bytes)
+{
+    std::size_t numTasks = tasks.size();
+    std::size_t numFailed = 0;
+    std::vector<ofxInstaLooter::FileTask> completed;
+
+    uint64_t startTime = ofGetElapsedTimeMicros();
+
+    for (std::size_t i = 0; i < numTasks; i += BATCH_SIZE)
+    {
+        for (std::size_t j = i; j < std::min(i + BATCH_SIZE, numTasks); ++j)
+        {
+            sink.submit(std::move(tasks[j]));
+        }
+
+        sink.drain(completed);
+
+        for (const auto& task: completed)
+        {
+            if (!task.success)
+            {
+                if (numFailed == 0)
+                {
+                    ofLogError("ofApp::run") << task.error;
+                }
+
+                ++numFailed;
+            }
+        }
+
+        completed.clear();
+    }
+
+    ::sync();
+
+    double seconds = (ofGetElapsedTimeMicros() - startTime) / 1000000.0;
+
+    tasks.clear();
+
+    if (numFailed > 0)
+    {
+        ofLogError("ofApp::run") << numFailed << " of " << numTasks << " tasks failed.";
+    }
+
+    Throughput throughput;
+    throughput.filesPerSecond = numTasks / seconds;
+    throughput.megabytesPerSecond = bytes / seconds / (1 << 20);
+    return throughput;
+}
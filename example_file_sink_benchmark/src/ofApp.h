@@ -0,0 +1,77 @@
+//
+// Copyright (c) 2017 Christopher Baker <https://christopherbaker.net>
+//
+// SPDX-License-Identifier:	MIT
+//
+
+
+#pragma once
+
+
+#include "ofMain.h"
+#include "ofxIO.h"
+#include "ofxInstaLooter.h"
+
+
+/// \brief Measures the throughput of each FileSink backend on a disk.
+///
+///     example_file_sink_benchmark [path] [--files n] [--size kb]
+///         [--threads n] [--queue-depth n]
+///
+/// A scratch directory is made under path, which defaults to bin/data, so
+/// run it once with a path on an SSD and once with a path on an HDD. For
+/// each backend, files are
+///
+/// - copied, as a client stages its downloads,
+/// - moved into a store directory tree, as the write queue stores them (a
+///   rename on the same volume, so its megabytes are nominal),
+/// - written with a small JSON sidecar, as the write queue does.
+///
+/// Tasks are submitted and collected in batches, like the ingest threads
+/// do. Each run ends with a sync(), so the time includes writing back to
+/// the disk rather than only to the page cache.
+///
+/// The files and megabytes per second are logged and the app exits.
+class ofApp: public ofBaseApp
+{
+public:
+    /// \brief The throughput of one run.
+    struct Throughput
+    {
+        double filesPerSecond = 0;
+        double megabytesPerSecond = 0;
+    };
+
+    void setup();
+
+    /// \brief Run tasks on a sink in batches and time them.
+    /// \param sink The sink.
+    /// \param tasks The tasks, left empty.
+    /// \param bytes The number of bytes the tasks copy, move or write.
+    /// \returns the throughput.
+    static Throughput run(ofxInstaLooter::FileSink& sink,
+                          std::vector<ofxInstaLooter::FileTask>& tasks,
+                          uint64_t bytes);
+
+    /// \brief The directory to make the scratch directory in.
+    std::string path = "";
+
+    /// \brief The number of files per run.
+    std::size_t numFiles = 2000;
+
+    /// \brief The size of each file in bytes.
+    std::size_t fileSize = 64 * 1024;
+
+    /// \brief The number of thread pool threads.
+    std::size_t numThreads = ofxInstaLooter::FileSink::DEFAULT_NUM_THREADS;
+
+    /// \brief The io_uring queue depth.
+    std::size_t queueDepth = ofxInstaLooter::FileSink::DEFAULT_QUEUE_DEPTH;
+
+    /// \brief The number of tasks submitted before they are collected.
+    static const std::size_t BATCH_SIZE;
+
+    /// \brief The number of store directories files are moved into.
+    static const std::size_t NUM_DIRECTORIES;
+
+};
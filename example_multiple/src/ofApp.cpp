@@ -17,34 +17,144 @@ void ofApp::setup()
 
     manager.setup(settings["paths"], settings["sources"]["instagram"]);
 
+    // Searches edited in settings.json are applied without a restart.
+    manager.watch(ofToDataPath("settings.json", true), "/sources/instagram");
+
 }
 
 
 void ofApp::update()
 {
-    ofxInstaLooter::Post post;
+    // Take all pending posts with a single lock.
+    posts.clear();
+    manager.posts.receiveAll(posts);
 
-    while (manager.posts.tryReceive(post))
+    for (const auto& post: posts)
     {
         std::stringstream ss;
 
-        for (auto hashtag: post.hashtags())
+        for (const auto& hashtag: post.hashtags())
         {
             ss << hashtag << ",";
         }
 
-        ofLogNotice("ofApp::update") << "New post with hashtags " << ss.str() << " @ " << post.path().filename();
+        // Posts in a pack store have no file of their own.
+        std::size_t imageSize = 0;
+
+        if (ofxInstaLooter::PackStore::isLocator(post.path()))
+        {
+            auto image = manager.getImage(post.id());
+            if (image) imageSize = image->size();
+        }
+        else if (std::filesystem::exists(post.path()))
+        {
+            imageSize = std::filesystem::file_size(post.path());
+        }
+
+        ofLogNotice("ofApp::update") << "New post with hashtags " << ss.str() << " @ " << post.path().filename() << " (" << imageSize << " bytes)";
+
+        report.record(post);
     }
 
-    while (manager.updatedPosts.tryReceive(post))
+    posts.clear();
+    manager.updatedPosts.receiveAll(posts);
+
+    for (const auto& post: posts)
     {
         std::stringstream ss;
         
-        for (auto hashtag: post.hashtags())
+        for (const auto& hashtag: post.hashtags())
         {
             ss << hashtag << ",";
         }
 
         ofLogNotice("ofApp::update") << "Updated post with hashtags " << ss.str() << " @ " << post.path().filename();
     }
+
+    // Posts removed by the "retention" settings.
+    posts.clear();
+    manager.removedPosts.receiveAll(posts);
+
+    for (const auto& post: posts)
+    {
+        ofLogVerbose("ofApp::update") << "Removed post " << post.id() << " @ " << post.path().filename();
+    }
+
+    if (report.count() > 0 && ofGetElapsedTimeMillis() > lastReportTime + 10000)
+    {
+        ofLogNotice("ofApp::update") << "Load: " << report.toString();
+        lastReportTime = ofGetElapsedTimeMillis();
+    }
+}
+
+
+void ofApp::keyPressed(int key)
+{
+    // Save the recent pipeline spans, if "trace" is enabled in the settings.
+    if (key == 't' && ofxInstaLooter::Trace::isEnabled())
+    {
+        std::string path = ofToDataPath("trace-" + ofGetTimestampString() + ".json", true);
+
+        if (ofxInstaLooter::Trace::save(path))
+        {
+            ofLogNotice("ofApp::keyPressed") << "Saved trace to " << path << ", open it at ui.perfetto.dev.";
+        }
+    }
+
+    // Check the store, or check and repair it with 'F'.
+    if ((key == 'f' || key == 'F') && manager.store() && !(checker && checker->isRunning()))
+    {
+        if (!checker)
+        {
+            checker = std::make_unique<ofxInstaLooter::StoreChecker>(*manager.store());
+        }
+
+        checker->start(ofToDataPath("fsck-" + ofGetTimestampString() + ".jsonl", true), key == 'F');
+    }
+
+    // Export the metadata of posts stored since the last export, read it
+    // with scripts/read_posts.py.
+    if (key == 'e' && manager.store() && !(exporter && exporter->isRunning()))
+    {
+        if (!exporter)
+        {
+            exporter = std::make_unique<ofxInstaLooter::StoreExporter>(*manager.store());
+        }
+
+        exporter->start(ofToDataPath("export", true));
+    }
+
+    // List what each client is doing, e.g. backing off after failures or
+    // paused while Instagram throttles the credentials.
+    if (key == 'c')
+    {
+        for (const auto& state: manager.clientStates())
+        {
+            ofLogNotice("ofApp::keyPressed") << ofxInstaLooter::HashtagClient::State::toJSON(state).dump();
+        }
+    }
+
+    // List the subscribers of the shared feed, if "shared_feed" is enabled,
+    // see example_feed_subscriber.
+    if (key == 's' && manager.feed())
+    {
+        auto consumers = manager.feed()->consumers();
+
+        ofLogNotice("ofApp::keyPressed") << consumers.size() << " subscribers to " << manager.feed()->path() << " at " << manager.feed()->head() << ".";
+
+        for (const auto& consumer: consumers)
+        {
+            ofLogNotice("ofApp::keyPressed") << "pid " << consumer.pid << ": lag " << consumer.lag << ", dropped " << consumer.dropped;
+        }
+    }
+}
+
+
+void ofApp::exit()
+{
+    // Useful when replaying a recording to test capacity.
+    if (report.count() > 0)
+    {
+        ofSavePrettyJson("report.json", report.toJSON());
+    }
 }
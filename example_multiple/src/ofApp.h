@@ -18,7 +18,24 @@ class ofApp: public ofBaseApp
 public:
     void setup();
     void update();
+    void exit();
+    void keyPressed(int key);
 
     ofxInstaLooter::HashtagClientManager manager;
 
+    std::vector<ofxInstaLooter::Post> posts;
+
+    /// \brief Throughput and latency of the received posts.
+    ofxInstaLooter::LoadReport report;
+
+    /// \brief The last time the report was logged.
+    uint64_t lastReportTime = 0;
+
+    /// \brief Checks the store on request.
+    std::unique_ptr<ofxInstaLooter::StoreChecker> checker;
+
+    /// \brief Exports post metadata on request.
+    std::unique_ptr<ofxInstaLooter::StoreExporter> exporter;
+
+
 };
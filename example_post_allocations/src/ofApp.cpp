@@ -0,0 +1,202 @@
+//
+// Copyright (c) 2017 Christopher Baker <https://christopherbaker.net>
+//
+// SPDX-License-Identifier:	MIT
+//
+
+
+#include "ofApp.h"
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+
+namespace {
+
+
+std::atomic<uint64_t> numAllocations(0);
+
+
+}
+
+
+void* operator new(std::size_t size)
+{
+    ++numAllocations;
+
+    if (void* p = std::malloc(size == 0 ? 1 : size))
+    {
+        return p;
+    }
+
+    throw std::bad_alloc();
+}
+
+
+void operator delete(void* p) noexcept
+{
+    std::free(p);
+}
+
+
+void operator delete(void* p, std::size_t) noexcept
+{
+    std::free(p);
+}
+
+
+double ofApp::Counts::total() const
+{
+    return parse + handoff + read + cache;
+}
+
+
+void ofApp::setup()
+{
+    ofLogNotice("ofApp::setup") << "Allocations per post.";
+    ofLogNotice("ofApp::setup") << "posts\tparse\thandoff\tread\tcache\ttotal";
+
+    Counts previous;
+    bool constant = true;
+
+    for (std::size_t numPosts: { 1000, 10000, 100000 })
+    {
+        Counts counts = measure(numPosts);
+
+        std::stringstream ss;
+        ss << numPosts << "\t" << counts.parse << "\t" << counts.handoff << "\t" << counts.read << "\t" << counts.cache << "\t" << counts.total();
+        ofLogNotice("ofApp::setup") << ss.str();
+
+        // Buffers that grow with the batch add a fraction of an allocation.
+        if (previous.total() > 0 && counts.total() > previous.total() + 0.5)
+        {
+            constant = false;
+        }
+
+        previous = counts;
+    }
+
+    if (!constant)
+    {
+        ofLogError("ofApp::setup") << "The allocations per post grow with the number of posts.";
+    }
+
+    ofExit(constant ? 0 : 1);
+}
+
+
+ofApp::Counts ofApp::measure(std::size_t numPosts)
+{
+    const std::size_t batchSize = 100;
+
+    // Long enough to need an allocation, like most hashtags.
+    const std::string hashtag = "instalooterbenchmark";
+
+    std::vector<std::filesystem::path> paths;
+
+    for (std::size_t i = 0; i < numPosts; ++i)
+    {
+        paths.push_back(std::filesystem::path("download") / hashtag / "raw" /
+                        (std::to_string(1451944358173325122 + i) + ".221088125.2017-2-16 22h21m17s0.jpg"));
+    }
+
+    Counts counts;
+
+    // Parse, as HashtagClient::_loot does.
+    std::vector<std::vector<ofxInstaLooter::Post>> batches(numPosts / batchSize + 1);
+
+    for (auto& batch: batches) batch.reserve(batchSize);
+
+    uint64_t start = allocations();
+
+    for (std::size_t i = 0; i < numPosts; ++i)
+    {
+        batches[i / batchSize].push_back(ofxInstaLooter::Post::fromDownloadPath(paths[i]));
+    }
+
+    counts.parse = double(allocations() - start) / numPosts;
+
+    // Hand off, as the client, the manager's route and write queue and the
+    // app do.
+    ofxInstaLooter::MultiProducerChannel<ofxInstaLooter::Post> clientPosts;
+    ofxInstaLooter::MultiProducerChannel<ofxInstaLooter::Post> posts;
+    std::vector<ofxInstaLooter::Post> received;
+    std::vector<ofxInstaLooter::Post> cached;
+    ofxInstaLooter::Post post;
+
+    cached.reserve(numPosts);
+
+    start = allocations();
+
+    {
+        ofxInstaLooter::WriteQueue writeQueue([&](std::vector<ofxInstaLooter::Post>& batch) {
+            posts.sendBatch(std::move(batch));
+        });
+
+        for (auto& batch: batches)
+        {
+            clientPosts.sendBatch(std::move(batch));
+
+            received.clear();
+            clientPosts.receiveAll(received);
+
+            for (auto& receivedPost: received)
+            {
+                writeQueue.send(std::move(receivedPost));
+            }
+
+            while (posts.tryReceive(post))
+            {
+                cached.push_back(std::move(post));
+            }
+        }
+    }
+
+    while (posts.tryReceive(post))
+    {
+        cached.push_back(std::move(post));
+    }
+
+    counts.handoff = double(allocations() - start) / numPosts;
+
+    // Read, as the app does.
+    uint64_t sum = 0;
+
+    start = allocations();
+
+    for (const auto& cachedPost: cached)
+    {
+        sum += cachedPost.id() + cachedPost.userId() + cachedPost.timestamp();
+        sum += cachedPost.width() + cachedPost.height() + cachedPost.downloadTime();
+        sum += cachedPost.path().native().size();
+
+        for (const auto& postHashtag: cachedPost.hashtags())
+        {
+            sum += postHashtag.size();
+        }
+    }
+
+    counts.read = double(allocations() - start) / numPosts;
+
+    ofLogVerbose("ofApp::measure") << "Checksum " << sum;
+
+    // Cache, as the manager does once the posts are written.
+    ofxInstaLooter::PostCache cache(numPosts / 2);
+
+    start = allocations();
+
+    for (const auto& cachedPost: cached)
+    {
+        cache.put(cachedPost);
+    }
+
+    counts.cache = double(allocations() - start) / numPosts;
+
+    return counts;
+}
+
+
+uint64_t ofApp::allocations()
+{
+    return numAllocations;
+}
@@ -0,0 +1,62 @@
+//
+// Copyright (c) 2017 Christopher Baker <https://christopherbaker.net>
+//
+// SPDX-License-Identifier:	MIT
+//
+
+
+#pragma once
+
+
+#include "ofMain.h"
+#include "ofxIO.h"
+#include "ofxInstaLooter.h"
+
+
+/// \brief Counts the heap allocations of each post on its way from a
+/// downloaded file to the app.
+///
+/// Every operator new of the process is counted. Posts are parsed from
+/// download paths like a HashtagClient does, handed through the client
+/// channel, a WriteQueue and the posts channel like the manager does, read
+/// by the app and put in a PostCache. Nothing touches the disk, so what is
+/// counted is the cost of the Post itself.
+///
+/// Each stage is run with more and more posts. The allocations per post
+/// should be the same at every size; the app logs an error and exits with
+/// a failure if they grow.
+class ofApp: public ofBaseApp
+{
+public:
+    /// \brief Allocations per post of each stage.
+    struct Counts
+    {
+        /// \brief Post::fromDownloadPath.
+        double parse = 0;
+
+        /// \brief From the client to the app, through the channels and a
+        /// WriteQueue.
+        double handoff = 0;
+
+        /// \brief Reading every field, as the app does.
+        double read = 0;
+
+        /// \brief PostCache::put.
+        double cache = 0;
+
+        /// \returns the sum of the stages.
+        double total() const;
+
+    };
+
+    void setup();
+
+    /// \brief Count the allocations of a number of posts.
+    /// \param numPosts The number of posts.
+    /// \returns the allocations per post.
+    static Counts measure(std::size_t numPosts);
+
+    /// \returns the number of allocations so far.
+    static uint64_t allocations();
+
+};
@@ -0,0 +1,22 @@
+#include "ofApp.h"
+#include "ofAppNoWindow.h"
+
+
+int main(int argc, char* argv[])
+{
+    auto app = std::make_shared<ofApp>();
+
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+
+        if (arg == "--polls" && i + 1 < argc) app->numPolls = std::stoull(argv[++i]);
+        else if (arg == "--downloads" && i + 1 < argc) app->numDownloads = std::stoull(argv[++i]);
+        else if (arg == "--retention" && i + 1 < argc) app->rawRetention = std::stoull(argv[++i]);
+        else if (arg == "--size" && i + 1 < argc) app->fileSize = std::stoull(argv[++i]) * 1024;
+    }
+
+    ofAppNoWindow window;
+    ofSetupOpenGL(&window, 1024, 768, OF_WINDOW);
+    return ofRunApp(app);
+}
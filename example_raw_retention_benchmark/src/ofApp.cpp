@@ -0,0 +1,146 @@
+//
+// Copyright (c) 2017 Christopher Baker <https://christopherbaker.net>
+//
+// SPDX-License-Identifier:	MIT
+//
+
+
+#include "ofApp.h"
+#include <fstream>
+#include <limits>
+
+
+const uint64_t ofApp::POLLING_INTERVAL = 10;
+const uint64_t ofApp::FIRST_ID = 1451944358173325100;
+
+
+void ofApp::setup()
+{
+    // Every poll is logged.
+    ofSetLogLevel("HashtagClient::_loot", OF_LOG_WARNING);
+
+    std::filesystem::path storePath = ofToDataPath("store", true);
+
+    ofLogNotice("ofApp::setup") << numPolls << " polls of " << numDownloads << " downloads of " << fileSize / 1024 << " KB, keeping " << rawRetention << " raw downloads.";
+
+    Run unbounded;
+    std::filesystem::remove_all(storePath);
+    search(storePath, std::numeric_limits<std::size_t>::max(), unbounded);
+
+    Run retained;
+    std::filesystem::remove_all(storePath);
+    search(storePath, rawRetention, retained);
+
+    std::filesystem::remove_all(storePath);
+
+    ofLogNotice("ofApp::setup") << "poll\tkept entries\tkept KB\tretained entries\tretained KB";
+
+    for (std::size_t i = 0; i < numPolls; ++i)
+    {
+        ofLogNotice("ofApp::setup") << i + 1
+                                    << "\t" << unbounded.entries[i] << "\t" << unbounded.bytes[i] / 1024
+                                    << "\t" << retained.entries[i] << "\t" << retained.bytes[i] / 1024;
+    }
+
+    ofExit();
+}
+
+
+void ofApp::search(const std::filesystem::path& storePath,
+                   std::size_t rawRetention,
+                   Run& run) const
+{
+    auto client = std::make_unique<ofxInstaLooter::HashtagClient>("raw_retention",
+                                                                  "",
+                                                                  "",
+                                                                  storePath,
+                                                                  POLLING_INTERVAL,
+                                                                  ofxInstaLooter::HashtagClient::DEFAULT_NUM_IMAGES_TO_DOWNLOAD,
+                                                                  "/usr/bin/true",
+                                                                  nullptr,
+                                                                  false);
+
+    client->setRawRetention(rawRetention);
+
+    std::string image(fileSize, 'x');
+    std::size_t poll = 0;
+
+    client->setFetcher([this, image, poll, &run](const ofxInstaLooter::FetchJob& job,
+                                                 const ofxInstaLooter::CancellationToken&,
+                                                 ofxInstaLooter::OutputMonitor&) mutable {
+        ofxInstaLooter::FetchResult result;
+        result.exitCode = 0;
+
+        // The directory as the previous poll left it.
+        if (poll > 0)
+        {
+            std::size_t entries = 0;
+            uint64_t bytes = 0;
+
+            measure(job.downloadPath, entries, bytes);
+
+            std::unique_lock<std::mutex> lock(run.mutex);
+
+            if (run.done) return result;
+
+            run.entries.push_back(entries);
+            run.bytes.push_back(bytes);
+
+            if (run.entries.size() == numPolls)
+            {
+                run.done = true;
+                return result;
+            }
+        }
+
+        // Downloads are left as instaLooter names them.
+        for (std::size_t i = 0; i < numDownloads; ++i)
+        {
+            uint64_t id = FIRST_ID + poll * numDownloads + i;
+            std::filesystem::path path = job.downloadPath / (std::to_string(id) + ".1.2017-2-16 22h21m17s0.jpg");
+            std::ofstream(path.string(), std::ios::binary) << image;
+        }
+
+        ++poll;
+
+        return result;
+    });
+
+    client->start();
+
+    while (true)
+    {
+        {
+            std::unique_lock<std::mutex> lock(run.mutex);
+            if (run.done) break;
+        }
+
+        ofxInstaLooter::Post post;
+
+        if (client->posts.tryReceive(post, POLLING_INTERVAL))
+        {
+            // The write queue removes the staged copy once the post is in
+            // the store, which lets the client remove its raw download.
+            std::filesystem::remove(post.path());
+        }
+    }
+}
+
+
+void ofApp::measure(const std::filesystem::path& path,
+                    std::size_t& entries,
+                    uint64_t& bytes)
+{
+    entries = 0;
+    bytes = 0;
+
+    for (std::filesystem::directory_iterator iter(path); iter != std::filesystem::directory_iterator(); ++iter)
+    {
+        ++entries;
+
+        if (std::filesystem::is_regular_file(iter->path()))
+        {
+            bytes += std::filesystem::file_size(iter->path());
+        }
+    }
+}
@@ -0,0 +1,86 @@
+//
+// Copyright (c) 2017 Christopher Baker <https://christopherbaker.net>
+//
+// SPDX-License-Identifier:	MIT
+//
+
+
+#pragma once
+
+
+#include "ofMain.h"
+#include "ofxIO.h"
+#include "ofxInstaLooter.h"
+
+
+/// \brief Measures how the raw retention bounds the unsorted/ directory.
+///
+///     example_raw_retention_benchmark [--polls n] [--downloads n]
+///         [--retention n] [--size kb]
+///
+/// A client runs a search with a stub fetcher that leaves new downloads in
+/// unsorted/ on every poll, as instaLooter would. The app stands in for the
+/// store and removes the staged copy of each post the client sends.
+///
+/// The search runs once with the raw downloads kept forever and once with
+/// the raw retention. Before each download, the fetcher measures the
+/// unsorted/ directory as the previous poll left it, after its compaction.
+///
+/// The entry count and size of unsorted/ after each poll are logged for
+/// both runs and the app exits.
+class ofApp: public ofBaseApp
+{
+public:
+    /// \brief The unsorted/ directory after each poll of a run.
+    struct Run
+    {
+        /// \brief The number of entries after each poll.
+        std::vector<std::size_t> entries;
+
+        /// \brief The size in bytes after each poll.
+        std::vector<uint64_t> bytes;
+
+        /// \brief True once every poll is measured.
+        bool done = false;
+
+        /// \brief Guards the run.
+        std::mutex mutex;
+    };
+
+    void setup();
+
+    /// \brief Run the search until every poll is measured.
+    /// \param storePath The store to download to.
+    /// \param rawRetention The number of raw downloads the client keeps.
+    /// \param run The run to measure.
+    void search(const std::filesystem::path& storePath,
+                std::size_t rawRetention,
+                Run& run) const;
+
+    /// \brief Measure a directory.
+    /// \param path The directory.
+    /// \param entries Set to the number of entries.
+    /// \param bytes Set to the total size of its files in bytes.
+    static void measure(const std::filesystem::path& path,
+                        std::size_t& entries,
+                        uint64_t& bytes);
+
+    /// \brief The number of polls per run.
+    std::size_t numPolls = 100;
+
+    /// \brief The number of new downloads per poll.
+    std::size_t numDownloads = 50;
+
+    /// \brief The number of raw downloads to keep.
+    std::size_t rawRetention = ofxInstaLooter::HashtagClient::DEFAULT_RAW_RETENTION;
+
+    /// \brief The size of each download in bytes.
+    std::size_t fileSize = 64 * 1024;
+
+    /// \brief The time in milliseconds between polls.
+    static const uint64_t POLLING_INTERVAL;
+
+    /// \brief The id of the first download.
+    static const uint64_t FIRST_ID;
+
+};
@@ -0,0 +1,226 @@
+//
+// Copyright (c) 2017 Christopher Baker <https://christopherbaker.net>
+//
+// SPDX-License-Identifier:	MIT
+//
+
+
+#include "ofApp.h"
+#include <algorithm>
+#include <chrono>
+#include <ctime>
+#include <thread>
+
+
+const std::size_t ofApp::IMAGE_SIZE = 64 * 1024;
+const std::size_t ofApp::BATCH_SIZE = 50;
+
+
+void ofApp::setup()
+{
+    const std::size_t numPosts = 20000;
+    const uint64_t day = 24 * 60 * 60;
+
+    std::filesystem::path root = ofToDataPath("store", true);
+    std::filesystem::remove_all(root);
+
+    uint64_t now = std::time(nullptr);
+
+    ofxInstaLooter::RetentionPolicy policy;
+    policy.maxAge = day;
+
+    {
+        ofxInstaLooter::Store store({ root });
+        ofxInstaLooter::Reaper reaper(store, policy);
+
+        fill(store, reaper, 1000000, numPosts, now - 2 * day);
+
+        // Find the old posts the way an external sweep does.
+        uint64_t startTime = ofGetElapsedTimeMicros();
+        std::size_t numFound = walk(store.savePath(0), now - day);
+        uint64_t walkTime = ofGetElapsedTimeMicros() - startTime;
+
+        startTime = ofGetElapsedTimeMicros();
+        numFound = reaper.index().select(policy, now, numPosts).size();
+        uint64_t selectTime = ofGetElapsedTimeMicros() - startTime;
+
+        ofLogNotice("ofApp::setup") << "Found " << numFound << " old posts: walk " << walkTime / 1000 << " ms, index " << selectTime / 1000 << " ms.";
+
+        startTime = ofGetElapsedTimeMicros();
+        std::size_t numRemoved = reaper.reap(now, nullptr);
+        double seconds = (ofGetElapsedTimeMicros() - startTime) / 1000000.0;
+
+        ofLogNotice("ofApp::setup") << "Reaped " << numRemoved << " posts in " << seconds << " s: " << (numRemoved / seconds) << " posts/s, " << (reaper.stats().bytes / seconds / (1 << 20)) << " MB/s.";
+    }
+
+    std::filesystem::remove_all(root);
+
+    {
+        ofxInstaLooter::Store store({ root });
+        ofxInstaLooter::Reaper reaper(store, policy);
+
+        Latency alone = ingest(store, reaper, 2000000, numPosts / 2);
+
+        fill(store, reaper, 3000000, numPosts, now - 2 * day);
+
+        std::thread reaperThread([&]() {
+            reaper.reap(now, nullptr);
+        });
+
+        Latency reaping = ingest(store, reaper, 4000000, numPosts / 2);
+
+        bool finished = reaper.index().size() == numPosts;
+
+        reaper.cancel();
+        reaperThread.join();
+
+        ofLogNotice("ofApp::setup") << "Ingest latency per batch of " << BATCH_SIZE << " posts, in microseconds.";
+        ofLogNotice("ofApp::setup") << "\tp50\tp99\tmax";
+        ofLogNotice("ofApp::setup") << "alone\t" << alone.p50 << "\t" << alone.p99 << "\t" << alone.max;
+        ofLogNotice("ofApp::setup") << "reaping\t" << reaping.p50 << "\t" << reaping.p99 << "\t" << reaping.max;
+
+        if (!finished)
+        {
+            ofLogNotice("ofApp::setup") << "The reaper was still running when ingestion finished.";
+        }
+    }
+
+    std::filesystem::remove_all(root);
+
+    ofExit();
+}
+
+
+void ofApp::fill(ofxInstaLooter::Store& store,
+                 ofxInstaLooter::Reaper& reaper,
+                 uint64_t firstId,
+                 std::size_t numPosts,
+                 uint64_t timestamp)
+{
+    std::string image(IMAGE_SIZE, 'x');
+    std::vector<ofxInstaLooter::Post> batch;
+
+    for (std::size_t i = 0; i < numPosts; ++i)
+    {
+        ofxInstaLooter::Post post("image.jpg",
+                                  firstId + i,
+                                  1,
+                                  timestamp,
+                                  640,
+                                  640,
+                                  { "hashtag" + std::to_string(i % 10) });
+
+        std::filesystem::path path = store.pathFor(post);
+        std::filesystem::path jsonPath = path;
+        jsonPath.replace_extension(".json.gz");
+
+        std::filesystem::create_directories(path.parent_path());
+        std::ofstream(path.string(), std::ios::binary) << image;
+        ofx::IO::JSONUtils::saveJSON(jsonPath, ofxInstaLooter::Post::toJSON(post));
+
+        // Dated like the post, for the walk.
+        std::filesystem::last_write_time(path, timestamp);
+        std::filesystem::last_write_time(jsonPath, timestamp);
+
+        batch.push_back(ofxInstaLooter::Post(path,
+                                             post.id(),
+                                             post.userId(),
+                                             post.timestamp(),
+                                             post.width(),
+                                             post.height(),
+                                             post.hashtags()));
+
+        if (batch.size() == BATCH_SIZE || i + 1 == numPosts)
+        {
+            reaper.add(0, batch);
+            batch.clear();
+        }
+    }
+}
+
+
+ofApp::Latency ofApp::ingest(ofxInstaLooter::Store& store,
+                             ofxInstaLooter::Reaper& reaper,
+                             uint64_t firstId,
+                             std::size_t numPosts)
+{
+    std::string image(IMAGE_SIZE, 'x');
+    std::vector<ofxInstaLooter::Post> batch;
+    std::vector<uint64_t> latencies;
+
+    uint64_t timestamp = std::time(nullptr);
+
+    for (std::size_t start = 0; start < numPosts; start += BATCH_SIZE)
+    {
+        uint64_t startTime = ofGetElapsedTimeMicros();
+
+        batch.clear();
+
+        for (std::size_t i = start; i < std::min(start + BATCH_SIZE, numPosts); ++i)
+        {
+            ofxInstaLooter::Post post("image.jpg",
+                                      firstId + i,
+                                      1,
+                                      timestamp,
+                                      640,
+                                      640,
+                                      { "hashtag" + std::to_string(i % 10) });
+
+            std::filesystem::path path = store.pathFor(post);
+            std::filesystem::path jsonPath = path;
+            jsonPath.replace_extension(".json.gz");
+
+            {
+                std::unique_lock<std::mutex> lock(store.mutexFor(post.id()));
+                std::filesystem::create_directories(path.parent_path());
+                std::ofstream(path.string(), std::ios::binary) << image;
+                ofx::IO::JSONUtils::saveJSON(jsonPath, ofxInstaLooter::Post::toJSON(post));
+            }
+
+            batch.push_back(ofxInstaLooter::Post(path,
+                                                 post.id(),
+                                                 post.userId(),
+                                                 post.timestamp(),
+                                                 post.width(),
+                                                 post.height(),
+                                                 post.hashtags()));
+        }
+
+        reaper.add(0, batch);
+
+        latencies.push_back(ofGetElapsedTimeMicros() - startTime);
+    }
+
+    std::sort(latencies.begin(), latencies.end());
+
+    Latency latency;
+
+    if (!latencies.empty())
+    {
+        latency.p50 = latencies[latencies.size() / 2];
+        latency.p99 = latencies[latencies.size() * 99 / 100];
+        latency.max = latencies.back();
+    }
+
+    return latency;
+}
+
+
+std::size_t ofApp::walk(const std::filesystem::path& path, std::time_t before)
+{
+    std::size_t numFound = 0;
+
+    std::filesystem::recursive_directory_iterator iter(path), end;
+
+    for (; iter != end; ++iter)
+    {
+        if (std::filesystem::is_regular_file(iter->status()) &&
+            iter->path().extension() != ".gz" &&
+            std::filesystem::last_write_time(iter->path()) < before)
+        {
+            ++numFound;
+        }
+    }
+
+    return numFound;
+}
@@ -0,0 +1,74 @@
+//
+// Copyright (c) 2017 Christopher Baker <https://christopherbaker.net>
+//
+// SPDX-License-Identifier:	MIT
+//
+
+
+#pragma once
+
+
+#include "ofMain.h"
+#include "ofxIO.h"
+#include "ofxInstaLooter.h"
+
+
+/// \brief Measures the Reaper and its effect on ingestion.
+///
+/// A scratch store in bin/data/store is filled with posts older than the
+/// retention policy. The time to find them by walking the store, as a
+/// `find -mtime` sweep does, is compared with the time to select them from
+/// the RetentionIndex, then the Reaper removes them all.
+///
+/// Then posts are ingested in batches, writing files and indexing them like
+/// the manager's write queue does, first alone and then while the Reaper
+/// removes another backlog, and the batch latencies are compared.
+///
+/// The results are logged and the app exits.
+class ofApp: public ofBaseApp
+{
+public:
+    /// \brief Latencies of ingested batches, in microseconds.
+    struct Latency
+    {
+        uint64_t p50 = 0;
+        uint64_t p99 = 0;
+        uint64_t max = 0;
+    };
+
+    void setup();
+
+    /// \brief Write old posts to the store and index them.
+    /// \param store The store.
+    /// \param reaper The reaper that indexes them.
+    /// \param firstId The id of the first post.
+    /// \param numPosts The number of posts.
+    /// \param timestamp The timestamp of the posts.
+    static void fill(ofxInstaLooter::Store& store,
+                     ofxInstaLooter::Reaper& reaper,
+                     uint64_t firstId,
+                     std::size_t numPosts,
+                     uint64_t timestamp);
+
+    /// \brief Ingest new posts in batches and time each batch.
+    /// \param store The store.
+    /// \param reaper The reaper that indexes them.
+    /// \param firstId The id of the first post.
+    /// \param numPosts The number of posts.
+    /// \returns the batch latencies.
+    static Latency ingest(ofxInstaLooter::Store& store,
+                          ofxInstaLooter::Reaper& reaper,
+                          uint64_t firstId,
+                          std::size_t numPosts);
+
+    /// \returns the number of files older than a time, found by walking a
+    ///     directory.
+    static std::size_t walk(const std::filesystem::path& path, std::time_t before);
+
+    /// \brief The size of each image.
+    static const std::size_t IMAGE_SIZE;
+
+    /// \brief The number of posts per ingested batch.
+    static const std::size_t BATCH_SIZE;
+
+};
@@ -0,0 +1,180 @@
+//
+// Copyright (c) 2017 Christopher Baker <https://christopherbaker.net>
+//
+// SPDX-License-Identifier:	MIT
+//
+
+
+#include "ofApp.h"
+#include <cerrno>
+#include <chrono>
+#include <fstream>
+#include <thread>
+#include <signal.h>
+
+
+const uint64_t ofApp::POLLING_INTERVAL = 10;
+const uint64_t ofApp::SHUTDOWN_LIMIT = 1000;
+const uint64_t ofApp::TIMEOUT = 5000;
+
+
+void ofApp::setup()
+{
+    // Every poll is logged, a hundred times a second.
+    ofSetLogLevel("HashtagClient::_loot", OF_LOG_WARNING);
+
+    std::filesystem::path storePath = ofToDataPath("store", true);
+    std::filesystem::remove_all(storePath);
+    std::filesystem::create_directories(storePath);
+
+    std::filesystem::path stubPath = storePath / "stub.sh";
+    std::filesystem::path groupsPath = storePath / "groups.txt";
+
+    writeStub(stubPath, groupsPath);
+
+    {
+        auto client = std::make_unique<ofxInstaLooter::HashtagClient>("shutdown",
+                                                                      "",
+                                                                      "",
+                                                                      storePath,
+                                                                      POLLING_INTERVAL,
+                                                                      ofxInstaLooter::HashtagClient::DEFAULT_NUM_IMAGES_TO_DOWNLOAD,
+                                                                      stubPath);
+
+        std::vector<pid_t> groups = waitForStubs(groupsPath, 1);
+
+        check(groups.size() == 1, "The client did not run the stub.");
+
+        uint64_t startTime = ofGetElapsedTimeMillis();
+        client.reset();
+        uint64_t duration = ofGetElapsedTimeMillis() - startTime;
+
+        ofLogNotice("ofApp::setup") << "The client shut down in " << duration << " ms.";
+
+        check(duration <= SHUTDOWN_LIMIT, "The client took " + ofToString(duration) + " ms to shut down.");
+        checkGroupsGone(groups, "client");
+    }
+
+    std::filesystem::remove(groupsPath);
+
+    {
+        ofJson paths;
+        paths["image_store_path"] = storePath.string();
+
+        ofJson settings;
+        settings["instalooter_path"] = stubPath.string();
+        settings["manager_polling_interval"] = POLLING_INTERVAL;
+
+        for (auto hashtag: { "shutdown_a", "shutdown_b", "shutdown_c", "shutdown_d" })
+        {
+            ofJson search;
+            search["hashtag"] = hashtag;
+            search["polling_interval"] = POLLING_INTERVAL;
+            settings["searches"].push_back(search);
+        }
+
+        auto manager = std::make_unique<ofxInstaLooter::HashtagClientManager>();
+        manager->setup(paths, settings);
+
+        std::vector<pid_t> groups = waitForStubs(groupsPath, settings["searches"].size());
+
+        check(groups.size() == settings["searches"].size(), "The manager's clients did not all run the stub.");
+
+        // Each client alone takes up to a poll of its process monitor to
+        // notice, so the limit only holds if they are cancelled together.
+        uint64_t startTime = ofGetElapsedTimeMillis();
+        manager.reset();
+        uint64_t duration = ofGetElapsedTimeMillis() - startTime;
+
+        ofLogNotice("ofApp::setup") << "The manager shut down " << groups.size() << " clients in " << duration << " ms.";
+
+        check(duration <= SHUTDOWN_LIMIT, "The manager took " + ofToString(duration) + " ms to shut down.");
+        checkGroupsGone(groups, "manager");
+    }
+
+    std::filesystem::remove_all(storePath);
+
+    ofExit(_passed ? 0 : 1);
+}
+
+
+void ofApp::writeStub(const std::filesystem::path& path,
+                      const std::filesystem::path& groupsPath)
+{
+    // The stub leads its own process group, so $$ is the group.
+    std::ofstream stub(path.string());
+    stub << "#!/bin/sh\n";
+    stub << "trap '' TERM\n";
+    stub << "sleep 600 &\n";
+    stub << "echo $$ >> '" << groupsPath.string() << "'\n";
+    stub << "while true; do sleep 600; done\n";
+    stub.close();
+
+    std::filesystem::permissions(path,
+                                 std::filesystem::perms::owner_all |
+                                 std::filesystem::perms::group_read |
+                                 std::filesystem::perms::group_exec);
+}
+
+
+std::vector<pid_t> ofApp::waitForStubs(const std::filesystem::path& groupsPath,
+                                       std::size_t count)
+{
+    std::vector<pid_t> groups;
+
+    uint64_t endTime = ofGetElapsedTimeMillis() + TIMEOUT;
+
+    while (ofGetElapsedTimeMillis() < endTime)
+    {
+        groups.clear();
+
+        std::ifstream input(groupsPath.string());
+        pid_t group = 0;
+
+        while (input >> group) groups.push_back(group);
+
+        if (groups.size() >= count)
+        {
+            break;
+        }
+
+        std::this_thread::sleep_for(std::chrono::milliseconds(POLLING_INTERVAL));
+    }
+
+    return groups;
+}
+
+
+void ofApp::checkGroupsGone(const std::vector<pid_t>& groups,
+                            const std::string& name)
+{
+    // Killed grandchildren are reaped by init rather than by the app, so
+    // they are given a moment to go.
+    uint64_t endTime = ofGetElapsedTimeMillis() + SHUTDOWN_LIMIT;
+
+    for (auto group: groups)
+    {
+        while (::kill(-group, 0) == 0 && ofGetElapsedTimeMillis() < endTime)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(POLLING_INTERVAL));
+        }
+
+        if (::kill(-group, 0) == 0 || errno != ESRCH)
+        {
+            check(false, "A process of group " + ofToString(group) + " survived the " + name + ".");
+
+            // Do not leave it behind.
+            ::kill(-group, SIGKILL);
+        }
+    }
+}
+
+
+void ofApp::check(bool condition, const std::string& message)
+{
+    if (!condition)
+    {
+        ofLogError("ofApp::check") << message;
+        _passed = false;
+    }
+}
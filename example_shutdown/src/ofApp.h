@@ -0,0 +1,73 @@
+//
+// Copyright (c) 2017 Christopher Baker <https://christopherbaker.net>
+//
+// SPDX-License-Identifier:	MIT
+//
+
+
+#pragma once
+
+
+#include "ofMain.h"
+#include "ofxIO.h"
+#include "ofxInstaLooter.h"
+
+
+/// \brief Checks that clients and the manager shut down quickly.
+///
+/// Searches run a stub in place of instaLooter that ignores SIGTERM and
+/// leaves a grandchild behind, as a hung instaLooter with a stuck download
+/// would. Each stub records its process group.
+///
+/// The app checks that
+///
+/// - destroying a client returns within SHUTDOWN_LIMIT,
+/// - destroying a manager with several clients returns within
+///   SHUTDOWN_LIMIT, as the clients are cancelled together,
+/// - no process of any stub's group survives either.
+///
+/// The app logs an error and exits with a failure if they do not.
+class ofApp: public ofBaseApp
+{
+public:
+    void setup();
+
+    /// \brief Write the stub that stands in for instaLooter.
+    /// \param path The path of the stub.
+    /// \param groupsPath The file each stub appends its process group to.
+    void writeStub(const std::filesystem::path& path,
+                   const std::filesystem::path& groupsPath);
+
+    /// \brief Wait until a number of stubs have started.
+    /// \param groupsPath The file the stubs append their process groups to.
+    /// \param count The number of stubs.
+    /// \returns the process groups of the stubs, or fewer on a timeout.
+    std::vector<pid_t> waitForStubs(const std::filesystem::path& groupsPath,
+                                    std::size_t count);
+
+    /// \brief Check that no process of the groups is left.
+    /// \param groups The process groups.
+    /// \param name What was shut down, for the error.
+    void checkGroupsGone(const std::vector<pid_t>& groups,
+                         const std::string& name);
+
+    /// \brief Check a condition and log an error if it does not hold.
+    /// \param condition The condition.
+    /// \param message The error.
+    void check(bool condition, const std::string& message);
+
+    /// \brief The time in milliseconds between polls of each client.
+    static const uint64_t POLLING_INTERVAL;
+
+    /// \brief The longest a client or manager may take to shut down, in
+    /// milliseconds.
+    static const uint64_t SHUTDOWN_LIMIT;
+
+    /// \brief How long to wait for the stubs to start, in milliseconds.
+    static const uint64_t TIMEOUT;
+
+private:
+    /// \brief True while every check holds.
+    bool _passed = true;
+
+};
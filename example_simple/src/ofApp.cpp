@@ -47,13 +47,13 @@ void ofApp::setup()
 
 void ofApp::update()
 {
-    ofxInstaLooter::Post post;
+    // Take all pending posts with a single lock.
+    posts.clear();
+    client->posts.receiveAll(posts);
 
-    while (client->posts.tryReceive(post))
+    for (const auto& post: posts)
     {
-        auto hashtags = post.hashtags();
-
-        for (auto hashtag: hashtags)
+        for (const auto& hashtag: post.hashtags())
         {
             std::cout << hashtag << ", ";
         }
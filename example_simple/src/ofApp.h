@@ -21,4 +21,6 @@ public:
 
     std::unique_ptr<ofxInstaLooter::HashtagClient> client;
 
+    std::vector<ofxInstaLooter::Post> posts;
+
 };
@@ -0,0 +1,207 @@
+//
+// Copyright (c) 2017 Christopher Baker <https://christopherbaker.net>
+//
+// SPDX-License-Identifier:	MIT
+//
+
+
+#pragma once
+
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include "ofJson.h"
+
+
+namespace ofx {
+namespace InstaLooter {
+
+
+/// \brief How long a client waits before running again after failures.
+///
+/// The delay starts at the initial delay and is multiplied after each
+/// consecutive failure, up to the maximum. Part of each delay is random, so
+/// clients that failed together do not all retry together.
+struct BackoffPolicy
+{
+    /// \brief The delay after the first failure, in milliseconds.
+    uint64_t initialDelay = 30000;
+
+    /// \brief The longest delay, in milliseconds.
+    uint64_t maxDelay = 1800000;
+
+    /// \brief The factor the delay grows by with each failure.
+    double multiplier = 2.0;
+
+    /// \brief The random fraction of each delay, from 0 for none to 1 for a
+    /// delay anywhere between 0 and the full delay.
+    double jitter = 0.5;
+
+    /// \brief Calculate the delay before the next run.
+    /// \param failures The number of consecutive failures, at least 1.
+    /// \param random A random number in [0, 1).
+    /// \returns the delay in milliseconds.
+    uint64_t delay(std::size_t failures, double random) const;
+
+    /// \brief Create a policy from "initial_delay", "max_delay" (both in
+    /// milliseconds), "multiplier" and "jitter" settings.
+    static BackoffPolicy fromJSON(const ofJson& settings);
+
+};
+
+
+/// \brief Stops every client using a credential once Instagram pushes back.
+///
+/// Throttling and login failures are about the account, not the hashtag,
+/// so a client retrying on its own only makes it worse for the others.
+/// Clients sharing a username share a breaker, and report the outcome of
+/// each run to it.
+///
+/// The breaker is closed until a number of consecutive failures, when it
+/// opens and allow() refuses every client for the open duration. Then it is
+/// half open and lets a single client through as a probe. A successful
+/// probe closes it, a failed one opens it again for twice as long, up to
+/// the maximum. Runs that started before it opened say nothing about the
+/// credential now, so while it is open only the probe's outcome counts.
+///
+/// All methods are thread-safe.
+class CircuitBreaker
+{
+public:
+    /// \brief The state of a breaker.
+    enum class State
+    {
+        /// \brief Clients run.
+        CLOSED,
+        /// \brief Clients are paused.
+        OPEN,
+        /// \brief One client may run to probe the credential.
+        HALF_OPEN
+    };
+
+    /// \brief Create a CircuitBreaker.
+    /// \param name The name of the credential, for logging.
+    /// \param threshold The number of consecutive failures that open it.
+    /// \param openDuration The first open duration, in milliseconds.
+    /// \param maxOpenDuration The longest open duration, in milliseconds.
+    CircuitBreaker(const std::string& name,
+                   std::size_t threshold = DEFAULT_THRESHOLD,
+                   uint64_t openDuration = DEFAULT_OPEN_DURATION,
+                   uint64_t maxOpenDuration = DEFAULT_MAX_OPEN_DURATION);
+
+    /// \returns the name of the credential.
+    std::string name() const;
+
+    /// \brief Ask to run.
+    ///
+    /// A client that is allowed to run while the breaker is half open is
+    /// the probe, and must report its outcome or call release() with
+    /// probe set.
+    ///
+    /// \param now The current time, in milliseconds.
+    /// \param probe Set to true if the client runs as the probe.
+    /// \returns true if the client may run.
+    bool allow(uint64_t now, bool& probe);
+
+    /// \brief Report a run that reached Instagram with the credential.
+    ///
+    /// While the breaker is open, only the probe closes it.
+    ///
+    /// \param probe True if the run was the probe.
+    void recordSuccess(bool probe);
+
+    /// \brief Report a run that was throttled or refused the credential.
+    ///
+    /// While the breaker is open, only the probe opens it again.
+    ///
+    /// \param now The current time, in milliseconds.
+    /// \param probe True if the run was the probe.
+    void recordFailure(uint64_t now, bool probe);
+
+    /// \brief Report a run that says nothing about the credential, e.g. a
+    /// cancelled run or a network error, so another client may probe.
+    /// \param probe True if the run was the probe.
+    void release(bool probe);
+
+    /// \param now The current time, in milliseconds.
+    /// \returns the state at that time.
+    State state(uint64_t now) const;
+
+    /// \returns the time the breaker stops being open, in milliseconds.
+    uint64_t openUntil() const;
+
+    /// \returns the number of consecutive failures.
+    std::size_t failures() const;
+
+    /// \returns the number of times the breaker has opened.
+    uint64_t trips() const;
+
+    /// \returns the name of a state, e.g. "half_open".
+    static std::string toString(State state);
+
+    /// \brief Create a CircuitBreaker from a "circuit_breaker" settings
+    /// object.
+    ///
+    /// The settings may contain "enabled", "threshold", "open_duration" and
+    /// "max_open_duration", in milliseconds. Missing settings give a
+    /// breaker with the defaults. Disabled settings return nullptr.
+    ///
+    /// \param settings The breaker settings, or null.
+    /// \param name The name of the credential.
+    /// \returns the breaker or nullptr.
+    static std::shared_ptr<CircuitBreaker> fromJSON(const ofJson& settings,
+                                                    const std::string& name);
+
+    /// \brief The default number of consecutive failures that open a
+    /// breaker.
+    static const std::size_t DEFAULT_THRESHOLD;
+
+    /// \brief The default first open duration, in milliseconds.
+    static const uint64_t DEFAULT_OPEN_DURATION;
+
+    /// \brief The default longest open duration, in milliseconds.
+    static const uint64_t DEFAULT_MAX_OPEN_DURATION;
+
+private:
+    /// \brief Open the breaker. Caller must hold the lock.
+    void _open(uint64_t now);
+
+    /// \brief The name of the credential.
+    std::string _name;
+
+    /// \brief The number of consecutive failures that open the breaker.
+    std::size_t _threshold = DEFAULT_THRESHOLD;
+
+    /// \brief The first open duration.
+    uint64_t _baseOpenDuration = DEFAULT_OPEN_DURATION;
+
+    /// \brief The longest open duration.
+    uint64_t _maxOpenDuration = DEFAULT_MAX_OPEN_DURATION;
+
+    /// \brief The next open duration.
+    uint64_t _openDuration = DEFAULT_OPEN_DURATION;
+
+    /// \brief True if the breaker has opened since it was last closed.
+    bool _isOpen = false;
+
+    /// \brief The time the breaker stops being open.
+    uint64_t _openUntil = 0;
+
+    /// \brief True if a probe is running.
+    bool _probing = false;
+
+    /// \brief The number of consecutive failures.
+    std::size_t _failures = 0;
+
+    /// \brief The number of times the breaker has opened.
+    uint64_t _trips = 0;
+
+    /// \brief Guards all state.
+    mutable std::mutex _mutex;
+
+};
+
+
+} } // ofx::InstaLooter
@@ -0,0 +1,301 @@
+//
+// Copyright (c) 2017 Christopher Baker <https://christopherbaker.net>
+//
+// SPDX-License-Identifier:	MIT
+//
+
+
+#pragma once
+
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstdint>
+#include <chrono>
+#include <mutex>
+#include <vector>
+
+
+namespace ofx {
+namespace InstaLooter {
+
+
+/// \brief A thread channel that can hand off all pending values at once.
+///
+/// BatchChannel has the same send / tryReceive / receive / close interface as
+/// IO::ThreadChannel, but also allows a consumer to take every pending value
+/// with a single lock. Values are always moved, never copied, out of the
+/// channel.
+///
+/// \tparam T The value type. Must be move constructible.
+template<typename T>
+class BatchChannel
+{
+public:
+    BatchChannel()
+    {
+    }
+
+    virtual ~BatchChannel()
+    {
+    }
+
+    /// \brief Block until a value is available or the channel is closed.
+    /// \param value The value to move the received value into.
+    /// \returns true if a value was received, false if the channel was closed.
+    bool receive(T& value)
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+
+        _condition.wait(lock, [&](){ return _available() || _closed; });
+
+        if (!_available())
+        {
+            return false;
+        }
+
+        _pop(value);
+        return true;
+    }
+
+    /// \brief Receive a value if one is available.
+    /// \param value The value to move the received value into.
+    /// \returns true if a value was received.
+    bool tryReceive(T& value)
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+
+        if (!_available())
+        {
+            return false;
+        }
+
+        _pop(value);
+        return true;
+    }
+
+    /// \brief Receive a value, waiting at most timeoutMs milliseconds.
+    /// \param value The value to move the received value into.
+    /// \param timeoutMs The timeout in milliseconds.
+    /// \returns true if a value was received.
+    bool tryReceive(T& value, int64_t timeoutMs)
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+
+        if (!_condition.wait_for(lock,
+                                 std::chrono::milliseconds(timeoutMs),
+                                 [&](){ return _available() || _closed; }))
+        {
+            return false;
+        }
+
+        if (!_available())
+        {
+            return false;
+        }
+
+        _pop(value);
+        return true;
+    }
+
+    /// \brief Move up to maxCount pending values into values.
+    ///
+    /// Received values are appended to values in the order they were sent.
+    ///
+    /// \param values The vector to append received values to.
+    /// \param maxCount The maximum number of values to receive.
+    /// \returns the number of values received.
+    std::size_t tryReceiveBatch(std::vector<T>& values, std::size_t maxCount)
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        return _popBatch(values, maxCount);
+    }
+
+    /// \brief Move all pending values into values.
+    ///
+    /// If values is empty, the whole pending buffer is swapped out without
+    /// touching the individual values. Received values are appended to values
+    /// in the order they were sent.
+    ///
+    /// \param values The vector to append received values to.
+    /// \returns the number of values received.
+    std::size_t receiveAll(std::vector<T>& values)
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        return _popBatch(values, _queue.size());
+    }
+
+    /// \brief Send a value by copy.
+    /// \param value The value to send.
+    /// \returns false if the channel was closed.
+    bool send(const T& value)
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+
+        if (_closed)
+        {
+            return false;
+        }
+
+        _queue.push_back(value);
+        _condition.notify_one();
+        return true;
+    }
+
+    /// \brief Send a value by move.
+    /// \param value The value to send.
+    /// \returns false if the channel was closed.
+    bool send(T&& value)
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+
+        if (_closed)
+        {
+            return false;
+        }
+
+        _queue.push_back(std::move(value));
+        _condition.notify_one();
+        return true;
+    }
+
+    /// \brief Send a batch of values with a single lock.
+    ///
+    /// The values are moved into the channel and values is left empty.
+    ///
+    /// \param values The values to send.
+    /// \returns false if the channel was closed.
+    bool sendBatch(std::vector<T>&& values)
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+
+        if (_closed)
+        {
+            return false;
+        }
+
+        if (!_available())
+        {
+            // Nothing is pending, so take the sender's buffer as is.
+            _queue.clear();
+            _queue.swap(values);
+            _head = 0;
+        }
+        else
+        {
+            _queue.reserve(_queue.size() + values.size());
+
+            for (auto& value: values)
+            {
+                _queue.push_back(std::move(value));
+            }
+        }
+
+        values.clear();
+        _condition.notify_all();
+        return true;
+    }
+
+    /// \brief Close the channel and wake any blocked receivers.
+    void close()
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _closed = true;
+        _condition.notify_all();
+    }
+
+    /// \returns true if the channel is closed.
+    bool closed() const
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        return _closed;
+    }
+
+    /// \returns true if there are no pending values.
+    bool empty() const
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        return !_available();
+    }
+
+    /// \returns the number of pending values.
+    std::size_t size() const
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        return _queue.size() - _head;
+    }
+
+private:
+    /// \returns true if there is a pending value. Caller must hold the lock.
+    bool _available() const
+    {
+        return _head < _queue.size();
+    }
+
+    /// \brief Pop the front value. Caller must hold the lock.
+    void _pop(T& value)
+    {
+        value = std::move(_queue[_head++]);
+
+        if (_head == _queue.size())
+        {
+            _queue.clear();
+            _head = 0;
+        }
+    }
+
+    /// \brief Pop up to maxCount values. Caller must hold the lock.
+    std::size_t _popBatch(std::vector<T>& values, std::size_t maxCount)
+    {
+        std::size_t count = std::min(maxCount, _queue.size() - _head);
+
+        if (count == 0)
+        {
+            return 0;
+        }
+
+        if (_head == 0 && count == _queue.size() && values.empty())
+        {
+            // Hand off the whole buffer and reuse the caller's capacity.
+            values.swap(_queue);
+        }
+        else
+        {
+            values.reserve(values.size() + count);
+
+            for (std::size_t i = 0; i < count; ++i)
+            {
+                values.push_back(std::move(_queue[_head + i]));
+            }
+
+            _head += count;
+        }
+
+        if (_head >= _queue.size())
+        {
+            _queue.clear();
+            _head = 0;
+        }
+
+        return count;
+    }
+
+    /// \brief The pending values, starting at _head.
+    std::vector<T> _queue;
+
+    /// \brief The index of the next value to receive.
+    std::size_t _head = 0;
+
+    /// \brief True if the channel has been closed.
+    bool _closed = false;
+
+    /// \brief The mutex protecting the queue.
+    mutable std::mutex _mutex;
+
+    /// \brief Signals receivers when values are sent or the channel closes.
+    std::condition_variable _condition;
+
+};
+
+
+} } // ofx::InstaLooter
@@ -0,0 +1,62 @@
+//
+// Copyright (c) 2017 Christopher Baker <https://christopherbaker.net>
+//
+// SPDX-License-Identifier:	MIT
+//
+
+
+#pragma once
+
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+
+
+namespace ofx {
+namespace InstaLooter {
+
+
+/// \brief A cooperative cancellation flag that can be waited on.
+///
+/// Long running stages check isCancelled() between units of work and use
+/// waitFor() instead of sleeping, so that a cancellation wakes them at once.
+class CancellationToken
+{
+public:
+    CancellationToken();
+
+    ~CancellationToken();
+
+    /// \brief Request cancellation and wake all waiters.
+    void cancel();
+
+    /// \brief Clear a previous cancellation request.
+    void reset();
+
+    /// \returns true if cancellation has been requested.
+    bool isCancelled() const;
+
+    /// \brief Sleep until cancelled or until the timeout expires.
+    /// \param milliseconds The maximum time to wait in milliseconds.
+    /// \returns true if cancellation has been requested.
+    bool waitFor(uint64_t milliseconds) const;
+
+private:
+    CancellationToken(const CancellationToken&) = delete;
+    CancellationToken& operator = (const CancellationToken&) = delete;
+
+    /// \brief True if cancellation has been requested.
+    std::atomic<bool> _cancelled;
+
+    /// \brief The mutex used with the condition.
+    mutable std::mutex _mutex;
+
+    /// \brief Wakes waiters on cancellation.
+    mutable std::condition_variable _condition;
+
+};
+
+
+} } // ofx::InstaLooter
@@ -0,0 +1,48 @@
+//
+// Copyright (c) 2017 Christopher Baker <https://christopherbaker.net>
+//
+// SPDX-License-Identifier:	MIT
+//
+
+
+#pragma once
+
+
+#include "ofx/InstaLooter/BatchChannel.h"
+#include "ofx/InstaLooter/RingChannel.h"
+
+
+namespace ofx {
+namespace InstaLooter {
+
+
+// The channels between threads are unbounded BatchChannels by default.
+// Define OFX_INSTALOOTER_RING_CHANNELS to use bounded, lock-free
+// RingChannels instead, in which case a sender blocks while its receiver is
+// RingChannel::DEFAULT_CAPACITY values behind.
+#if defined(OFX_INSTALOOTER_RING_CHANNELS)
+
+/// \brief A channel with one sending and one receiving thread.
+template<typename T>
+using SingleProducerChannel = RingChannel<T, false>;
+
+/// \brief A channel with any number of sending threads and one receiving
+/// thread.
+template<typename T>
+using MultiProducerChannel = RingChannel<T, true>;
+
+#else
+
+/// \brief A channel with one sending and one receiving thread.
+template<typename T>
+using SingleProducerChannel = BatchChannel<T>;
+
+/// \brief A channel with any number of sending threads and one receiving
+/// thread.
+template<typename T>
+using MultiProducerChannel = BatchChannel<T>;
+
+#endif
+
+
+} } // ofx::InstaLooter
@@ -0,0 +1,133 @@
+//
+// Copyright (c) 2017 Christopher Baker <https://christopherbaker.net>
+//
+// SPDX-License-Identifier:	MIT
+//
+
+
+#pragma once
+
+
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <sys/types.h>
+
+
+namespace ofx {
+namespace InstaLooter {
+
+
+/// \brief A child process running in its own process group.
+///
+/// Unlike Poco::Process, the child is the leader of a new process group, so
+/// kill() also takes down anything it spawned (e.g. the python interpreter
+/// behind the instaLooter entry point). The combined stdout / stderr is read
+/// with a timeout, so the reader never blocks on a pipe held open by a
+/// grandchild.
+///
+/// kill() may be called from any thread. All other functions must be called
+/// from the thread that owns the process.
+///
+/// This is currently implemented for POSIX platforms only.
+class ChildProcess
+{
+public:
+    /// \brief Options for launching a process.
+    enum Options
+    {
+        /// \brief Open a pipe to the process's standard input.
+        OPTION_PIPE_INPUT = 1 << 0,
+        /// \brief Leave standard error attached to the parent instead of
+        /// merging it into the output.
+        OPTION_INHERIT_ERROR = 1 << 1
+    };
+
+    ChildProcess();
+
+    /// \brief Kill the process group if it is still running and reap it.
+    ~ChildProcess();
+
+    /// \brief Launch a command.
+    /// \param command The command to execute.
+    /// \param args The command arguments, not including the command.
+    /// \param options A combination of Options flags.
+    /// \throws Poco::IOException if the process could not be launched.
+    void launch(const std::string& command,
+                const std::vector<std::string>& args,
+                int options = 0);
+
+    /// \returns the process id, or 0 if not launched.
+    pid_t id() const;
+
+    /// \brief Check whether the process is still running, reaping it if not.
+    /// \returns true if the process is running.
+    bool isRunning();
+
+    /// \brief Read any available output.
+    /// \param output The string to append output to.
+    /// \param timeout The maximum time to wait for output in milliseconds.
+    /// \returns false if the output is closed (end of file).
+    bool read(std::string& output, uint64_t timeout);
+
+    /// \brief Write data to the process's standard input.
+    ///
+    /// Requires OPTION_PIPE_INPUT. A closed pipe is reported as a failure
+    /// rather than raising SIGPIPE.
+    ///
+    /// \param data The data to write.
+    /// \returns true if all data was written.
+    bool write(const std::string& data);
+
+    /// \brief Close the input pipe, signalling end of file to the process.
+    void closeInput();
+
+    /// \brief Send SIGKILL to the whole process group.
+    ///
+    /// This is a no-op if the process has already been reaped and may be
+    /// called from any thread.
+    void kill();
+
+    /// \brief Close the output pipe.
+    void closeOutput();
+
+    /// \brief Wait for the process to exit.
+    /// \param timeout The maximum time to wait in milliseconds.
+    /// \returns true if the process exited and was reaped.
+    bool wait(uint64_t timeout);
+
+    /// \returns the exit code, the negated signal number if the process was
+    ///     killed by a signal, or -1 if it has not exited.
+    int exitCode() const;
+
+private:
+    ChildProcess(const ChildProcess&) = delete;
+    ChildProcess& operator = (const ChildProcess&) = delete;
+
+    /// \brief Reap the process without blocking. Caller must hold the lock.
+    /// \returns true if the process has exited.
+    bool _reap();
+
+    /// \brief The process id and process group id.
+    pid_t _pid = 0;
+
+    /// \brief The read end of the output pipe, or -1.
+    int _outputFD = -1;
+
+    /// \brief The write end of the input pipe, or -1.
+    int _inputFD = -1;
+
+    /// \brief True once the process has been reaped.
+    bool _exited = false;
+
+    /// \brief The exit code.
+    int _exitCode = -1;
+
+    /// \brief Guards the process state between kill() and reaping.
+    mutable std::mutex _mutex;
+
+};
+
+
+} } // ofx::InstaLooter
@@ -0,0 +1,142 @@
+//
+// Copyright (c) 2017 Christopher Baker <https://christopherbaker.net>
+//
+// SPDX-License-Identifier:	MIT
+//
+
+
+#pragma once
+
+
+#include <cstdint>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "ofFileUtils.h"
+
+
+namespace ofx {
+namespace InstaLooter {
+
+
+/// \brief A batch of post metadata, one vector per column.
+struct PostColumns
+{
+    std::vector<uint64_t> ids;
+    std::vector<uint64_t> userIds;
+    std::vector<uint64_t> timestamps;
+    std::vector<uint32_t> widths;
+    std::vector<uint32_t> heights;
+
+    /// \brief Row i has hashtags[hashtagOffsets[i]] up to
+    /// hashtags[hashtagOffsets[i + 1]].
+    std::vector<uint32_t> hashtagOffsets = { 0 };
+
+    std::vector<std::string> hashtags;
+
+    /// \brief Add a row.
+    void add(uint64_t id,
+             uint64_t userId,
+             uint64_t timestamp,
+             uint32_t width,
+             uint32_t height,
+             const std::vector<std::string>& postHashtags);
+
+    /// \returns the number of rows.
+    std::size_t size() const;
+
+    /// \brief Remove every row, keeping the memory.
+    void clear();
+
+};
+
+
+/// \brief Writes post metadata to a columnar file.
+///
+/// The file is a sequence of record batches, each holding its columns
+/// contiguously, so a reader can load a column of a batch with a single
+/// read. Hashtags are dictionary encoded; each batch carries only the
+/// dictionary entries it adds, so a file cut short by a crash is readable
+/// up to its last whole batch. All integers are in host byte order, which
+/// is little-endian on every supported platform.
+///
+///     magic      "ILPOSTS1"
+///     batch...   "BTCH"
+///                uint32 rows, uint32 new dictionary entries
+///                per entry: uint32 length, bytes
+///                uint64 id[rows], uint64 user_id[rows],
+///                uint64 timestamp[rows], uint32 width[rows],
+///                uint32 height[rows], uint32 hashtag_offsets[rows + 1],
+///                uint32 hashtag_ids[hashtag_offsets[rows]]
+///     footer     "INDX"
+///                uint32 batches, uint64 batch_offset[batches],
+///                uint64 rows, uint64 footer_offset
+///     magic      "ILPOSTS1"
+///
+/// scripts/read_posts.py reads the format.
+class ColumnWriter
+{
+public:
+    /// \brief Create a file, replacing any existing one.
+    /// \param path The file path.
+    ColumnWriter(const std::filesystem::path& path);
+
+    /// \brief Close the file, if it is still open.
+    ~ColumnWriter();
+
+    /// \returns true if the file is open and every write succeeded.
+    bool isGood() const;
+
+    /// \brief Append a batch. Thread-safe.
+    /// \param batch The rows.
+    void write(const PostColumns& batch);
+
+    /// \brief Write the footer and close the file.
+    /// \returns true if everything was written.
+    bool close();
+
+    /// \returns the number of rows written.
+    uint64_t rows() const;
+
+    /// \returns the number of bytes written.
+    uint64_t bytes() const;
+
+    /// \brief The file's first and last eight bytes.
+    static const std::string MAGIC;
+
+private:
+    /// \brief Write raw bytes. Caller must hold the lock.
+    void _write(const void* data, std::size_t size);
+
+    /// \brief Write a column. Caller must hold the lock.
+    template <typename T>
+    void _write(const std::vector<T>& column)
+    {
+        if (!column.empty()) _write(column.data(), column.size() * sizeof(T));
+    }
+
+    std::filesystem::path _path;
+
+    std::ofstream _stream;
+
+    /// \brief The id of each hashtag written so far.
+    std::unordered_map<std::string, uint32_t> _dictionary;
+
+    /// \brief The offset of each batch.
+    std::vector<uint64_t> _batchOffsets;
+
+    uint64_t _rows = 0;
+
+    uint64_t _bytes = 0;
+
+    bool _closed = false;
+
+    /// \brief Guards everything.
+    mutable std::mutex _mutex;
+
+};
+
+
+} } // ofx::InstaLooter
@@ -0,0 +1,84 @@
+//
+// Copyright (c) 2017 Christopher Baker <https://christopherbaker.net>
+//
+// SPDX-License-Identifier:	MIT
+//
+
+
+#pragma once
+
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+
+
+namespace ofx {
+namespace InstaLooter {
+
+
+/// \brief Lets lock-free code block until a condition may have changed.
+///
+/// A waiter announces itself with prepareWait(), checks its condition again
+/// and then either calls cancelWait() or wait() with the returned key. A
+/// notifier changes the condition and then calls notifyAll(), which costs
+/// a single atomic load when nobody has announced a wait since the last
+/// notification, so a burst of notifications wakes a sleeper only once.
+///
+/// On Linux waiting uses a futex on the event counter. Elsewhere a mutex and
+/// condition variable are used, but only on the slow path.
+class EventCount
+{
+public:
+    /// \brief A snapshot of the event counter.
+    typedef uint32_t Key;
+
+    EventCount();
+
+    /// \brief Announce a wait.
+    ///
+    /// The caller must check its condition after this call, then call
+    /// cancelWait() or wait().
+    ///
+    /// \returns the key to wait on.
+    Key prepareWait();
+
+    /// \brief Withdraw a wait announced with prepareWait().
+    void cancelWait();
+
+    /// \brief Block until notified after prepareWait() returned key.
+    /// \param key The key returned by prepareWait().
+    void wait(Key key);
+
+    /// \brief Block until notified or the timeout expires.
+    /// \param key The key returned by prepareWait().
+    /// \param timeoutMs The timeout in milliseconds.
+    /// \returns false if the timeout expired.
+    bool waitFor(Key key, uint64_t timeoutMs);
+
+    /// \brief Wake every waiter.
+    ///
+    /// The caller must make its change visible before calling this.
+    void notifyAll();
+
+private:
+    /// \brief Block while the counter equals key. Returns false on timeout.
+    bool _wait(Key key, int64_t timeoutMs);
+
+    /// \brief The event counter in the upper 31 bits, advanced by every
+    /// notification with waiters, and a waiters flag in the lowest bit.
+    std::atomic<uint32_t> _state;
+
+#if !defined(__linux__)
+    /// \brief Guards the slow path.
+    std::mutex _mutex;
+
+    /// \brief Signals the slow path.
+    std::condition_variable _condition;
+#endif
+
+};
+
+
+} } // ofx::InstaLooter
@@ -0,0 +1,158 @@
+//
+// Copyright (c) 2017 Christopher Baker <https://christopherbaker.net>
+//
+// SPDX-License-Identifier:	MIT
+//
+
+
+#pragma once
+
+
+#include <string>
+#include <vector>
+#include "ofJson.h"
+#include "ofFileUtils.h"
+#include "ofx/InstaLooter/OutputMonitor.h"
+
+
+namespace ofx {
+namespace InstaLooter {
+
+
+/// \brief The newest post a search has stored.
+///
+/// Instagram post ids grow with time, so a fetcher that stops at the
+/// cursor only does work for new posts, however long the history it would
+/// otherwise page through.
+struct FetchCursor
+{
+    /// \brief The newest post id, or 0 if nothing has been stored.
+    uint64_t id = 0;
+
+    /// \brief The timestamp of that post in seconds since the epoch.
+    uint64_t timestamp = 0;
+
+    /// \returns true if nothing has been stored.
+    bool isEmpty() const;
+
+    /// \brief Move the cursor to a post if it is newer.
+    /// \returns true if the cursor moved.
+    bool advance(uint64_t id, uint64_t timestamp);
+
+    /// \brief Load a cursor.
+    /// \param path The cursor file.
+    /// \returns the cursor, or an empty cursor if there is none.
+    static FetchCursor load(const std::filesystem::path& path);
+
+    /// \brief Save a cursor, replacing the file atomically.
+    /// \param path The cursor file.
+    /// \param cursor The cursor.
+    /// \returns true if it was saved.
+    static bool save(const std::filesystem::path& path, const FetchCursor& cursor);
+
+    static ofJson toJSON(const FetchCursor& cursor);
+    static FetchCursor fromJSON(const ofJson& json);
+
+    /// \brief The name of the cursor file in a search's save path.
+    static const std::string FILENAME;
+
+};
+
+
+/// \brief A single instaLooter hashtag search.
+struct FetchJob
+{
+    /// \brief The search hashtag.
+    std::string hashtag;
+
+    /// \brief The directory instaLooter downloads into.
+    std::filesystem::path downloadPath;
+
+    /// \brief The maximum number of images to download.
+    uint64_t numImagesToDownload = 0;
+
+    /// \brief The instaLooter filename template.
+    std::string filenameTemplate;
+
+    /// \brief The optional username for authenticated searches.
+    std::string username;
+
+    /// \brief The optional password for authenticated searches.
+    std::string password;
+
+    /// \brief If true, instaLooter produces no output.
+    bool quiet = false;
+
+    /// \brief The newest post already stored. Workers stop there.
+    FetchCursor cursor;
+
+    /// \brief If true, instaLooter is also limited to posts from the day
+    /// before the cursor on.
+    bool timeFilter = false;
+
+    /// \returns the instaLooter command line arguments for this job.
+    std::vector<std::string> toArguments() const;
+
+    /// \returns the job as a worker request.
+    static ofJson toJSON(const FetchJob& job);
+
+};
+
+
+/// \brief The outcome of running a FetchJob.
+struct FetchResult
+{
+    /// \brief What a run means for the next one.
+    enum class Outcome
+    {
+        /// \brief The run completed.
+        SUCCESS,
+        /// \brief The run was killed because the client stopped.
+        CANCELLED,
+        /// \brief Instagram rate limited the run.
+        THROTTLED,
+        /// \brief The login failed or was challenged.
+        AUTH_FAILED,
+        /// \brief Instagram could not be reached.
+        NETWORK_ERROR,
+        /// \brief The run was killed because it timed out.
+        TIMED_OUT,
+        /// \brief Any other failure, including a failed launch.
+        FAILED
+    };
+
+    /// \brief The exit code, or -1 if the run did not complete.
+    int exitCode = -1;
+
+    /// \brief True if the run was killed before it completed.
+    bool killed = false;
+
+    /// \brief True if the run was killed because it timed out.
+    bool timedOut = false;
+
+    /// \brief The last lines of the combined instaLooter output.
+    std::string output;
+
+    /// \brief The counters parsed from the output.
+    FetchProgress progress;
+
+    /// \brief Classify the run by its exit code and parsed output.
+    ///
+    /// Rate limiting comes first, then authentication errors, even if the
+    /// run exited with 0, as instaLooter may give up on a throttled or
+    /// refused search without failing. Only lines that report them count
+    /// (see OutputMonitor), so a line that only mentions 429 or a
+    /// checkpoint, e.g. in a count or a caption, does not fail a run. Otherwise a run that exits with 0
+    /// succeeded, then come a timeout and network errors, which
+    /// instaLooter also retries itself.
+    ///
+    /// \returns the outcome.
+    Outcome outcome() const;
+
+    /// \returns the name of an outcome, e.g. "throttled".
+    static std::string toString(Outcome outcome);
+
+};
+
+
+} } // ofx::InstaLooter
@@ -0,0 +1,345 @@
+//
+// Copyright (c) 2017 Christopher Baker <https://christopherbaker.net>
+//
+// SPDX-License-Identifier:	MIT
+//
+
+
+#pragma once
+
+
+#include <atomic>
+#include <condition_variable>
+#include <ctime>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "ofJson.h"
+#include "ofFileUtils.h"
+#include "ofx/InstaLooter/BatchChannel.h"
+#include "ofx/InstaLooter/ResourcePolicy.h"
+
+
+namespace ofx {
+namespace InstaLooter {
+
+
+/// \brief A single filesystem operation performed by a FileSink.
+struct FileOperation
+{
+    /// \brief The kind of operation.
+    enum Type
+    {
+        /// \brief Create path and any missing parents.
+        CREATE_DIRECTORIES,
+        /// \brief Move path to target, copying across volumes.
+        MOVE,
+        /// \brief Copy path to target.
+        COPY,
+        /// \brief Set the modification time of path.
+        SET_WRITE_TIME,
+        /// \brief Replace the contents of path with data.
+        WRITE,
+        /// \brief Remove path.
+        REMOVE
+    };
+
+    /// \brief The kind of operation.
+    Type type = CREATE_DIRECTORIES;
+
+    /// \brief The path operated on, or the source of a move or copy.
+    std::filesystem::path path;
+
+    /// \brief The destination of a move or copy.
+    std::filesystem::path target;
+
+    /// \brief The modification time for SET_WRITE_TIME.
+    std::time_t time = 0;
+
+    /// \brief The file contents for WRITE.
+    std::string data;
+
+    static FileOperation createDirectories(const std::filesystem::path& path);
+    static FileOperation move(const std::filesystem::path& from, const std::filesystem::path& to);
+    static FileOperation copy(const std::filesystem::path& from, const std::filesystem::path& to);
+    static FileOperation setWriteTime(const std::filesystem::path& path, std::time_t time);
+    static FileOperation write(const std::filesystem::path& path, std::string data);
+    static FileOperation remove(const std::filesystem::path& path);
+
+    /// \brief Write JSON, gzipped if the path ends in ".gz".
+    static FileOperation writeJSON(const std::filesystem::path& path, const ofJson& json);
+
+};
+
+
+/// \brief A sequence of operations that run in order.
+///
+/// A task stops at the first failed operation.
+struct FileTask
+{
+    /// \brief A caller defined tag, e.g. an index into a batch of posts.
+    uint64_t tag = 0;
+
+    /// \brief The operations to run in order.
+    std::vector<FileOperation> operations;
+
+    /// \brief True if every operation succeeded. Set on completion.
+    bool success = true;
+
+    /// \brief The first error. Set on completion.
+    std::string error;
+
+};
+
+
+/// \brief Performs filesystem tasks on behalf of an ingest thread.
+///
+/// An ingest thread submits many tasks, keeps working and then collects the
+/// completed tasks in batches. Tasks run concurrently and may complete in
+/// any order, but the operations within a task always run in order.
+///
+/// A FileSink is used by a single thread. The default, synchronous sink runs
+/// each task as it is submitted; ThreadPoolFileSink and IoUringFileSink keep
+/// many tasks in flight at once.
+class FileSink
+{
+public:
+    virtual ~FileSink();
+
+    /// \brief Submit a task.
+    /// \param task The task to run.
+    virtual void submit(FileTask&& task) = 0;
+
+    /// \brief Collect completed tasks.
+    /// \param tasks The vector to append completed tasks to.
+    /// \param wait If true, block until at least one task completes, unless
+    ///     none are in flight.
+    /// \returns the number of tasks collected.
+    virtual std::size_t complete(std::vector<FileTask>& tasks, bool wait) = 0;
+
+    /// \returns the number of submitted tasks that have not been collected.
+    virtual std::size_t inFlight() const = 0;
+
+    /// \returns the backend name.
+    virtual std::string name() const = 0;
+
+    /// \brief Wait for and collect every task in flight.
+    /// \param tasks The vector to append completed tasks to.
+    /// \returns the number of tasks collected.
+    std::size_t drain(std::vector<FileTask>& tasks);
+
+    /// \brief Run a task on the calling thread with blocking calls.
+    /// \param task The task to run. Its success and error are set.
+    static void run(FileTask& task);
+
+    /// \brief Create a sink from a "file_sink" settings object.
+    ///
+    /// The settings may contain "backend" ("sync", "threads" or "io_uring"),
+    /// "threads" and "queue_depth". If io_uring is not available, the thread
+    /// pool is used instead.
+    ///
+    /// \param settings The sink settings.
+    /// \param threadPolicy The policy of the sink's threads, if it has any.
+    /// \returns a new sink.
+    static std::unique_ptr<FileSink> fromJSON(const ofJson& settings,
+                                              const ResourcePolicy& threadPolicy = ResourcePolicy());
+
+    /// \brief The default number of tasks kept in flight.
+    static const std::size_t DEFAULT_QUEUE_DEPTH;
+
+    /// \brief The default number of thread pool threads.
+    static const std::size_t DEFAULT_NUM_THREADS;
+
+};
+
+
+/// \brief A FileSink that runs each task as it is submitted.
+class SynchronousFileSink: public FileSink
+{
+public:
+    void submit(FileTask&& task) override;
+    std::size_t complete(std::vector<FileTask>& tasks, bool wait) override;
+    std::size_t inFlight() const override;
+    std::string name() const override;
+
+private:
+    /// \brief Tasks that ran but have not been collected.
+    std::vector<FileTask> _completed;
+
+};
+
+
+/// \brief A FileSink that runs tasks on a pool of threads.
+class ThreadPoolFileSink: public FileSink
+{
+public:
+    /// \brief Create a ThreadPoolFileSink.
+    /// \param numThreads The number of threads.
+    /// \param threadPolicy The policy of the threads.
+    ThreadPoolFileSink(std::size_t numThreads = DEFAULT_NUM_THREADS,
+                       const ResourcePolicy& threadPolicy = ResourcePolicy());
+
+    /// \brief Finish all submitted tasks and join the threads.
+    virtual ~ThreadPoolFileSink();
+
+    void submit(FileTask&& task) override;
+    std::size_t complete(std::vector<FileTask>& tasks, bool wait) override;
+    std::size_t inFlight() const override;
+    std::string name() const override;
+
+private:
+    /// \brief The thread function.
+    void _run();
+
+    /// \brief Tasks waiting for a thread.
+    BatchChannel<FileTask> _pending;
+
+    /// \brief Tasks that ran but have not been collected.
+    BatchChannel<FileTask> _completed;
+
+    /// \brief The number of submitted tasks not yet collected.
+    std::size_t _inFlight = 0;
+
+    /// \brief The policy of the threads.
+    ResourcePolicy _threadPolicy;
+
+    /// \brief The pool threads.
+    std::vector<std::thread> _threads;
+
+};
+
+
+class PooledFileSink;
+
+
+/// \brief Shares one asynchronous sink between the threads of a store.
+///
+/// A FileSink is used by a single thread, so a sink for every client and
+/// every store root would mean a thread pool or an io_uring ring each. A
+/// pool keeps a single one and hands each thread a light sink that submits
+/// to it and collects only its own tasks.
+///
+/// The backend belongs to a collector thread, which submits the tasks of
+/// every sink and hands the completed ones back. A sink waiting for its
+/// tasks does not hold up the others, which keep submitting and collecting
+/// while a slow write runs.
+///
+/// A synchronous pool has nothing to share, and hands out synchronous sinks.
+class FileSinkPool: public std::enable_shared_from_this<FileSinkPool>
+{
+public:
+    /// \brief Create a FileSinkPool.
+    /// \param backend The shared sink, or nullptr for synchronous sinks.
+    /// \param threadPolicy The policy of the collector thread.
+    FileSinkPool(std::unique_ptr<FileSink> backend,
+                 const ResourcePolicy& threadPolicy = ResourcePolicy());
+
+    /// \brief Stop the collector thread.
+    ~FileSinkPool();
+
+    /// \brief Create a sink for one thread.
+    ///
+    /// The sink keeps the pool alive, and waits for its own tasks when it is
+    /// destroyed.
+    ///
+    /// \returns a new sink.
+    std::unique_ptr<FileSink> createSink();
+
+    /// \returns the backend name.
+    std::string name() const;
+
+    /// \brief Create a pool from a "file_sink" settings object.
+    /// \param settings The sink settings (see FileSink::fromJSON).
+    /// \param threadPolicy The policy of the backend's threads, if any.
+    /// \returns a new pool.
+    static std::shared_ptr<FileSinkPool> fromJSON(const ofJson& settings,
+                                                  const ResourcePolicy& threadPolicy = ResourcePolicy());
+
+    /// \brief The time in milliseconds between collections while tasks are
+    /// in flight.
+    static const uint64_t COLLECT_INTERVAL;
+
+private:
+    friend class PooledFileSink;
+
+    /// \brief Queue a task of a sink for the collector. Caller must hold
+    /// the lock.
+    void _submit(PooledFileSink& sink, FileTask&& task);
+
+    /// \brief The collector thread function.
+    void _run();
+
+    /// \brief The shared sink, or nullptr. Only used by the collector.
+    std::unique_ptr<FileSink> _backend;
+
+    /// \brief The sink and the tag of each task in flight, by backend tag.
+    std::map<uint64_t, std::pair<PooledFileSink*, uint64_t>> _owners;
+
+    /// \brief The next backend tag.
+    uint64_t _nextTag = 0;
+
+    /// \brief Tasks waiting for the collector to submit them.
+    std::vector<FileTask> _submitted;
+
+    /// \brief The number of tasks in the backend. Only used by the
+    /// collector.
+    std::size_t _backendInFlight = 0;
+
+    /// \brief True once the pool is being destroyed.
+    bool _stopped = false;
+
+    /// \brief Guards the queued tasks, the owners and the sinks' tasks.
+    std::mutex _mutex;
+
+    /// \brief Wakes the collector when tasks are queued.
+    std::condition_variable _condition;
+
+    /// \brief The policy of the collector thread.
+    ResourcePolicy _threadPolicy;
+
+    /// \brief The collector thread, if there is a backend.
+    std::thread _collector;
+
+};
+
+
+/// \brief A sink for one thread that runs its tasks on a FileSinkPool.
+class PooledFileSink: public FileSink
+{
+public:
+    /// \brief Create a PooledFileSink.
+    /// \param pool The pool.
+    PooledFileSink(std::shared_ptr<FileSinkPool> pool);
+
+    /// \brief Wait for the tasks still in flight.
+    virtual ~PooledFileSink();
+
+    void submit(FileTask&& task) override;
+    std::size_t complete(std::vector<FileTask>& tasks, bool wait) override;
+    std::size_t inFlight() const override;
+    std::string name() const override;
+
+private:
+    friend class FileSinkPool;
+
+    /// \brief The pool.
+    std::shared_ptr<FileSinkPool> _pool;
+
+    /// \brief Tasks that ran but have not been collected, guarded by the
+    /// pool.
+    std::vector<FileTask> _completed;
+
+    /// \brief The number of submitted tasks not yet collected, guarded by
+    /// the pool.
+    std::size_t _inFlight = 0;
+
+    /// \brief Notified by the collector when tasks of this sink complete.
+    std::condition_variable _condition;
+
+};
+
+
+} } // ofx::InstaLooter
@@ -8,13 +8,28 @@
 #pragma once
 
 
+#include <atomic>
 #include <string>
 #include <chrono>
+#include <functional>
+#include <map>
+#include <random>
+#include <set>
+#include <unordered_set>
+#include <utility>
 #include "ofJson.h"
 #include "ofFileUtils.h"
 #include "ofx/IO/PollingThread.h"
 #include "ofx/IO/FileExtensionFilter.h"
-#include "ofx/IO/ThreadChannel.h"
+#include "ofx/InstaLooter/Backoff.h"
+#include "ofx/InstaLooter/Channel.h"
+#include "ofx/InstaLooter/CancellationToken.h"
+#include "ofx/InstaLooter/ChildProcess.h"
+#include "ofx/InstaLooter/FetchJob.h"
+#include "ofx/InstaLooter/FileSink.h"
+#include "ofx/InstaLooter/ResourcePolicy.h"
+#include "ofx/InstaLooter/StoreLayout.h"
+#include "ofx/InstaLooter/WorkerPool.h"
 
 
 namespace ofx {
@@ -22,6 +37,11 @@ namespace InstaLooter {
 
 
 /// \brief Create an InstaLooter Post.
+///
+/// Posts are moved, never copied, from the client that finds them through
+/// the manager to the posts channels, so a post costs the same few
+/// allocations however far it travels. The accessors return references,
+/// valid as long as the post, so reading a post does not allocate either.
 class Post
 {
 public:
@@ -35,16 +55,16 @@ public:
     /// \param width Image width.
     /// \param height Image height.
     /// \param hashtags The hashtags associated with the image.
-    Post(const std::filesystem::path& path,
+    Post(std::filesystem::path path,
          uint64_t id,
          uint64_t userId,
          uint64_t timestamp,
          uint64_t width,
          uint64_t height,
-         const std::set<std::string>& hashtags);
+         std::set<std::string> hashtags);
 
     /// \returns the path to the image.
-    std::filesystem::path path() const;
+    const std::filesystem::path& path() const;
 
     /// \returns the image id.
     uint64_t id() const;
@@ -62,9 +82,18 @@ public:
     uint64_t height() const;
 
     /// \returns the hashtag that that yielded the image.
-    std::set<std::string> hashtags() const;
+    const std::set<std::string>& hashtags() const;
 
-    static Post fromOldSortedPath(const std::filesystem::path& path);
+    /// \returns when instaLooter downloaded the image, in milliseconds since
+    /// the epoch, or 0 if unknown. This is not saved with the post.
+    uint64_t downloadTime() const;
+
+    /// \brief Create a Post from a path in a hashtag sorted store.
+    /// \param path The path to the image.
+    /// \param layout The layout of the sorted store.
+    /// \throws Poco::InvalidArgumentException if unable to parse.
+    static Post fromOldSortedPath(const std::filesystem::path& path,
+                                  const StoreLayout& layout = StoreLayout());
 
     /// \brief Create an Image by parsing a filename.
     /// \throws Poco::InvalidArgumentException if unable to parse.
@@ -74,15 +103,19 @@ public:
     /// \throws Poco::InvalidArgumentException if invalid syntax.
     static std::tm parseDownloadDateTime(const std::string& dateTime);
 
+    /// \param post The post.
+    /// \param layout The layout of the store, usually read from its manifest.
     /// \throws Poco::InvalidArgumentException if unable to parse.
     /// \returns a store path for the post, given the baseStorePath.
-    static std::filesystem::path relativeStorePathForImage(const Post& post);
+    static std::filesystem::path relativeStorePathForImage(const Post& post,
+                                                           const StoreLayout& layout = StoreLayout());
 
     static ofJson toJSON(const Post& post);
     static Post fromJSON(const ofJson& json);
 
     enum
     {
+        /// \brief The depth of the default StoreLayout.
         ID_PATH_DEPTH = 6
     };
 
@@ -95,36 +128,281 @@ private:
     uint64_t _width = 0;
     uint64_t _height = 0;
     std::set<std::string> _hashtags;
+    uint64_t _downloadTime = 0;
 
     friend class HashtagClient;
     friend class HashtagClientManager;
+    friend class FeedSubscriber;
+    friend class SharedFeed;
     
 };
 
 
 /// \brief A wrapper for executing instaLooter and organizing its loot.
+///
+/// Each run is classified by its exit code and output. After a failure the
+/// client skips polls until a jittered, exponentially growing delay has
+/// passed, and throttling and login failures are reported to the circuit
+/// breaker of its credential, which pauses every client that shares it.
 class HashtagClient: public IO::PollingThread
 {
 public:
+    /// \brief A function that runs a search in place of instaLooter, e.g. a
+    /// stub that fails on purpose.
+    ///
+    /// Lines written to the output are parsed as instaLooter output, and
+    /// the result's output and progress are taken from it.
+    typedef std::function<FetchResult(const FetchJob& job,
+                                      const CancellationToken& cancellation,
+                                      OutputMonitor& output)> Fetcher;
+
+    /// \brief What a client is doing.
+    enum class Status
+    {
+        /// \brief Waiting for the next poll.
+        IDLE,
+        /// \brief Running a search.
+        FETCHING,
+        /// \brief Skipping polls after a failure.
+        BACKING_OFF,
+        /// \brief Skipping polls while its credential's breaker is open.
+        PAUSED
+    };
+
+    /// \brief A snapshot of a client for monitoring.
+    struct State
+    {
+        /// \brief The search hashtag.
+        std::string hashtag;
+
+        /// \brief What the client is doing.
+        Status status = Status::IDLE;
+
+        /// \brief The outcome of the last run.
+        FetchResult::Outcome lastOutcome = FetchResult::Outcome::SUCCESS;
+
+        /// \brief The exit code of the last run.
+        int lastExitCode = 0;
+
+        /// \brief The number of failed runs since the last success.
+        std::size_t consecutiveFailures = 0;
+
+        /// \brief The time in milliseconds until the client may run again,
+        /// or 0 if it is not backing off or paused.
+        uint64_t retryDelay = 0;
+
+        /// \brief The state of its credential's breaker.
+        CircuitBreaker::State circuitBreaker = CircuitBreaker::State::CLOSED;
+
+        /// \brief The number of runs.
+        uint64_t runs = 0;
+
+        /// \brief The number of failed runs.
+        uint64_t failedRuns = 0;
+
+        static ofJson toJSON(const State& state);
+
+    };
+
+    /// \brief Create a HashtagClient.
+    ///
+    /// Pass false for autoStart to set the fetcher, file sink, policies or
+    /// circuit breaker before the first poll, then call start(). Otherwise
+    /// the first poll may run without them.
+    ///
+    /// \param hashtag The search hashtag.
+    /// \param username The optional username.
+    /// \param password The optional password.
+    /// \param storePath The store root to download to.
+    /// \param pollingInterval The time in milliseconds between polls.
+    /// \param numImagesToDownload The number of images per query.
+    /// \param instaLooterPath The instaLooter executable.
+    /// \param workerPool The optional shared worker pool.
+    /// \param autoStart True to start polling right away.
     HashtagClient(const std::string& hashtag,
                   const std::string& username,
                   const std::string& password,
                   const std::filesystem::path& storePath,
                   uint64_t pollingInterval = DEFAULT_POLLING_INTERVAL,
                   uint64_t numImagesToDownload = DEFAULT_NUM_IMAGES_TO_DOWNLOAD,
-                  const std::filesystem::path& instaLooterPath = DEFAULT_INSTALOOTER_PATH);
+                  const std::filesystem::path& instaLooterPath = DEFAULT_INSTALOOTER_PATH,
+                  std::shared_ptr<WorkerPool> workerPool = nullptr,
+                  bool autoStart = true);
 
     /// \brief Destroy the HashtagClient.
+    ///
+    /// Cancels any work in progress, so destruction does not wait for a
+    /// running instaLooter process.
     virtual ~HashtagClient();
 
+    /// \brief Cancel any work in progress.
+    ///
+    /// A running instaLooter process group is killed immediately and every
+    /// later stage of the current poll is skipped. This does not block, so
+    /// many clients can be cancelled before any of them are joined.
+    void cancel();
+
+    /// \returns true if the client has been cancelled.
+    bool isCancelled() const;
+
+    /// \returns the search hashtag.
+    std::string getHashtag() const;
+
+    /// \brief Set the number of images to download per query.
+    ///
+    /// Takes effect from the next poll.
+    ///
+    /// \param numImagesToDownload The number of images.
+    void setNumImagesToDownload(uint64_t numImagesToDownload);
+
+    /// \returns the number of images to download per query.
+    uint64_t getNumImagesToDownload() const;
+
     void setUsername(const std::string& username);
     std::string getUsername() const;
 
     void setPassword(const std::string& password);
     std::string getPassword() const;
 
-    /// \brief A thread channel for new posts fo und by this client.
-    IO::ThreadChannel<Post> posts;
+    /// \brief Run searches on a shared pool of persistent workers.
+    ///
+    /// When set, each poll is sent to the pool instead of launching a new
+    /// instaLooter process.
+    ///
+    /// \param workerPool The worker pool, or nullptr to launch processes.
+    void setWorkerPool(std::shared_ptr<WorkerPool> workerPool);
+
+    /// \returns the worker pool or nullptr if none is set.
+    std::shared_ptr<WorkerPool> getWorkerPool() const;
+
+    /// \brief Set the sink used to copy downloads into the store.
+    ///
+    /// The sink is used only by this client's thread. A replaced sink is
+    /// released after the poll that is using it.
+    ///
+    /// \param fileSink The file sink, or nullptr for a synchronous sink.
+    void setFileSink(std::shared_ptr<FileSink> fileSink);
+
+    /// \returns the file sink.
+    std::shared_ptr<FileSink> getFileSink() const;
+
+    /// \brief Set the number of raw downloads to keep.
+    ///
+    /// instaLooter's --new option stops at the first post it has already
+    /// downloaded, so the newest raw files are kept as a reference. Older
+    /// files are removed once they are in the store. With references
+    /// dropped (see setDropReferences()) none are kept.
+    ///
+    /// \param rawRetention The number of raw files to keep, at least 1.
+    void setRawRetention(std::size_t rawRetention);
+
+    /// \returns the number of raw downloads to keep.
+    std::size_t getRawRetention() const;
+
+    /// \returns the number of raw downloads known to be on disk.
+    std::size_t getRawFileCount() const;
+
+    /// \returns the newest post stored by this search.
+    ///
+    /// The cursor is kept in the save path, so it survives restarts. It is
+    /// passed to the fetcher with every job, and downloads no newer than it
+    /// are treated as already stored. It only passes a post once the store
+    /// has taken in its staged copy, and never passes a failed copy.
+    FetchCursor getCursor() const;
+
+    /// \brief Report that the store could not take in a post sent by this
+    /// client.
+    ///
+    /// On the next poll the staged copy is removed, and the post is staged
+    /// and sent again from its raw download, which is kept until the post
+    /// is stored. The cursor does not pass the post until then.
+    ///
+    /// \param id The post id.
+    void storeFailed(uint64_t id);
+
+    /// \brief Also limit instaLooter itself to posts from around the cursor
+    /// on, with its --time option.
+    ///
+    /// The worker stub always honors the cursor.
+    ///
+    /// \param timeFilter True to pass the cursor to instaLooter.
+    void setTimeFilter(bool timeFilter);
+
+    /// \returns true if the cursor is passed to instaLooter.
+    bool getTimeFilter() const;
+
+    /// \brief Remove every raw download once it is stored.
+    ///
+    /// Only safe when the fetcher stops at the cursor, either the worker
+    /// stub or instaLooter with the time filter. Otherwise --new has no
+    /// reference and each poll downloads num_images_to_download again.
+    ///
+    /// \param dropReferences True to keep no raw files.
+    void setDropReferences(bool dropReferences);
+
+    /// \returns true if no raw files are kept.
+    bool getDropReferences() const;
+
+    /// \returns the progress of the current or last instaLooter run.
+    FetchProgress getProgress() const;
+
+    /// \returns the last lines of output of the current or last run.
+    std::vector<std::string> getOutputTail() const;
+
+    /// \brief Set the policy applied to instaLooter processes launched by
+    /// this client.
+    ///
+    /// Processes of a worker pool use the pool's policy instead.
+    ///
+    /// \param processPolicy The process policy.
+    void setProcessPolicy(const ResourcePolicy& processPolicy);
+
+    /// \returns the process policy.
+    ResourcePolicy getProcessPolicy() const;
+
+    /// \brief Set the policy of this client's polling thread.
+    ///
+    /// Takes effect from the next poll. Processes launched by the thread
+    /// inherit whatever the process policy does not set.
+    ///
+    /// \param threadPolicy The thread policy.
+    void setThreadPolicy(const ResourcePolicy& threadPolicy);
+
+    /// \returns the thread policy.
+    ResourcePolicy getThreadPolicy() const;
+
+    /// \brief Set the delays between runs after failures.
+    /// \param backoffPolicy The backoff policy.
+    void setBackoffPolicy(const BackoffPolicy& backoffPolicy);
+
+    /// \returns the backoff policy.
+    BackoffPolicy getBackoffPolicy() const;
+
+    /// \brief Set the circuit breaker shared by the clients of a credential.
+    /// \param circuitBreaker The breaker, or nullptr for none.
+    void setCircuitBreaker(std::shared_ptr<CircuitBreaker> circuitBreaker);
+
+    /// \returns the circuit breaker or nullptr if none is set.
+    std::shared_ptr<CircuitBreaker> getCircuitBreaker() const;
+
+    /// \brief Run searches with a function instead of instaLooter.
+    ///
+    /// Takes precedence over a worker pool. Takes effect from the next poll.
+    ///
+    /// \param fetcher The fetcher, or nullptr to use instaLooter.
+    void setFetcher(Fetcher fetcher);
+
+    /// \returns the fetcher or nullptr if none is set.
+    Fetcher getFetcher() const;
+
+    /// \returns a snapshot of the client.
+    State getState() const;
+
+    /// \returns the name of a status, e.g. "backing_off".
+    static std::string toString(Status status);
+
+    /// \brief A thread channel for new posts found by this client.
+    SingleProducerChannel<Post> posts;
 
     /// \brief The default Instagram polling interval in milliseconds.
     static const uint64_t DEFAULT_POLLING_INTERVAL;
@@ -135,9 +413,16 @@ public:
     /// \brief Default command timeout in milliseconds.
     static const uint64_t DEFAULT_PROCESS_TIMEOUT;
 
-    /// \brief Thread sleep timeout in milliseconds.
+    /// \brief The longest time in milliseconds the process monitor waits
+    /// before checking for cancellation and timeouts.
     static const uint64_t PROCESS_THREAD_SLEEP;
 
+    /// \brief The default number of raw downloads to keep.
+    static const std::size_t DEFAULT_RAW_RETENTION;
+
+    /// \brief The maximum number of raw downloads removed per poll.
+    static const std::size_t RAW_COMPACTION_BATCH;
+
     /// \brief Default instaLooter script path.
     static const std::string DEFAULT_INSTALOOTER_PATH;
 
@@ -148,6 +433,44 @@ private:
     /// \brief An internal function for executing instaLooter.
     void _loot();
 
+    /// \brief Run a search by launching instaLooter directly.
+    FetchResult _fetch(const FetchJob& job);
+
+    /// \brief Update the backoff and the circuit breaker after a run.
+    /// \param result The result of the run.
+    /// \param circuitBreaker The breaker the run was allowed by, if any.
+    /// \param probe True if the run was the breaker's probe.
+    /// \returns the outcome of the run.
+    FetchResult::Outcome _recordOutcome(const FetchResult& result,
+                                        CircuitBreaker* circuitBreaker,
+                                        bool probe);
+
+    /// \returns true if the thread is stopping or the client was cancelled.
+    bool _shouldStop() const;
+
+    /// \brief Remove the oldest raw downloads beyond the retention limit.
+    /// \param fileSink The sink to remove files with.
+    /// \returns the number of files removed.
+    std::size_t _compactRaw(FileSink& fileSink);
+
+    /// \brief Send the copies a previous run staged under _savePath but
+    /// the store never took in, e.g. because it crashed first.
+    ///
+    /// The manager removes each copy once the post is in the store, so
+    /// whatever is left was in flight.
+    ///
+    /// \returns the number of posts sent.
+    std::size_t _recoverStaged();
+
+    /// \brief Forget the staged copies the store reported as failed, so
+    /// that their raw downloads are staged again.
+    void _restage();
+
+    /// \returns true if the raw download of a post must be kept, as the
+    /// post is not in the store yet.
+    /// \param filename The filename of the raw download.
+    bool _isUnstored(const std::string& filename) const;
+
     /// \brief If true, there is no output from instaLooter.
     bool _quiet = false;
 
@@ -171,13 +494,121 @@ private:
     /// \brief The location of the instaLooter app.
     std::filesystem::path _instaLooterPath;
 
-    uint64_t _numImagesToDownload = DEFAULT_NUM_IMAGES_TO_DOWNLOAD;
+    /// \brief The number of images to download per query.
+    std::atomic<uint64_t> _numImagesToDownload;
 
     uint64_t _processTimeout = DEFAULT_PROCESS_TIMEOUT;
 
     IO::FileExtensionFilter _fileExtensionFilter;
 
-    std::vector<Post> _lastPostsSaved;
+    /// \brief Raw downloads that have been staged, oldest first, as
+    /// (timestamp, filename). Those of posts not yet in the store are kept.
+    std::set<std::pair<uint64_t, std::string>> _rawIndex;
+
+    /// \brief Filenames of every raw download that has been handled,
+    /// including those that could not be parsed.
+    std::unordered_set<std::string> _rawFilenames;
+
+    /// \brief The number of raw downloads to keep.
+    std::atomic<std::size_t> _rawRetention;
+
+    /// \brief The size of _rawIndex, readable from any thread.
+    std::atomic<std::size_t> _rawFileCount;
+
+    /// \brief True once the staged copies of a previous run were sent.
+    bool _stagedRecovered = false;
+
+    /// \brief Posts sent to the store whose staged copies were still there
+    /// at the last poll, by id, as (timestamp, staged path). The cursor
+    /// does not pass them.
+    std::map<uint64_t, std::pair<uint64_t, std::filesystem::path>> _stagedPosts;
+
+    /// \brief Posts the store failed to take in, whose raw downloads are
+    /// staged again. The cursor does not pass them.
+    std::set<uint64_t> _restagedIds;
+
+    /// \brief Ids reported by storeFailed() since the last poll.
+    std::vector<uint64_t> _failedIds;
+
+    /// \brief Guards _failedIds.
+    mutable std::mutex _failedIdsMutex;
+
+    /// \brief The newest post stored.
+    FetchCursor _cursor;
+
+    /// \brief Guards _cursor.
+    mutable std::mutex _cursorMutex;
+
+    /// \brief True if the cursor is passed to instaLooter.
+    std::atomic<bool> _timeFilter;
+
+    /// \brief True if no raw files are kept.
+    std::atomic<bool> _dropReferences;
+
+    /// \brief Cancels the current poll.
+    CancellationToken _cancellation;
+
+    /// \brief Reads the output of the current run.
+    OutputMonitor _output;
+
+    /// \brief The running instaLooter process, if any.
+    ChildProcess* _activeProcess = nullptr;
+
+    /// \brief The optional shared worker pool.
+    std::shared_ptr<WorkerPool> _workerPool;
+
+    /// \brief The sink for copying and removing downloads.
+    std::shared_ptr<FileSink> _fileSink;
+
+    /// \brief The policy of launched instaLooter processes.
+    ResourcePolicy _processPolicy;
+
+    /// \brief The policy of the polling thread.
+    ResourcePolicy _threadPolicy;
+
+    /// \brief True if the thread policy has changed since it was applied.
+    std::atomic<bool> _threadPolicyChanged;
+
+    /// \brief The delays between runs after failures.
+    BackoffPolicy _backoffPolicy;
+
+    /// \brief The optional circuit breaker of the credential.
+    std::shared_ptr<CircuitBreaker> _circuitBreaker;
+
+    /// \brief The optional fetcher used instead of instaLooter.
+    Fetcher _fetcher;
+
+    /// \brief Guards _activeProcess, _workerPool, _fileSink, the policies,
+    /// the circuit breaker and the fetcher.
+    mutable std::mutex _processMutex;
+
+    /// \brief True while a search runs.
+    std::atomic<bool> _fetching;
+
+    /// \brief The outcome of the last run.
+    FetchResult::Outcome _lastOutcome = FetchResult::Outcome::SUCCESS;
+
+    /// \brief The exit code of the last run.
+    int _lastExitCode = 0;
+
+    /// \brief The number of failed runs since the last success.
+    std::size_t _consecutiveFailures = 0;
+
+    /// \brief The elapsed time in milliseconds before which polls are
+    /// skipped.
+    uint64_t _nextRunTime = 0;
+
+    /// \brief The number of runs.
+    uint64_t _runs = 0;
+
+    /// \brief The number of failed runs.
+    uint64_t _failedRuns = 0;
+
+    /// \brief Guards the outcome of the last run and the backoff.
+    mutable std::mutex _stateMutex;
+
+    /// \brief Draws the jitter of backoff delays. Used by the client thread.
+    std::mt19937 _random;
 
 };
 
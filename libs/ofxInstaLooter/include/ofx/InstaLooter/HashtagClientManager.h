@@ -8,8 +8,19 @@
 #pragma once
 
 
+#include <map>
+#include <mutex>
 #include "ofJson.h"
 #include "ofx/InstaLooter/HashtagClient.h"
+#include "ofx/InstaLooter/HashtagLog.h"
+#include "ofx/InstaLooter/IngestJournal.h"
+#include "ofx/InstaLooter/PostCache.h"
+#include "ofx/InstaLooter/PostMerger.h"
+#include "ofx/InstaLooter/Reaper.h"
+#include "ofx/InstaLooter/SharedFeed.h"
+#include "ofx/InstaLooter/Store.h"
+#include "ofx/InstaLooter/Trace.h"
+#include "ofx/InstaLooter/WriteQueue.h"
 #include "ofx/IO/Thread.h"
 
 
@@ -22,24 +33,296 @@ class HashtagClientManager: public IO::PollingThread
 {
 public:
     HashtagClientManager();
+
+    /// \brief Cancel all clients and wait for them to finish.
     virtual ~HashtagClientManager();
 
+    /// \brief Create the store and a client for each search, then start.
+    ///
+    /// The paths configure the store (see Store::fromJSON). Clients download
+    /// to its first root. The optional settings objects are:
+    ///
+    /// - "file_sink": how files are written (see FileSinkPool::fromJSON).
+    /// - "isolation": "children" and "ingest" policies for processes and
+    ///   threads (see ResourcePolicy::fromJSON).
+    /// - "post_cache": the cache of recent posts (see PostCache::fromJSON).
+    /// - "ordered_output": timestamp order across hashtags (see
+    ///   PostMerger::fromJSON).
+    /// - "shared_feed": publish posts to other processes (see
+    ///   SharedFeed::fromJSON).
+    /// - "hashtag_log", "ingest_journal": set "enabled" to false to turn off.
+    /// - "retention": remove old posts (see Reaper::fromJSON).
+    /// - "backoff": delay after a failed run (see BackoffPolicy::fromJSON).
+    /// - "circuit_breaker": shared by clients with the same credentials (see
+    ///   CircuitBreaker::fromJSON).
+    /// - "trace": record spans of each poll and write (see
+    ///   TraceWriter::fromJSON).
+    ///
+    /// A search may override "isolation" and "backoff". The "file_sink" is
+    /// read once, so a reload does not change it.
+    ///
+    /// \param paths The store paths settings.
+    /// \param settings The instagram source settings.
     void setup(const ofJson& paths, const ofJson& settings);
 
+    /// \brief Apply the searches of new settings.
+    ///
+    /// Clients of new searches are started and those of removed searches
+    /// are stopped. Clients that remain keep their state, and their
+    /// "polling_interval", "num_images_to_download", "raw_retention" and
+    /// "backoff" are changed in place. Other settings only apply to new clients.
+    ///
+    /// The settings are applied by the manager thread on its next poll.
+    ///
+    /// \param settings The instagram source settings.
+    void reload(const ofJson& settings);
+
+    /// \brief Reload the searches whenever a settings file changes.
+    ///
+    /// If the manager is not set up yet, the file is checked from the end
+    /// of setup().
+    ///
+    /// \param settingsPath The settings file.
+    /// \param pointer The JSON pointer of the instagram source settings in
+    ///        the file, e.g. "/sources/instagram".
+    /// \param interval The time in milliseconds between checks.
+    void watch(const std::filesystem::path& settingsPath,
+               const std::string& pointer,
+               uint64_t interval = DEFAULT_WATCH_INTERVAL);
+
+    /// \returns the time in milliseconds the last reload took.
+    uint64_t getLastReloadDuration() const;
+
+    /// \returns the store, or nullptr before setup.
+    Store* store();
+
+    /// \brief Get a post by id.
+    ///
+    /// Recently written posts are served from memory. Others are loaded
+    /// from the store and cached.
+    ///
+    /// \param id The post id.
+    /// \param post Set to the post if found.
+    /// \returns true if the post was found.
+    bool getPost(uint64_t id, Post& post);
+
+    /// \brief Get the encoded image of a post.
+    ///
+    /// Posts in a pack store have a locator rather than a file as their
+    /// path (see PackStore::locatorFor()), so this is how their images are
+    /// read. Images of other posts are only returned if they are cached.
+    ///
+    /// \param id The post id.
+    /// \returns the image bytes, or nullptr if they are not available.
+    std::shared_ptr<const std::string> getImage(uint64_t id) const;
+
+    /// \brief Get the most recently written posts with a hashtag.
+    /// \param hashtag The hashtag.
+    /// \param count The maximum number of posts.
+    /// \returns the posts, newest first.
+    std::vector<Post> recent(const std::string& hashtag, std::size_t count) const;
+
+    /// \returns the cache of recent posts, e.g. for its hit counters.
+    const PostCache& cache() const;
+
+    /// \returns the shared feed, e.g. for the lag of its subscribers, or
+    /// nullptr if there is none.
+    const SharedFeed* feed() const;
+
+    /// \returns the reaper, e.g. for its totals, or nullptr if there is no
+    /// retention.
+    const Reaper* reaper() const;
+
+    /// \returns a snapshot of each client, e.g. to see which are backing off
+    /// or paused.
+    std::vector<HashtagClient::State> clientStates() const;
+
+    /// \brief The default time in milliseconds between compactions of the
+    /// hashtag logs.
+    static const uint64_t DEFAULT_COMPACTION_INTERVAL;
+
+    /// \brief The default time in milliseconds between checks of a watched
+    /// settings file.
+    static const uint64_t DEFAULT_WATCH_INTERVAL;
+
     /// \brief New posts.
-    IO::ThreadChannel<Post> posts;
+    MultiProducerChannel<Post> posts;
 
     /// \brief Posts that have been downloaded already but have additional or updated info (e.g. hashtags).
-    IO::ThreadChannel<Post> updatedPosts;
+    MultiProducerChannel<Post> updatedPosts;
+
+    /// \brief Posts removed from the store by the retention policy.
+    MultiProducerChannel<Post> removedPosts;
 
 private:
     void _process();
 
+    /// \brief Send the posts of a client to the write queues.
+    void _route(HashtagClient& client);
+
+    /// \brief Apply reloaded settings, if there are any.
+    void _checkSettings();
+
+    /// \brief Start, stop and update clients to match the searches.
+    void _updateClients(const ofJson& settings);
+
+    /// \returns the modification time and size of a file, or zeros.
+    static std::pair<std::time_t, uintmax_t> _modified(const std::filesystem::path& path);
+
+    /// \brief Write a batch of posts to the store.
+    ///
+    /// Called on the write queue thread of the root that holds the posts.
+    ///
+    /// \param root The index of the root.
+    /// \param posts The posts to write.
+    void _write(std::size_t root, std::vector<Post>& posts);
+
+    /// \brief Tell the clients of posts that could not be written to
+    /// stage them again.
+    void _rejected(const std::vector<Post>& posts);
+
+    /// \brief Send written posts to the posts channel, through the merger
+    /// if output is ordered.
+    void _send(std::vector<Post>& posts);
+
+    /// \brief Send posts to a channel and publish them to the shared feed.
+    void _deliver(std::vector<Post>& posts, SharedFeed::Kind kind);
+
+    /// \brief Add written posts to the cache.
+    void _cache(const std::vector<Post>& posts);
+
+    /// \brief Load a post that is not cached from the store.
+    bool _load(uint64_t id, Post& post) const;
+
+    /// \brief Load a post from one store root.
+    bool _load(std::size_t root, uint64_t id, Post& post) const;
+
+    /// \brief Find the metadata file of a post in a file store root.
+    bool _findJSON(std::size_t root, uint64_t id, std::filesystem::path& jsonPath) const;
+
+    /// \brief Fold the hashtag logs into the metadata files.
+    void _compact();
+
+    /// \brief Remove the posts that break the retention policy.
+    void _reap();
+
+    /// \brief Drop removed posts from the cache and send them on.
+    void _removed(std::vector<Post>& posts);
+
+    /// \brief Add logged hashtags to the metadata file of a post.
+    /// \returns false if the post should be tried again later.
+    bool _applyHashtags(std::size_t root,
+                        uint64_t id,
+                        const std::set<std::string>& hashtags);
+
+    /// \brief Write a batch of posts to a root's PackStore.
+    /// \param packStore The PackStore of the root.
+    /// \param posts The posts to write.
+    void _writePacked(PackStore& packStore, std::vector<Post>& posts);
+
+    /// \brief The primary store root, where clients download.
     std::filesystem::path _storePath;
-    std::filesystem::path _savePath;
+
+    /// \brief The store, which may span several roots.
+    std::unique_ptr<Store> _store;
+
+    /// \brief The file sink backend shared by the clients and store roots.
+    std::shared_ptr<FileSinkPool> _fileSinkPool;
+
+    /// \brief One file sink per store root, used by its write queue.
+    std::vector<std::unique_ptr<FileSink>> _fileSinks;
+
+    /// \brief One write queue per store root.
+    std::vector<std::unique_ptr<WriteQueue>> _writeQueues;
 
     std::vector<std::unique_ptr<HashtagClient>> _clients;
 
+    /// \brief Guards changes to _clients, which the manager thread reads
+    /// without it. Every change is made under it, including clients moved
+    /// out of the vector before it is erased.
+    mutable std::mutex _clientsMutex;
+
+    /// \brief The circuit breaker of each username, or nullptr if disabled.
+    std::map<std::string, std::shared_ptr<CircuitBreaker>> _circuitBreakers;
+
+    /// \brief The optional worker pool shared by all clients.
+    std::shared_ptr<WorkerPool> _workerPool;
+
+    /// \brief Recently written posts.
+    std::unique_ptr<PostCache> _postCache;
+
+    /// \brief True if image bytes are cached along with posts.
+    bool _cacheImages = false;
+
+    /// \brief One hashtag log per store root, nullptr for pack roots.
+    std::vector<std::unique_ptr<HashtagLog>> _hashtagLogs;
+
+    /// \brief One ingest journal per store root, nullptr for pack roots.
+    std::vector<std::unique_ptr<IngestJournal>> _journals;
+
+    /// \brief Runs _compact() in the background.
+    IO::PollingThread _compactor;
+
+    /// \brief Removes old posts, or nullptr if there is no retention.
+    std::unique_ptr<Reaper> _reaper;
+
+    /// \brief Runs _reap() in the background.
+    IO::PollingThread _reaperThread;
+
+    /// \brief Orders the posts channel, or nullptr if unordered.
+    std::unique_ptr<PostMerger> _merger;
+
+    /// \brief Guards _merger and keeps its output in order on the channel.
+    std::mutex _mergerMutex;
+
+    /// \brief Publishes posts to other processes, or nullptr.
+    std::unique_ptr<SharedFeed> _feed;
+
+    /// \brief A reusable buffer for posts received from the clients.
+    std::vector<Post> _receivedPosts;
+
+    /// \brief The default policy of instaLooter and worker processes.
+    ResourcePolicy _processPolicy;
+
+    /// \brief The default policy of ingest threads.
+    ResourcePolicy _threadPolicy;
+
+    /// \brief True once _threadPolicy is applied to the manager thread.
+    bool _threadPolicyApplied = false;
+
+    /// \brief True once _threadPolicy is applied to the reaper thread.
+    bool _reaperThreadPolicyApplied = false;
+
+    /// \brief Streams trace events to a file, or nullptr.
+    std::unique_ptr<TraceWriter> _traceWriter;
+
+    /// \brief Settings waiting to be applied.
+    ofJson _pendingSettings;
+
+    /// \brief True if _pendingSettings should be applied.
+    bool _hasPendingSettings = false;
+
+    /// \brief The watched settings file, or empty.
+    std::filesystem::path _settingsPath;
+
+    /// \brief The JSON pointer of the source settings in the file.
+    std::string _settingsPointer;
+
+    /// \brief The time in milliseconds between checks of the file.
+    uint64_t _watchInterval = DEFAULT_WATCH_INTERVAL;
+
+    /// \brief The last time the file was checked.
+    uint64_t _lastWatchTime = 0;
+
+    /// \brief The modification time and size of the file when last loaded.
+    std::pair<std::time_t, uintmax_t> _settingsModified;
+
+    /// \brief Guards the reload state above.
+    mutable std::mutex _reloadMutex;
+
+    /// \brief The time in milliseconds the last reload took.
+    std::atomic<uint64_t> _lastReloadDuration;
+
 };
 
 
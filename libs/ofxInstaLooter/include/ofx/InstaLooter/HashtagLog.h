@@ -0,0 +1,129 @@
+//
+// Copyright (c) 2017 Christopher Baker <https://christopherbaker.net>
+//
+// SPDX-License-Identifier:	MIT
+//
+
+
+#pragma once
+
+
+#include <cstdint>
+#include <fstream>
+#include <functional>
+#include <mutex>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include "ofFileUtils.h"
+
+
+namespace ofx {
+namespace InstaLooter {
+
+
+/// \brief An append-only log of hashtags added to stored posts.
+///
+/// Adding a hashtag to a post used to rewrite its whole .json.gz file.
+/// Instead, each addition is appended to the log as a single line,
+///
+///     <id> <hashtag> [<hashtag> ...]
+///
+/// and kept in memory, so readers can merge it into the stored metadata.
+/// From time to time compact() folds the logged hashtags into the metadata
+/// files and drops them from the log.
+///
+/// Compaction first moves the log aside, so additions made while it runs go
+/// to a new log. A compaction interrupted by a crash is finished by the
+/// next one, as both files are read when the log is opened.
+///
+/// All methods are thread-safe.
+class HashtagLog
+{
+public:
+    /// \brief Fold the hashtags of one post into its metadata.
+    /// \returns true if the metadata was updated.
+    typedef std::function<bool(uint64_t id, const std::set<std::string>& hashtags)> Apply;
+
+    /// \brief Open or create a HashtagLog.
+    /// \param path The log file.
+    HashtagLog(const std::filesystem::path& path);
+
+    /// \returns the log file.
+    std::filesystem::path path() const;
+
+    /// \brief Log hashtags added to a post.
+    /// \param id The post id.
+    /// \param hashtags The added hashtags.
+    void add(uint64_t id, const std::set<std::string>& hashtags);
+
+    /// \brief Get the logged hashtags of a post.
+    /// \param id The post id.
+    /// \returns the hashtags not yet in its metadata.
+    std::set<std::string> hashtags(uint64_t id) const;
+
+    /// \returns the number of posts with logged hashtags.
+    std::size_t size() const;
+
+    /// \brief Fold the logged hashtags into the metadata.
+    ///
+    /// Posts that apply fails for are kept and tried again next time, up
+    /// to MAX_ATTEMPTS times. Then their hashtags are logged as an error
+    /// and dropped, e.g. for a corrupt metadata file, so the log does not
+    /// grow without bound.
+    ///
+    /// \param apply Updates the metadata of one post.
+    /// \returns the number of posts updated.
+    std::size_t compact(const Apply& apply);
+
+    /// \brief The name of the log in each store root.
+    static const std::string FILENAME;
+
+    /// \brief The number of compactions that may fail to apply the
+    /// hashtags of a post before they are dropped.
+    static const std::size_t MAX_ATTEMPTS;
+
+private:
+    typedef std::unordered_map<uint64_t, std::set<std::string>> Additions;
+
+    /// \returns the path of the log being compacted.
+    std::filesystem::path _compactingPath() const;
+
+    /// \brief Write one line of a log.
+    static void _writeLine(std::ostream& stream,
+                           uint64_t id,
+                           const std::set<std::string>& hashtags);
+
+    /// \brief Write a whole log.
+    static void _write(std::ostream& stream, const Additions& additions);
+
+    /// \brief Read a log into additions, dropping a line torn by a crash.
+    static void _read(const std::filesystem::path& path, Additions& additions);
+
+    /// \brief The log file.
+    std::filesystem::path _path;
+
+    /// \brief Hashtags in the current log.
+    Additions _pending;
+
+    /// \brief Hashtags in the log being compacted.
+    Additions _compacting;
+
+    /// \brief The number of failed attempts to apply each post in
+    /// _compacting. Not persisted, so a restart tries them afresh. Guarded
+    /// by _compactionMutex.
+    std::unordered_map<uint64_t, std::size_t> _attempts;
+
+    /// \brief The current log.
+    std::ofstream _stream;
+
+    /// \brief Guards all state.
+    mutable std::mutex _mutex;
+
+    /// \brief Allows one compaction at a time.
+    std::mutex _compactionMutex;
+
+};
+
+
+} } // ofx::InstaLooter
@@ -0,0 +1,154 @@
+//
+// Copyright (c) 2017 Christopher Baker <https://christopherbaker.net>
+//
+// SPDX-License-Identifier:	MIT
+//
+
+
+#pragma once
+
+
+#include <cstdint>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "ofJson.h"
+#include "ofFileUtils.h"
+
+
+namespace ofx {
+namespace InstaLooter {
+
+
+/// \brief A write-ahead journal of the new posts a file store root is
+/// taking in.
+///
+/// Storing a new post moves its image into the store and writes its
+/// metadata beside it. A crash between the two used to leave an image
+/// without metadata, which only a walk of the whole store would find.
+/// Instead, before a batch touches any file, an intent holding everything
+/// needed to store each of its posts is appended to the journal, and once
+/// the batch is done the journal is emptied. Opening the journal finishes
+/// or rolls back whatever a crash left in it, so recovery takes as long as
+/// the work that was in flight, whatever the size of the store.
+///
+/// Each intent is a line of JSON,
+///
+///     {"id":<id>,"source":<path>,"image":<path>,"json":<path>,"metadata":{...}}
+///
+/// and a line torn by a crash is dropped, as nothing of its batch was
+/// touched yet.
+///
+/// Metadata is written to temporaryPathFor() and renamed into place after
+/// the image, so a metadata file is always whole and its image always in
+/// place.
+///
+/// The journal only covers the write queue. Posts a client staged but the
+/// queue never reached are sent again by the client when it restarts.
+///
+/// Each root has a single write queue, so there is at most one open batch.
+class IngestJournal
+{
+public:
+    /// \brief Everything needed to store one new post.
+    struct Intent
+    {
+        /// \brief The post id.
+        uint64_t id = 0;
+
+        /// \brief Where the client left the image.
+        std::filesystem::path source;
+
+        /// \brief Where the image goes in the store.
+        std::filesystem::path image;
+
+        /// \brief Where the metadata goes in the store.
+        std::filesystem::path json;
+
+        /// \brief The metadata.
+        ofJson metadata;
+
+        static ofJson toJSON(const Intent& intent);
+        static Intent fromJSON(const ofJson& json);
+
+    };
+
+    /// \brief What opening the journal recovered.
+    struct Recovery
+    {
+        /// \brief Posts that were finished: their image was moved into
+        /// place if needed and their metadata written.
+        std::size_t replayed = 0;
+
+        /// \brief Posts whose image was gone, whose partial metadata was
+        /// removed.
+        std::size_t rolledBack = 0;
+
+        /// \brief Intents that could not be recovered and stay in the
+        /// journal for the next start.
+        std::size_t failed = 0;
+
+    };
+
+    /// \brief Open or create a journal, recovering any intents left in it.
+    /// \param path The journal file.
+    /// \throws Poco::IOException if unable to open the journal.
+    IngestJournal(const std::filesystem::path& path);
+
+    /// \returns the journal file.
+    std::filesystem::path path() const;
+
+    /// \returns what opening the journal recovered.
+    Recovery recovery() const;
+
+    /// \brief Record the intents of a batch, before touching its files.
+    /// \param intents The intents.
+    /// \returns false if the journal could not be written, in which case
+    ///     the batch is not protected.
+    bool begin(const std::vector<Intent>& intents);
+
+    /// \brief Mark the open batch done and empty the journal.
+    void commit();
+
+    /// \brief Replace a metadata file atomically.
+    /// \param jsonPath The metadata file.
+    /// \param json The metadata.
+    /// \returns true if the file was replaced.
+    static bool replaceJSON(const std::filesystem::path& jsonPath, const ofJson& json);
+
+    /// \returns the path metadata is written to before it is renamed to
+    ///     jsonPath. Hidden, so the store does not take it for a post.
+    static std::filesystem::path temporaryPathFor(const std::filesystem::path& jsonPath);
+
+    /// \brief The name of the journal in each store root.
+    static const std::string FILENAME;
+
+private:
+    /// \brief Finish or roll back one intent.
+    /// \returns false if it failed.
+    bool _recover(const Intent& intent);
+
+    /// \brief The journal file.
+    std::filesystem::path _path;
+
+    /// \brief The journal.
+    std::ofstream _stream;
+
+    /// \brief What opening the journal recovered.
+    Recovery _recovery;
+
+    /// \brief The lines of intents that failed to recover, kept in the
+    /// journal until the next start.
+    std::string _retained;
+
+    /// \brief True if the journal holds an open batch.
+    bool _open = false;
+
+    /// \brief Guards the journal.
+    mutable std::mutex _mutex;
+
+};
+
+
+} } // ofx::InstaLooter
@@ -0,0 +1,93 @@
+//
+// Copyright (c) 2017 Christopher Baker <https://christopherbaker.net>
+//
+// SPDX-License-Identifier:	MIT
+//
+
+
+#pragma once
+
+
+#include <memory>
+#include <string>
+#include <unordered_set>
+#include <vector>
+#include "ofx/InstaLooter/FileSink.h"
+
+
+namespace ofx {
+namespace InstaLooter {
+
+
+/// \brief A FileSink that uses Linux io_uring.
+///
+/// Each operation is issued as a chain of linked submissions: a MOVE is a
+/// single renameat, a WRITE is an openat into a direct descriptor followed by
+/// a write, a COPY is two openats, a read and a write, and
+/// CREATE_DIRECTORIES is one mkdirat per missing component. Up to the queue
+/// depth tasks are kept in flight and completions are reaped in batches, so
+/// a single ingest thread can keep a disk busy without blocking on each
+/// call. SET_WRITE_TIME has no io_uring equivalent and runs inline.
+///
+/// The ring is set up with raw system calls and needs Linux 5.15 or newer.
+/// Use isAvailable() or FileSink::fromJSON(), which falls back to a thread
+/// pool on other platforms.
+class IoUringFileSink: public FileSink
+{
+public:
+    /// \brief Create an IoUringFileSink.
+    /// \param queueDepth The maximum number of tasks in flight.
+    /// \throws Poco::IOException if io_uring is not available.
+    IoUringFileSink(std::size_t queueDepth = DEFAULT_QUEUE_DEPTH);
+
+    /// \brief Finish all submitted tasks and close the ring.
+    virtual ~IoUringFileSink();
+
+    void submit(FileTask&& task) override;
+    std::size_t complete(std::vector<FileTask>& tasks, bool wait) override;
+    std::size_t inFlight() const override;
+    std::string name() const override;
+
+    /// \returns true if the kernel supports every operation this sink uses.
+    static bool isAvailable();
+
+private:
+    struct Ring;
+    struct Slot;
+
+    /// \brief Issue the next operation of a slot's task, running inline
+    /// operations and finishing the task when there is nothing left.
+    void _advance(std::size_t slotIndex);
+
+    /// \brief Handle the end of a slot's outstanding submissions.
+    void _evaluate(std::size_t slotIndex);
+
+    /// \brief Move a slot's task to the completed list and free the slot.
+    void _finish(std::size_t slotIndex, const std::string& error);
+
+    /// \brief Submit prepared submissions and reap completions.
+    /// \param minComplete The number of completions to wait for.
+    void _enter(unsigned minComplete);
+
+    /// \brief Handle all available completions.
+    void _reap();
+
+    /// \brief The ring.
+    std::unique_ptr<Ring> _ring;
+
+    /// \brief One slot per task that may be in flight.
+    std::vector<std::unique_ptr<Slot>> _slots;
+
+    /// \brief Indices of free slots.
+    std::vector<std::size_t> _freeSlots;
+
+    /// \brief Completed tasks that have not been collected.
+    std::vector<FileTask> _completed;
+
+    /// \brief Directories known to exist, so they are not created again.
+    std::unordered_set<std::string> _knownDirectories;
+
+};
+
+
+} } // ofx::InstaLooter
@@ -0,0 +1,97 @@
+//
+// Copyright (c) 2017 Christopher Baker <https://christopherbaker.net>
+//
+// SPDX-License-Identifier:	MIT
+//
+
+
+#pragma once
+
+
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "ofJson.h"
+#include "ofx/InstaLooter/HashtagClient.h"
+
+
+namespace ofx {
+namespace InstaLooter {
+
+
+/// \brief Throughput and latency of posts reaching a consumer.
+///
+/// A consumer records each post it receives. The latency of a post is the
+/// time from instaLooter writing the raw download to the post being
+/// recorded, so it covers polling, ingest, the store and the channels.
+///
+/// Combined with a replaying worker pool (see WorkerPool::fromJSON) this
+/// measures the capacity of a configuration offline.
+class LoadReport
+{
+public:
+    LoadReport();
+
+    /// \brief Record a received post.
+    /// \param post The post.
+    void record(const Post& post);
+
+    /// \brief Record a received post.
+    /// \param post The post.
+    /// \param now The receive time in milliseconds since the epoch.
+    void record(const Post& post, uint64_t now);
+
+    /// \brief Forget everything recorded.
+    void reset();
+
+    /// \returns the number of recorded posts.
+    uint64_t count() const;
+
+    /// \returns the posts per second since the first post was recorded.
+    double throughput() const;
+
+    /// \brief Get a latency percentile.
+    /// \param percentile The percentile, 0 to 100.
+    /// \returns the latency in milliseconds, or 0 if nothing was recorded.
+    uint64_t latency(double percentile) const;
+
+    /// \returns the report as JSON.
+    ofJson toJSON() const;
+
+    /// \returns a one line summary.
+    std::string toString() const;
+
+    /// \returns the current time in milliseconds since the epoch.
+    static uint64_t now();
+
+private:
+    /// \brief Get a latency percentile. Caller must hold the lock.
+    uint64_t _latency(double percentile) const;
+
+    /// \brief The time the first post was recorded.
+    uint64_t _firstTime = 0;
+
+    /// \brief The time the last post was recorded.
+    uint64_t _lastTime = 0;
+
+    /// \brief The number of recorded posts.
+    uint64_t _count = 0;
+
+    /// \brief The number of posts of each hashtag.
+    std::map<std::string, uint64_t> _hashtagCounts;
+
+    /// \brief The latency of each post with a known download time.
+    mutable std::vector<uint64_t> _latencies;
+
+    /// \brief True if _latencies is sorted.
+    mutable bool _sorted = true;
+
+    /// \brief Guards all state.
+    mutable std::mutex _mutex;
+
+};
+
+
+} } // ofx::InstaLooter
@@ -0,0 +1,140 @@
+//
+// Copyright (c) 2017 Christopher Baker <https://christopherbaker.net>
+//
+// SPDX-License-Identifier:	MIT
+//
+
+
+#pragma once
+
+
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <vector>
+
+
+namespace ofx {
+namespace InstaLooter {
+
+
+/// \brief Counters parsed from instaLooter output.
+struct FetchProgress
+{
+    /// \brief The number of output lines.
+    uint64_t lines = 0;
+
+    /// \brief The number of posts fetched so far.
+    uint64_t items = 0;
+
+    /// \brief The expected number of posts, or 0 if unknown.
+    uint64_t total = 0;
+
+    /// \brief The number of error lines.
+    uint64_t errors = 0;
+
+    /// \brief The number of lines reporting rate limiting.
+    uint64_t rateLimits = 0;
+
+    /// \brief The number of lines reporting a failed or challenged login.
+    uint64_t authErrors = 0;
+
+    /// \brief The number of lines reporting a connection failure.
+    uint64_t networkErrors = 0;
+};
+
+
+/// \brief Reads instaLooter output as it streams in, in bounded memory.
+///
+/// Output is split into lines, on '\n' or on the '\r' of progress bars. The
+/// last lines are kept in a ring buffer for diagnostics and every line is
+/// parsed into FetchProgress counters, which can be read from any thread
+/// while the process runs.
+///
+/// Recognised lines are:
+///
+/// - progress bars, e.g. "12/50 [00:03<00:09, 4.0it/s]" or "12it [...]",
+///   which set the items and total,
+/// - "Downloaded <file>" lines of the worker script, which add an item,
+/// - lines reporting an HTTP 429 status, e.g. "HTTP Error 429" or "status
+///   429", or mentioning "rate limit", "too many requests" or "please wait a
+///   few minutes", which count as rate limiting,
+/// - lines about a failed login, a required checkpoint or a challenge, which
+///   count as authentication errors,
+/// - lines about a refused, reset or unreachable connection, a failed name
+///   lookup or a connection timeout, which count as network errors,
+/// - other lines mentioning "error", which count as errors.
+///
+/// Authentication and network error lines also count as errors.
+///
+/// write() and reset() must be called from one thread at a time. The other
+/// functions are thread-safe.
+class OutputMonitor
+{
+public:
+    /// \brief Create an OutputMonitor.
+    /// \param tailSize The number of lines kept for diagnostics.
+    OutputMonitor(std::size_t tailSize = DEFAULT_TAIL_SIZE);
+
+    /// \brief Add output.
+    /// \param data The output, not necessarily whole lines.
+    void write(const std::string& data);
+
+    /// \brief Add a whole line of output.
+    /// \param line The line, without its line ending.
+    void writeLine(const std::string& line);
+
+    /// \brief Finish a trailing partial line.
+    void flush();
+
+    /// \brief Forget all output and counters, e.g. before a new run.
+    void reset();
+
+    /// \returns the current counters.
+    FetchProgress progress() const;
+
+    /// \returns the last lines of output, oldest first.
+    std::vector<std::string> tail() const;
+
+    /// \returns the last lines of output, one per line.
+    std::string tailString() const;
+
+    /// \brief The default number of lines kept for diagnostics.
+    static const std::size_t DEFAULT_TAIL_SIZE;
+
+    /// \brief The longest line kept. Longer lines are truncated.
+    static const std::size_t MAX_LINE_LENGTH;
+
+private:
+    /// \brief Parse a line and keep it in the tail.
+    void _line(std::string& line);
+
+    /// \brief The number of lines kept.
+    std::size_t _tailSize = DEFAULT_TAIL_SIZE;
+
+    /// \brief The partial line at the end of the output so far.
+    std::string _partial;
+
+    /// \brief The last lines of output.
+    std::deque<std::string> _tail;
+
+    /// \brief True if the last line in the tail is a progress bar.
+    bool _tailEndsWithProgress = false;
+
+    /// \brief Guards _tail and _tailEndsWithProgress.
+    mutable std::mutex _mutex;
+
+    std::atomic<uint64_t> _lines;
+    std::atomic<uint64_t> _items;
+    std::atomic<uint64_t> _total;
+    std::atomic<uint64_t> _errors;
+    std::atomic<uint64_t> _rateLimits;
+    std::atomic<uint64_t> _authErrors;
+    std::atomic<uint64_t> _networkErrors;
+
+};
+
+
+} } // ofx::InstaLooter
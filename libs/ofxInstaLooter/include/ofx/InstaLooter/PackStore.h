@@ -0,0 +1,255 @@
+//
+// Copyright (c) 2017 Christopher Baker <https://christopherbaker.net>
+//
+// SPDX-License-Identifier:	MIT
+//
+
+
+#pragma once
+
+
+#include <cstdint>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "Poco/SharedMemory.h"
+#include "ofJson.h"
+#include "ofFileUtils.h"
+#include "ofx/InstaLooter/StoreLayout.h"
+
+
+namespace ofx {
+namespace InstaLooter {
+
+
+/// \brief An image store that appends posts to large segment files.
+///
+/// Instead of one image and one JSON file per post, records are appended
+/// to segment files of up to segmentSize bytes. When a segment is full it
+/// is sealed: a sorted index of (id, location) entries is written next to
+/// it and a new segment is started. Sealed segments and their indices are
+/// never modified again, which makes backups and rsync cheap.
+///
+/// Lookups search the in-memory index of the active segment and then the
+/// memory-mapped indices of the sealed segments, newest first. Reads
+/// return spans into memory-mapped segments, so no data is copied.
+///
+/// Updated metadata is appended as a metadata-only record, so the latest
+/// record of an id always wins. exportTo() rebuilds the one-file-per-post
+/// directory layout on demand.
+///
+/// A post stored in a PackStore has no file of its own, so its path is a
+/// locator (see locatorFor()) that only keeps the image's extension. Read
+/// its image with get().
+///
+/// One thread may write while any number of threads read.
+class PackStore
+{
+public:
+    /// \brief A span of memory-mapped bytes.
+    ///
+    /// The span stays valid for as long as the span exists, even if the
+    /// store is closed.
+    struct Span
+    {
+        /// \brief The first byte, or nullptr if empty.
+        const char* data = nullptr;
+
+        /// \brief The number of bytes.
+        std::size_t size = 0;
+
+        /// \brief Keeps the mapping alive.
+        std::shared_ptr<Poco::SharedMemory> mapping;
+
+    };
+
+    /// \brief The stored data of a post.
+    struct Record
+    {
+        /// \brief The image file contents.
+        Span image;
+
+        /// \brief The post JSON.
+        Span metadata;
+
+    };
+
+    /// \brief Open or create a PackStore.
+    ///
+    /// An unsealed segment is scanned to rebuild its index, and a record
+    /// torn by a crash is truncated.
+    ///
+    /// \param path The directory holding the segments.
+    /// \param segmentSize The size at which segments are sealed.
+    /// \throws Poco::IOException if the store cannot be opened.
+    PackStore(const std::filesystem::path& path,
+              uint64_t segmentSize = DEFAULT_SEGMENT_SIZE);
+
+    ~PackStore();
+
+    /// \returns the directory holding the segments.
+    std::filesystem::path path() const;
+
+    /// \returns true if the id is stored.
+    bool contains(uint64_t id) const;
+
+    /// \brief Get the latest image and metadata of a post.
+    /// \param id The post id.
+    /// \param record Set to the post's record.
+    /// \returns true if the id is stored.
+    bool get(uint64_t id, Record& record) const;
+
+    /// \brief Get the latest metadata of a post.
+    /// \param id The post id.
+    /// \param metadata Set to the parsed JSON.
+    /// \returns true if the id is stored.
+    bool getMetadata(uint64_t id, ofJson& metadata) const;
+
+    /// \brief Append a post.
+    /// \param id The post id.
+    /// \param image The image file to store.
+    /// \param metadata The post JSON.
+    /// \throws Poco::IOException if the image cannot be read or written.
+    void append(uint64_t id,
+                const std::filesystem::path& image,
+                const ofJson& metadata);
+
+    /// \brief Replace the metadata of a stored post.
+    /// \param id The post id.
+    /// \param metadata The post JSON.
+    /// \throws Poco::InvalidArgumentException if the id is not stored.
+    /// \throws Poco::IOException if the record cannot be written.
+    void updateMetadata(uint64_t id, const ofJson& metadata);
+
+    /// \brief Seal the active segment and start a new one.
+    void seal();
+
+    /// \returns the number of segments, including the active one.
+    std::size_t numSegments() const;
+
+    /// \brief Write every post as an image and JSON file.
+    ///
+    /// Existing files are left alone, so an interrupted export can be run
+    /// again.
+    ///
+    /// \param savePath The directory to export to.
+    /// \param layout The directory layout to create.
+    /// \returns the number of posts written.
+    std::size_t exportTo(const std::filesystem::path& savePath,
+                         const StoreLayout& layout = StoreLayout()) const;
+
+    /// \brief The path of a post stored in a PackStore.
+    ///
+    /// It names no file, e.g. "pack:1451944358173325122.jpg".
+    ///
+    /// \param id The post id.
+    /// \param extension The extension of the image, e.g. ".jpg".
+    /// \returns the locator.
+    static std::filesystem::path locatorFor(uint64_t id,
+                                            const std::filesystem::path& extension);
+
+    /// \returns true if a post path is a locator rather than a file.
+    static bool isLocator(const std::filesystem::path& path);
+
+    /// \brief The prefix of locators.
+    static const std::string LOCATOR_PREFIX;
+
+    /// \brief The default segment size (1 GiB).
+    static const uint64_t DEFAULT_SEGMENT_SIZE;
+
+private:
+    /// \brief The location of the latest image and metadata of an id.
+    ///
+    /// This is also the on-disk format of a sealed index.
+    struct Entry
+    {
+        uint64_t id = 0;
+        uint64_t imageOffset = 0;
+        uint64_t metadataOffset = 0;
+        uint32_t imageSegment = 0;
+        uint32_t imageLength = 0;
+        uint32_t metadataSegment = 0;
+        uint32_t metadataLength = 0;
+    };
+
+    /// \brief A segment file and its index.
+    struct Segment
+    {
+        /// \brief The segment number.
+        uint32_t number = 0;
+
+        /// \brief The size of the segment file.
+        uint64_t size = 0;
+
+        /// \brief True if the segment has a sealed index.
+        bool sealed = false;
+
+        /// \brief The mapped segment, or nullptr until read. Remapped as the
+        /// active segment grows.
+        mutable std::shared_ptr<Poco::SharedMemory> data;
+
+        /// \brief The mapped sealed index, or nullptr.
+        std::shared_ptr<Poco::SharedMemory> index;
+
+        /// \brief The number of entries in the sealed index.
+        uint64_t indexSize = 0;
+    };
+
+    /// \brief Find the latest entry of an id. Caller must hold the lock.
+    bool _find(uint64_t id, Entry& entry) const;
+
+    /// \brief Get a span of a segment. Caller must hold the lock.
+    Span _span(uint32_t segment, uint64_t offset, uint32_t length) const;
+
+    /// \brief Append a record to the active segment. Caller must hold the lock.
+    ///
+    /// A record without an image updates the metadata of a stored post.
+    void _append(uint64_t id, const std::string& image, const std::string& metadata);
+
+    /// \brief Seal the active segment and start a new one. Caller must hold
+    /// the lock.
+    void _seal();
+
+    /// \brief Write _active as the sorted index of a segment and map it.
+    void _writeIndex(Segment& segment);
+
+    /// \brief Start a new active segment. Caller must hold the lock.
+    void _openSegment(uint32_t number);
+
+    /// \brief Rebuild the index of an unsealed segment.
+    void _scan(Segment& segment);
+
+    /// \brief Map a sealed index.
+    void _mapIndex(Segment& segment);
+
+    /// \returns the path of a segment file.
+    std::filesystem::path _segmentPath(uint32_t number) const;
+
+    /// \returns the path of a segment index.
+    std::filesystem::path _indexPath(uint32_t number) const;
+
+    /// \brief The directory holding the segments.
+    std::filesystem::path _path;
+
+    /// \brief The size at which segments are sealed.
+    uint64_t _segmentSize = DEFAULT_SEGMENT_SIZE;
+
+    /// \brief All segments, oldest first. The last one is active.
+    std::vector<Segment> _segments;
+
+    /// \brief The index of the active segment.
+    std::map<uint64_t, Entry> _active;
+
+    /// \brief The active segment file.
+    std::ofstream _stream;
+
+    /// \brief Guards all state.
+    mutable std::mutex _mutex;
+
+};
+
+
+} } // ofx::InstaLooter
@@ -0,0 +1,171 @@
+//
+// Copyright (c) 2017 Christopher Baker <https://christopherbaker.net>
+//
+// SPDX-License-Identifier:	MIT
+//
+
+
+#pragma once
+
+
+#include <atomic>
+#include <deque>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "ofJson.h"
+#include "ofx/InstaLooter/HashtagClient.h"
+
+
+namespace ofx {
+namespace InstaLooter {
+
+
+/// \brief A size-bounded, thread-safe LRU cache of recent posts.
+///
+/// Posts are spread over shards by id, each with its own lock and LRU
+/// list, so concurrent readers rarely contend. Encoded image bytes may be
+/// cached alongside the posts, bounded by a separate byte budget.
+///
+/// The cache also remembers the most recently added ids of each hashtag,
+/// so recent() can answer without a directory walk.
+class PostCache
+{
+public:
+    /// \brief Create a PostCache.
+    /// \param capacity The maximum number of posts.
+    /// \param imageCapacity The maximum number of cached image bytes.
+    /// \param numShards The number of shards.
+    PostCache(std::size_t capacity = DEFAULT_CAPACITY,
+              std::size_t imageCapacity = 0,
+              std::size_t numShards = DEFAULT_NUM_SHARDS);
+
+    /// \brief Add or replace a post.
+    /// \param post The post.
+    /// \param image The encoded image bytes, or nullptr to keep any that
+    ///     are cached already.
+    void put(const Post& post, std::shared_ptr<const std::string> image = nullptr);
+
+    /// \brief Add or replace a post loaded from the store.
+    ///
+    /// Unlike put(), the post is not added to the recent posts of its
+    /// hashtags, as an old post read on a miss is not new.
+    ///
+    /// \param post The post.
+    void fill(const Post& post);
+
+    /// \brief Get a post.
+    /// \param id The post id.
+    /// \param post Set to the post if found.
+    /// \returns true if the post is cached.
+    bool get(uint64_t id, Post& post) const;
+
+    /// \brief Get the encoded image bytes of a post.
+    /// \param id The post id.
+    /// \returns the bytes, or nullptr if they are not cached.
+    std::shared_ptr<const std::string> getImage(uint64_t id) const;
+
+    /// \brief Get the most recently added posts with a hashtag.
+    /// \param hashtag The hashtag.
+    /// \param count The maximum number of posts.
+    /// \returns the cached posts, newest first.
+    std::vector<Post> recent(const std::string& hashtag, std::size_t count) const;
+
+    /// \brief Remove a post and its image.
+    /// \param id The post id.
+    void remove(uint64_t id);
+
+    /// \brief Remove everything.
+    void clear();
+
+    /// \returns the number of cached posts.
+    std::size_t size() const;
+
+    /// \returns the number of cached image bytes.
+    std::size_t imageBytes() const;
+
+    /// \returns the number of lookups that found a post.
+    uint64_t hits() const;
+
+    /// \returns the number of lookups that did not find a post.
+    uint64_t misses() const;
+
+    /// \brief Create a cache from "capacity", "image_capacity_mb" and
+    /// "shards" settings.
+    static std::unique_ptr<PostCache> fromJSON(const ofJson& settings);
+
+    /// \brief The default maximum number of posts.
+    static const std::size_t DEFAULT_CAPACITY;
+
+    /// \brief The default number of shards.
+    static const std::size_t DEFAULT_NUM_SHARDS;
+
+private:
+    struct Entry
+    {
+        uint64_t id = 0;
+        Post post;
+        std::shared_ptr<const std::string> image;
+    };
+
+    struct Shard
+    {
+        /// \brief Entries, most recently used first.
+        std::list<Entry> entries;
+
+        /// \brief The entry of each id.
+        std::unordered_map<uint64_t, std::list<Entry>::iterator> index;
+
+        /// \brief The number of image bytes in this shard.
+        std::size_t imageBytes = 0;
+
+        mutable std::mutex mutex;
+    };
+
+    /// \returns the shard of an id.
+    Shard& _shard(uint64_t id) const;
+
+    /// \brief Add or replace an entry, without touching the recent posts.
+    void _put(const Post& post, std::shared_ptr<const std::string> image);
+
+    /// \brief Find an entry, marking it used. Caller must hold the lock.
+    Entry* _find(Shard& shard, uint64_t id) const;
+
+    /// \brief Find an entry without marking it used. Caller must hold the
+    /// lock.
+    const Entry* _peek(const Shard& shard, uint64_t id) const;
+
+    /// \brief Evict until the shard fits. Caller must hold the lock.
+    void _evict(Shard& shard);
+
+    /// \brief The maximum number of posts per shard.
+    std::size_t _shardCapacity = 0;
+
+    /// \brief The maximum number of image bytes per shard.
+    std::size_t _shardImageCapacity = 0;
+
+    /// \brief The shards.
+    std::unique_ptr<Shard[]> _shards;
+
+    /// \brief The number of shards.
+    std::size_t _numShards = 0;
+
+    /// \brief The most recently added ids of each hashtag, newest first.
+    std::unordered_map<std::string, std::deque<uint64_t>> _recent;
+
+    /// \brief The maximum length of each recent list.
+    std::size_t _recentCapacity = 0;
+
+    /// \brief Guards _recent.
+    mutable std::mutex _recentMutex;
+
+    mutable std::atomic<uint64_t> _hits;
+    mutable std::atomic<uint64_t> _misses;
+
+};
+
+
+} } // ofx::InstaLooter
@@ -0,0 +1,157 @@
+//
+// Copyright (c) 2017 Christopher Baker <https://christopherbaker.net>
+//
+// SPDX-License-Identifier:	MIT
+//
+
+
+#pragma once
+
+
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <memory>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+#include "ofJson.h"
+#include "ofx/InstaLooter/HashtagClient.h"
+
+
+namespace ofx {
+namespace InstaLooter {
+
+
+/// \brief Merges the post streams of several hashtags into timestamp order.
+///
+/// Posts are buffered per hashtag, sorted by timestamp, and released by a
+/// k-way merge: the oldest buffered post is released as soon as every
+/// hashtag seen so far has a buffered post, since nothing older can then
+/// arrive from a stream that is itself in order.
+///
+/// A quiet hashtag would hold back the merge forever, so the buffer is also
+/// bounded by a reorder window. The oldest post is released once any post
+/// has been buffered for windowMs, or once more than windowSize posts are
+/// buffered. A post that arrives older than one already released is passed
+/// on at once and counted as late.
+///
+/// This class is not thread-safe.
+class PostMerger
+{
+public:
+    /// \brief Create a PostMerger.
+    /// \param windowMs The longest time in milliseconds a post is held.
+    /// \param windowSize The most posts that are held.
+    PostMerger(uint64_t windowMs = DEFAULT_WINDOW_MS,
+               std::size_t windowSize = DEFAULT_WINDOW_SIZE);
+
+    /// \brief Add posts and release those that are ready.
+    /// \param posts The posts to add, left empty.
+    /// \param now The current time in milliseconds.
+    /// \param ready The vector to append released posts to, in order.
+    void push(std::vector<Post>& posts, uint64_t now, std::vector<Post>& ready);
+
+    /// \brief Release posts whose time in the window is up.
+    /// \param now The current time in milliseconds.
+    /// \param ready The vector to append released posts to, in order.
+    void poll(uint64_t now, std::vector<Post>& ready);
+
+    /// \brief Release every buffered post.
+    /// \param ready The vector to append released posts to, in order.
+    void flush(std::vector<Post>& ready);
+
+    /// \brief Stop waiting for a hashtag, e.g. when its search is removed.
+    ///
+    /// Its buffered posts, and any that still arrive, are released in
+    /// order, but once its stream is empty it no longer holds back the
+    /// merge.
+    ///
+    /// \param hashtag The hashtag.
+    void removeStream(const std::string& hashtag);
+
+    /// \brief Wait for a hashtag again, e.g. when its search is added back.
+    /// \param hashtag The hashtag.
+    void addStream(const std::string& hashtag);
+
+    /// \returns the number of buffered posts.
+    std::size_t size() const;
+
+    /// \returns the number of posts released out of order.
+    uint64_t late() const;
+
+    /// \brief Create a PostMerger from an "ordered_output" settings object.
+    ///
+    /// The settings may contain "enabled", "window_ms" and "window_size".
+    /// A disabled or missing merger returns nullptr.
+    ///
+    /// \param settings The ordered output settings.
+    /// \returns the merger or nullptr.
+    static std::unique_ptr<PostMerger> fromJSON(const ofJson& settings);
+
+    /// \brief The default longest time in milliseconds a post is held.
+    static const uint64_t DEFAULT_WINDOW_MS;
+
+    /// \brief The default most posts that are held.
+    static const std::size_t DEFAULT_WINDOW_SIZE;
+
+private:
+    /// \brief A buffered post.
+    struct Entry
+    {
+        Post post;
+
+        /// \brief When the post was added.
+        uint64_t arrival = 0;
+    };
+
+    /// \brief Release posts while the merge or the window allows it.
+    void _release(uint64_t now, std::vector<Post>& ready, bool all);
+
+    /// \brief The buffered posts of each hashtag.
+    typedef std::map<std::string, std::deque<Entry>> Streams;
+
+    /// \returns the stream holding the oldest buffered post.
+    Streams::iterator _oldest();
+
+    /// \brief The order of a post, by timestamp then id.
+    typedef std::pair<uint64_t, uint64_t> Key;
+
+    /// \returns the key of a post.
+    static Key _key(const Post& post);
+
+    /// \returns true if a comes before b.
+    static bool _before(const Post& a, const Post& b);
+
+    /// \brief The longest time in milliseconds a post is held.
+    uint64_t _windowMs = DEFAULT_WINDOW_MS;
+
+    /// \brief The most posts that are held.
+    std::size_t _windowSize = DEFAULT_WINDOW_SIZE;
+
+    /// \brief The buffered posts of each hashtag, oldest first.
+    Streams _streams;
+
+    /// \brief The hashtags whose streams are dropped once empty.
+    std::set<std::string> _removedStreams;
+
+    /// \brief The arrival times of all buffered posts.
+    std::multiset<uint64_t> _arrivals;
+
+    /// \brief The number of streams with buffered posts.
+    std::size_t _nonEmptyStreams = 0;
+
+    /// \brief The key of the last released post, if any.
+    Key _lastReleased;
+
+    /// \brief True if a post has been released.
+    bool _released = false;
+
+    /// \brief The number of posts released out of order.
+    uint64_t _late = 0;
+
+};
+
+
+} } // ofx::InstaLooter
@@ -0,0 +1,363 @@
+//
+// Copyright (c) 2017 Christopher Baker <https://christopherbaker.net>
+//
+// SPDX-License-Identifier:	MIT
+//
+
+
+#pragma once
+
+
+#include <atomic>
+#include <cstdint>
+#include <fstream>
+#include <functional>
+#include <mutex>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include "ofJson.h"
+#include "ofFileUtils.h"
+#include "ofx/InstaLooter/HashtagClient.h"
+#include "ofx/InstaLooter/Store.h"
+
+
+namespace ofx {
+namespace InstaLooter {
+
+
+/// \brief Limits on what the store keeps. A limit of 0 is no limit.
+struct RetentionPolicy
+{
+    /// \brief The maximum age of a post in seconds, by its timestamp.
+    uint64_t maxAge = 0;
+
+    /// \brief The maximum number of posts with each hashtag.
+    ///
+    /// A post is counted for each of its hashtags, and removing it for one
+    /// removes it for all.
+    std::size_t maxPostsPerHashtag = 0;
+
+    /// \brief The maximum number of bytes of images and metadata.
+    uint64_t maxBytes = 0;
+
+    /// \returns true if any limit is set.
+    bool isEnabled() const;
+
+    /// \brief Create a policy from "max_age_hours", "max_posts_per_hashtag"
+    /// and "max_size_mb" settings.
+    static RetentionPolicy fromJSON(const ofJson& settings);
+
+};
+
+
+/// \brief A persistent index of stored posts, ordered by timestamp.
+///
+/// Finding the oldest posts used to take a walk of every directory in the
+/// store. Instead, each stored post is recorded here with its timestamp,
+/// size, root and hashtags, so the posts that break a RetentionPolicy are
+/// found without touching the disk.
+///
+/// The index is a snapshot, rewritten from time to time, and a log of the
+/// changes since, one line per change:
+///
+///     + <id> <timestamp> <bytes> <root> [<hashtag> ...]
+///     - <id>
+///
+/// Compaction moves the log aside before writing a new snapshot, so a
+/// crash at any point is recovered when the index is next opened. A line
+/// torn by a crash is dropped.
+///
+/// All methods are thread-safe.
+class RetentionIndex
+{
+public:
+    /// \brief A post in the index.
+    struct Record
+    {
+        /// \brief The post id.
+        uint64_t id = 0;
+
+        /// \brief The post timestamp, in seconds since the epoch.
+        uint64_t timestamp = 0;
+
+        /// \brief The size of its image and metadata.
+        uint64_t bytes = 0;
+
+        /// \brief The store root that holds it.
+        std::size_t root = 0;
+
+        /// \brief Its hashtags.
+        std::set<std::string> hashtags;
+
+    };
+
+    /// \brief Open or create a RetentionIndex.
+    /// \param path The snapshot file. The log is next to it.
+    /// \throws Poco::IOException if unable to open the log.
+    RetentionIndex(const std::filesystem::path& path);
+
+    /// \returns the snapshot file.
+    std::filesystem::path path() const;
+
+    /// \brief Add posts, or update posts already in the index.
+    ///
+    /// The hashtags of a post already in the index are merged.
+    ///
+    /// \param records The posts.
+    void add(const std::vector<Record>& records);
+
+    /// \brief Remove posts.
+    /// \param ids The post ids.
+    void remove(const std::vector<uint64_t>& ids);
+
+    /// \brief Find the posts that break a policy, oldest first.
+    ///
+    /// Posts older than the maximum age come first, then the oldest posts
+    /// of each hashtag over its maximum, then the oldest posts while the
+    /// store is over its maximum size.
+    ///
+    /// \param policy The policy.
+    /// \param now The current time, in seconds since the epoch.
+    /// \param count The maximum number of posts to return.
+    /// \returns the posts to remove.
+    std::vector<Record> select(const RetentionPolicy& policy,
+                               uint64_t now,
+                               std::size_t count) const;
+
+    /// \returns the number of posts in the index.
+    std::size_t size() const;
+
+    /// \returns the total size of the posts in the index.
+    uint64_t bytes() const;
+
+    /// \returns the number of posts with a hashtag.
+    std::size_t count(const std::string& hashtag) const;
+
+    /// \brief Rewrite the snapshot and empty the log.
+    void compact();
+
+    /// \brief The name of the index in the first store root.
+    static const std::string FILENAME;
+
+    /// \brief The smallest log that is compacted, in lines. Longer logs are
+    /// compacted once they have more lines than the index has posts.
+    static const std::size_t MIN_COMPACTION_LINES;
+
+private:
+    /// \brief A post, with its hashtags interned.
+    struct Entry
+    {
+        uint64_t timestamp = 0;
+        uint64_t bytes = 0;
+        uint32_t root = 0;
+        std::vector<uint32_t> hashtags;
+    };
+
+    /// \brief The timestamp and id of a post, which orders the index.
+    typedef std::pair<uint64_t, uint64_t> Key;
+
+    /// \brief Add or update a post. Caller must hold the lock.
+    void _add(uint64_t id, Entry entry);
+
+    /// \brief Remove a post. Caller must hold the lock.
+    void _remove(uint64_t id);
+
+    /// \returns the index of a hashtag, adding it if new. Caller must hold
+    ///     the lock.
+    uint32_t _intern(const std::string& hashtag);
+
+    /// \returns the record of a post. Caller must hold the lock.
+    Record _record(uint64_t id, const Entry& entry) const;
+
+    /// \brief Apply a snapshot or log, dropping a line torn by a crash.
+    /// \returns the number of lines applied.
+    std::size_t _read(const std::filesystem::path& path);
+
+    /// \brief Write one post as a line.
+    static void _writeLine(std::ostream& stream,
+                           uint64_t id,
+                           const Entry& entry,
+                           const std::vector<std::string>& hashtags);
+
+    /// \returns the path of the log.
+    std::filesystem::path _logPath() const;
+
+    /// \returns the path of the log being compacted.
+    std::filesystem::path _compactingPath() const;
+
+    /// \brief The snapshot file.
+    std::filesystem::path _path;
+
+    /// \brief The posts by id.
+    std::unordered_map<uint64_t, Entry> _entries;
+
+    /// \brief The posts, oldest first.
+    std::set<Key> _byTime;
+
+    /// \brief The posts of each interned hashtag, oldest first.
+    std::vector<std::set<Key>> _byHashtag;
+
+    /// \brief The interned hashtags.
+    std::vector<std::string> _hashtags;
+
+    /// \brief The index of each interned hashtag.
+    std::unordered_map<std::string, uint32_t> _hashtagIndices;
+
+    /// \brief The total size of the posts.
+    uint64_t _bytes = 0;
+
+    /// \brief The number of lines in the log since the last snapshot.
+    std::size_t _numLogLines = 0;
+
+    /// \brief The log.
+    std::ofstream _stream;
+
+    /// \brief Guards all state.
+    mutable std::mutex _mutex;
+
+    /// \brief Allows one compaction at a time.
+    std::mutex _compactionMutex;
+
+};
+
+
+/// \brief Removes the posts that break a RetentionPolicy from a Store.
+///
+/// The manager adds each post it writes, and a background thread calls
+/// reap() from time to time. Each pass removes posts in batches: a batch
+/// is chosen from the RetentionIndex, the files of each post are removed
+/// under its Store::mutexFor() lock, and only then are the posts dropped
+/// from the index and handed to the handler, so a crash mid-batch only
+/// leaves posts to remove again.
+///
+/// Posts stored before the index existed are not indexed and are kept.
+/// Pack roots cannot remove posts, so a pack store has no Reaper.
+class Reaper
+{
+public:
+    /// \brief A function that receives removed posts.
+    ///
+    /// Removed posts carry their id, timestamp, hashtags and the path their
+    /// image had.
+    typedef std::function<void(std::vector<Post>& posts)> Handler;
+
+    /// \brief The totals of a Reaper.
+    struct Stats
+    {
+        /// \brief The number of passes.
+        uint64_t passes = 0;
+
+        /// \brief The number of posts removed.
+        uint64_t posts = 0;
+
+        /// \brief The number of bytes removed.
+        uint64_t bytes = 0;
+
+        /// \brief The time in milliseconds spent removing posts.
+        uint64_t duration = 0;
+
+        /// \brief The number of posts removed by the last pass.
+        uint64_t lastPosts = 0;
+
+        /// \brief The time in milliseconds the last pass took.
+        uint64_t lastDuration = 0;
+
+    };
+
+    /// \brief Create a Reaper with an index in the first root of a store.
+    /// \param store The store.
+    /// \param policy The policy.
+    /// \param batchSize The number of posts removed at a time.
+    /// \throws Poco::IOException if unable to open the index.
+    Reaper(Store& store,
+           const RetentionPolicy& policy,
+           std::size_t batchSize = DEFAULT_BATCH_SIZE);
+
+    /// \brief Index written posts.
+    ///
+    /// Posts whose image is gone, or in a pack root, are skipped.
+    ///
+    /// \param root The root that holds the posts.
+    /// \param posts The posts.
+    void add(std::size_t root, const std::vector<Post>& posts);
+
+    /// \brief Remove every post that breaks the policy.
+    ///
+    /// Returns at once after cancel(), until resume() is called.
+    ///
+    /// \param now The current time, in seconds since the epoch.
+    /// \param handler Receives each batch of removed posts.
+    /// \returns the number of posts removed.
+    std::size_t reap(uint64_t now, const Handler& handler);
+
+    /// \brief Stop a running pass after its current batch.
+    ///
+    /// Later passes stop too, so a cancel that lands just before a pass
+    /// starts is not lost.
+    void cancel();
+
+    /// \brief Let passes run again after cancel().
+    void resume();
+
+    /// \returns the policy.
+    const RetentionPolicy& policy() const;
+
+    /// \returns the index.
+    const RetentionIndex& index() const;
+
+    /// \returns the totals so far.
+    Stats stats() const;
+
+    /// \brief Create a Reaper from a "retention" settings object.
+    ///
+    /// The settings may contain "enabled", "batch_size" and the limits of
+    /// RetentionPolicy::fromJSON. Missing or disabled settings, settings
+    /// without any limit, or a store of pack roots, which cannot remove
+    /// posts, return nullptr. The last two are logged as warnings.
+    ///
+    /// \param settings The retention settings.
+    /// \param store The store.
+    /// \returns the Reaper or nullptr.
+    static std::unique_ptr<Reaper> fromJSON(const ofJson& settings, Store& store);
+
+    /// \brief The default number of posts removed at a time.
+    static const std::size_t DEFAULT_BATCH_SIZE;
+
+    /// \brief The default time in milliseconds between passes.
+    static const uint64_t DEFAULT_INTERVAL;
+
+private:
+    /// \brief Remove the files of a post from every layout it may be in.
+    /// \param record The post.
+    /// \param imagePath Set to the path of its image, if found.
+    void _removeFiles(const RetentionIndex::Record& record,
+                      std::filesystem::path& imagePath);
+
+    /// \brief The store.
+    Store& _store;
+
+    /// \brief The policy.
+    RetentionPolicy _policy;
+
+    /// \brief The number of posts removed at a time.
+    std::size_t _batchSize = DEFAULT_BATCH_SIZE;
+
+    /// \brief The index.
+    RetentionIndex _index;
+
+    /// \brief True if passes should stop, until resumed.
+    std::atomic<bool> _cancelled;
+
+    /// \brief The totals so far.
+    Stats _stats;
+
+    /// \brief Guards _stats.
+    mutable std::mutex _mutex;
+
+};
+
+
+} } // ofx::InstaLooter
@@ -0,0 +1,120 @@
+//
+// Copyright (c) 2017 Christopher Baker <https://christopherbaker.net>
+//
+// SPDX-License-Identifier:	MIT
+//
+
+
+#pragma once
+
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <sys/types.h>
+#include "ofJson.h"
+
+
+namespace ofx {
+namespace InstaLooter {
+
+
+/// \brief CPU and IO limits for a process or thread.
+///
+/// Keeps instaLooter and ingest work away from the render thread: a higher
+/// nice value and the idle IO class let them use whatever the app leaves,
+/// CPU affinity keeps them off the render thread's cores, and a cgroup v2
+/// group caps their memory and CPU time.
+///
+/// Unset fields leave the inherited value alone. Failures are logged and
+/// otherwise ignored, so a missing permission never stops ingestion.
+///
+/// IO classes, per-thread priorities, affinity and cgroups are Linux only.
+/// Elsewhere only the nice value of processes is applied.
+struct ResourcePolicy
+{
+    /// \brief IO scheduling classes, as used by ionice.
+    enum IOClass
+    {
+        /// \brief Leave the IO class alone.
+        IO_CLASS_NONE = 0,
+        /// \brief Served before everything else.
+        IO_CLASS_REALTIME = 1,
+        /// \brief The default class, with a level from 0 (high) to 7 (low).
+        IO_CLASS_BEST_EFFORT = 2,
+        /// \brief Only served when no one else needs the disk.
+        IO_CLASS_IDLE = 3
+    };
+
+    /// \brief True if the nice value is set.
+    bool hasNice = false;
+
+    /// \brief The nice value, from -20 (high) to 19 (low).
+    int nice = 0;
+
+    /// \brief The IO class.
+    IOClass ioClass = IO_CLASS_NONE;
+
+    /// \brief The level within the IO class, from 0 (high) to 7 (low).
+    int ioLevel = 4;
+
+    /// \brief The CPUs to run on, or empty for any.
+    std::vector<int> cpus;
+
+    /// \brief The cgroup v2 group for processes, relative to CGROUP_ROOT,
+    /// or empty for none. It is created if needed, which requires write
+    /// access to its parent (e.g. a delegated systemd slice).
+    std::string cgroup;
+
+    /// \brief The memory limit of the cgroup in bytes, or 0 for none.
+    uint64_t memoryMax = 0;
+
+    /// \brief The CPU limit of the cgroup in CPUs (e.g. 1.5), or 0 for none.
+    double cpuMax = 0;
+
+    /// \returns true if nothing is set.
+    bool isEmpty() const;
+
+    /// \brief Apply the policy to a process, e.g. just after launching it.
+    ///
+    /// Threads and processes it starts later inherit the policy. It is
+    /// applied from the outside once the process has been spawned, so the
+    /// process runs unrestricted from its exec until this returns, usually
+    /// well under a millisecond. Anything it starts in that window keeps
+    /// the default placement: a child process stays outside the cgroup and
+    /// a thread keeps its nice, IO class and affinity.
+    ///
+    /// \param pid The process id.
+    void applyToProcess(pid_t pid) const;
+
+    /// \brief Apply the policy, except the cgroup, to the calling thread.
+    void applyToThread() const;
+
+    /// \brief Create a policy from settings.
+    ///
+    /// The settings may contain "nice", "io_class" ("realtime",
+    /// "best-effort" or "idle"), "io_priority", "cpus" (a list of CPU
+    /// numbers) and "cgroup", an object with "path", "memory_max_mb" and
+    /// "cpu_max".
+    ///
+    /// \param settings The policy settings.
+    /// \returns the policy.
+    static ResourcePolicy fromJSON(const ofJson& settings);
+
+    /// \brief Create a policy from settings that override another.
+    /// \param settings The policy settings (see above).
+    /// \param defaults The policy missing keys are taken from.
+    /// \returns the policy.
+    static ResourcePolicy fromJSON(const ofJson& settings,
+                                   const ResourcePolicy& defaults);
+
+    /// \brief The cgroup v2 mount point.
+    static const std::string CGROUP_ROOT;
+
+    /// \brief The cgroup CPU period in microseconds.
+    static const uint64_t CGROUP_CPU_PERIOD;
+
+};
+
+
+} } // ofx::InstaLooter
@@ -0,0 +1,429 @@
+//
+// Copyright (c) 2017 Christopher Baker <https://christopherbaker.net>
+//
+// SPDX-License-Identifier:	MIT
+//
+
+
+#pragma once
+
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include "ofx/InstaLooter/EventCount.h"
+
+
+namespace ofx {
+namespace InstaLooter {
+
+
+/// \brief A bounded, lock-free thread channel.
+///
+/// RingChannel has the same send / tryReceive / receive / close interface as
+/// BatchChannel, but values are passed through a fixed ring of slots without
+/// taking a lock. Each slot carries a sequence number that tells producers
+/// and the consumer whose turn it is, so the fast path of a send or receive
+/// is a few atomic operations and never enters the kernel.
+///
+/// A receiver blocks on an empty channel and a sender blocks on a full one.
+/// Blocked threads sleep on an EventCount, so nothing is signalled unless
+/// someone is actually waiting.
+///
+/// Any number of threads may send if MultiProducer is true, otherwise only
+/// one. Only one thread may receive.
+///
+/// \tparam T The value type. Must be move constructible.
+/// \tparam MultiProducer True to allow concurrent senders.
+template<typename T, bool MultiProducer = true>
+class RingChannel
+{
+public:
+    /// \brief Create a RingChannel.
+    /// \param capacity The number of slots, rounded up to a power of two.
+    RingChannel(std::size_t capacity = DEFAULT_CAPACITY):
+        _head(0),
+        _tail(0),
+        _closed(false)
+    {
+        _capacity = 2;
+
+        while (_capacity < capacity)
+        {
+            _capacity *= 2;
+        }
+
+        _mask = _capacity - 1;
+        _cells.reset(new Cell[_capacity]);
+
+        for (std::size_t i = 0; i < _capacity; ++i)
+        {
+            _cells[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    virtual ~RingChannel()
+    {
+        std::size_t position = _head.load(std::memory_order_relaxed);
+
+        while (_cells[position & _mask].sequence.load(std::memory_order_relaxed) == position + 1)
+        {
+            reinterpret_cast<T*>(&_cells[position & _mask].storage)->~T();
+            ++position;
+        }
+    }
+
+    /// \brief Block until a value is available or the channel is closed.
+    /// \param value The value to move the received value into.
+    /// \returns true if a value was received, false if the channel was closed.
+    bool receive(T& value)
+    {
+        while (!_tryPop(value))
+        {
+            EventCount::Key key = _notEmpty.prepareWait();
+
+            if (_tryPop(value))
+            {
+                _notEmpty.cancelWait();
+                break;
+            }
+
+            if (_closed.load(std::memory_order_acquire))
+            {
+                _notEmpty.cancelWait();
+
+                // A sender may have finished just before closing.
+                if (_tryPop(value)) break;
+                return false;
+            }
+
+            _notEmpty.wait(key);
+        }
+
+        _notFull.notifyAll();
+        return true;
+    }
+
+    /// \brief Receive a value if one is available.
+    /// \param value The value to move the received value into.
+    /// \returns true if a value was received.
+    bool tryReceive(T& value)
+    {
+        if (!_tryPop(value))
+        {
+            return false;
+        }
+
+        _notFull.notifyAll();
+        return true;
+    }
+
+    /// \brief Receive a value, waiting at most timeoutMs milliseconds.
+    /// \param value The value to move the received value into.
+    /// \param timeoutMs The timeout in milliseconds.
+    /// \returns true if a value was received.
+    bool tryReceive(T& value, int64_t timeoutMs)
+    {
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeoutMs);
+
+        while (!_tryPop(value))
+        {
+            EventCount::Key key = _notEmpty.prepareWait();
+
+            if (_tryPop(value))
+            {
+                _notEmpty.cancelWait();
+                break;
+            }
+
+            if (_closed.load(std::memory_order_acquire))
+            {
+                _notEmpty.cancelWait();
+                if (_tryPop(value)) break;
+                return false;
+            }
+
+            auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now()).count();
+
+            if (!_notEmpty.waitFor(key, remaining < 0 ? 0 : remaining))
+            {
+                if (_tryPop(value)) break;
+                return false;
+            }
+        }
+
+        _notFull.notifyAll();
+        return true;
+    }
+
+    /// \brief Move up to maxCount pending values into values.
+    ///
+    /// Received values are appended to values in the order they were sent.
+    ///
+    /// \param values The vector to append received values to.
+    /// \param maxCount The maximum number of values to receive.
+    /// \returns the number of values received.
+    std::size_t tryReceiveBatch(std::vector<T>& values, std::size_t maxCount)
+    {
+        std::size_t count = 0;
+        T value;
+
+        while (count < maxCount && _tryPop(value))
+        {
+            values.push_back(std::move(value));
+            ++count;
+        }
+
+        if (count > 0)
+        {
+            _notFull.notifyAll();
+        }
+
+        return count;
+    }
+
+    /// \brief Move all pending values into values.
+    ///
+    /// Received values are appended to values in the order they were sent.
+    ///
+    /// \param values The vector to append received values to.
+    /// \returns the number of values received.
+    std::size_t receiveAll(std::vector<T>& values)
+    {
+        return tryReceiveBatch(values, _capacity);
+    }
+
+    /// \brief Send a value by copy, blocking while the channel is full.
+    /// \param value The value to send.
+    /// \returns false if the channel was closed.
+    bool send(const T& value)
+    {
+        T copy(value);
+        return send(std::move(copy));
+    }
+
+    /// \brief Send a value by move, blocking while the channel is full.
+    /// \param value The value to send.
+    /// \returns false if the channel was closed.
+    bool send(T&& value)
+    {
+        if (_closed.load(std::memory_order_acquire))
+        {
+            return false;
+        }
+
+        while (!_tryPush(value))
+        {
+            if (_closed.load(std::memory_order_acquire))
+            {
+                return false;
+            }
+
+            EventCount::Key key = _notFull.prepareWait();
+
+            if (_tryPush(value))
+            {
+                _notFull.cancelWait();
+                break;
+            }
+
+            if (_closed.load(std::memory_order_acquire))
+            {
+                _notFull.cancelWait();
+                return false;
+            }
+
+            _notFull.wait(key);
+        }
+
+        _notEmpty.notifyAll();
+        return true;
+    }
+
+    /// \brief Send a batch of values.
+    ///
+    /// The values are moved into the channel and values is left empty. The
+    /// receiver is woken once per batch unless the channel fills up.
+    ///
+    /// \param values The values to send.
+    /// \returns false if the channel was closed.
+    bool sendBatch(std::vector<T>&& values)
+    {
+        if (_closed.load(std::memory_order_acquire))
+        {
+            return false;
+        }
+
+        bool sent = true;
+
+        for (auto& value: values)
+        {
+            if (_tryPush(value))
+            {
+                continue;
+            }
+
+            // Full, so let the receiver in and fall back to blocking.
+            _notEmpty.notifyAll();
+
+            if (!send(std::move(value)))
+            {
+                sent = false;
+                break;
+            }
+        }
+
+        values.clear();
+        _notEmpty.notifyAll();
+        return sent;
+    }
+
+    /// \brief Close the channel and wake any blocked threads.
+    ///
+    /// Values already sent can still be received.
+    void close()
+    {
+        _closed.store(true, std::memory_order_release);
+        _notEmpty.notifyAll();
+        _notFull.notifyAll();
+    }
+
+    /// \returns true if the channel is closed.
+    bool closed() const
+    {
+        return _closed.load(std::memory_order_acquire);
+    }
+
+    /// \returns true if there are no pending values.
+    bool empty() const
+    {
+        return size() == 0;
+    }
+
+    /// \returns the number of pending values, which may already be out of
+    /// date when other threads are using the channel.
+    std::size_t size() const
+    {
+        std::size_t head = _head.load(std::memory_order_acquire);
+        std::size_t tail = _tail.load(std::memory_order_acquire);
+        return tail > head ? tail - head : 0;
+    }
+
+    /// \returns the number of slots.
+    std::size_t capacity() const
+    {
+        return _capacity;
+    }
+
+    /// \brief The default number of slots.
+    enum
+    {
+        DEFAULT_CAPACITY = 4096
+    };
+
+private:
+    /// \brief A slot and its sequence number.
+    ///
+    /// A slot at position p is free for a producer when its sequence is p
+    /// and holds a value for the consumer when its sequence is p + 1.
+    struct Cell
+    {
+        std::atomic<std::size_t> sequence;
+        typename std::aligned_storage<sizeof(T), alignof(T)>::type storage;
+    };
+
+    /// \brief Move a value into the next free slot.
+    /// \returns false if the channel is full.
+    bool _tryPush(T& value)
+    {
+        std::size_t position = _tail.load(std::memory_order_relaxed);
+        Cell* cell = nullptr;
+
+        for (;;)
+        {
+            cell = &_cells[position & _mask];
+
+            std::size_t sequence = cell->sequence.load(std::memory_order_acquire);
+            std::intptr_t difference = static_cast<std::intptr_t>(sequence) - static_cast<std::intptr_t>(position);
+
+            if (difference == 0)
+            {
+                if (!MultiProducer)
+                {
+                    _tail.store(position + 1, std::memory_order_relaxed);
+                    break;
+                }
+                else if (_tail.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+                {
+                    break;
+                }
+            }
+            else if (difference < 0)
+            {
+                return false;
+            }
+            else
+            {
+                position = _tail.load(std::memory_order_relaxed);
+            }
+        }
+
+        new (&cell->storage) T(std::move(value));
+        cell->sequence.store(position + 1, std::memory_order_release);
+        return true;
+    }
+
+    /// \brief Move the oldest value out of its slot.
+    /// \returns false if the channel is empty.
+    bool _tryPop(T& value)
+    {
+        std::size_t position = _head.load(std::memory_order_relaxed);
+        Cell& cell = _cells[position & _mask];
+
+        if (cell.sequence.load(std::memory_order_acquire) != position + 1)
+        {
+            return false;
+        }
+
+        T* stored = reinterpret_cast<T*>(&cell.storage);
+        value = std::move(*stored);
+        stored->~T();
+
+        cell.sequence.store(position + _capacity, std::memory_order_release);
+        _head.store(position + 1, std::memory_order_release);
+        return true;
+    }
+
+    /// \brief The slots.
+    std::unique_ptr<Cell[]> _cells;
+
+    /// \brief The number of slots, a power of two.
+    std::size_t _capacity = 0;
+
+    /// \brief _capacity - 1.
+    std::size_t _mask = 0;
+
+    /// \brief The position of the next value to receive.
+    alignas(64) std::atomic<std::size_t> _head;
+
+    /// \brief The position of the next free slot.
+    alignas(64) std::atomic<std::size_t> _tail;
+
+    /// \brief True if the channel has been closed.
+    alignas(64) std::atomic<bool> _closed;
+
+    /// \brief Wakes a receiver waiting for values.
+    EventCount _notEmpty;
+
+    /// \brief Wakes senders waiting for free slots.
+    EventCount _notFull;
+
+};
+
+
+} } // ofx::InstaLooter
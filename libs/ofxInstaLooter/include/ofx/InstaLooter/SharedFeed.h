@@ -0,0 +1,284 @@
+//
+// Copyright (c) 2017 Christopher Baker <https://christopherbaker.net>
+//
+// SPDX-License-Identifier:	MIT
+//
+
+
+#pragma once
+
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "Poco/SharedMemory.h"
+#include "ofJson.h"
+#include "ofFileUtils.h"
+#include "ofx/InstaLooter/HashtagClient.h"
+
+
+namespace ofx {
+namespace InstaLooter {
+
+
+/// \brief Publishes posts to other processes on the same machine through a
+/// ring of fixed size slots in a shared file mapping.
+///
+/// There is one publisher, the HashtagClientManager, and any number of
+/// FeedSubscriber processes. The publisher never waits for subscribers: it
+/// overwrites the oldest slot, and a subscriber that falls a whole ring
+/// behind loses the posts it missed and resumes according to its
+/// FeedSubscriber::LagPolicy.
+///
+/// Each slot is guarded by a sequence number that is odd while the slot is
+/// written, so a subscriber reads a post straight from the mapping and
+/// discards it if the slot changed under it. Subscribers register in a
+/// table in the mapping, where they publish how far they have read, so the
+/// publisher can report their lag with consumers().
+///
+/// The mapping is a file, by default in /dev/shm, and outlives the
+/// publisher: a restarted publisher with the same geometry continues the
+/// sequence, and subscribers carry on.
+///
+///     ring       header (128 bytes): "ILFEED01", uint32 version,
+///                uint32 slot size, uint32 number of slots,
+///                uint32 number of consumers, uint64 head
+///     consumers  per consumer (64 bytes): uint64 pid, uint64 cursor,
+///                uint64 dropped, uint64 last seen in ms
+///     slots      per slot: uint64 sequence, uint32 length, uint32 kind,
+///                then the post: uint64 id, user id, timestamp, width,
+///                height, download time, uint32 length and bytes of the
+///                path, uint32 number of hashtags, then for each its uint32
+///                length and bytes
+class SharedFeed
+{
+public:
+    /// \brief Which channel of the manager a post was sent on.
+    enum class Kind
+    {
+        /// \brief A new post, as sent on HashtagClientManager::posts.
+        NEW = 0,
+        /// \brief An updated post, as sent on HashtagClientManager::updatedPosts.
+        UPDATED = 1,
+        /// \brief A post removed from the store, as sent on
+        /// HashtagClientManager::removedPosts.
+        REMOVED = 2
+    };
+
+    /// \brief A registered subscriber.
+    struct Consumer
+    {
+        /// \brief The process id of the subscriber.
+        uint64_t pid = 0;
+
+        /// \brief The sequence number of the next post it will read.
+        uint64_t cursor = 0;
+
+        /// \brief The number of posts published that it has not read yet.
+        uint64_t lag = 0;
+
+        /// \brief The number of posts it lost by falling behind.
+        uint64_t dropped = 0;
+
+        /// \brief The last time it read, in milliseconds since the epoch.
+        uint64_t lastSeen = 0;
+
+    };
+
+    /// \brief Create or reopen a feed.
+    ///
+    /// An existing feed with the same geometry is reopened and continues
+    /// its sequence. Anything else at the path is replaced.
+    ///
+    /// \param path The path of the mapped file.
+    /// \param numSlots The number of posts the ring holds.
+    /// \param slotSize The size of a slot in bytes. Posts that do not fit
+    ///     are not published.
+    SharedFeed(const std::filesystem::path& path,
+               std::size_t numSlots = DEFAULT_NUM_SLOTS,
+               std::size_t slotSize = DEFAULT_SLOT_SIZE);
+
+    /// \returns true if the feed is mapped.
+    bool isOpen() const;
+
+    /// \brief Publish posts. Thread-safe.
+    /// \param posts The posts.
+    /// \param kind The kind of the posts.
+    void publish(const std::vector<Post>& posts, Kind kind);
+
+    /// \returns the sequence number of the next post.
+    uint64_t head() const;
+
+    /// \returns the registered subscribers.
+    std::vector<Consumer> consumers() const;
+
+    /// \returns the path of the mapped file.
+    std::filesystem::path path() const;
+
+    /// \brief Create a SharedFeed from a "shared_feed" settings object.
+    ///
+    /// The settings may contain "enabled", "path", "slots" and "slot_size".
+    /// A disabled or missing feed, or one that could not be mapped,
+    /// returns nullptr.
+    ///
+    /// \param settings The shared feed settings.
+    /// \returns the feed or nullptr.
+    static std::unique_ptr<SharedFeed> fromJSON(const ofJson& settings);
+
+    /// \brief The default path of the mapped file.
+    static const std::string DEFAULT_PATH;
+
+    /// \brief The default number of slots.
+    static const std::size_t DEFAULT_NUM_SLOTS;
+
+    /// \brief The default slot size in bytes.
+    static const std::size_t DEFAULT_SLOT_SIZE;
+
+    /// \brief The number of subscribers that can register.
+    static const std::size_t MAX_CONSUMERS;
+
+private:
+    /// \brief Map the file, creating or replacing it if needed.
+    bool _open(std::size_t numSlots, std::size_t slotSize);
+
+    std::filesystem::path _path;
+
+    Poco::SharedMemory _mapping;
+
+    /// \brief The start of the mapping, or nullptr.
+    char* _data = nullptr;
+
+    /// \brief True once a post too large for a slot was reported.
+    bool _warnedSize = false;
+
+    /// \brief Guards publishing, as every write queue publishes.
+    std::mutex _mutex;
+
+};
+
+
+/// \brief Reads the posts of a SharedFeed published by another process.
+///
+/// Reading is non-blocking and copies each post once, from its slot into
+/// the caller's Post, so it suits a polling loop such as ofApp::update().
+///
+///     FeedSubscriber feed("/dev/shm/instalooter-feed");
+///
+///     void ofApp::update()
+///     {
+///         Post post;
+///         SharedFeed::Kind kind;
+///
+///         while (feed.receive(post, kind))
+///         {
+///             // ...
+///         }
+///     }
+///
+/// The feed may be created after the subscriber, and a publisher that
+/// replaces it is followed. A subscriber is not thread-safe; each thread
+/// should have its own.
+class FeedSubscriber
+{
+public:
+    /// \brief What to do after falling a whole ring behind.
+    enum class LagPolicy
+    {
+        /// \brief Resume from the oldest post still in the ring, so as few
+        /// posts as possible are lost.
+        OLDEST,
+        /// \brief Skip to the newest posts, so the subscriber is current
+        /// again at once.
+        LATEST
+    };
+
+    /// \brief Create a subscriber.
+    /// \param path The path of the mapped file.
+    /// \param policy What to do after falling behind.
+    /// \param fromOldest True to start with the oldest post in the ring
+    ///     instead of the next one published.
+    FeedSubscriber(const std::filesystem::path& path,
+                   LagPolicy policy = LagPolicy::OLDEST,
+                   bool fromOldest = false);
+
+    /// \brief Release the subscriber's registration.
+    ~FeedSubscriber();
+
+    FeedSubscriber(const FeedSubscriber&) = delete;
+    FeedSubscriber& operator = (const FeedSubscriber&) = delete;
+
+    /// \returns true if the feed is mapped.
+    bool isOpen() const;
+
+    /// \brief Read the next post, if there is one.
+    /// \param post Set to the post. Its memory is reused.
+    /// \param kind Set to the kind of the post.
+    /// \returns true if a post was read.
+    bool receive(Post& post, SharedFeed::Kind& kind);
+
+    /// \brief Read every available post.
+    /// \param newPosts The vector to append new posts to.
+    /// \param updatedPosts The vector to append updated posts to.
+    /// \param removedPosts The vector to append removed posts to.
+    /// \returns the number of posts read.
+    std::size_t receiveAll(std::vector<Post>& newPosts,
+                           std::vector<Post>& updatedPosts,
+                           std::vector<Post>& removedPosts);
+
+    /// \brief Read every available post, skipping removed posts.
+    /// \param newPosts The vector to append new posts to.
+    /// \param updatedPosts The vector to append updated posts to.
+    /// \returns the number of posts read.
+    std::size_t receiveAll(std::vector<Post>& newPosts,
+                           std::vector<Post>& updatedPosts);
+
+    /// \returns the number of posts published that have not been read yet.
+    uint64_t lag() const;
+
+    /// \returns the number of posts lost by falling behind.
+    uint64_t dropped() const;
+
+    /// \brief The time in milliseconds between checks for a feed that is
+    /// missing or was replaced.
+    static const uint64_t REOPEN_INTERVAL;
+
+private:
+    /// \brief Map the feed if it exists, or if it was replaced.
+    void _reopen();
+
+    /// \brief Unmap the feed, releasing the registration.
+    void _close();
+
+    std::filesystem::path _path;
+
+    LagPolicy _policy = LagPolicy::OLDEST;
+
+    bool _fromOldest = false;
+
+    Poco::SharedMemory _mapping;
+
+    /// \brief The start of the mapping, or nullptr. Writable, as the
+    /// subscriber publishes its cursor.
+    char* _data = nullptr;
+
+    /// \brief The inode of the mapped file.
+    uint64_t _inode = 0;
+
+    /// \brief The registration, or -1 if the table was full.
+    int _consumer = -1;
+
+    /// \brief The sequence number of the next post to read.
+    uint64_t _cursor = 0;
+
+    /// \brief Posts lost by falling behind.
+    uint64_t _dropped = 0;
+
+    /// \brief The time of the last check for a replaced feed.
+    uint64_t _lastCheck = 0;
+
+};
+
+
+} } // ofx::InstaLooter
@@ -0,0 +1,275 @@
+//
+// Copyright (c) 2017 Christopher Baker <https://christopherbaker.net>
+//
+// SPDX-License-Identifier:	MIT
+//
+
+
+#pragma once
+
+
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include "ofJson.h"
+#include "ofFileUtils.h"
+#include "ofx/InstaLooter/HashtagClient.h"
+#include "ofx/InstaLooter/PackStore.h"
+#include "ofx/InstaLooter/StoreLayout.h"
+
+
+namespace ofx {
+namespace InstaLooter {
+
+
+/// \brief An image store that spans one or more root directories.
+///
+/// Each post lives under exactly one root, chosen by a placement policy the
+/// first time its id is seen. Lookups never probe the roots: with HASH
+/// placement the root is computed from the id, and with the other policies
+/// it is read from an in-memory index that is persisted as an append-only
+/// log of fixed size records in the first root.
+///
+/// Ids without a recorded location (e.g. posts stored before the store was
+/// sharded) live in the first root. With HASH placement they hash to some
+/// other root, so find() looks in the first root when the hashed one does
+/// not hold the post, and records where it found it.
+///
+/// With packs enabled, each root keeps its posts in a PackStore instead of
+/// one image and JSON file per post.
+///
+/// The directory layout within each root is recorded in a manifest in the
+/// first root. While a StoreResharder moves the store to a new layout, new
+/// posts use the new layout and find() also checks the previous one.
+class Store
+{
+public:
+    /// \brief Policies for choosing the root of a new post.
+    enum class Placement
+    {
+        /// \brief Spread posts evenly by id.
+        HASH,
+        /// \brief Weighted round-robin by free space on each root.
+        FREE_SPACE,
+        /// \brief Keep each hashtag on a single root.
+        HASHTAG
+    };
+
+    /// \brief Create a Store.
+    /// \param roots The store root directories. Must not be empty.
+    /// \param placement The placement policy for new posts.
+    /// \param layout The layout for a new store. An existing store keeps the
+    ///     layout in its manifest.
+    /// \throws Poco::InvalidArgumentException if roots is empty.
+    Store(const std::vector<std::filesystem::path>& roots,
+          Placement placement = Placement::HASH,
+          const StoreLayout& layout = StoreLayout());
+
+    ~Store();
+
+    /// \returns the number of roots.
+    std::size_t size() const;
+
+    /// \returns the base path of the given root.
+    std::filesystem::path root(std::size_t index) const;
+
+    /// \returns the instagram save path of the given root.
+    std::filesystem::path savePath(std::size_t index) const;
+
+    /// \returns the placement policy.
+    Placement placement() const;
+
+    /// \brief Find the root of a post, placing it if it is new.
+    /// \param post The post.
+    /// \returns the index of the root that holds the post.
+    std::size_t rootFor(const Post& post);
+
+    /// \brief Find the root of an id without placing it.
+    /// \param id The post id.
+    /// \returns the index of the root that holds or would hold the id.
+    std::size_t locate(uint64_t id) const;
+
+    /// \brief Check whether an id has a recorded location.
+    ///
+    /// With HASH placement, a post whose id is not recorded may have been
+    /// stored in the first root before the store was sharded.
+    ///
+    /// \param id The post id.
+    /// \returns true if the store has more than one root and the id has no
+    ///     recorded location.
+    bool isUnrecorded(uint64_t id) const;
+
+    /// \brief Find the store path of a post, placing it if it is new.
+    /// \param post The post.
+    /// \returns the absolute path of the post's image in the store.
+    std::filesystem::path pathFor(const Post& post);
+
+    /// \brief Find where a post's image is stored, placing it if it is new.
+    ///
+    /// Checks the current layout and, while resharding, the previous one.
+    /// An unrecorded post is also looked for in the first root.
+    /// Hold mutexFor() the post's id so a resharder cannot move the image
+    /// between the check and its use.
+    ///
+    /// \param post The post.
+    /// \param path Set to the image path if found, otherwise to pathFor().
+    /// \returns true if the image exists.
+    bool find(const Post& post, std::filesystem::path& path);
+
+    /// \returns the mutex that serializes changes to posts with this id.
+    std::mutex& mutexFor(uint64_t id);
+
+    /// \brief Record that the files of a new post are being written.
+    ///
+    /// Call while holding mutexFor() the id, when find() shows the post is
+    /// new. The files are written later without the lock, so others must
+    /// leave the post alone until endWrite().
+    ///
+    /// \param id The post id.
+    void beginWrite(uint64_t id);
+
+    /// \brief Record that the files of a new post are written, or failed.
+    /// \param id The post id.
+    void endWrite(uint64_t id);
+
+    /// \returns true if the files of a new post are being written. Hold
+    /// mutexFor() the id, so a write cannot begin after the check.
+    /// \param id The post id.
+    bool isWriting(uint64_t id) const;
+
+    /// \returns the layout for new posts.
+    StoreLayout layout() const;
+
+    /// \returns the layout being moved away from, if resharding.
+    StoreLayout previousLayout() const;
+
+    /// \returns true if posts may still be in the previous layout.
+    bool isResharding() const;
+
+    /// \brief Start using a new layout and record the old one as previous.
+    ///
+    /// If a reshard is already in progress its previous layout is kept.
+    ///
+    /// \param layout The new layout.
+    void beginReshard(const StoreLayout& layout);
+
+    /// \brief Record that no posts remain in the previous layout.
+    void finishReshard();
+
+    /// \brief Store posts in a PackStore in each root.
+    ///
+    /// Call before the store is used.
+    ///
+    /// \param segmentSize The size at which segments are sealed.
+    void openPacks(uint64_t segmentSize = PackStore::DEFAULT_SEGMENT_SIZE);
+
+    /// \returns the PackStore of a root, or nullptr if packs are not used.
+    PackStore* packStore(std::size_t index) const;
+
+    /// \brief Create a Store from the "paths" settings.
+    ///
+    /// Reads "image_store_paths" (an array) or "image_store_path", the
+    /// optional "placement" policy ("hash", "free_space" or "hashtag"), the
+    /// optional "layout" for a new store (see StoreLayout::fromJSON) and the
+    /// optional "backend" ("files" or "pack") with its "segment_size".
+    ///
+    /// \param paths The paths settings.
+    /// \returns the store.
+    static std::unique_ptr<Store> fromJSON(const ofJson& paths);
+
+    /// \returns the placement policy with the given name, or HASH.
+    static Placement placementFromString(const std::string& name);
+
+    /// \brief The name of the location log in the first root.
+    static const std::string LOCATION_LOG_FILENAME;
+
+    /// \brief The name of the layout manifest in the first root.
+    static const std::string MANIFEST_FILENAME;
+
+    /// \brief The name of the pack directory in each root.
+    static const std::string PACK_DIRECTORY;
+
+    /// \brief How often free space is sampled, in milliseconds.
+    static const uint64_t FREE_SPACE_UPDATE_INTERVAL;
+
+private:
+    /// \brief Choose a root for a new post. Caller must hold the lock.
+    std::size_t _place(const Post& post);
+
+    /// \brief Look up a recorded location. Caller must hold the lock.
+    std::size_t _locate(uint64_t id) const;
+
+    /// \brief Record the location of an id. Caller must hold the lock.
+    void _record(uint64_t id, std::size_t index);
+
+    /// \brief Find a post's image in one root.
+    bool _find(const Post& post, std::size_t index, std::filesystem::path& path);
+
+    /// \brief Refresh the free space samples if they are stale.
+    void _updateFreeSpace();
+
+    /// \brief Load the location log.
+    void _loadLocations();
+
+    /// \brief Load the manifest, creating it for a new store.
+    /// \param layout The configured layout.
+    void _loadManifest(const StoreLayout& layout);
+
+    /// \brief Replace the manifest. Caller must hold the lock.
+    void _saveManifest();
+
+    /// \returns true if a root holds posts from before manifests existed.
+    bool _hasUnversionedPosts() const;
+
+    /// \brief The store root directories.
+    std::vector<std::filesystem::path> _roots;
+
+    /// \brief The placement policy.
+    Placement _placement = Placement::HASH;
+
+    /// \brief The recorded root of each placed id.
+    std::unordered_map<uint64_t, uint32_t> _locations;
+
+    /// \brief The append-only location log.
+    std::ofstream _locationLog;
+
+    /// \brief The last sampled free bytes per root.
+    std::vector<uint64_t> _freeSpace;
+
+    /// \brief The smooth weighted round-robin state per root.
+    std::vector<int64_t> _currentWeights;
+
+    /// \brief The time of the last free space sample.
+    uint64_t _lastFreeSpaceUpdate = 0;
+
+    /// \brief The layout for new posts.
+    StoreLayout _layout;
+
+    /// \brief The layout being moved away from.
+    StoreLayout _previousLayout;
+
+    /// \brief True while posts may be in the previous layout.
+    bool _resharding = false;
+
+    /// \brief Striped per post mutexes.
+    std::vector<std::mutex> _postMutexes;
+
+    /// \brief The ids of new posts whose files are being written.
+    std::unordered_set<uint64_t> _writing;
+
+    /// \brief Guards _writing.
+    mutable std::mutex _writingMutex;
+
+    /// \brief One PackStore per root, if packs are used.
+    std::vector<std::unique_ptr<PackStore>> _packStores;
+
+    /// \brief Guards the location index, placement state and layouts.
+    mutable std::mutex _mutex;
+
+};
+
+
+} } // ofx::InstaLooter
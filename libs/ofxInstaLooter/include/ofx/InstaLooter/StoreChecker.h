@@ -0,0 +1,265 @@
+//
+// Copyright (c) 2017 Christopher Baker <https://christopherbaker.net>
+//
+// SPDX-License-Identifier:	MIT
+//
+
+
+#pragma once
+
+
+#include <atomic>
+#include <fstream>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "ofJson.h"
+#include "ofFileUtils.h"
+#include "ofx/InstaLooter/Store.h"
+
+
+namespace ofx {
+namespace InstaLooter {
+
+
+/// \brief Checks a file store for posts whose image and JSON disagree.
+///
+/// Like StoreResharder, the top level directories of every root are shared
+/// among the threads, and each thread only holds the listings of the
+/// directories it is in, so memory does not grow with the store. Each post
+/// is checked while holding Store::mutexFor() its id, which the write queue
+/// and resharder hold while they change a post's files in place. New posts
+/// are written without it, after Store::beginWrite(), so the checker skips
+/// a post while Store::isWriting() its id, and it is not reported or
+/// repaired half written.
+///
+/// For each post it checks that:
+///
+/// - the image has a JSON sidecar and the JSON has an image,
+/// - the JSON parses and describes the post its filename names,
+/// - the image header can be read and matches the JSON's dimensions,
+/// - the post is in the directory and root its id maps to.
+///
+/// Every problem is written to the report as a line of JSON, followed by a
+/// final line with the totals:
+///
+///     {"problem":"missing_json","path":"...","id":123,"repaired":true}
+///     {"summary":{"posts":10000000,...}}
+///
+/// In repair mode JSON missing an image or image missing JSON is rebuilt
+/// from what remains, keeping any hashtags, and misplaced posts are moved
+/// where they belong. Files that cannot be repaired, such as unreadable
+/// images and JSON without an image, are moved to LOST_AND_FOUND_DIRECTORY
+/// in the root's save path. Misplaced posts are left to the resharder while
+/// a reshard runs. Stray files and posts in the wrong root are only
+/// reported.
+///
+/// Pack stores are skipped.
+///
+///     StoreChecker checker(*manager.store());
+///     checker.start("fsck.jsonl");
+class StoreChecker
+{
+public:
+    /// \brief The problems a post can have.
+    enum class Problem
+    {
+        /// \brief An image without JSON.
+        MISSING_JSON,
+        /// \brief JSON without an image.
+        MISSING_IMAGE,
+        /// \brief JSON that cannot be parsed or lacks fields.
+        INVALID_JSON,
+        /// \brief An image whose header cannot be read.
+        INVALID_IMAGE,
+        /// \brief JSON whose width or height differs from the image.
+        DIMENSION_MISMATCH,
+        /// \brief JSON for a different id than its filename.
+        ID_MISMATCH,
+        /// \brief A post outside the directory its id maps to.
+        MISPLACED,
+        /// \brief A post outside the root its id maps to.
+        WRONG_ROOT,
+        /// \brief A file that is not part of a post, e.g. a temporary file.
+        STRAY
+    };
+
+    /// \brief Counters describing a check.
+    struct Stats
+    {
+        /// \brief The number of posts checked.
+        uint64_t posts = 0;
+
+        /// \brief The number of directories listed.
+        uint64_t directories = 0;
+
+        /// \brief The number of posts skipped as they were being written.
+        uint64_t writing = 0;
+
+        uint64_t missingJSON = 0;
+        uint64_t missingImage = 0;
+        uint64_t invalidJSON = 0;
+        uint64_t invalidImage = 0;
+        uint64_t dimensionMismatch = 0;
+        uint64_t idMismatch = 0;
+        uint64_t misplaced = 0;
+        uint64_t wrongRoot = 0;
+        uint64_t stray = 0;
+
+        /// \brief The number of problems repaired.
+        uint64_t repaired = 0;
+
+        /// \brief The number of files that could not be read or repaired.
+        uint64_t errors = 0;
+
+        /// \returns the number of problems found.
+        uint64_t problems() const;
+
+        /// \brief Add another thread's counters.
+        void add(const Stats& other);
+
+        static ofJson toJSON(const Stats& stats);
+
+    };
+
+    /// \brief Create a StoreChecker.
+    /// \param store The store to check. Must outlive the checker.
+    /// \param numThreads The number of threads.
+    StoreChecker(Store& store, std::size_t numThreads = DEFAULT_NUM_THREADS);
+
+    /// \brief Cancel and wait for the threads.
+    ~StoreChecker();
+
+    /// \brief Start checking the store.
+    ///
+    /// Does nothing if a check is already running.
+    ///
+    /// \param reportPath The report file, replaced if it exists.
+    /// \param repair True to repair the problems found.
+    void start(const std::filesystem::path& reportPath, bool repair = false);
+
+    /// \brief Stop after the directories currently being checked.
+    void cancel();
+
+    /// \brief Wait for the check to finish or be cancelled.
+    void wait();
+
+    /// \returns true if a check is running.
+    bool isRunning() const;
+
+    /// \returns the counters of the current or last check.
+    Stats stats() const;
+
+    /// \returns the report name of a problem, e.g. "missing_json".
+    static std::string toString(Problem problem);
+
+    /// \brief The default number of threads.
+    ///
+    /// The check mostly waits on the disk, so more threads than cores help.
+    static const std::size_t DEFAULT_NUM_THREADS;
+
+    /// \brief The directory unrepairable files are moved to.
+    static const std::string LOST_AND_FOUND_DIRECTORY;
+
+private:
+    /// \brief A directory to walk.
+    struct Unit
+    {
+        std::size_t root = 0;
+        std::filesystem::path directory;
+        std::size_t level = 0;
+
+        /// \brief False if its subdirectories are units of their own.
+        bool recurse = true;
+    };
+
+    /// \brief The files of one post in a directory.
+    struct Entry
+    {
+        std::filesystem::path image;
+        std::filesystem::path json;
+    };
+
+    /// \returns true if a directory name is a level of either layout.
+    bool _isLevel(const std::string& name) const;
+
+    /// \brief The thread function.
+    void _run();
+
+    /// \brief Check every post below a directory.
+    void _walk(const Unit& unit, Stats& stats);
+
+    /// \brief Check one post.
+    void _check(std::size_t root, const std::string& name, Entry entry, Stats& stats);
+
+    /// \brief Move a post to where its id maps to, updating its paths.
+    /// \returns true if it was moved.
+    bool _move(Entry& entry, const std::filesystem::path& directory, Stats& stats);
+
+    /// \brief Move a file to the root's lost and found directory.
+    /// \returns true if it was moved.
+    bool _quarantine(std::size_t root, const std::filesystem::path& path, Stats& stats);
+
+    /// \brief Count a problem and write it to the report.
+    void _report(Problem problem,
+                 const std::filesystem::path& path,
+                 uint64_t id,
+                 bool repaired,
+                 const std::string& detail,
+                 Stats& stats);
+
+    /// \brief Called by the last thread to finish.
+    void _finish();
+
+    /// \brief The store.
+    Store& _store;
+
+    /// \brief The number of threads.
+    std::size_t _numThreads = DEFAULT_NUM_THREADS;
+
+    /// \brief The layout of new posts.
+    StoreLayout _layout;
+
+    /// \brief The layout being moved away from, if resharding.
+    StoreLayout _previousLayout;
+
+    /// \brief True if the store is resharding.
+    bool _resharding = false;
+
+    /// \brief True to repair problems.
+    bool _repair = false;
+
+    /// \brief The directories to walk.
+    std::vector<Unit> _units;
+
+    /// \brief The index of the next unit.
+    std::atomic<std::size_t> _nextUnit;
+
+    /// \brief The number of threads still running.
+    std::atomic<std::size_t> _activeThreads;
+
+    /// \brief True if cancelled.
+    std::atomic<bool> _cancelled;
+
+    /// \brief The threads.
+    std::vector<std::thread> _threads;
+
+    /// \brief The report.
+    std::ofstream _reportStream;
+
+    /// \brief The report path.
+    std::filesystem::path _reportPath;
+
+    /// \brief The counters.
+    Stats _stats;
+
+    /// \brief The time the check started.
+    uint64_t _startTime = 0;
+
+    /// \brief Guards _stats and _reportStream.
+    mutable std::mutex _mutex;
+
+};
+
+
+} } // ofx::InstaLooter
@@ -0,0 +1,203 @@
+//
+// Copyright (c) 2017 Christopher Baker <https://christopherbaker.net>
+//
+// SPDX-License-Identifier:	MIT
+//
+
+
+#pragma once
+
+
+#include <atomic>
+#include <ctime>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "ofJson.h"
+#include "ofFileUtils.h"
+#include "ofx/InstaLooter/ColumnWriter.h"
+#include "ofx/InstaLooter/Store.h"
+
+
+namespace ofx {
+namespace InstaLooter {
+
+
+/// \brief Exports the metadata of every post in a file store to a columnar
+/// file for analysis.
+///
+/// The walk is shared among threads like StoreChecker's. Each thread fills
+/// a batch of BATCH_SIZE rows and appends it to one ColumnWriter, so memory
+/// stays flat whatever the size of the store.
+///
+/// Each export writes a new part, posts-<n>.ilp, to the export directory
+/// and records it in STATE_FILENAME there. An incremental export only
+/// reads the leaf directories changed since the last export started, and
+/// only the posts written since then: new posts, and posts whose JSON was
+/// replaced, e.g. when hashtags were compacted into it. A post can so be
+/// in more than one part; its last part is the latest. A cancelled export
+/// leaves no part and is redone by the next one.
+///
+/// Pack stores are skipped.
+///
+///     StoreExporter exporter(*manager.store());
+///     exporter.start("export/");
+///
+/// scripts/read_posts.py reads the parts of an export directory.
+class StoreExporter
+{
+public:
+    /// \brief Counters describing an export.
+    struct Stats
+    {
+        /// \brief The number of posts written.
+        uint64_t posts = 0;
+
+        /// \brief The number of directories listed.
+        uint64_t directories = 0;
+
+        /// \brief The number of leaf directories skipped as unchanged.
+        uint64_t skipped = 0;
+
+        /// \brief The number of JSON files that could not be read.
+        uint64_t errors = 0;
+
+        /// \brief Add another thread's counters.
+        void add(const Stats& other);
+
+    };
+
+    /// \brief Create a StoreExporter.
+    /// \param store The store to export. Must outlive the exporter.
+    /// \param numThreads The number of threads.
+    StoreExporter(Store& store, std::size_t numThreads = DEFAULT_NUM_THREADS);
+
+    /// \brief Cancel and wait for the threads.
+    ~StoreExporter();
+
+    /// \brief Start exporting.
+    ///
+    /// Does nothing if an export is already running.
+    ///
+    /// \param directory The export directory.
+    /// \param incremental True to only export posts written since the last
+    ///     export to the directory started.
+    void start(const std::filesystem::path& directory, bool incremental = true);
+
+    /// \brief Stop after the directories currently being exported.
+    void cancel();
+
+    /// \brief Wait for the export to finish or be cancelled.
+    void wait();
+
+    /// \returns true if an export is running.
+    bool isRunning() const;
+
+    /// \returns the counters of the current or last export.
+    Stats stats() const;
+
+    /// \brief The default number of threads.
+    static const std::size_t DEFAULT_NUM_THREADS;
+
+    /// \brief The number of rows each thread collects before writing.
+    static const std::size_t BATCH_SIZE;
+
+    /// \brief The name of the export state in the export directory.
+    static const std::string STATE_FILENAME;
+
+    /// \brief How far before the last start an incremental export looks, in
+    /// seconds, to allow for coarse file times.
+    static const std::time_t TIME_SLACK;
+
+private:
+    /// \brief A directory to walk.
+    struct Unit
+    {
+        std::size_t root = 0;
+        std::filesystem::path directory;
+        std::size_t level = 0;
+
+        /// \brief False if its subdirectories are units of their own.
+        bool recurse = true;
+    };
+
+    /// \returns true if a directory name is a level of either layout.
+    bool _isLevel(const std::string& name) const;
+
+    /// \brief The thread function.
+    void _run();
+
+    /// \brief Export every post below a directory.
+    void _walk(const Unit& unit, PostColumns& batch, Stats& stats);
+
+    /// \brief Export one post.
+    void _export(const std::filesystem::path& jsonPath, PostColumns& batch, Stats& stats);
+
+    /// \brief Called by the last thread to finish.
+    void _finish();
+
+    /// \brief The store.
+    Store& _store;
+
+    /// \brief The number of threads.
+    std::size_t _numThreads = DEFAULT_NUM_THREADS;
+
+    /// \brief The layout of new posts.
+    StoreLayout _layout;
+
+    /// \brief The layout being moved away from, if resharding.
+    StoreLayout _previousLayout;
+
+    /// \brief True if the store is resharding.
+    bool _resharding = false;
+
+    /// \brief The deepest level of either layout.
+    std::size_t _depth = 0;
+
+    /// \brief Posts and leaf directories older than this are skipped.
+    std::time_t _since = 0;
+
+    /// \brief The export directory.
+    std::filesystem::path _directory;
+
+    /// \brief The export state.
+    ofJson _state;
+
+    /// \brief The part being written.
+    std::filesystem::path _partPath;
+
+    /// \brief The time the export started, in seconds since the epoch.
+    std::time_t _started = 0;
+
+    /// \brief The writer of the part.
+    std::unique_ptr<ColumnWriter> _writer;
+
+    /// \brief The directories to walk.
+    std::vector<Unit> _units;
+
+    /// \brief The index of the next unit.
+    std::atomic<std::size_t> _nextUnit;
+
+    /// \brief The number of threads still running.
+    std::atomic<std::size_t> _activeThreads;
+
+    /// \brief True if cancelled.
+    std::atomic<bool> _cancelled;
+
+    /// \brief The threads.
+    std::vector<std::thread> _threads;
+
+    /// \brief The counters.
+    Stats _stats;
+
+    /// \brief The time the export started.
+    uint64_t _startTime = 0;
+
+    /// \brief Guards _stats.
+    mutable std::mutex _mutex;
+
+};
+
+
+} } // ofx::InstaLooter
@@ -0,0 +1,82 @@
+//
+// Copyright (c) 2017 Christopher Baker <https://christopherbaker.net>
+//
+// SPDX-License-Identifier:	MIT
+//
+
+
+#pragma once
+
+
+#include <cstdint>
+#include <string>
+#include "ofJson.h"
+#include "ofFileUtils.h"
+
+
+namespace ofx {
+namespace InstaLooter {
+
+
+/// \brief The directory fan-out of an image store.
+///
+/// A post is stored depth directories deep, each named after the next
+/// digitsPerLevel digits of its id. The original layout, one digit for each
+/// of six levels, can create up to a million leaf directories holding a few
+/// files each. Fewer, wider levels (e.g. two levels of two digits) need far
+/// fewer directories and metadata operations per post.
+class StoreLayout
+{
+public:
+    /// \brief Create the default layout.
+    StoreLayout();
+
+    /// \brief Create a layout.
+    /// \param depth The number of directory levels.
+    /// \param digitsPerLevel The number of id digits that name each level.
+    /// \throws Poco::InvalidArgumentException if digitsPerLevel is 0 or the
+    ///     layout needs more digits than an id has.
+    StoreLayout(std::size_t depth, std::size_t digitsPerLevel);
+
+    /// \returns the number of directory levels.
+    std::size_t depth() const;
+
+    /// \returns the number of id digits that name each level.
+    std::size_t digitsPerLevel() const;
+
+    /// \brief Get the directory of an id, relative to the store save path.
+    /// \param id The post id.
+    /// \returns the relative directory.
+    /// \throws Poco::InvalidArgumentException if the id is too short.
+    std::filesystem::path directoryFor(uint64_t id) const;
+
+    /// \returns a short description, e.g. "6x1".
+    std::string toString() const;
+
+    bool operator == (const StoreLayout& other) const;
+    bool operator != (const StoreLayout& other) const;
+
+    /// \brief Read a layout from "depth" and "digits_per_level".
+    ///
+    /// Missing values take their defaults.
+    ///
+    /// \param json The layout settings.
+    /// \returns the layout.
+    static StoreLayout fromJSON(const ofJson& json);
+
+    static ofJson toJSON(const StoreLayout& layout);
+
+    /// \brief The default number of directory levels.
+    static const std::size_t DEFAULT_DEPTH;
+
+    /// \brief The default number of id digits per level.
+    static const std::size_t DEFAULT_DIGITS_PER_LEVEL;
+
+private:
+    std::size_t _depth = DEFAULT_DEPTH;
+    std::size_t _digitsPerLevel = DEFAULT_DIGITS_PER_LEVEL;
+
+};
+
+
+} } // ofx::InstaLooter
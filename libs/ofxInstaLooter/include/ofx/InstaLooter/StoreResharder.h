@@ -0,0 +1,161 @@
+//
+// Copyright (c) 2017 Christopher Baker <https://christopherbaker.net>
+//
+// SPDX-License-Identifier:	MIT
+//
+
+
+#pragma once
+
+
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "ofFileUtils.h"
+#include "ofx/InstaLooter/Store.h"
+
+
+namespace ofx {
+namespace InstaLooter {
+
+
+/// \brief Moves an existing store to a new StoreLayout while it is in use.
+///
+/// start() switches the store to the new layout, so new posts are written
+/// there at once, and then moves the existing posts in the background. The
+/// top level directories of every root are shared among the threads. Each
+/// post is moved while holding Store::mutexFor() its id, so ingest never
+/// sees a post half moved. Emptied directories of the old layout are
+/// removed as the walk leaves them.
+///
+/// The store records the reshard in its manifest. If the resharder is
+/// cancelled or the application exits, start() with the same layout resumes
+/// it later.
+///
+///     StoreResharder resharder(*manager.store());
+///     resharder.start(StoreLayout(2, 2));
+class StoreResharder
+{
+public:
+    /// \brief Counters describing a reshard.
+    struct Stats
+    {
+        /// \brief The number of posts moved.
+        uint64_t posts = 0;
+
+        /// \brief The number of files skipped because the target existed.
+        uint64_t skipped = 0;
+
+        /// \brief The number of errors.
+        uint64_t errors = 0;
+
+        /// \brief The number of directories created.
+        uint64_t directoriesCreated = 0;
+
+        /// \brief The number of directories removed.
+        uint64_t directoriesRemoved = 0;
+
+        /// \brief The number of files renamed.
+        uint64_t renames = 0;
+
+        /// \brief The number of directories listed.
+        uint64_t directoriesListed = 0;
+
+        /// \returns the metadata operations (listings, creations, renames
+        ///     and removals) per moved post.
+        double operationsPerPost() const;
+
+    };
+
+    /// \brief Create a StoreResharder.
+    /// \param store The store to reshard. Must outlive the resharder.
+    /// \param numThreads The number of threads.
+    StoreResharder(Store& store, std::size_t numThreads = DEFAULT_NUM_THREADS);
+
+    /// \brief Cancel and wait for the threads.
+    ~StoreResharder();
+
+    /// \brief Start moving the store to a layout.
+    ///
+    /// Does nothing if a reshard is already running.
+    ///
+    /// \param layout The new layout.
+    void start(const StoreLayout& layout);
+
+    /// \brief Stop after the posts currently being moved.
+    void cancel();
+
+    /// \brief Wait for the reshard to finish or be cancelled.
+    void wait();
+
+    /// \returns true if a reshard is running.
+    bool isRunning() const;
+
+    /// \returns the counters of the current or last reshard.
+    Stats stats() const;
+
+    /// \brief The default number of threads.
+    static const std::size_t DEFAULT_NUM_THREADS;
+
+private:
+    /// \brief A directory of the previous layout to walk.
+    struct Unit
+    {
+        std::size_t root = 0;
+        std::filesystem::path directory;
+        std::size_t level = 0;
+    };
+
+    /// \brief The thread function.
+    void _run();
+
+    /// \brief Move every post below a directory.
+    void _walk(const Unit& unit, Stats& stats);
+
+    /// \brief Move one image and its JSON.
+    void _move(std::size_t root, const std::filesystem::path& path, Stats& stats);
+
+    /// \brief Called by the last thread to finish.
+    void _finish();
+
+    /// \brief The store.
+    Store& _store;
+
+    /// \brief The number of threads.
+    std::size_t _numThreads = DEFAULT_NUM_THREADS;
+
+    /// \brief The layout being moved away from.
+    StoreLayout _from;
+
+    /// \brief The layout being moved to.
+    StoreLayout _to;
+
+    /// \brief The directories to walk.
+    std::vector<Unit> _units;
+
+    /// \brief The index of the next unit.
+    std::atomic<std::size_t> _nextUnit;
+
+    /// \brief The number of threads still running.
+    std::atomic<std::size_t> _activeThreads;
+
+    /// \brief True if cancelled.
+    std::atomic<bool> _cancelled;
+
+    /// \brief The threads.
+    std::vector<std::thread> _threads;
+
+    /// \brief The counters.
+    Stats _stats;
+
+    /// \brief The time the reshard started.
+    uint64_t _startTime = 0;
+
+    /// \brief Guards _stats.
+    mutable std::mutex _mutex;
+
+};
+
+
+} } // ofx::InstaLooter
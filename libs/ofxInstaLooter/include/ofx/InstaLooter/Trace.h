@@ -0,0 +1,261 @@
+//
+// Copyright (c) 2017 Christopher Baker <https://christopherbaker.net>
+//
+// SPDX-License-Identifier:	MIT
+//
+
+
+#pragma once
+
+
+#include <atomic>
+#include <cstdint>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+#include "ofFileUtils.h"
+#include "ofJson.h"
+#include "ofx/IO/Thread.h"
+
+
+namespace ofx {
+namespace InstaLooter {
+
+
+/// \brief A timed span of work on one thread.
+struct TraceEvent
+{
+    /// \brief The span name. Must be a string literal.
+    const char* name = nullptr;
+
+    /// \brief The start time in microseconds (see Trace::now()).
+    uint64_t start = 0;
+
+    /// \brief The duration in microseconds.
+    uint64_t duration = 0;
+
+    /// \brief The number of items handled, or -1 if not set.
+    int64_t count = -1;
+};
+
+
+/// \brief The events recorded by one thread.
+struct TraceThread
+{
+    /// \brief A small number identifying the thread in the trace.
+    uint64_t id = 0;
+
+    /// \brief The thread name, if set.
+    std::string name;
+
+    /// \brief The events, oldest first.
+    std::vector<TraceEvent> events;
+
+    /// \brief The number of events overwritten before they were collected.
+    uint64_t dropped = 0;
+};
+
+
+/// \brief Records spans of the polling pipeline for Chrome or Perfetto.
+///
+/// Each thread records into its own ring buffer, which keeps the most
+/// recent events and overwrites the oldest. The buffers can be saved on
+/// demand with save(), or streamed to a file by a TraceWriter. Both write
+/// the Chrome trace event format, which ui.perfetto.dev and
+/// chrome://tracing open directly.
+///
+/// The buffer of a thread outlives it, so its last events can still be
+/// saved. It is released once a TraceWriter has streamed it, and at most
+/// MAX_EXITED_THREADS buffers of exited threads are kept, dropping the
+/// oldest.
+///
+/// Tracing is off by default. A disabled TraceSpan costs a relaxed atomic
+/// load.
+///
+/// All methods are thread-safe.
+class Trace
+{
+public:
+    /// \brief Turn recording on or off.
+    static void setEnabled(bool enabled);
+
+    /// \returns true if spans are recorded.
+    static bool isEnabled()
+    {
+        return _enabled.load(std::memory_order_relaxed);
+    }
+
+    /// \brief Set the ring buffer size of threads that record from now on.
+    /// \param bufferSize The number of events each thread keeps.
+    static void setBufferSize(std::size_t bufferSize);
+
+    /// \brief Name the calling thread in the trace.
+    /// \param name The thread name.
+    static void setThreadName(const std::string& name);
+
+    /// \brief Record an event on the calling thread.
+    static void record(const TraceEvent& event);
+
+    /// \returns the current time in microseconds since the first trace call.
+    static uint64_t now();
+
+    /// \brief Collect the events of every thread.
+    ///
+    /// With cursors, only events recorded since the last collection with the
+    /// same cursors are returned, and the cursors are advanced. The buffers
+    /// of exited threads are then released.
+    ///
+    /// \param cursors The collection position of each thread, or nullptr to
+    ///        collect every event still in the buffers.
+    /// \returns the threads with events.
+    static std::vector<TraceThread> collect(std::map<uint64_t, uint64_t>* cursors = nullptr);
+
+    /// \brief Write events as a comma separated list of trace event objects.
+    /// \param stream The stream to write to.
+    /// \param threads The events to write.
+    /// \param first True if nothing has been written to the list yet. Set to
+    ///        false if anything was written.
+    static void writeEvents(std::ostream& stream,
+                            const std::vector<TraceThread>& threads,
+                            bool& first);
+
+    /// \brief Save every event still in the buffers as a trace file.
+    /// \param path The trace file.
+    /// \returns true if the file was saved.
+    static bool save(const std::filesystem::path& path);
+
+    /// \brief The default number of events each thread keeps.
+    static const std::size_t DEFAULT_BUFFER_SIZE;
+
+    /// \brief The most buffers of exited threads that are kept.
+    static const std::size_t MAX_EXITED_THREADS;
+
+private:
+    /// \brief True if spans are recorded.
+    static std::atomic<bool> _enabled;
+
+};
+
+
+/// \brief Records the lifetime of a scope as a TraceEvent.
+///
+/// Typical use:
+///
+///     TraceSpan span("list");
+///     ... work ...
+///     span.setCount(paths.size());
+///
+class TraceSpan
+{
+public:
+    /// \brief Start a span if tracing is enabled.
+    /// \param name The span name. Must be a string literal.
+    TraceSpan(const char* name)
+    {
+        if (Trace::isEnabled())
+        {
+            _active = true;
+            _event.name = name;
+            _event.start = Trace::now();
+        }
+    }
+
+    /// \brief End the span.
+    ~TraceSpan()
+    {
+        end();
+    }
+
+    /// \brief End the span before the end of the scope.
+    void end()
+    {
+        if (_active)
+        {
+            _active = false;
+            _event.duration = Trace::now() - _event.start;
+            Trace::record(_event);
+        }
+    }
+
+    /// \brief Attach the number of items handled, e.g. files listed.
+    void setCount(uint64_t count)
+    {
+        _event.count = static_cast<int64_t>(count);
+    }
+
+private:
+    TraceSpan(const TraceSpan&) = delete;
+    TraceSpan& operator = (const TraceSpan&) = delete;
+
+    /// \brief True if the span is being recorded.
+    bool _active = false;
+
+    /// \brief The event recorded when the span ends.
+    TraceEvent _event;
+
+};
+
+
+/// \brief Streams trace events to a file as they are recorded.
+///
+/// The file uses the JSON array form of the trace event format, which is
+/// valid without its closing bracket, so it can be opened while the writer
+/// is still running or after a crash.
+class TraceWriter: public IO::PollingThread
+{
+public:
+    /// \brief Create a TraceWriter and start it.
+    /// \param path The trace file, truncated on start.
+    /// \param interval The time in milliseconds between writes.
+    TraceWriter(const std::filesystem::path& path,
+                uint64_t interval = DEFAULT_INTERVAL);
+
+    /// \brief Write the remaining events and close the file.
+    virtual ~TraceWriter();
+
+    /// \returns the trace file.
+    std::filesystem::path path() const;
+
+    /// \brief Configure tracing from a "trace" settings object.
+    ///
+    /// The settings may contain "enabled", "buffer_size" (see
+    /// Trace::setBufferSize()), and "continuous", "path" and "interval" for
+    /// a TraceWriter. The path is relative to the data folder.
+    ///
+    /// \param settings The trace settings.
+    /// \returns a writer if tracing is enabled and continuous, or nullptr.
+    static std::unique_ptr<TraceWriter> fromJSON(const ofJson& settings);
+
+    /// \brief The default time in milliseconds between writes.
+    static const uint64_t DEFAULT_INTERVAL;
+
+    /// \brief The default trace file.
+    static const std::string DEFAULT_PATH;
+
+private:
+    /// \brief Append the events recorded since the last write.
+    void _write();
+
+    /// \brief The trace file.
+    std::filesystem::path _path;
+
+    /// \brief The trace file stream.
+    std::ofstream _stream;
+
+    /// \brief The collection position of each thread.
+    std::map<uint64_t, uint64_t> _cursors;
+
+    /// \brief True if no event has been written yet.
+    bool _first = true;
+
+    /// \brief Guards the stream between the thread and the destructor.
+    std::mutex _mutex;
+
+};
+
+
+} } // ofx::InstaLooter
@@ -0,0 +1,167 @@
+//
+// Copyright (c) 2017 Christopher Baker <https://christopherbaker.net>
+//
+// SPDX-License-Identifier:	MIT
+//
+
+
+#pragma once
+
+
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "ofJson.h"
+#include "ofFileUtils.h"
+#include "ofx/InstaLooter/CancellationToken.h"
+#include "ofx/InstaLooter/ChildProcess.h"
+#include "ofx/InstaLooter/FetchJob.h"
+#include "ofx/InstaLooter/ResourcePolicy.h"
+
+
+namespace ofx {
+namespace InstaLooter {
+
+
+/// \brief A pool of long-lived instaLooter worker processes.
+///
+/// Launching instaLooter for every poll pays for interpreter start up and
+/// module imports each time. A worker (see scripts/instalooter_worker.py)
+/// stays alive and runs one job at a time using a line-delimited JSON
+/// protocol on its standard input and output.
+///
+/// Each request is a single line:
+///
+///     {"id": 1, "hashtag": "me", "directory": "...", "arguments": [...], ...}
+///
+/// and the worker answers with any number of log lines followed by a done
+/// line, all tagged with the request id:
+///
+///     {"id": 1, "type": "log", "message": "..."}
+///     {"id": 1, "type": "done", "exit_code": 0}
+///
+/// Workers are started lazily, and a worker that crashes, misbehaves or
+/// exceeds the job timeout is killed and restarted for the next job.
+class WorkerPool
+{
+public:
+    /// \brief Create a WorkerPool.
+    /// \param workerPath The worker executable.
+    /// \param workerArgs Additional arguments for the worker.
+    /// \param size The number of workers.
+    WorkerPool(const std::filesystem::path& workerPath,
+               const std::vector<std::string>& workerArgs = {},
+               std::size_t size = DEFAULT_SIZE);
+
+    /// \brief Kill all workers.
+    ~WorkerPool();
+
+    /// \brief Run a job on the next free worker.
+    ///
+    /// Blocks until the job completes, times out or the token is cancelled.
+    ///
+    /// \param job The job to run.
+    /// \param timeout The job timeout in milliseconds.
+    /// \param token Cancels waiting for a worker and the job itself.
+    /// \param monitor Reads the job's output as it arrives, or nullptr.
+    /// \returns the job result.
+    FetchResult run(const FetchJob& job,
+                    uint64_t timeout,
+                    const CancellationToken& token,
+                    OutputMonitor* monitor = nullptr);
+
+    /// \returns the number of workers.
+    std::size_t size() const;
+
+    /// \returns the number of times a worker has been (re)started.
+    uint64_t launches() const;
+
+    /// \brief Set the policy applied to workers launched from now on.
+    /// \param processPolicy The worker process policy.
+    void setProcessPolicy(const ResourcePolicy& processPolicy);
+
+    /// \returns the worker process policy.
+    ResourcePolicy getProcessPolicy() const;
+
+    /// \brief Create a WorkerPool from a "worker_pool" settings object.
+    ///
+    /// The settings may contain "worker_path", "worker_args", "size" and
+    /// "stub". A disabled or missing pool returns nullptr.
+    ///
+    /// With "stub", a "stub_failure" object with a "rate" and a "kind"
+    /// ("throttled", "auth", "network" or "error") makes that fraction of
+    /// jobs fail like instaLooter does, to check backoff and circuit
+    /// breakers offline.
+    ///
+    /// A "replay" object with a "path" and an optional "speed" makes the
+    /// workers play back a recorded copy of the instagram/downloads
+    /// directory instead of contacting Instagram. Each file is dropped into
+    /// the download directory when its modification time comes around,
+    /// relative to the oldest file and divided by the speed, so the rest of
+    /// the pipeline sees the recorded load.
+    ///
+    /// \param settings The worker pool settings.
+    /// \returns the pool or nullptr.
+    static std::shared_ptr<WorkerPool> fromJSON(const ofJson& settings);
+
+    /// \brief The default number of workers.
+    static const std::size_t DEFAULT_SIZE;
+
+    /// \brief The default worker script path.
+    static const std::string DEFAULT_WORKER_PATH;
+
+    /// \brief The longest time in milliseconds a job waits before checking
+    /// for cancellation and timeouts.
+    static const uint64_t POLL_INTERVAL;
+
+private:
+    /// \brief A single worker process and its partial output.
+    struct Worker
+    {
+        std::unique_ptr<ChildProcess> process;
+        std::string buffer;
+        bool busy = false;
+    };
+
+    /// \brief Wait for a free worker.
+    /// \returns the worker or nullptr if cancelled.
+    Worker* _acquire(const CancellationToken& token);
+
+    /// \brief Return a worker, killing it if it is no longer usable.
+    void _release(Worker* worker, bool healthy);
+
+    /// \brief Launch the worker's process if it is not running.
+    /// \throws Poco::IOException if the process could not be launched.
+    void _ensureRunning(Worker& worker);
+
+    /// \brief The worker executable.
+    std::filesystem::path _workerPath;
+
+    /// \brief Additional arguments for the worker.
+    std::vector<std::string> _workerArgs;
+
+    /// \brief The workers.
+    std::vector<std::unique_ptr<Worker>> _workers;
+
+    /// \brief The number of worker launches.
+    std::atomic<uint64_t> _launches;
+
+    /// \brief The id of the next job.
+    std::atomic<uint64_t> _nextJobId;
+
+    /// \brief The policy applied to each worker process.
+    ResourcePolicy _processPolicy;
+
+    /// \brief Guards the busy flags and _processPolicy.
+    mutable std::mutex _mutex;
+
+    /// \brief Signals when a worker is released.
+    std::condition_variable _condition;
+
+};
+
+
+} } // ofx::InstaLooter
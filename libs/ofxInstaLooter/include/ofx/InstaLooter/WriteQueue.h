@@ -0,0 +1,69 @@
+//
+// Copyright (c) 2017 Christopher Baker <https://christopherbaker.net>
+//
+// SPDX-License-Identifier:	MIT
+//
+
+
+#pragma once
+
+
+#include <functional>
+#include <thread>
+#include <vector>
+#include "ofx/InstaLooter/Channel.h"
+#include "ofx/InstaLooter/HashtagClient.h"
+#include "ofx/InstaLooter/ResourcePolicy.h"
+
+
+namespace ofx {
+namespace InstaLooter {
+
+
+/// \brief A queue of posts written by a dedicated thread.
+///
+/// The manager keeps one WriteQueue per store root, so that a slow volume
+/// does not hold up writes to the others. The thread takes everything that
+/// is pending with a single lock and passes it to the handler as a batch.
+class WriteQueue
+{
+public:
+    /// \brief A function that writes a batch of posts.
+    typedef std::function<void(std::vector<Post>& posts)> Handler;
+
+    /// \brief Create a WriteQueue and start its thread.
+    /// \param handler The function that writes each batch.
+    /// \param threadPolicy The policy of the thread.
+    WriteQueue(Handler handler,
+               const ResourcePolicy& threadPolicy = ResourcePolicy());
+
+    /// \brief Write everything still queued and join the thread.
+    ~WriteQueue();
+
+    /// \brief Queue a post for writing.
+    /// \param post The post to write.
+    void send(Post&& post);
+
+    /// \returns the number of posts waiting to be written.
+    std::size_t size() const;
+
+private:
+    /// \brief The writer thread function.
+    void _run();
+
+    /// \brief The function that writes each batch.
+    Handler _handler;
+
+    /// \brief The posts waiting to be written.
+    SingleProducerChannel<Post> _posts;
+
+    /// \brief The policy of the thread.
+    ResourcePolicy _threadPolicy;
+
+    /// \brief The writer thread.
+    std::thread _thread;
+
+};
+
+
+} } // ofx::InstaLooter
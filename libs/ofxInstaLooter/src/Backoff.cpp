@@ -0,0 +1,224 @@
+//
+// Copyright (c) 2017 Christopher Baker <https://christopherbaker.net>
+//
+// SPDX-License-Identifier:	MIT
+//
+
+
+#include "ofx/InstaLooter/Backoff.h"
+#include <algorithm>
+#include <cmath>
+#include "ofLog.h"
+
+
+namespace ofx {
+namespace InstaLooter {
+
+
+uint64_t BackoffPolicy::delay(std::size_t failures, double random) const
+{
+    double delay = static_cast<double>(initialDelay);
+
+    for (std::size_t i = 1; i < failures && delay < maxDelay; ++i)
+    {
+        delay *= std::max(multiplier, 1.0);
+    }
+
+    delay = std::min(delay, static_cast<double>(maxDelay));
+
+    double clampedJitter = std::min(std::max(jitter, 0.0), 1.0);
+    double clampedRandom = std::min(std::max(random, 0.0), 1.0);
+
+    return static_cast<uint64_t>(delay * (1.0 - clampedJitter * clampedRandom));
+}
+
+
+BackoffPolicy BackoffPolicy::fromJSON(const ofJson& settings)
+{
+    BackoffPolicy policy;
+
+    if (!settings.is_object())
+    {
+        return policy;
+    }
+
+    policy.initialDelay = settings.value("initial_delay", policy.initialDelay);
+    policy.maxDelay = std::max(settings.value("max_delay", policy.maxDelay), policy.initialDelay);
+    policy.multiplier = settings.value("multiplier", policy.multiplier);
+    policy.jitter = settings.value("jitter", policy.jitter);
+
+    return policy;
+}
+
+
+const std::size_t CircuitBreaker::DEFAULT_THRESHOLD = 3;
+const uint64_t CircuitBreaker::DEFAULT_OPEN_DURATION = 300000;
+const uint64_t CircuitBreaker::DEFAULT_MAX_OPEN_DURATION = 3600000;
+
+
+CircuitBreaker::CircuitBreaker(const std::string& name,
+                               std::size_t threshold,
+                               uint64_t openDuration,
+                               uint64_t maxOpenDuration):
+    _name(name),
+    _threshold(std::max(threshold, std::size_t(1))),
+    _baseOpenDuration(openDuration),
+    _maxOpenDuration(std::max(maxOpenDuration, openDuration)),
+    _openDuration(openDuration)
+{
+}
+
+
+std::string CircuitBreaker::name() const
+{
+    return _name;
+}
+
+
+bool CircuitBreaker::allow(uint64_t now, bool& probe)
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+
+    probe = false;
+
+    if (!_isOpen)
+    {
+        return true;
+    }
+
+    if (now < _openUntil || _probing)
+    {
+        return false;
+    }
+
+    _probing = true;
+    probe = true;
+    return true;
+}
+
+
+void CircuitBreaker::recordSuccess(bool probe)
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+
+    if (_isOpen)
+    {
+        // A run that started before it opened, e.g. before the throttling
+        // reached this client, must not resume the others.
+        if (!probe) return;
+
+        ofLogNotice("CircuitBreaker::recordSuccess") << "Resuming clients of " << _name << ".";
+    }
+
+    _isOpen = false;
+    _probing = false;
+    _failures = 0;
+    _openDuration = _baseOpenDuration;
+}
+
+
+void CircuitBreaker::recordFailure(uint64_t now, bool probe)
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+
+    if (_isOpen)
+    {
+        // A failed probe reopens it. A run that started before it opened
+        // changes nothing.
+        if (!probe) return;
+
+        ++_failures;
+        _probing = false;
+        _open(now);
+    }
+    else if (++_failures >= _threshold)
+    {
+        _open(now);
+    }
+}
+
+
+void CircuitBreaker::release(bool probe)
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+
+    // Otherwise a run that started before it opened would let a second
+    // probe through while the first is still running.
+    if (probe) _probing = false;
+}
+
+
+CircuitBreaker::State CircuitBreaker::state(uint64_t now) const
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+
+    if (!_isOpen) return State::CLOSED;
+    if (now < _openUntil) return State::OPEN;
+    return State::HALF_OPEN;
+}
+
+
+uint64_t CircuitBreaker::openUntil() const
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    return _isOpen ? _openUntil : 0;
+}
+
+
+std::size_t CircuitBreaker::failures() const
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    return _failures;
+}
+
+
+uint64_t CircuitBreaker::trips() const
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    return _trips;
+}
+
+
+std::string CircuitBreaker::toString(State state)
+{
+    switch (state)
+    {
+        case State::CLOSED: return "closed";
+        case State::OPEN: return "open";
+        case State::HALF_OPEN: return "half_open";
+    }
+
+    return "unknown";
+}
+
+
+std::shared_ptr<CircuitBreaker> CircuitBreaker::fromJSON(const ofJson& settings,
+                                                         const std::string& name)
+{
+    // Missing settings get a default breaker, so it is on unless disabled.
+    ofJson breakerSettings = settings.is_object() ? settings : ofJson::object();
+
+    if (!breakerSettings.value("enabled", true))
+    {
+        return nullptr;
+    }
+
+    return std::make_shared<CircuitBreaker>(name,
+                                            breakerSettings.value("threshold", DEFAULT_THRESHOLD),
+                                            breakerSettings.value("open_duration", DEFAULT_OPEN_DURATION),
+                                            breakerSettings.value("max_open_duration", DEFAULT_MAX_OPEN_DURATION));
+}
+
+
+void CircuitBreaker::_open(uint64_t now)
+{
+    ofLogWarning("CircuitBreaker::_open") << "Pausing clients of " << _name << " for " << _openDuration / 1000 << " s after " << _failures << " failures.";
+
+    _isOpen = true;
+    _openUntil = now + _openDuration;
+    _openDuration = std::min(_openDuration * 2, _maxOpenDuration);
+    ++_trips;
+}
+
+
+} } // ofx::InstaLooter
@@ -0,0 +1,57 @@
+//
+// Copyright (c) 2017 Christopher Baker <https://christopherbaker.net>
+//
+// SPDX-License-Identifier:	MIT
+//
+
+
+#include "ofx/InstaLooter/CancellationToken.h"
+#include <chrono>
+
+
+namespace ofx {
+namespace InstaLooter {
+
+
+CancellationToken::CancellationToken(): _cancelled(false)
+{
+}
+
+
+CancellationToken::~CancellationToken()
+{
+}
+
+
+void CancellationToken::cancel()
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    _cancelled = true;
+    _condition.notify_all();
+}
+
+
+void CancellationToken::reset()
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    _cancelled = false;
+}
+
+
+bool CancellationToken::isCancelled() const
+{
+    return _cancelled;
+}
+
+
+bool CancellationToken::waitFor(uint64_t milliseconds) const
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+
+    return _condition.wait_for(lock,
+                               std::chrono::milliseconds(milliseconds),
+                               [&](){ return _cancelled.load(); });
+}
+
+
+} } // ofx::InstaLooter
@@ -0,0 +1,385 @@
+//
+// Copyright (c) 2017 Christopher Baker <https://christopherbaker.net>
+//
+// SPDX-License-Identifier:	MIT
+//
+
+
+#include "ofx/InstaLooter/ChildProcess.h"
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <thread>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <spawn.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "Poco/Exception.h"
+
+
+extern char** environ;
+
+
+namespace ofx {
+namespace InstaLooter {
+
+
+namespace {
+
+
+/// \brief Create a pipe whose ends are closed on exec.
+///
+/// Children are launched from many threads at once, so an end left open
+/// would leak into unrelated children and hold the pipe open.
+int createPipe(int fds[2])
+{
+#if defined(__linux__)
+    return ::pipe2(fds, O_CLOEXEC);
+#else
+    if (::pipe(fds) != 0)
+    {
+        return -1;
+    }
+
+    // Not atomic, a child spawned in between may still inherit them.
+    if (::fcntl(fds[0], F_SETFD, FD_CLOEXEC) != 0 ||
+        ::fcntl(fds[1], F_SETFD, FD_CLOEXEC) != 0)
+    {
+        int error = errno;
+        ::close(fds[0]);
+        ::close(fds[1]);
+        errno = error;
+        return -1;
+    }
+
+    return 0;
+#endif
+}
+
+
+}
+
+
+ChildProcess::ChildProcess()
+{
+}
+
+
+ChildProcess::~ChildProcess()
+{
+    kill();
+    closeInput();
+    closeOutput();
+    wait(500);
+}
+
+
+void ChildProcess::launch(const std::string& command,
+                          const std::vector<std::string>& args,
+                          int options)
+{
+    int fds[2];
+    int inputFDs[2] = { -1, -1 };
+
+    if (createPipe(fds) != 0)
+    {
+        throw Poco::IOException("Unable to create pipe: " + std::string(std::strerror(errno)));
+    }
+
+    if ((options & OPTION_PIPE_INPUT) && createPipe(inputFDs) != 0)
+    {
+        int error = errno;
+        ::close(fds[0]);
+        ::close(fds[1]);
+        throw Poco::IOException("Unable to create pipe: " + std::string(std::strerror(error)));
+    }
+
+#if defined(F_SETNOSIGPIPE)
+    if (inputFDs[1] >= 0)
+    {
+        ::fcntl(inputFDs[1], F_SETNOSIGPIPE, 1);
+    }
+#endif
+
+    std::vector<char*> argv;
+    argv.push_back(const_cast<char*>(command.c_str()));
+    for (const auto& arg: args) argv.push_back(const_cast<char*>(arg.c_str()));
+    argv.push_back(nullptr);
+
+    // Duplicating the child's ends onto its standard streams clears their
+    // close-on-exec flag, in the child only.
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_adddup2(&actions, fds[1], STDOUT_FILENO);
+
+    if (!(options & OPTION_INHERIT_ERROR))
+    {
+        posix_spawn_file_actions_adddup2(&actions, fds[1], STDERR_FILENO);
+    }
+
+    posix_spawn_file_actions_addclose(&actions, fds[0]);
+    posix_spawn_file_actions_addclose(&actions, fds[1]);
+
+    if (inputFDs[0] >= 0)
+    {
+        posix_spawn_file_actions_adddup2(&actions, inputFDs[0], STDIN_FILENO);
+        posix_spawn_file_actions_addclose(&actions, inputFDs[0]);
+        posix_spawn_file_actions_addclose(&actions, inputFDs[1]);
+    }
+
+    posix_spawnattr_t attributes;
+    posix_spawnattr_init(&attributes);
+    posix_spawnattr_setflags(&attributes, POSIX_SPAWN_SETPGROUP);
+    posix_spawnattr_setpgroup(&attributes, 0);
+
+    pid_t pid = 0;
+
+    int result = ::posix_spawnp(&pid,
+                                command.c_str(),
+                                &actions,
+                                &attributes,
+                                argv.data(),
+                                environ);
+
+    posix_spawn_file_actions_destroy(&actions);
+    posix_spawnattr_destroy(&attributes);
+
+    ::close(fds[1]);
+
+    if (inputFDs[0] >= 0)
+    {
+        ::close(inputFDs[0]);
+    }
+
+    if (result != 0)
+    {
+        ::close(fds[0]);
+
+        if (inputFDs[1] >= 0)
+        {
+            ::close(inputFDs[1]);
+        }
+
+        throw Poco::IOException("Unable to launch " + command + ": " + std::string(std::strerror(result)));
+    }
+
+    std::unique_lock<std::mutex> lock(_mutex);
+    _pid = pid;
+    _outputFD = fds[0];
+    _inputFD = inputFDs[1];
+    _exited = false;
+    _exitCode = -1;
+}
+
+
+pid_t ChildProcess::id() const
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    return _pid;
+}
+
+
+bool ChildProcess::isRunning()
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    return _pid > 0 && !_reap();
+}
+
+
+bool ChildProcess::read(std::string& output, uint64_t timeout)
+{
+    if (_outputFD < 0)
+    {
+        return false;
+    }
+
+    pollfd pfd;
+    pfd.fd = _outputFD;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+
+    int result = ::poll(&pfd, 1, static_cast<int>(timeout));
+
+    if (result < 0)
+    {
+        return errno == EINTR;
+    }
+    else if (result == 0)
+    {
+        return true;
+    }
+
+    char buffer[4096];
+
+    ssize_t count = ::read(_outputFD, buffer, sizeof(buffer));
+
+    if (count > 0)
+    {
+        output.append(buffer, static_cast<std::size_t>(count));
+        return true;
+    }
+    else if (count < 0 && (errno == EINTR || errno == EAGAIN))
+    {
+        return true;
+    }
+
+    closeOutput();
+    return false;
+}
+
+
+bool ChildProcess::write(const std::string& data)
+{
+    if (_inputFD < 0)
+    {
+        return false;
+    }
+
+#if !defined(F_SETNOSIGPIPE)
+    // Block SIGPIPE on this thread so a dead reader is reported as EPIPE.
+    sigset_t pipeSet;
+    sigset_t oldSet;
+    sigemptyset(&pipeSet);
+    sigaddset(&pipeSet, SIGPIPE);
+    pthread_sigmask(SIG_BLOCK, &pipeSet, &oldSet);
+#endif
+
+    bool success = true;
+    std::size_t written = 0;
+
+    while (written < data.size())
+    {
+        ssize_t count = ::write(_inputFD, data.data() + written, data.size() - written);
+
+        if (count > 0)
+        {
+            written += static_cast<std::size_t>(count);
+        }
+        else if (count < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        else
+        {
+            success = false;
+            break;
+        }
+    }
+
+#if !defined(F_SETNOSIGPIPE)
+    if (!success && errno == EPIPE)
+    {
+        // Consume the pending SIGPIPE before unblocking it.
+        timespec zero = { 0, 0 };
+        sigtimedwait(&pipeSet, nullptr, &zero);
+    }
+
+    pthread_sigmask(SIG_SETMASK, &oldSet, nullptr);
+#endif
+
+    return success;
+}
+
+
+void ChildProcess::closeInput()
+{
+    if (_inputFD >= 0)
+    {
+        ::close(_inputFD);
+        _inputFD = -1;
+    }
+}
+
+
+void ChildProcess::kill()
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+
+    if (_pid > 0 && !_exited)
+    {
+        // The child is the group leader, so this takes its children with it.
+        ::kill(-_pid, SIGKILL);
+    }
+}
+
+
+void ChildProcess::closeOutput()
+{
+    if (_outputFD >= 0)
+    {
+        ::close(_outputFD);
+        _outputFD = -1;
+    }
+}
+
+
+bool ChildProcess::wait(uint64_t timeout)
+{
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout);
+
+    while (true)
+    {
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+
+            if (_pid <= 0 || _reap())
+            {
+                return true;
+            }
+        }
+
+        if (std::chrono::steady_clock::now() >= deadline)
+        {
+            return false;
+        }
+
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    }
+}
+
+
+int ChildProcess::exitCode() const
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    return _exitCode;
+}
+
+
+bool ChildProcess::_reap()
+{
+    if (_exited)
+    {
+        return true;
+    }
+
+    int status = 0;
+
+    pid_t result = ::waitpid(_pid, &status, WNOHANG);
+
+    if (result == _pid)
+    {
+        if (WIFEXITED(status))
+        {
+            _exitCode = WEXITSTATUS(status);
+        }
+        else if (WIFSIGNALED(status))
+        {
+            _exitCode = -WTERMSIG(status);
+        }
+
+        _exited = true;
+    }
+    else if (result < 0 && errno == ECHILD)
+    {
+        // Someone else reaped it.
+        _exited = true;
+    }
+
+    return _exited;
+}
+
+
+} } // ofx::InstaLooter
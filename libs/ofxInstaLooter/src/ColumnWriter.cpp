@@ -0,0 +1,194 @@
+//
+// Copyright (c) 2017 Christopher Baker <https://christopherbaker.net>
+//
+// SPDX-License-Identifier:	MIT
+//
+
+
+#include "ofx/InstaLooter/ColumnWriter.h"
+#include "ofLog.h"
+
+
+namespace ofx {
+namespace InstaLooter {
+
+
+void PostColumns::add(uint64_t id,
+                      uint64_t userId,
+                      uint64_t timestamp,
+                      uint32_t width,
+                      uint32_t height,
+                      const std::vector<std::string>& postHashtags)
+{
+    ids.push_back(id);
+    userIds.push_back(userId);
+    timestamps.push_back(timestamp);
+    widths.push_back(width);
+    heights.push_back(height);
+    hashtags.insert(hashtags.end(), postHashtags.begin(), postHashtags.end());
+    hashtagOffsets.push_back(static_cast<uint32_t>(hashtags.size()));
+}
+
+
+std::size_t PostColumns::size() const
+{
+    return ids.size();
+}
+
+
+void PostColumns::clear()
+{
+    ids.clear();
+    userIds.clear();
+    timestamps.clear();
+    widths.clear();
+    heights.clear();
+    hashtagOffsets.assign(1, 0);
+    hashtags.clear();
+}
+
+
+const std::string ColumnWriter::MAGIC = "ILPOSTS1";
+
+
+ColumnWriter::ColumnWriter(const std::filesystem::path& path):
+    _path(path),
+    _stream(path.string(), std::ios::binary | std::ios::trunc)
+{
+    if (!_stream)
+    {
+        ofLogError("ColumnWriter::ColumnWriter") << "Unable to create " << _path;
+        return;
+    }
+
+    _write(MAGIC.data(), MAGIC.size());
+}
+
+
+ColumnWriter::~ColumnWriter()
+{
+    close();
+}
+
+
+bool ColumnWriter::isGood() const
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    return static_cast<bool>(_stream);
+}
+
+
+void ColumnWriter::write(const PostColumns& batch)
+{
+    if (batch.size() == 0)
+    {
+        return;
+    }
+
+    std::unique_lock<std::mutex> lock(_mutex);
+
+    if (_closed || !_stream)
+    {
+        return;
+    }
+
+    std::vector<uint32_t> hashtagIds;
+    std::vector<const std::string*> added;
+
+    hashtagIds.reserve(batch.hashtags.size());
+
+    for (const auto& hashtag: batch.hashtags)
+    {
+        auto result = _dictionary.insert(std::make_pair(hashtag, static_cast<uint32_t>(_dictionary.size())));
+
+        if (result.second)
+        {
+            added.push_back(&result.first->first);
+        }
+
+        hashtagIds.push_back(result.first->second);
+    }
+
+    _batchOffsets.push_back(_bytes);
+
+    uint32_t rows = static_cast<uint32_t>(batch.size());
+    uint32_t numAdded = static_cast<uint32_t>(added.size());
+
+    _write("BTCH", 4);
+    _write(&rows, sizeof(rows));
+    _write(&numAdded, sizeof(numAdded));
+
+    for (const auto* hashtag: added)
+    {
+        uint32_t length = static_cast<uint32_t>(hashtag->size());
+        _write(&length, sizeof(length));
+        _write(hashtag->data(), hashtag->size());
+    }
+
+    _write(batch.ids);
+    _write(batch.userIds);
+    _write(batch.timestamps);
+    _write(batch.widths);
+    _write(batch.heights);
+    _write(batch.hashtagOffsets);
+    _write(hashtagIds);
+
+    _rows += rows;
+}
+
+
+bool ColumnWriter::close()
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+
+    if (_closed)
+    {
+        return static_cast<bool>(_stream);
+    }
+
+    _closed = true;
+
+    uint64_t footerOffset = _bytes;
+    uint32_t batches = static_cast<uint32_t>(_batchOffsets.size());
+
+    _write("INDX", 4);
+    _write(&batches, sizeof(batches));
+    _write(_batchOffsets);
+    _write(&_rows, sizeof(_rows));
+    _write(&footerOffset, sizeof(footerOffset));
+    _write(MAGIC.data(), MAGIC.size());
+
+    _stream.close();
+
+    if (!_stream)
+    {
+        ofLogError("ColumnWriter::close") << "Unable to write " << _path;
+        return false;
+    }
+
+    return true;
+}
+
+
+uint64_t ColumnWriter::rows() const
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    return _rows;
+}
+
+
+uint64_t ColumnWriter::bytes() const
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    return _bytes;
+}
+
+
+void ColumnWriter::_write(const void* data, std::size_t size)
+{
+    _stream.write(static_cast<const char*>(data), size);
+    _bytes += size;
+}
+
+
+} } // ofx::InstaLooter
@@ -0,0 +1,129 @@
+//
+// Copyright (c) 2017 Christopher Baker <https://christopherbaker.net>
+//
+// SPDX-License-Identifier:	MIT
+//
+
+
+#include "ofx/InstaLooter/EventCount.h"
+#include <chrono>
+
+
+#if defined(__linux__)
+#include <cerrno>
+#include <ctime>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+
+namespace ofx {
+namespace InstaLooter {
+
+
+EventCount::EventCount():
+    _state(0)
+{
+}
+
+
+EventCount::Key EventCount::prepareWait()
+{
+    // Sequentially consistent, so either the waiter sees the notifier's
+    // change or the notifier sees the flag.
+    return _state.fetch_or(1, std::memory_order_seq_cst) | 1;
+}
+
+
+void EventCount::cancelWait()
+{
+    // The flag is left set, which costs at most one needless wake up.
+}
+
+
+void EventCount::wait(Key key)
+{
+    _wait(key, -1);
+}
+
+
+bool EventCount::waitFor(Key key, uint64_t timeoutMs)
+{
+    return _wait(key, static_cast<int64_t>(timeoutMs));
+}
+
+
+void EventCount::notifyAll()
+{
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+
+    uint32_t state = _state.load(std::memory_order_seq_cst);
+
+    while (state & 1)
+    {
+        // Advance the counter and clear the flag. On failure another
+        // notifier got there first, and state is reloaded.
+        if (_state.compare_exchange_weak(state, (state + 2) & ~uint32_t(1), std::memory_order_seq_cst))
+        {
+#if defined(__linux__)
+            syscall(SYS_futex, reinterpret_cast<uint32_t*>(&_state), FUTEX_WAKE_PRIVATE, INT32_MAX, nullptr, nullptr, 0);
+#else
+            // Taking the lock orders this with a waiter between its check
+            // and wait.
+            { std::unique_lock<std::mutex> lock(_mutex); }
+            _condition.notify_all();
+#endif
+            return;
+        }
+    }
+}
+
+
+bool EventCount::_wait(Key key, int64_t timeoutMs)
+{
+#if defined(__linux__)
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeoutMs);
+
+    while (_state.load(std::memory_order_acquire) == key)
+    {
+        timespec timeout;
+        timespec* timeoutPtr = nullptr;
+
+        if (timeoutMs >= 0)
+        {
+            auto remaining = std::chrono::duration_cast<std::chrono::nanoseconds>(deadline - std::chrono::steady_clock::now()).count();
+
+            if (remaining <= 0)
+            {
+                return false;
+            }
+
+            timeout.tv_sec = remaining / 1000000000;
+            timeout.tv_nsec = remaining % 1000000000;
+            timeoutPtr = &timeout;
+        }
+
+        // Returns at once if the counter has moved on; EINTR and spurious
+        // wakeups loop.
+        syscall(SYS_futex, reinterpret_cast<uint32_t*>(&_state), FUTEX_WAIT_PRIVATE, key, timeoutPtr, nullptr, 0);
+    }
+
+    return true;
+#else
+    std::unique_lock<std::mutex> lock(_mutex);
+
+    auto changed = [&](){ return _state.load(std::memory_order_acquire) != key; };
+
+    if (timeoutMs < 0)
+    {
+        _condition.wait(lock, changed);
+        return true;
+    }
+
+    return _condition.wait_for(lock, std::chrono::milliseconds(timeoutMs), changed);
+#endif
+}
+
+
+} } // ofx::InstaLooter
@@ -0,0 +1,176 @@
+//
+// Copyright (c) 2017 Christopher Baker <https://christopherbaker.net>
+//
+// SPDX-License-Identifier:	MIT
+//
+
+
+#include "ofx/InstaLooter/FetchJob.h"
+#include <ctime>
+#include "ofLog.h"
+#include "ofx/IO/JSONUtils.h"
+
+
+namespace ofx {
+namespace InstaLooter {
+
+
+const std::string FetchCursor::FILENAME = "cursor.json";
+
+
+bool FetchCursor::isEmpty() const
+{
+    return id == 0;
+}
+
+
+bool FetchCursor::advance(uint64_t postId, uint64_t postTimestamp)
+{
+    if (postId <= id)
+    {
+        return false;
+    }
+
+    id = postId;
+    timestamp = postTimestamp;
+    return true;
+}
+
+
+FetchCursor FetchCursor::load(const std::filesystem::path& path)
+{
+    ofJson json;
+
+    if (!std::filesystem::exists(path) || !IO::JSONUtils::loadJSON(path, json))
+    {
+        return FetchCursor();
+    }
+
+    return fromJSON(json);
+}
+
+
+bool FetchCursor::save(const std::filesystem::path& path, const FetchCursor& cursor)
+{
+    std::filesystem::path temporaryPath = path;
+    temporaryPath += ".tmp";
+
+    if (!IO::JSONUtils::saveJSON(temporaryPath, toJSON(cursor)))
+    {
+        return false;
+    }
+
+    try
+    {
+        std::filesystem::rename(temporaryPath, path);
+    }
+    catch (const std::exception& exc)
+    {
+        ofLogError("FetchCursor::save") << "Unable to save " << path << ": " << exc.what();
+        return false;
+    }
+
+    return true;
+}
+
+
+ofJson FetchCursor::toJSON(const FetchCursor& cursor)
+{
+    ofJson json;
+    json["id"] = cursor.id;
+    json["timestamp"] = cursor.timestamp;
+    return json;
+}
+
+
+FetchCursor FetchCursor::fromJSON(const ofJson& json)
+{
+    FetchCursor cursor;
+
+    if (json.is_object())
+    {
+        cursor.id = json.value("id", uint64_t(0));
+        cursor.timestamp = json.value("timestamp", uint64_t(0));
+    }
+
+    return cursor;
+}
+
+
+std::vector<std::string> FetchJob::toArguments() const
+{
+    std::vector<std::string> args;
+
+    args.push_back("hashtag");
+    args.push_back(hashtag);
+    args.push_back(downloadPath.string());
+    if (quiet)
+    {
+        args.push_back("--quiet");
+    }
+    args.push_back("--new");
+    args.push_back("-n " + std::to_string(numImagesToDownload));
+    args.push_back("-T" + filenameTemplate);
+    if (!username.empty() || !password.empty())
+    {
+        args.push_back("-c" + username + ":" + password);
+    }
+    if (timeFilter && !cursor.isEmpty())
+    {
+        // instaLooter ranges run newest:oldest and take whole days, so
+        // start a day early to cover time zones. --new skips the overlap.
+        std::time_t oldest = static_cast<std::time_t>(cursor.timestamp) - 24 * 60 * 60;
+        char date[16];
+        std::strftime(date, sizeof(date), "%Y-%m-%d", std::gmtime(&oldest));
+        args.push_back("--time");
+        args.push_back(std::string(":") + date);
+    }
+
+    return args;
+}
+
+
+ofJson FetchJob::toJSON(const FetchJob& job)
+{
+    ofJson json;
+    json["hashtag"] = job.hashtag;
+    json["directory"] = job.downloadPath.string();
+    json["num_images_to_download"] = job.numImagesToDownload;
+    json["template"] = job.filenameTemplate;
+    json["quiet"] = job.quiet;
+    json["cursor"] = FetchCursor::toJSON(job.cursor);
+    json["arguments"] = job.toArguments();
+    return json;
+}
+
+
+FetchResult::Outcome FetchResult::outcome() const
+{
+    if (killed && !timedOut) return Outcome::CANCELLED;
+    if (progress.rateLimits > 0) return Outcome::THROTTLED;
+    if (progress.authErrors > 0) return Outcome::AUTH_FAILED;
+    if (!killed && exitCode == 0) return Outcome::SUCCESS;
+    if (timedOut) return Outcome::TIMED_OUT;
+    if (progress.networkErrors > 0) return Outcome::NETWORK_ERROR;
+    return Outcome::FAILED;
+}
+
+
+std::string FetchResult::toString(Outcome outcome)
+{
+    switch (outcome)
+    {
+        case Outcome::SUCCESS: return "success";
+        case Outcome::CANCELLED: return "cancelled";
+        case Outcome::THROTTLED: return "throttled";
+        case Outcome::AUTH_FAILED: return "auth_failed";
+        case Outcome::NETWORK_ERROR: return "network_error";
+        case Outcome::TIMED_OUT: return "timed_out";
+        case Outcome::FAILED: return "failed";
+    }
+
+    return "failed";
+}
+
+
+} } // ofx::InstaLooter
@@ -0,0 +1,525 @@
+//
+// Copyright (c) 2017 Christopher Baker <https://christopherbaker.net>
+//
+// SPDX-License-Identifier:	MIT
+//
+
+
+#include "ofx/InstaLooter/FileSink.h"
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iterator>
+#include <sstream>
+#include "Poco/DeflatingStream.h"
+#include "ofLog.h"
+#include "ofx/InstaLooter/IoUringFileSink.h"
+
+
+namespace ofx {
+namespace InstaLooter {
+
+
+FileOperation FileOperation::createDirectories(const std::filesystem::path& path)
+{
+    FileOperation operation;
+    operation.type = CREATE_DIRECTORIES;
+    operation.path = path;
+    return operation;
+}
+
+
+FileOperation FileOperation::move(const std::filesystem::path& from,
+                                  const std::filesystem::path& to)
+{
+    FileOperation operation;
+    operation.type = MOVE;
+    operation.path = from;
+    operation.target = to;
+    return operation;
+}
+
+
+FileOperation FileOperation::copy(const std::filesystem::path& from,
+                                  const std::filesystem::path& to)
+{
+    FileOperation operation;
+    operation.type = COPY;
+    operation.path = from;
+    operation.target = to;
+    return operation;
+}
+
+
+FileOperation FileOperation::setWriteTime(const std::filesystem::path& path,
+                                          std::time_t time)
+{
+    FileOperation operation;
+    operation.type = SET_WRITE_TIME;
+    operation.path = path;
+    operation.time = time;
+    return operation;
+}
+
+
+FileOperation FileOperation::write(const std::filesystem::path& path,
+                                   std::string data)
+{
+    FileOperation operation;
+    operation.type = WRITE;
+    operation.path = path;
+    operation.data = std::move(data);
+    return operation;
+}
+
+
+FileOperation FileOperation::remove(const std::filesystem::path& path)
+{
+    FileOperation operation;
+    operation.type = REMOVE;
+    operation.path = path;
+    return operation;
+}
+
+
+FileOperation FileOperation::writeJSON(const std::filesystem::path& path,
+                                       const ofJson& json)
+{
+    if (path.extension() != ".gz")
+    {
+        return write(path, json.dump());
+    }
+
+    // Compress on the calling thread so the sink only does I/O.
+    std::ostringstream compressed;
+    Poco::DeflatingOutputStream deflater(compressed, Poco::DeflatingStreamBuf::STREAM_GZIP);
+    deflater << json.dump();
+    deflater.close();
+
+    return write(path, compressed.str());
+}
+
+
+const std::size_t FileSink::DEFAULT_QUEUE_DEPTH = 256;
+const std::size_t FileSink::DEFAULT_NUM_THREADS = 4;
+
+
+FileSink::~FileSink()
+{
+}
+
+
+std::size_t FileSink::drain(std::vector<FileTask>& tasks)
+{
+    std::size_t count = 0;
+
+    while (inFlight() > 0)
+    {
+        count += complete(tasks, true);
+    }
+
+    return count;
+}
+
+
+void FileSink::run(FileTask& task)
+{
+    task.success = true;
+    task.error.clear();
+
+    for (const auto& operation: task.operations)
+    {
+        try
+        {
+            switch (operation.type)
+            {
+                case FileOperation::CREATE_DIRECTORIES:
+                    std::filesystem::create_directories(operation.path);
+                    break;
+                case FileOperation::MOVE:
+                    try
+                    {
+                        std::filesystem::rename(operation.path, operation.target);
+                    }
+                    catch (const std::filesystem::filesystem_error&)
+                    {
+                        // The target may be on a different volume.
+                        std::filesystem::copy_file(operation.path, operation.target);
+                        std::filesystem::remove(operation.path);
+                    }
+                    break;
+                case FileOperation::COPY:
+                    std::filesystem::copy_file(operation.path, operation.target);
+                    break;
+                case FileOperation::SET_WRITE_TIME:
+                    std::filesystem::last_write_time(operation.path, operation.time);
+                    break;
+                case FileOperation::WRITE:
+                {
+                    std::ofstream stream(operation.path.string(), std::ios::binary | std::ios::trunc);
+                    stream.write(operation.data.data(), operation.data.size());
+                    stream.close();
+
+                    if (!stream)
+                    {
+                        throw std::runtime_error("Unable to write " + operation.path.string());
+                    }
+                    break;
+                }
+                case FileOperation::REMOVE:
+                    if (!std::filesystem::remove(operation.path))
+                    {
+                        throw std::runtime_error("Unable to remove " + operation.path.string());
+                    }
+                    break;
+            }
+        }
+        catch (const std::exception& exc)
+        {
+            task.success = false;
+            task.error = exc.what();
+            return;
+        }
+    }
+}
+
+
+std::unique_ptr<FileSink> FileSink::fromJSON(const ofJson& settings,
+                                             const ResourcePolicy& threadPolicy)
+{
+    std::string backend = settings.is_object() ? settings.value("backend", "sync") : "sync";
+    std::size_t numThreads = settings.is_object() ? settings.value("threads", DEFAULT_NUM_THREADS) : DEFAULT_NUM_THREADS;
+    std::size_t queueDepth = settings.is_object() ? settings.value("queue_depth", DEFAULT_QUEUE_DEPTH) : DEFAULT_QUEUE_DEPTH;
+
+    if (backend == "io_uring")
+    {
+        if (IoUringFileSink::isAvailable())
+        {
+            return std::make_unique<IoUringFileSink>(queueDepth);
+        }
+
+        ofLogWarning("FileSink::fromJSON") << "io_uring is not available, using threads.";
+        backend = "threads";
+    }
+
+    if (backend == "threads")
+    {
+        return std::make_unique<ThreadPoolFileSink>(numThreads, threadPolicy);
+    }
+    else if (backend != "sync")
+    {
+        ofLogWarning("FileSink::fromJSON") << "Unknown backend " << backend << ", using sync.";
+    }
+
+    return std::make_unique<SynchronousFileSink>();
+}
+
+
+void SynchronousFileSink::submit(FileTask&& task)
+{
+    run(task);
+    _completed.push_back(std::move(task));
+}
+
+
+std::size_t SynchronousFileSink::complete(std::vector<FileTask>& tasks, bool /* wait */)
+{
+    std::size_t count = _completed.size();
+
+    for (auto& task: _completed)
+    {
+        tasks.push_back(std::move(task));
+    }
+
+    _completed.clear();
+    return count;
+}
+
+
+std::size_t SynchronousFileSink::inFlight() const
+{
+    return _completed.size();
+}
+
+
+std::string SynchronousFileSink::name() const
+{
+    return "sync";
+}
+
+
+ThreadPoolFileSink::ThreadPoolFileSink(std::size_t numThreads,
+                                       const ResourcePolicy& threadPolicy):
+    _threadPolicy(threadPolicy)
+{
+    for (std::size_t i = 0; i < std::max(numThreads, std::size_t(1)); ++i)
+    {
+        _threads.emplace_back(&ThreadPoolFileSink::_run, this);
+    }
+}
+
+
+ThreadPoolFileSink::~ThreadPoolFileSink()
+{
+    _pending.close();
+
+    for (auto& thread: _threads)
+    {
+        thread.join();
+    }
+}
+
+
+void ThreadPoolFileSink::submit(FileTask&& task)
+{
+    ++_inFlight;
+    _pending.send(std::move(task));
+}
+
+
+std::size_t ThreadPoolFileSink::complete(std::vector<FileTask>& tasks, bool wait)
+{
+    std::size_t count = 0;
+
+    if (wait && _inFlight > 0 && _completed.empty())
+    {
+        FileTask task;
+
+        if (_completed.receive(task))
+        {
+            tasks.push_back(std::move(task));
+            ++count;
+        }
+    }
+
+    count += _completed.receiveAll(tasks);
+
+    _inFlight -= count;
+    return count;
+}
+
+
+std::size_t ThreadPoolFileSink::inFlight() const
+{
+    return _inFlight;
+}
+
+
+std::string ThreadPoolFileSink::name() const
+{
+    return "threads";
+}
+
+
+void ThreadPoolFileSink::_run()
+{
+    _threadPolicy.applyToThread();
+
+    FileTask task;
+
+    while (_pending.receive(task))
+    {
+        run(task);
+        _completed.send(std::move(task));
+    }
+}
+
+
+const uint64_t FileSinkPool::COLLECT_INTERVAL = 1;
+
+
+FileSinkPool::FileSinkPool(std::unique_ptr<FileSink> backend,
+                           const ResourcePolicy& threadPolicy):
+    _backend(std::move(backend)),
+    _threadPolicy(threadPolicy)
+{
+    if (_backend)
+    {
+        _collector = std::thread(&FileSinkPool::_run, this);
+    }
+}
+
+
+FileSinkPool::~FileSinkPool()
+{
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _stopped = true;
+    }
+
+    _condition.notify_all();
+
+    if (_collector.joinable())
+    {
+        _collector.join();
+    }
+}
+
+
+std::unique_ptr<FileSink> FileSinkPool::createSink()
+{
+    if (!_backend)
+    {
+        return std::make_unique<SynchronousFileSink>();
+    }
+
+    return std::make_unique<PooledFileSink>(shared_from_this());
+}
+
+
+std::string FileSinkPool::name() const
+{
+    return _backend ? _backend->name() : "sync";
+}
+
+
+std::shared_ptr<FileSinkPool> FileSinkPool::fromJSON(const ofJson& settings,
+                                                     const ResourcePolicy& threadPolicy)
+{
+    std::unique_ptr<FileSink> backend = FileSink::fromJSON(settings, threadPolicy);
+
+    // Synchronous sinks run on the calling thread, so sharing one would
+    // only serialize the threads.
+    if (backend->name() == "sync")
+    {
+        backend.reset();
+    }
+
+    return std::make_shared<FileSinkPool>(std::move(backend), threadPolicy);
+}
+
+
+void FileSinkPool::_submit(PooledFileSink& sink, FileTask&& task)
+{
+    uint64_t tag = _nextTag++;
+    _owners[tag] = std::make_pair(&sink, task.tag);
+    task.tag = tag;
+    _submitted.push_back(std::move(task));
+}
+
+
+void FileSinkPool::_run()
+{
+    _threadPolicy.applyToThread();
+
+    std::vector<FileTask> submitted;
+    std::vector<FileTask> collected;
+
+    std::unique_lock<std::mutex> lock(_mutex);
+
+    while (true)
+    {
+        if (_submitted.empty() && !_stopped)
+        {
+            // The backend cannot be woken while it waits for a task, so it
+            // is polled instead, and new tasks are never held up behind a
+            // slow one.
+            if (_backendInFlight > 0)
+            {
+                _condition.wait_for(lock, std::chrono::milliseconds(COLLECT_INTERVAL));
+            }
+            else
+            {
+                _condition.wait(lock, [this]() { return !_submitted.empty() || _stopped; });
+            }
+        }
+
+        // Sinks wait for their tasks before they go, so nothing is left.
+        if (_stopped && _submitted.empty())
+        {
+            break;
+        }
+
+        submitted.swap(_submitted);
+
+        lock.unlock();
+
+        for (auto& task: submitted)
+        {
+            _backend->submit(std::move(task));
+        }
+
+        _backendInFlight += submitted.size();
+        submitted.clear();
+
+        _backendInFlight -= _backend->complete(collected, false);
+
+        lock.lock();
+
+        for (auto& task: collected)
+        {
+            auto owner = _owners.find(task.tag);
+            PooledFileSink* sink = owner->second.first;
+            task.tag = owner->second.second;
+            sink->_completed.push_back(std::move(task));
+            _owners.erase(owner);
+
+            // Under the lock, so the sink cannot collect it and go first.
+            sink->_condition.notify_all();
+        }
+
+        collected.clear();
+    }
+}
+
+
+PooledFileSink::PooledFileSink(std::shared_ptr<FileSinkPool> pool):
+    _pool(pool)
+{
+}
+
+
+PooledFileSink::~PooledFileSink()
+{
+    // Otherwise the pool would hand their completions to a dead sink.
+    std::vector<FileTask> tasks;
+    drain(tasks);
+}
+
+
+void PooledFileSink::submit(FileTask&& task)
+{
+    {
+        std::unique_lock<std::mutex> lock(_pool->_mutex);
+        ++_inFlight;
+        _pool->_submit(*this, std::move(task));
+    }
+
+    _pool->_condition.notify_one();
+}
+
+
+std::size_t PooledFileSink::complete(std::vector<FileTask>& tasks, bool wait)
+{
+    std::unique_lock<std::mutex> lock(_pool->_mutex);
+
+    // The lock is released while waiting, so other sinks keep going.
+    if (wait)
+    {
+        _condition.wait(lock, [this]() { return !_completed.empty() || _inFlight == 0; });
+    }
+
+    std::size_t count = _completed.size();
+
+    std::move(_completed.begin(), _completed.end(), std::back_inserter(tasks));
+    _completed.clear();
+
+    _inFlight -= count;
+    return count;
+}
+
+
+std::size_t PooledFileSink::inFlight() const
+{
+    std::unique_lock<std::mutex> lock(_pool->_mutex);
+    return _inFlight;
+}
+
+
+std::string PooledFileSink::name() const
+{
+    return _pool->name();
+}
+
+
+} } // ofx::InstaLooter
@@ -6,43 +6,88 @@
 
 
 #include "ofx/InstaLooter/HashtagClient.h"
+#include <algorithm>
+#include <cstdio>
 #include <iomanip>
-#include "Poco/PipeStream.h"
-#include "Poco/Process.h"
-#include "Poco/StreamCopier.h"
+#include <limits>
+#include <type_traits>
+#include "Poco/Exception.h"
+#include "Poco/File.h"
 #include "ofLog.h"
 #include "ofx/IO/DirectoryUtils.h"
 #include "ofx/IO/ImageUtils.h"
+#include "ofx/InstaLooter/Trace.h"
 
 
 namespace ofx {
 namespace InstaLooter {
 
 
+namespace {
+
+
+/// \brief Parse the digits of text from begin to end.
+/// \returns false if they are not a number that fits.
+bool parseNumber(const std::string& text, std::size_t begin, std::size_t end, uint64_t& value)
+{
+    if (begin >= end)
+    {
+        return false;
+    }
+
+    value = 0;
+
+    for (std::size_t i = begin; i < end; ++i)
+    {
+        if (text[i] < '0' || text[i] > '9')
+        {
+            return false;
+        }
+
+        uint64_t digit = text[i] - '0';
+
+        if (value > (std::numeric_limits<uint64_t>::max() - digit) / 10)
+        {
+            return false;
+        }
+
+        value = value * 10 + digit;
+    }
+
+    return true;
+}
+
+
+}
+
+
+static_assert(std::is_nothrow_move_constructible<Post>::value, "Posts are moved through the pipeline, and vectors only move what cannot throw.");
+
+
 Post::Post()
 {
 }
 
 
-Post::Post(const std::filesystem::path& path,
+Post::Post(std::filesystem::path path,
            uint64_t id,
            uint64_t userId,
            uint64_t timestamp,
            uint64_t width,
            uint64_t height,
-           const std::set<std::string>& hashtags):
-    _path(path),
+           std::set<std::string> hashtags):
+    _path(std::move(path)),
     _id(id),
     _userId(userId),
     _timestamp(timestamp),
     _width(width),
     _height(height),
-    _hashtags(hashtags)
+    _hashtags(std::move(hashtags))
 {
 }
 
 
-std::filesystem::path Post::path() const
+const std::filesystem::path& Post::path() const
 {
     return _path;
 }
@@ -78,17 +123,24 @@ uint64_t Post::height() const
 }
 
 
-std::set<std::string> Post::hashtags() const
+const std::set<std::string>& Post::hashtags() const
 {
     return _hashtags;
 }
 
 
-Post Post::fromOldSortedPath(const std::filesystem::path& path)
+uint64_t Post::downloadTime() const
+{
+    return _downloadTime;
+}
+
+
+Post Post::fromOldSortedPath(const std::filesystem::path& path,
+                             const StoreLayout& layout)
 {
     auto p = path;
 
-    for (auto i = 0; i < ID_PATH_DEPTH; ++i) p = p.parent_path();
+    for (std::size_t i = 0; i < layout.depth(); ++i) p = p.parent_path();
 
     std::string hashtag = p.parent_path().filename().string();
 
@@ -126,35 +178,43 @@ Post Post::fromDownloadPath(const std::filesystem::path& path)
 {
     std::string hashtag = path.parent_path().parent_path().filename().string();
 
-    auto filename = path.filename();
-    auto tokens = ofSplitString(filename.string(), ".");
+    // 1451944358173325122.221088125.2017-2-16 22h21m17s0.jpg, parsed in
+    // place as this runs for every download.
+    std::filesystem::path filenamePath = path.filename();
+    const std::string& filename = filenamePath.string();
 
-    if (tokens.size() != 4)
-    {
-        throw Poco::InvalidArgumentException("Invalid path: " + filename.string());
-    }
+    std::size_t first = filename.find('.');
+    std::size_t second = first == std::string::npos ? first : filename.find('.', first + 1);
+    std::size_t third = second == std::string::npos ? second : filename.find('.', second + 1);
 
-    auto idToken = tokens[0];
-    auto userIdToken = tokens[1];
-    auto timestampToken = tokens[2];
+    uint64_t id = 0;
+    uint64_t userId = 0;
 
-    uint64_t id = std::stoull(idToken);
-    uint64_t userId = std::stoull(userIdToken);
+    if (third == std::string::npos ||
+        filename.find('.', third + 1) != std::string::npos ||
+        !parseNumber(filename, 0, first, id) ||
+        !parseNumber(filename, first + 1, second, userId))
+    {
+        throw Poco::InvalidArgumentException("Invalid path: " + filename);
+    }
 
-    auto _tm = parseDownloadDateTime(timestampToken);
+    auto _tm = parseDownloadDateTime(filename.substr(second + 1, third - second - 1));
 
     std::time_t _time = std::mktime(&_tm);
 
     uint64_t width = 0;
     uint64_t height = 0;
 
+    std::set<std::string> hashtags;
+    hashtags.insert(std::move(hashtag));
+
     return Post(path,
                 id,
                 userId,
                 static_cast<uint64_t>(_time),
                 width,
                 height,
-                { hashtag });
+                std::move(hashtags));
 }
 
 
@@ -166,66 +226,32 @@ std::tm Post::parseDownloadDateTime(const std::string& dateTime)
 
     std::tm _tm = {};
 
-    auto tok0 = ofSplitString(dateTime, " ");
-
-    if (tok0.size() != 2)
-    {
-        throw Poco::InvalidArgumentException("Invalid dateTime: " + dateTime);
-    }
-
-    auto dateToken = tok0[0];
-    auto timeToken = tok0[1];
-
-    auto tok1 = ofSplitString(tok0[0], "-");
-
-    if (tok1.size() != 3)
+    // The seconds may be followed by milliseconds, which are ignored.
+    if (std::sscanf(dateTime.c_str(),
+                    "%d-%d-%d %dh%dm%ds",
+                    &_tm.tm_year,
+                    &_tm.tm_mon,
+                    &_tm.tm_mday,
+                    &_tm.tm_hour,
+                    &_tm.tm_min,
+                    &_tm.tm_sec) != 6)
     {
         throw Poco::InvalidArgumentException("Invalid dateTime: " + dateTime);
     }
 
-    _tm.tm_year = ofToInt(tok1[0]) - 1900;
-    _tm.tm_mon = ofToInt(tok1[1]) - 1;
-    _tm.tm_mday = ofToInt(tok1[2]);
-
-    // 1451944358173325122.221088125.2017-2-16 22h21m17s0.jpg
-
-    auto hIndex = timeToken.find("h");
-    auto mIndex = timeToken.find("m");
-    auto sIndex = timeToken.find("s");
-
-    if (hIndex == std::string::npos ||
-        mIndex == std::string::npos ||
-        sIndex == std::string::npos)
-    {
-        throw Poco::InvalidArgumentException("Invalid timestamp: " + dateTime);
-    }
-
-    _tm.tm_hour = ofToInt(timeToken.substr(0, hIndex));
-    _tm.tm_min = ofToInt(timeToken.substr(hIndex + 1, mIndex - hIndex - 1));
-    _tm.tm_sec = ofToInt(timeToken.substr(mIndex + 1, sIndex - mIndex - 1));
-    // Ignore milliseconds token.
+    _tm.tm_year -= 1900;
+    _tm.tm_mon -= 1;
 
     return _tm;
 }
 
 
-std::filesystem::path Post::relativeStorePathForImage(const Post& post)
+std::filesystem::path Post::relativeStorePathForImage(const Post& post,
+                                                     const StoreLayout& layout)
 {
-    std::filesystem::path path = "";
-
-    std::string id = std::to_string(post.id());
+    std::filesystem::path path = layout.directoryFor(post.id());
 
-    if (id.length() <= ID_PATH_DEPTH)
-    {
-        throw Poco::InvalidArgumentException("Invalid ID: " + id);
-    }
-
-    for (auto i = 0; i < ID_PATH_DEPTH; ++i)
-    {
-        path = path / id.substr(i, 1);
-    }
-
-    path = path / id;
+    path = path / std::to_string(post.id());
     path += ".";
     path += std::to_string(post.userId());
     path += ".";
@@ -276,7 +302,9 @@ Post Post::fromJSON(const ofJson& json)
 const uint64_t HashtagClient::DEFAULT_POLLING_INTERVAL = 15000;
 const uint64_t HashtagClient::DEFAULT_NUM_IMAGES_TO_DOWNLOAD = 4000;
 const uint64_t HashtagClient::DEFAULT_PROCESS_TIMEOUT = 300000;
-const uint64_t HashtagClient::PROCESS_THREAD_SLEEP = 1000;
+const uint64_t HashtagClient::PROCESS_THREAD_SLEEP = 100;
+const std::size_t HashtagClient::DEFAULT_RAW_RETENTION = 200;
+const std::size_t HashtagClient::RAW_COMPACTION_BATCH = 500;
 const std::string HashtagClient::DEFAULT_INSTALOOTER_PATH = "/usr/local/bin/instaLooter";
 const std::string HashtagClient::FILENAME_TEMPLATE = "{id}.{ownerid}.{datetime}";
 
@@ -287,7 +315,9 @@ HashtagClient::HashtagClient(const std::string& hashtag,
                              const std::filesystem::path& storePath,
                              uint64_t pollingInterval,
                              uint64_t numImagesToDownload,
-                             const std::filesystem::path& instaLooterPath):
+                             const std::filesystem::path& instaLooterPath,
+                             std::shared_ptr<WorkerPool> workerPool,
+                             bool autoStart):
     IO::PollingThread(std::bind(&HashtagClient::_loot, this), pollingInterval),
     _hashtag(hashtag),
     _username(username),
@@ -296,21 +326,319 @@ HashtagClient::HashtagClient(const std::string& hashtag,
     _savePath(_storePath / "instagram" / "downloads" / _hashtag),
     _downloadPath(_savePath / "unsorted"),
     _numImagesToDownload(numImagesToDownload),
-    _instaLooterPath(instaLooterPath)
+    _instaLooterPath(instaLooterPath),
+    _rawRetention(DEFAULT_RAW_RETENTION),
+    _rawFileCount(0),
+    _timeFilter(false),
+    _dropReferences(false),
+    _workerPool(workerPool),
+    _fileSink(std::make_shared<SynchronousFileSink>()),
+    _threadPolicyChanged(false),
+    _fetching(false),
+    _random(std::random_device()())
 {
     // Ensure that the paths exist.
     std::filesystem::create_directories(_downloadPath);
 
+    _cursor = FetchCursor::load(_savePath / FetchCursor::FILENAME);
+
     // Add file folder extensions.
     _fileExtensionFilter.addExtensions({ "jpg", "jpeg", "gif", "png" });
 
     // Start the thread.
-    start();
+    if (autoStart) start();
 }
 
 
 HashtagClient::~HashtagClient()
 {
+    cancel();
+
+    // Closed first, so a send blocked on a bounded channel returns.
+    posts.close();
+    stop();
+}
+
+
+void HashtagClient::setWorkerPool(std::shared_ptr<WorkerPool> workerPool)
+{
+    std::unique_lock<std::mutex> lock(_processMutex);
+    _workerPool = workerPool;
+}
+
+
+std::shared_ptr<WorkerPool> HashtagClient::getWorkerPool() const
+{
+    std::unique_lock<std::mutex> lock(_processMutex);
+    return _workerPool;
+}
+
+
+void HashtagClient::setFileSink(std::shared_ptr<FileSink> fileSink)
+{
+    std::unique_lock<std::mutex> lock(_processMutex);
+    _fileSink = fileSink ? fileSink : std::make_shared<SynchronousFileSink>();
+}
+
+
+std::shared_ptr<FileSink> HashtagClient::getFileSink() const
+{
+    std::unique_lock<std::mutex> lock(_processMutex);
+    return _fileSink;
+}
+
+
+void HashtagClient::setRawRetention(std::size_t rawRetention)
+{
+    _rawRetention = std::max(rawRetention, std::size_t(1));
+}
+
+
+std::size_t HashtagClient::getRawRetention() const
+{
+    return _rawRetention;
+}
+
+
+std::size_t HashtagClient::getRawFileCount() const
+{
+    return _rawFileCount;
+}
+
+
+FetchCursor HashtagClient::getCursor() const
+{
+    std::unique_lock<std::mutex> lock(_cursorMutex);
+    return _cursor;
+}
+
+
+void HashtagClient::storeFailed(uint64_t id)
+{
+    std::unique_lock<std::mutex> lock(_failedIdsMutex);
+    _failedIds.push_back(id);
+}
+
+
+void HashtagClient::setTimeFilter(bool timeFilter)
+{
+    _timeFilter = timeFilter;
+}
+
+
+bool HashtagClient::getTimeFilter() const
+{
+    return _timeFilter;
+}
+
+
+void HashtagClient::setDropReferences(bool dropReferences)
+{
+    _dropReferences = dropReferences;
+}
+
+
+bool HashtagClient::getDropReferences() const
+{
+    return _dropReferences;
+}
+
+
+FetchProgress HashtagClient::getProgress() const
+{
+    return _output.progress();
+}
+
+
+std::vector<std::string> HashtagClient::getOutputTail() const
+{
+    return _output.tail();
+}
+
+
+void HashtagClient::setProcessPolicy(const ResourcePolicy& processPolicy)
+{
+    std::unique_lock<std::mutex> lock(_processMutex);
+    _processPolicy = processPolicy;
+}
+
+
+ResourcePolicy HashtagClient::getProcessPolicy() const
+{
+    std::unique_lock<std::mutex> lock(_processMutex);
+    return _processPolicy;
+}
+
+
+void HashtagClient::setThreadPolicy(const ResourcePolicy& threadPolicy)
+{
+    std::unique_lock<std::mutex> lock(_processMutex);
+    _threadPolicy = threadPolicy;
+    _threadPolicyChanged = true;
+}
+
+
+ResourcePolicy HashtagClient::getThreadPolicy() const
+{
+    std::unique_lock<std::mutex> lock(_processMutex);
+    return _threadPolicy;
+}
+
+
+void HashtagClient::setBackoffPolicy(const BackoffPolicy& backoffPolicy)
+{
+    std::unique_lock<std::mutex> lock(_processMutex);
+    _backoffPolicy = backoffPolicy;
+}
+
+
+BackoffPolicy HashtagClient::getBackoffPolicy() const
+{
+    std::unique_lock<std::mutex> lock(_processMutex);
+    return _backoffPolicy;
+}
+
+
+void HashtagClient::setCircuitBreaker(std::shared_ptr<CircuitBreaker> circuitBreaker)
+{
+    std::unique_lock<std::mutex> lock(_processMutex);
+    _circuitBreaker = circuitBreaker;
+}
+
+
+std::shared_ptr<CircuitBreaker> HashtagClient::getCircuitBreaker() const
+{
+    std::unique_lock<std::mutex> lock(_processMutex);
+    return _circuitBreaker;
+}
+
+
+void HashtagClient::setFetcher(Fetcher fetcher)
+{
+    std::unique_lock<std::mutex> lock(_processMutex);
+    _fetcher = fetcher;
+}
+
+
+HashtagClient::Fetcher HashtagClient::getFetcher() const
+{
+    std::unique_lock<std::mutex> lock(_processMutex);
+    return _fetcher;
+}
+
+
+HashtagClient::State HashtagClient::getState() const
+{
+    uint64_t now = ofGetElapsedTimeMillis();
+
+    State state;
+    state.hashtag = _hashtag;
+
+    uint64_t nextRunTime = 0;
+
+    {
+        std::unique_lock<std::mutex> lock(_stateMutex);
+        state.lastOutcome = _lastOutcome;
+        state.lastExitCode = _lastExitCode;
+        state.consecutiveFailures = _consecutiveFailures;
+        state.runs = _runs;
+        state.failedRuns = _failedRuns;
+        nextRunTime = _nextRunTime;
+    }
+
+    std::shared_ptr<CircuitBreaker> circuitBreaker = getCircuitBreaker();
+
+    uint64_t openUntil = 0;
+
+    if (circuitBreaker)
+    {
+        state.circuitBreaker = circuitBreaker->state(now);
+        openUntil = circuitBreaker->openUntil();
+    }
+
+    if (_fetching)
+    {
+        state.status = Status::FETCHING;
+    }
+    else if (state.circuitBreaker == CircuitBreaker::State::OPEN)
+    {
+        state.status = Status::PAUSED;
+        state.retryDelay = std::max(openUntil, nextRunTime) - now;
+    }
+    else if (now < nextRunTime)
+    {
+        state.status = Status::BACKING_OFF;
+        state.retryDelay = nextRunTime - now;
+    }
+
+    return state;
+}
+
+
+std::string HashtagClient::toString(Status status)
+{
+    switch (status)
+    {
+        case Status::IDLE: return "idle";
+        case Status::FETCHING: return "fetching";
+        case Status::BACKING_OFF: return "backing_off";
+        case Status::PAUSED: return "paused";
+    }
+
+    return "unknown";
+}
+
+
+ofJson HashtagClient::State::toJSON(const State& state)
+{
+    ofJson json;
+    json["hashtag"] = state.hashtag;
+    json["status"] = HashtagClient::toString(state.status);
+    json["last_outcome"] = FetchResult::toString(state.lastOutcome);
+    json["last_exit_code"] = state.lastExitCode;
+    json["consecutive_failures"] = state.consecutiveFailures;
+    json["retry_delay"] = state.retryDelay;
+    json["circuit_breaker"] = CircuitBreaker::toString(state.circuitBreaker);
+    json["runs"] = state.runs;
+    json["failed_runs"] = state.failedRuns;
+    return json;
+}
+
+
+void HashtagClient::cancel()
+{
+    _cancellation.cancel();
+
+    std::unique_lock<std::mutex> lock(_processMutex);
+
+    if (_activeProcess)
+    {
+        _activeProcess->kill();
+    }
+}
+
+
+bool HashtagClient::isCancelled() const
+{
+    return _cancellation.isCancelled();
+}
+
+
+std::string HashtagClient::getHashtag() const
+{
+    return _hashtag;
+}
+
+
+void HashtagClient::setNumImagesToDownload(uint64_t numImagesToDownload)
+{
+    _numImagesToDownload = numImagesToDownload;
+}
+
+
+uint64_t HashtagClient::getNumImagesToDownload() const
+{
+    return _numImagesToDownload;
 }
 
 
@@ -339,183 +667,642 @@ std::string HashtagClient::getPassword() const
 
 void HashtagClient::_loot()
 {
+    if (_shouldStop())
+    {
+        return;
+    }
+
+    if (!_stagedRecovered)
+    {
+        _stagedRecovered = true;
+        _recoverStaged();
+    }
+
+    _restage();
+
+    uint64_t now = ofGetElapsedTimeMillis();
+
+    {
+        // Backing off, the poll is skipped without launching anything.
+        std::unique_lock<std::mutex> lock(_stateMutex);
+        if (now < _nextRunTime) return;
+    }
+
+    std::shared_ptr<CircuitBreaker> circuitBreaker = getCircuitBreaker();
+
+    bool probe = false;
+
+    if (circuitBreaker && !circuitBreaker->allow(now, probe))
+    {
+        return;
+    }
+
     ofLogVerbose("HashtagClient::_loot") << "Looting " << _hashtag << " " << _downloadPath;
 
-    std::vector<std::string> args;
+    if (Trace::isEnabled()) Trace::setThreadName("HashtagClient #" + _hashtag);
 
-    args.push_back("hashtag");
-    args.push_back(_hashtag);
-    args.push_back(_downloadPath.string());
-    if (_quiet)
+    if (_threadPolicyChanged.exchange(false))
     {
-        args.push_back("--quiet");
+        getThreadPolicy().applyToThread();
     }
-    args.push_back("--new");
-    args.push_back("-n " + std::to_string(_numImagesToDownload));
-    args.push_back("-T" + FILENAME_TEMPLATE);
-    if (!_username.empty() || !_password.empty())
+
+    TraceSpan lootSpan("loot");
+
+    FetchJob job;
+    job.hashtag = _hashtag;
+    job.downloadPath = _downloadPath;
+    job.numImagesToDownload = _numImagesToDownload;
+    job.filenameTemplate = FILENAME_TEMPLATE;
+    job.username = _username;
+    job.password = _password;
+    job.quiet = _quiet;
+    job.cursor = getCursor();
+    job.timeFilter = _timeFilter;
+
+    std::shared_ptr<WorkerPool> workerPool = getWorkerPool();
+    Fetcher fetcher = getFetcher();
+
+    TraceSpan fetchSpan("fetch");
+    _output.reset();
+    _fetching = true;
+
+    FetchResult result;
+
+    if (fetcher)
+    {
+        result = fetcher(job, _cancellation, _output);
+        _output.flush();
+        result.output = _output.tailString();
+        result.progress = _output.progress();
+    }
+    else if (workerPool)
+    {
+        result = workerPool->run(job, _processTimeout, _cancellation, &_output);
+    }
+    else
+    {
+        result = _fetch(job);
+    }
+
+    _fetching = false;
+    fetchSpan.end();
+
+    ofLogVerbose("HashtagClient::_loot") << "Process Output: " << result.output;
+    ofLogVerbose("HashtagClient::_loot") << "Process exited with code: " << result.exitCode;
+
+    FetchResult::Outcome outcome = _recordOutcome(result, circuitBreaker.get(), probe);
+
+    bool didKill = result.killed;
+
+    if (_shouldStop())
     {
-        args.push_back("-c" + _username + ":" + _password);
+        return;
     }
 
-    Poco::Pipe outPipe;
+    std::vector<std::filesystem::path> paths;
+
+    TraceSpan listSpan("list");
+    IO::DirectoryUtils::list(_downloadPath, paths, false, &_fileExtensionFilter);
+    listSpan.setCount(paths.size());
+    listSpan.end();
+
+    TraceSpan parseSpan("parse");
 
-    Poco::ProcessHandle handle = Poco::Process::launch(_instaLooterPath.string(),
-                                                       args,
-                                                       nullptr,
-                                                       &outPipe,
-                                                       &outPipe);
-    Poco::PipeInputStream istr(outPipe);
+    std::vector<Post> rawPosts;
 
-    std::atomic<int> exitCode(0);
+    // Only files that have not been handled before are parsed, so with the
+    // directory compacted the cost of a poll follows the new downloads.
+    for (const auto& path: paths)
+    {
+        std::string filename = path.filename().string();
 
-    std::thread processThread([&](){
-        std::string outString;
-        Poco::StreamCopier::copyToString(istr, outString);
-        ofLogVerbose("HashtagClient::_loot") << "Process Output: " << outString;
+        if (_rawFilenames.find(filename) != _rawFilenames.end())
+        {
+            continue;
+        }
 
         try
         {
-            exitCode = handle.wait();
+            Post rawPost = Post::fromDownloadPath(path);
+
+            // Kept to measure the latency of the whole pipeline.
+            rawPost._downloadTime = Poco::File(path.string()).getLastModified().epochMicroseconds() / 1000;
+
+            rawPosts.push_back(std::move(rawPost));
         }
-        catch (const std::exception& exc)
+        catch (const Poco::Exception& exc)
         {
-            ofLogWarning("HashtagClient::_loot") << "Process Thread: " << exc.what();
+            ofLogWarning("HashtagClient::_loot") << "Ignoring " << path << ": " << exc.displayText();
+            _rawFilenames.insert(filename);
         }
+    }
+
+    parseSpan.setCount(rawPosts.size());
+    parseSpan.end();
+
+    TraceSpan copySpan("copy");
+
+    std::shared_ptr<FileSink> fileSink = getFileSink();
+
+    // Indices into rawPosts, whose posts are moved on once copied.
+    std::vector<std::size_t> pendingPosts;
+    std::size_t alreadySaved = 0;
+
+    // Ids grow with time, so anything no newer than the cursor was stored
+    // by an earlier poll, even if it has since moved on from _savePath.
+    FetchCursor cursor = job.cursor;
+
+    for (std::size_t i = 0; i < rawPosts.size(); ++i)
+    {
+        const Post& rawPost = rawPosts[i];
+        std::filesystem::path newPath = _savePath / Post::relativeStorePathForImage(rawPost);
+
+        bool isStaged = rawPost.id() > cursor.id &&
+                        (_stagedPosts.find(rawPost.id()) != _stagedPosts.end() || std::filesystem::exists(newPath));
+
+        if (rawPost.id() <= cursor.id || isStaged)
+        {
+            // A staged copy is on its way to the store, e.g. sent again by
+            // _recoverStaged(), and holds the cursor back until it is there.
+            if (isStaged) _stagedPosts.insert(std::make_pair(rawPost.id(), std::make_pair(rawPost.timestamp(), newPath)));
+
+            std::string filename = rawPost.path().filename().string();
+            _rawIndex.insert(std::make_pair(rawPost.timestamp(), filename));
+            _rawFilenames.insert(std::move(filename));
+            ++alreadySaved;
+        }
+        else
+        {
+            // Queue the copy and keep going, the sink may run many at once.
+            FileTask task;
+            task.tag = pendingPosts.size();
+            task.operations.push_back(FileOperation::createDirectories(newPath.parent_path()));
+            task.operations.push_back(FileOperation::copy(rawPost.path(), newPath));
+            task.operations.push_back(FileOperation::setWriteTime(newPath, static_cast<std::time_t>(rawPost.timestamp())));
+
+            pendingPosts.push_back(i);
+            fileSink->submit(std::move(task));
+        }
+
+        if (_shouldStop()) break;
+    }
+
+    std::vector<FileTask> tasks;
+    fileSink->drain(tasks);
+
+    copySpan.setCount(tasks.size());
+    copySpan.end();
+
+    TraceSpan probeSpan("probe");
+
+    // Keep the download order, whatever order the copies finished in.
+    std::sort(tasks.begin(), tasks.end(), [](const FileTask& a, const FileTask& b) {
+        return a.tag < b.tag;
     });
 
-    bool didKill = false;
+    std::vector<Post> newPosts;
 
-    uint64_t startTime = ofGetElapsedTimeMillis();
+    // The cursor may not pass a failed copy, or it would be skipped when
+    // it is tried again.
+    uint64_t failedId = std::numeric_limits<uint64_t>::max();
 
-    while (isRunning())
+    for (const auto& task: tasks)
     {
-        if (Poco::Process::isRunning(handle))
+        Post& newPost = rawPosts[pendingPosts[task.tag]];
+
+        if (task.success)
+        {
+            _stagedPosts[newPost.id()] = std::make_pair(newPost.timestamp(),
+                                                        _savePath / Post::relativeStorePathForImage(newPost));
+            _restagedIds.erase(newPost.id());
+        }
+        else
         {
-            uint64_t now = ofGetElapsedTimeMillis();
+            failedId = std::min(failedId, newPost.id());
+        }
+    }
 
-            if (now < (startTime + DEFAULT_PROCESS_TIMEOUT))
-            {
-                std::this_thread::sleep_for(std::chrono::milliseconds(PROCESS_THREAD_SLEEP));
-            }
-            else break;
+    // Nor a post the store failed to take in, until it is staged again.
+    if (!_restagedIds.empty())
+    {
+        failedId = std::min(failedId, *_restagedIds.begin());
+    }
+
+    // The store removes each staged copy once it holds the post, so the
+    // cursor only passes posts whose copies are gone. Otherwise a crash
+    // before the write queue reached them would skip them for good.
+    auto stagedIter = _stagedPosts.begin();
+
+    while (stagedIter != _stagedPosts.end() &&
+           stagedIter->first < failedId &&
+           !std::filesystem::exists(stagedIter->second.second))
+    {
+        cursor.advance(stagedIter->first, stagedIter->second.first);
+        stagedIter = _stagedPosts.erase(stagedIter);
+    }
+
+    uint64_t storedBefore = stagedIter == _stagedPosts.end() ? failedId : std::min(failedId, stagedIter->first);
+
+    for (const auto& rawPost: rawPosts)
+    {
+        if (rawPost.id() < storedBefore && _rawFilenames.find(rawPost.path().filename().string()) != _rawFilenames.end())
+        {
+            cursor.advance(rawPost.id(), rawPost.timestamp());
         }
-        else break;
     }
 
-    if (Poco::Process::isRunning(handle))
+    for (const auto& task: tasks)
     {
-        ofLogWarning("HashtagClient::_loot") << "Process timed out, killing.";
-        Poco::Process::kill(handle);
-        didKill = true;
+        Post& newPost = rawPosts[pendingPosts[task.tag]];
+
+        if (!task.success)
+        {
+            // Not indexed, so it is tried again next poll.
+            ofLogError("HashtagClient::_loot") << "Unable to copy " << newPost.path() << ": " << task.error;
+            continue;
+        }
+
+        std::string filename = newPost.path().filename().string();
+        _rawIndex.insert(std::make_pair(newPost.timestamp(), filename));
+        _rawFilenames.insert(std::move(filename));
+
+        // Update the path.
+        newPost._path = _savePath / Post::relativeStorePathForImage(newPost);
+
+        IO::ImageUtils::ImageHeader header;
+
+        if (IO::ImageUtils::loadHeader(header, newPost.path()))
+        {
+            newPost._width = header.width;
+            newPost._height = header.height;
+        }
+
+        newPosts.push_back(std::move(newPost));
     }
 
-    try
+    probeSpan.setCount(newPosts.size());
+    probeSpan.end();
+
+    if (cursor.id != job.cursor.id)
     {
-        exitCode = handle.wait();
+        if (!FetchCursor::save(_savePath / FetchCursor::FILENAME, cursor))
+        {
+            ofLogError("HashtagClient::_loot") << "Unable to save the cursor of #" << _hashtag;
+        }
+
+        std::unique_lock<std::mutex> lock(_cursorMutex);
+        _cursor = cursor;
     }
-    catch (const std::exception& exc)
+
+    TraceSpan compactSpan("compact_raw");
+    std::size_t cleanedUp = _compactRaw(*fileSink);
+    compactSpan.setCount(cleanedUp);
+    compactSpan.end();
+
+    _rawFileCount = _rawIndex.size();
+
+    ofLogNotice("HashtagClient::_loot") << "#" << _hashtag << " New: " << newPosts.size() << (didKill ? " [killed process]" : "") << " Old: " << alreadySaved << " Cleaned up: " << cleanedUp << " Raw: " << _rawIndex.size() << " Fetched: " << result.progress.items << " Errors: " << result.progress.errors << " Rate limited: " << result.progress.rateLimits << " Outcome: " << FetchResult::toString(outcome);
+
+    TraceSpan sendSpan("send");
+    sendSpan.setCount(newPosts.size());
+    posts.sendBatch(std::move(newPosts));
+}
+
+
+FetchResult::Outcome HashtagClient::_recordOutcome(const FetchResult& result,
+                                                   CircuitBreaker* circuitBreaker,
+                                                   bool probe)
+{
+    FetchResult::Outcome outcome = result.outcome();
+
+    uint64_t now = ofGetElapsedTimeMillis();
+
+    if (circuitBreaker)
+    {
+        // Only Instagram refusing the credential says anything about the
+        // other clients that use it.
+        if (outcome == FetchResult::Outcome::SUCCESS) circuitBreaker->recordSuccess(probe);
+        else if (outcome == FetchResult::Outcome::THROTTLED || outcome == FetchResult::Outcome::AUTH_FAILED) circuitBreaker->recordFailure(now, probe);
+        else circuitBreaker->release(probe);
+    }
+
+    BackoffPolicy backoffPolicy = getBackoffPolicy();
+
+    std::unique_lock<std::mutex> lock(_stateMutex);
+
+    _lastOutcome = outcome;
+    _lastExitCode = result.exitCode;
+    ++_runs;
+
+    if (outcome == FetchResult::Outcome::SUCCESS)
     {
+        _consecutiveFailures = 0;
+        _nextRunTime = 0;
+    }
+    else if (outcome != FetchResult::Outcome::CANCELLED)
+    {
+        ++_consecutiveFailures;
+        ++_failedRuns;
+
+        std::uniform_real_distribution<double> distribution(0.0, 1.0);
+        uint64_t delay = backoffPolicy.delay(_consecutiveFailures, distribution(_random));
+        _nextRunTime = now + delay;
+
+        ofLogWarning("HashtagClient::_recordOutcome") << "#" << _hashtag << " " << FetchResult::toString(outcome) << " (exit code " << result.exitCode << "), " << _consecutiveFailures << " in a row, retrying in " << delay / 1000.0 << " s.";
     }
 
+    return outcome;
+}
+
+
+FetchResult HashtagClient::_fetch(const FetchJob& job)
+{
+    FetchResult result;
+
+    ChildProcess process;
+
     try
     {
-        ofLogVerbose("HashtagClient::_loot") << "Joining Process ...";
-        processThread.join();
+        process.launch(_instaLooterPath.string(), job.toArguments());
     }
-    catch (const std::exception& exc)
+    catch (const Poco::Exception& exc)
     {
-        ofLogVerbose("HashtagClient::_loot") << "Exit: " << exc.what();
+        ofLogError("HashtagClient::_fetch") << exc.displayText();
+        return result;
     }
 
-    ofLogVerbose("HashtagClient::_loot") << "... joined and process exited with code: " << exitCode;
+    {
+        std::unique_lock<std::mutex> lock(_processMutex);
+        _activeProcess = &process;
+        _processPolicy.applyToProcess(process.id());
+    }
 
-    std::vector<std::filesystem::path> paths;
+    // Catch a cancel() that happened before the process was published.
+    if (_shouldStop()) process.kill();
 
-    IO::DirectoryUtils::list(_downloadPath, paths, false, &_fileExtensionFilter);
+    bool outputOpen = true;
 
-    std::vector<Post> rawPosts;
+    // Read in chunks, so memory stays bounded however long the run.
+    std::string chunk;
 
-    // compare new posts to old posts.
-    // sort / copy new posts
-    // remove old posts
-    // new posts remain as reference for downloader
+    uint64_t startTime = ofGetElapsedTimeMillis();
 
-    for (const auto& path: paths)
+    while (process.isRunning())
     {
-        rawPosts.push_back(Post::fromDownloadPath(path));
+        if (_shouldStop())
+        {
+            ofLogVerbose("HashtagClient::_fetch") << "Cancelled, killing.";
+            process.kill();
+            result.killed = true;
+            break;
+        }
+        else if (ofGetElapsedTimeMillis() >= (startTime + _processTimeout))
+        {
+            ofLogWarning("HashtagClient::_fetch") << "Process timed out, killing.";
+            process.kill();
+            result.killed = true;
+            result.timedOut = true;
+            break;
+        }
+
+        // Reading doubles as the wait, so output never fills the pipe.
+        if (outputOpen)
+        {
+            outputOpen = process.read(chunk, PROCESS_THREAD_SLEEP);
+            _output.write(chunk);
+            chunk.clear();
+        }
+        else
+        {
+            _cancellation.waitFor(PROCESS_THREAD_SLEEP);
+        }
     }
 
-    std::vector<Post> newPosts;
-    std::vector<Post> rawPostsToDelete;
+    // Drain whatever is left without waiting on a pipe held by a grandchild.
+    while (!result.killed && outputOpen)
+    {
+        outputOpen = process.read(chunk, 0);
+        if (chunk.empty()) break;
+        _output.write(chunk);
+        chunk.clear();
+    }
+
+    _output.flush();
+
+    process.closeOutput();
+
+    if (!process.wait(PROCESS_THREAD_SLEEP))
+    {
+        ofLogWarning("HashtagClient::_fetch") << "Process did not exit after being killed.";
+    }
 
-    if (!rawPosts.empty())
     {
-        for (const auto& rawPost: rawPosts)
+        std::unique_lock<std::mutex> lock(_processMutex);
+        _activeProcess = nullptr;
+    }
+
+    result.exitCode = process.exitCode();
+    result.output = _output.tailString();
+    result.progress = _output.progress();
+
+    return result;
+}
+
+
+std::size_t HashtagClient::_compactRaw(FileSink& fileSink)
+{
+    std::size_t retention = _dropReferences ? 0 : _rawRetention.load();
+
+    if (_rawIndex.size() <= retention)
+    {
+        return 0;
+    }
+
+    // Bound the work per poll, so a large backlog is removed over several.
+    std::size_t count = std::min(_rawIndex.size() - retention, RAW_COMPACTION_BATCH);
+
+    std::vector<std::set<std::pair<uint64_t, std::string>>::iterator> entries;
+
+    auto iter = _rawIndex.begin();
+
+    for (; entries.size() < count && iter != _rawIndex.end(); ++iter)
+    {
+        // Staged again from its raw download if the store fails to take it in.
+        if (_isUnstored(iter->second)) continue;
+
+        FileTask task;
+        task.tag = entries.size();
+        task.operations.push_back(FileOperation::remove(_downloadPath / iter->second));
+        fileSink.submit(std::move(task));
+        entries.push_back(iter);
+    }
+
+    std::vector<FileTask> tasks;
+    fileSink.drain(tasks);
+
+    std::size_t removed = 0;
+
+    for (const auto& task: tasks)
+    {
+        auto entry = entries[task.tag];
+
+        if (task.success)
+        {
+            ++removed;
+        }
+        else if (std::filesystem::exists(_downloadPath / entry->second))
         {
-            std::filesystem::path newPath = _savePath / Post::relativeStorePathForImage(rawPost);
-            std::filesystem::create_directories(newPath.parent_path());
+            // Try again next poll.
+            continue;
+        }
 
-            // Update the path.
-            Post newPost = rawPost;
-            newPost._path = newPath;
+        _rawFilenames.erase(entry->second);
+        _rawIndex.erase(entry);
+    }
 
-            bool alreadySaved = false;
+    return removed;
+}
 
-            for (const auto& post: _lastPostsSaved)
-            {
-                if (post.path() == newPath)
-                {
-                    alreadySaved = true;
-                    break;
-                }
-            }
 
-            if (alreadySaved || std::filesystem::exists(newPost.path()))
+std::size_t HashtagClient::_recoverStaged()
+{
+    std::vector<Post> stagedPosts;
+
+    try
+    {
+        std::filesystem::recursive_directory_iterator iter(_savePath), end;
+
+        while (iter != end)
+        {
+            const std::filesystem::path& path = iter->path();
+
+            if (std::filesystem::is_directory(path))
             {
-                if (std::filesystem::exists(rawPost.path()))
-                {
-                    rawPostsToDelete.push_back(rawPost);
-                }
+                // Raw downloads are not staged yet.
+                if (path == _downloadPath) iter.no_push();
             }
-            else
+            else if (_fileExtensionFilter.accept(path))
             {
-                std::filesystem::copy(rawPost.path(), newPost.path());
-                std::filesystem::last_write_time(newPost.path(), static_cast<std::time_t>(newPost.timestamp()));
+                try
+                {
+                    Post stagedPost = Post::fromOldSortedPath(path);
+
+                    IO::ImageUtils::ImageHeader header;
 
-                IO::ImageUtils::ImageHeader header;
+                    if (IO::ImageUtils::loadHeader(header, path))
+                    {
+                        stagedPost._width = header.width;
+                        stagedPost._height = header.height;
+                    }
 
-                if (IO::ImageUtils::loadHeader(header, newPost.path()))
+                    _stagedPosts[stagedPost.id()] = std::make_pair(stagedPost.timestamp(), path);
+                    stagedPosts.push_back(std::move(stagedPost));
+                }
+                catch (const std::exception& exc)
                 {
-                    newPost._width = header.width;
-                    newPost._height = header.height;
+                    ofLogWarning("HashtagClient::_recoverStaged") << "Ignoring " << path << ": " << exc.what();
                 }
-
-                newPosts.push_back(newPost);
             }
 
-            if (!isRunning()) break;
+            ++iter;
         }
     }
+    catch (const std::exception& exc)
+    {
+        ofLogError("HashtagClient::_recoverStaged") << "Unable to list " << _savePath << ": " << exc.what();
+    }
+
+    std::size_t count = stagedPosts.size();
+
+    if (count > 0)
+    {
+        ofLogNotice("HashtagClient::_recoverStaged") << "Sending " << count << " posts of #" << _hashtag << " staged by a previous run.";
+        posts.sendBatch(std::move(stagedPosts));
+    }
+
+    return count;
+}
 
-    _lastPostsSaved = newPosts;
 
-    std::size_t cleanedUp = 0;
+void HashtagClient::_restage()
+{
+    std::vector<uint64_t> failedIds;
+
+    {
+        std::unique_lock<std::mutex> lock(_failedIdsMutex);
+        failedIds.swap(_failedIds);
+    }
 
-    if (!newPosts.empty() && !didKill)
+    for (auto id: failedIds)
     {
-        for (const auto& rawImage: rawPostsToDelete)
+        auto stagedIter = _stagedPosts.find(id);
+
+        if (stagedIter == _stagedPosts.end())
+        {
+            continue;
+        }
+
+        // Removed here rather than by the store, so no poll in between
+        // takes the missing copy for a stored post.
+        try
+        {
+            std::filesystem::remove(stagedIter->second.second);
+        }
+        catch (const std::exception& exc)
         {
-            if (std::filesystem::remove(rawImage.path()))
+            ofLogWarning("HashtagClient::_restage") << "Unable to remove " << stagedIter->second.second << ": " << exc.what();
+        }
+
+        _stagedPosts.erase(stagedIter);
+
+        // Forget the raw download, so the next listing parses it again.
+        std::string prefix = std::to_string(id) + ".";
+        bool found = false;
+
+        for (auto iter = _rawIndex.begin(); iter != _rawIndex.end(); ++iter)
+        {
+            if (iter->second.compare(0, prefix.size(), prefix) == 0)
             {
-                ++cleanedUp;
+                found = std::filesystem::exists(_downloadPath / iter->second);
+                _rawFilenames.erase(iter->second);
+                _rawIndex.erase(iter);
+                break;
             }
         }
+
+        if (found)
+        {
+            ofLogWarning("HashtagClient::_restage") << "The store failed to take in " << id << ", staging it again.";
+            _restagedIds.insert(id);
+        }
+        else
+        {
+            // Nothing to stage it from, so holding the cursor back would
+            // only widen every later search.
+            ofLogError("HashtagClient::_restage") << "The store failed to take in " << id << " and its download is gone, skipping it.";
+        }
+    }
+}
+
+
+bool HashtagClient::_isUnstored(const std::string& filename) const
+{
+    std::size_t end = filename.find('.');
+    uint64_t id = 0;
+
+    if (end == std::string::npos || !parseNumber(filename, 0, end, id))
+    {
+        return false;
     }
 
-    ofLogNotice("HashtagClient::_loot") << "#" << _hashtag << " New: " << newPosts.size() << (didKill ? " [killed process]" : "") << " Old: " << rawPostsToDelete.size() << " Cleaned up: " << cleanedUp;
+    return _stagedPosts.find(id) != _stagedPosts.end() ||
+           _restagedIds.find(id) != _restagedIds.end();
+}
+
 
-    for (const auto& post: newPosts) posts.send(post);
+bool HashtagClient::_shouldStop() const
+{
+    return !isRunning() || _cancellation.isCancelled();
 }
 
 
@@ -6,83 +6,187 @@
 
 
 #include "ofx/InstaLooter/HashtagClientManager.h"
+#include <algorithm>
+#include <ctime>
+#include <fstream>
+#include <iterator>
+#include <map>
+#include <set>
+#include <sstream>
 #include "ofx/IO/JSONUtils.h"
+#include "ofUtils.h"
 
 
 namespace ofx {
 namespace InstaLooter {
 
 
+const uint64_t HashtagClientManager::DEFAULT_COMPACTION_INTERVAL = 60000;
+const uint64_t HashtagClientManager::DEFAULT_WATCH_INTERVAL = 1000;
+
 
 HashtagClientManager::HashtagClientManager():
-    IO::PollingThread(std::bind(&HashtagClientManager::_process, this))
+    IO::PollingThread(std::bind(&HashtagClientManager::_process, this)),
+    _postCache(std::make_unique<PostCache>()),
+    _compactor(std::bind(&HashtagClientManager::_compact, this)),
+    _reaperThread(std::bind(&HashtagClientManager::_reap, this)),
+    _lastReloadDuration(0)
 {
 }
 
 
 HashtagClientManager::~HashtagClientManager()
 {
+    {
+        // Cancel every client before joining any of them, so that their
+        // shutdowns overlap instead of adding up. The manager thread is
+        // still running and may be reloading, so the lock is held.
+        std::unique_lock<std::mutex> lock(_clientsMutex);
+        for (auto& client: _clients) client->cancel();
+    }
+
+    if (_reaper) _reaper->cancel();
+
+#if defined(OFX_INSTALOOTER_RING_CHANNELS)
+    // Closed first, as nothing receives any more and a bounded channel would
+    // block the threads and queues sending to it.
+    posts.close();
+    updatedPosts.close();
+    removedPosts.close();
+#endif
+
+    _compactor.stop();
+    _reaperThread.stop();
+    stop();
+
+    {
+        std::unique_lock<std::mutex> lock(_clientsMutex);
+        _clients.clear();
+    }
+
+    // Finish writing everything that was already handed to the queues.
+    _writeQueues.clear();
+
+    if (_merger)
+    {
+        // Release the posts still held back for ordering, now that the
+        // queues have pushed their last ones.
+        std::vector<Post> ready;
 
+        std::unique_lock<std::mutex> lock(_mergerMutex);
+        _merger->flush(ready);
+
+        if (!ready.empty()) _deliver(ready, SharedFeed::Kind::NEW);
+    }
+
+    posts.close();
+    updatedPosts.close();
+    removedPosts.close();
 }
     
 
 void HashtagClientManager::setup(const ofJson& paths, const ofJson& settings)
 {
-    _storePath = ofToDataPath(paths.value("image_store_path", ""), true);
-    _savePath = _storePath / "instagram";
+    // First, so that every thread started below is traced.
+    _traceWriter = TraceWriter::fromJSON(settings.value("trace", ofJson()));
 
-    setPollingInterval(settings.value("manager_polling_interval",
-                                      getPollingInterval()));
+    _store = Store::fromJSON(paths);
+    _storePath = _store->root(0);
 
-    auto instaLooterPath = ofToDataPath(settings.value("instalooter_path",
-                                                       HashtagClient::DEFAULT_INSTALOOTER_PATH),
-                                        true);
+    ofJson fileSinkSettings = settings.value("file_sink", ofJson::object());
 
-    auto credentials = settings.find("credentials");
+    ofJson isolationSettings = settings.value("isolation", ofJson::object());
+    _processPolicy = ResourcePolicy::fromJSON(isolationSettings.value("children", ofJson()));
+    _threadPolicy = ResourcePolicy::fromJSON(isolationSettings.value("ingest", ofJson()));
 
-    std::string username = "";
-    std::string password = "";
+    ofJson postCacheSettings = settings.value("post_cache", ofJson::object());
+    _postCache = PostCache::fromJSON(postCacheSettings);
+    _cacheImages = postCacheSettings.value("image_capacity_mb", 0) > 0;
 
-    if (credentials != settings.end())
+    _merger = PostMerger::fromJSON(settings.value("ordered_output", ofJson()));
+    _feed = SharedFeed::fromJSON(settings.value("shared_feed", ofJson()));
+
+    ofJson hashtagLogSettings = settings.value("hashtag_log", ofJson::object());
+    bool useHashtagLogs = hashtagLogSettings.value("enabled", true);
+
+    bool useJournals = settings.value("ingest_journal", ofJson::object()).value("enabled", true);
+
+    _fileSinkPool = FileSinkPool::fromJSON(fileSinkSettings, _threadPolicy);
+
+    for (std::size_t i = 0; i < _store->size(); ++i)
     {
-        username = credentials->value("username", "");
-        password = credentials->value("password", "");
+        // Pack stores already append metadata updates.
+        if (useHashtagLogs && !_store->packStore(i))
+        {
+            _hashtagLogs.push_back(std::make_unique<HashtagLog>(_store->savePath(i) / HashtagLog::FILENAME));
+        }
+        else
+        {
+            _hashtagLogs.push_back(nullptr);
+        }
+
+        // Opened before the write queues start, as it recovers what a crash
+        // left behind.
+        if (useJournals && !_store->packStore(i))
+        {
+            _journals.push_back(std::make_unique<IngestJournal>(_store->savePath(i) / IngestJournal::FILENAME));
+        }
+        else
+        {
+            _journals.push_back(nullptr);
+        }
+
+        _fileSinks.push_back(_fileSinkPool->createSink());
+        _writeQueues.push_back(std::make_unique<WriteQueue>([this, i](std::vector<Post>& batch) {
+            _write(i, batch);
+        }, _threadPolicy));
     }
 
-    auto searchesIter = settings.find("searches");
+    setPollingInterval(settings.value("manager_polling_interval",
+                                      getPollingInterval()));
 
-    if (searchesIter != settings.end())
+    if (useHashtagLogs)
     {
-        for (const auto& search: *searchesIter)
-        {
-            auto hashtagIter = search.find("hashtag");
+        _compactor.setPollingInterval(hashtagLogSettings.value("compaction_interval",
+                                                               DEFAULT_COMPACTION_INTERVAL));
+        _compactor.start();
+    }
 
-            if (hashtagIter != search.end())
-            {
-                std::string hashtag = hashtagIter->get<std::string>();
+    ofJson retentionSettings = settings.value("retention", ofJson());
+    _reaper = Reaper::fromJSON(retentionSettings, *_store);
+
+    if (_reaper)
+    {
+        _reaperThread.setPollingInterval(retentionSettings.value("interval",
+                                                                 Reaper::DEFAULT_INTERVAL));
+        _reaperThread.start();
+    }
 
-                uint64_t interval = search.value("polling_interval",
-                                                 HashtagClient::DEFAULT_POLLING_INTERVAL);
+    auto workerPoolIter = settings.find("worker_pool");
 
-                uint64_t numImagesToDownload = search.value("num_images_to_download",
-                                                            HashtagClient::DEFAULT_NUM_IMAGES_TO_DOWNLOAD);
+    if (workerPoolIter != settings.end())
+    {
+        _workerPool = WorkerPool::fromJSON(*workerPoolIter);
 
-                auto client = std::make_unique<HashtagClient>(hashtag,
-                                                              username,
-                                                              password,
-                                                              _storePath,
-                                                              interval,
-                                                              numImagesToDownload,
-                                                              instaLooterPath);
+        // Workers are shared by every search, so only the global policy applies.
+        if (_workerPool) _workerPool->setProcessPolicy(_processPolicy);
+    }
 
-                _clients.push_back(std::move(client));
-            }
-            else
-            {
-                ofLogError("HashtagClientManager::setup") << "No hashtag was listed in the search.";
-            }
-        }
+    bool watching = false;
 
+    {
+        std::unique_lock<std::mutex> lock(_reloadMutex);
+        watching = !_settingsPath.empty();
+    }
+
+    if (settings.find("searches") != settings.end())
+    {
+        _updateClients(settings);
+        start();
+    }
+    else if (watching)
+    {
+        // Searches may be added later by the watched file.
         start();
     }
     else
@@ -92,89 +196,1055 @@ void HashtagClientManager::setup(const ofJson& paths, const ofJson& settings)
 }
 
 
+void HashtagClientManager::reload(const ofJson& settings)
+{
+    std::unique_lock<std::mutex> lock(_reloadMutex);
+    _pendingSettings = settings;
+    _hasPendingSettings = true;
+}
+
+
+void HashtagClientManager::watch(const std::filesystem::path& settingsPath,
+                                 const std::string& pointer,
+                                 uint64_t interval)
+{
+    {
+        std::unique_lock<std::mutex> lock(_reloadMutex);
+        _settingsPath = settingsPath;
+        _settingsPointer = pointer;
+        _watchInterval = interval;
+        _lastWatchTime = ofGetElapsedTimeMillis();
+        _settingsModified = _modified(settingsPath);
+    }
+
+    // Reloading needs the store and the queues, so setup() starts polling.
+    if (!_store)
+    {
+        ofLogNotice("HashtagClientManager::watch") << "Watching " << settingsPath << " once the manager is set up.";
+        return;
+    }
+
+    // Searches may be added later, so poll even if there are none yet.
+    if (!isRunning()) start();
+}
+
+
+uint64_t HashtagClientManager::getLastReloadDuration() const
+{
+    return _lastReloadDuration;
+}
+
+
+Store* HashtagClientManager::store()
+{
+    return _store.get();
+}
+
+
+bool HashtagClientManager::getPost(uint64_t id, Post& post)
+{
+    if (_postCache->get(id, post))
+    {
+        return true;
+    }
+    else if (_load(id, post))
+    {
+        // An old post, so it is not one of the recent posts.
+        _postCache->fill(post);
+        return true;
+    }
+
+    return false;
+}
+
+
+std::shared_ptr<const std::string> HashtagClientManager::getImage(uint64_t id) const
+{
+    std::shared_ptr<const std::string> image = _postCache->getImage(id);
+
+    if (image || !_store)
+    {
+        return image;
+    }
+
+    // Posts in a pack have no file, so their images are read from it.
+    PackStore* packStore = _store->packStore(_store->locate(id));
+
+    PackStore::Record record;
+
+    if (packStore && packStore->get(id, record))
+    {
+        image = std::make_shared<std::string>(record.image.data, record.image.size);
+    }
+
+    return image;
+}
+
+
+std::vector<Post> HashtagClientManager::recent(const std::string& hashtag, std::size_t count) const
+{
+    return _postCache->recent(hashtag, count);
+}
+
+
+const PostCache& HashtagClientManager::cache() const
+{
+    return *_postCache;
+}
+
+
+const SharedFeed* HashtagClientManager::feed() const
+{
+    return _feed.get();
+}
+
+
+const Reaper* HashtagClientManager::reaper() const
+{
+    return _reaper.get();
+}
+
+
+std::vector<HashtagClient::State> HashtagClientManager::clientStates() const
+{
+    std::unique_lock<std::mutex> lock(_clientsMutex);
+
+    std::vector<HashtagClient::State> states;
+    states.reserve(_clients.size());
+
+    for (const auto& client: _clients)
+    {
+        states.push_back(client->getState());
+    }
+
+    return states;
+}
+
+
 void HashtagClientManager::_process()
 {
+    if (Trace::isEnabled()) Trace::setThreadName("HashtagClientManager");
+
+    TraceSpan processSpan("process");
+
+    if (!_threadPolicyApplied)
+    {
+        _threadPolicy.applyToThread();
+        _threadPolicyApplied = true;
+    }
+
+    // Clients are only added and removed here, under _clientsMutex, so
+    // reading _clients on this thread needs no lock.
+    _checkSettings();
+
     for (auto& client: _clients)
     {
-        Post post;
+        _route(*client);
+    }
 
-        while (client->posts.tryReceive(post) && isRunning())
-        {
-            std::filesystem::path newPath = _savePath / Post::relativeStorePathForImage(post);
+    if (_merger)
+    {
+        TraceSpan pollSpan("merge_poll");
 
-            Post newPost(newPath,
-                         post.id(),
-                         post.userId(),
-                         post.timestamp(),
-                         post.width(),
-                         post.height(),
-                         post.hashtags());
+        // Release posts held back by a quiet hashtag.
+        std::vector<Post> ready;
 
-            std::filesystem::path jsonPath = newPath;
-            jsonPath.replace_extension(".json.gz");
+        std::unique_lock<std::mutex> lock(_mergerMutex);
+        _merger->poll(ofGetElapsedTimeMillis(), ready);
 
-            if (!std::filesystem::exists(newPath))
-            {
-                ofJson newPostJson;
+        if (!ready.empty()) _deliver(ready, SharedFeed::Kind::NEW);
+    }
+}
 
-                if (std::filesystem::exists(jsonPath))
-                {
-                    ofLogError("HashtagClientManager::_process") << "No image, but was json - overwriting.";
-                }
 
-                newPostJson = Post::toJSON(newPost);
+void HashtagClientManager::_route(HashtagClient& client)
+{
+    _receivedPosts.clear();
 
-                std::filesystem::create_directories(newPath.parent_path());
-                std::filesystem::rename(post.path(), newPath);
+    TraceSpan routeSpan("route");
 
-                ofx::IO::JSONUtils::saveJSON(jsonPath, Post::toJSON(newPost));
+    // Take everything the client has found with a single lock.
+    client.posts.receiveAll(_receivedPosts);
 
-                posts.send(newPost);
-            }
-            else
+    routeSpan.setCount(_receivedPosts.size());
+
+    // Route each post to the queue of the root that holds it. The whole
+    // batch is routed, even while stopping, as it was already taken from
+    // the client and would otherwise be lost.
+    for (auto& post: _receivedPosts)
+    {
+        _writeQueues[_store->rootFor(post)]->send(std::move(post));
+    }
+}
+
+
+void HashtagClientManager::_checkSettings()
+{
+    ofJson settings;
+
+    {
+        std::unique_lock<std::mutex> lock(_reloadMutex);
+
+        uint64_t now = ofGetElapsedTimeMillis();
+
+        if (!_settingsPath.empty() && now >= _lastWatchTime + _watchInterval)
+        {
+            _lastWatchTime = now;
+
+            std::pair<std::time_t, uintmax_t> modified = _modified(_settingsPath);
+
+            if (modified != _settingsModified)
             {
-                ofJson existingPostJson;
+                // Remembered even if the file does not parse, as it is
+                // likely mid-edit and will change again.
+                _settingsModified = modified;
+
+                ofJson json;
 
-                if (ofx::IO::JSONUtils::loadJSON(jsonPath, existingPostJson))
+                if (!IO::JSONUtils::loadJSON(_settingsPath, json))
                 {
-                    ofLogError("HashtagClientManager::_process") << "Image, but invalid json, saving afterall.";
-                    ofx::IO::JSONUtils::saveJSON(jsonPath, Post::toJSON(newPost));
-                    updatedPosts.send(newPost);
+                    ofLogWarning("HashtagClientManager::_checkSettings") << "Unable to load " << _settingsPath << ", keeping the current searches.";
                 }
                 else
                 {
                     try
                     {
-                        Post existingPost = Post::fromJSON(existingPostJson);
-
-                        auto oldHashtags = existingPost.hashtags();
-                        auto oldNumHashtags = oldHashtags.size();
-
-                        auto newHashtags = newPost.hashtags();
-
-                        oldHashtags.insert(newHashtags.begin(),
-                                           newHashtags.end());
-
-                        if (oldNumHashtags != oldHashtags.size())
-                        {
-                            existingPost._hashtags = oldHashtags;
-                            ofx::IO::JSONUtils::saveJSON(jsonPath, Post::toJSON(existingPost));
-                            updatedPosts.send(existingPost);
-                        }
-                        else
-                        {
-                            // skipping
-                        }
+                        _pendingSettings = json.at(ofJson::json_pointer(_settingsPointer));
+                        _hasPendingSettings = true;
                     }
-                    catch (const std::exception& e)
+                    catch (const std::exception& exc)
                     {
-                        ofLogError("HashtagClientManager::_process") << "Unable to load exisitng post json.";
-                        ofx::IO::JSONUtils::saveJSON(jsonPath, Post::toJSON(newPost));
-                        updatedPosts.send(newPost);
+                        ofLogWarning("HashtagClientManager::_checkSettings") << "No settings at \"" << _settingsPointer << "\" in " << _settingsPath << ": " << exc.what();
                     }
                 }
             }
         }
+
+        if (!_hasPendingSettings)
+        {
+            return;
+        }
+
+        settings.swap(_pendingSettings);
+        _hasPendingSettings = false;
+    }
+
+    TraceSpan reloadSpan("reload");
+
+    uint64_t startTime = ofGetElapsedTimeMillis();
+
+    _updateClients(settings);
+
+    _lastReloadDuration = ofGetElapsedTimeMillis() - startTime;
+
+    ofLogNotice("HashtagClientManager::_checkSettings") << "Reloaded searches in " << _lastReloadDuration << " ms.";
+}
+
+
+void HashtagClientManager::_updateClients(const ofJson& settings)
+{
+    auto searchesIter = settings.find("searches");
+
+    if (searchesIter == settings.end())
+    {
+        ofLogError("HashtagClientManager::_updateClients") << "No searches were in the settings, keeping the current searches.";
+        return;
+    }
+
+    std::map<std::string, ofJson> searches;
+
+    for (const auto& search: *searchesIter)
+    {
+        auto hashtagIter = search.find("hashtag");
+
+        if (hashtagIter == search.end())
+        {
+            ofLogError("HashtagClientManager::_updateClients") << "No hashtag was listed in the search.";
+        }
+        else if (!searches.insert(std::make_pair(hashtagIter->get<std::string>(), search)).second)
+        {
+            ofLogWarning("HashtagClientManager::_updateClients") << "Ignoring duplicate search for #" << hashtagIter->get<std::string>();
+        }
+    }
+
+    // Cancel every removed client before joining any of them.
+    std::vector<std::unique_ptr<HashtagClient>> removed;
+
+    {
+        // Held across the move and the erase, so clientStates() never sees
+        // an emptied slot.
+        std::unique_lock<std::mutex> lock(_clientsMutex);
+
+        for (auto& client: _clients)
+        {
+            if (searches.find(client->getHashtag()) == searches.end())
+            {
+                client->cancel();
+                removed.push_back(std::move(client));
+            }
+        }
+
+        _clients.erase(std::remove(_clients.begin(), _clients.end(), nullptr), _clients.end());
+    }
+
+    for (auto& client: removed)
+    {
+        // Keep what the last poll found, so its downloads are not orphaned.
+        _route(*client);
+        client->stop();
+        _route(*client);
+
+        // Otherwise its empty stream would hold back every other hashtag.
+        if (_merger)
+        {
+            std::unique_lock<std::mutex> lock(_mergerMutex);
+            _merger->removeStream(client->getHashtag());
+        }
+
+        ofLogNotice("HashtagClientManager::_updateClients") << "Stopped #" << client->getHashtag();
+    }
+
+    removed.clear();
+
+    // Existing clients keep their raw index and threads, only their
+    // settings change.
+    for (auto& client: _clients)
+    {
+        const ofJson& search = searches[client->getHashtag()];
+        ofJson isolation = search.value("isolation", ofJson::object());
+
+        client->setPollingInterval(search.value("polling_interval",
+                                                HashtagClient::DEFAULT_POLLING_INTERVAL));
+        client->setNumImagesToDownload(search.value("num_images_to_download",
+                                                    HashtagClient::DEFAULT_NUM_IMAGES_TO_DOWNLOAD));
+        client->setRawRetention(search.value("raw_retention",
+                                             HashtagClient::DEFAULT_RAW_RETENTION));
+        client->setTimeFilter(search.value("time_filter", settings.value("time_filter", false)));
+        client->setDropReferences(search.value("drop_references", settings.value("drop_references", false)));
+        client->setProcessPolicy(ResourcePolicy::fromJSON(isolation.value("children", ofJson()), _processPolicy));
+        client->setThreadPolicy(ResourcePolicy::fromJSON(isolation.value("ingest", ofJson()), _threadPolicy));
+        client->setBackoffPolicy(BackoffPolicy::fromJSON(search.value("backoff", settings.value("backoff", ofJson()))));
+
+        searches.erase(client->getHashtag());
+    }
+
+    if (searches.empty())
+    {
+        return;
+    }
+
+    // Shared settings only apply to new clients.
+    auto instaLooterPath = ofToDataPath(settings.value("instalooter_path",
+                                                       HashtagClient::DEFAULT_INSTALOOTER_PATH),
+                                        true);
+
+    auto credentials = settings.find("credentials");
+
+    std::string username = "";
+    std::string password = "";
+
+    if (credentials != settings.end())
+    {
+        username = credentials->value("username", "");
+        password = credentials->value("password", "");
+    }
+
+    // Throttling follows the account, so every search using it shares one
+    // breaker. Its settings are read when the account is first used.
+    auto circuitBreakerIter = _circuitBreakers.find(username);
+
+    if (circuitBreakerIter == _circuitBreakers.end())
+    {
+        auto circuitBreaker = CircuitBreaker::fromJSON(settings.value("circuit_breaker", ofJson()),
+                                                       username.empty() ? "anonymous" : username);
+
+        circuitBreakerIter = _circuitBreakers.insert(std::make_pair(username, circuitBreaker)).first;
+    }
+
+    for (const auto& entry: searches)
+    {
+        const ofJson& search = entry.second;
+        ofJson isolation = search.value("isolation", ofJson::object());
+
+        ResourcePolicy processPolicy = ResourcePolicy::fromJSON(isolation.value("children", ofJson()), _processPolicy);
+        ResourcePolicy threadPolicy = ResourcePolicy::fromJSON(isolation.value("ingest", ofJson()), _threadPolicy);
+
+        uint64_t interval = search.value("polling_interval",
+                                         HashtagClient::DEFAULT_POLLING_INTERVAL);
+
+        uint64_t numImagesToDownload = search.value("num_images_to_download",
+                                                    HashtagClient::DEFAULT_NUM_IMAGES_TO_DOWNLOAD);
+
+        // Started once configured, so the first poll already runs with the
+        // sink, policies and breaker.
+        auto client = std::make_unique<HashtagClient>(entry.first,
+                                                      username,
+                                                      password,
+                                                      _storePath,
+                                                      interval,
+                                                      numImagesToDownload,
+                                                      instaLooterPath,
+                                                      _workerPool,
+                                                      false);
+
+        client->setFileSink(_fileSinkPool->createSink());
+        client->setRawRetention(search.value("raw_retention",
+                                             HashtagClient::DEFAULT_RAW_RETENTION));
+        client->setTimeFilter(search.value("time_filter", settings.value("time_filter", false)));
+        client->setDropReferences(search.value("drop_references", settings.value("drop_references", false)));
+        client->setProcessPolicy(processPolicy);
+        client->setThreadPolicy(threadPolicy);
+        client->setBackoffPolicy(BackoffPolicy::fromJSON(search.value("backoff", settings.value("backoff", ofJson()))));
+        client->setCircuitBreaker(circuitBreakerIter->second);
+
+        if (_merger)
+        {
+            std::unique_lock<std::mutex> lock(_mergerMutex);
+            _merger->addStream(entry.first);
+        }
+
+        client->start();
+
+        ofLogNotice("HashtagClientManager::_updateClients") << "Started #" << entry.first;
+
+        std::unique_lock<std::mutex> lock(_clientsMutex);
+        _clients.push_back(std::move(client));
+    }
+}
+
+
+std::pair<std::time_t, uintmax_t> HashtagClientManager::_modified(const std::filesystem::path& path)
+{
+    try
+    {
+        return std::make_pair(std::filesystem::last_write_time(path),
+                              std::filesystem::file_size(path));
+    }
+    catch (const std::exception&)
+    {
+        // Missing while an editor replaces it.
+        return std::make_pair(std::time_t(0), uintmax_t(0));
+    }
+}
+
+
+void HashtagClientManager::_write(std::size_t root, std::vector<Post>& batch)
+{
+    if (Trace::isEnabled()) Trace::setThreadName("WriteQueue " + std::to_string(root));
+
+    TraceSpan writeSpan("write");
+    writeSpan.setCount(batch.size());
+
+    PackStore* packStore = _store->packStore(root);
+
+    if (packStore)
+    {
+        _writePacked(*packStore, batch);
+        return;
+    }
+
+    FileSink& fileSink = *_fileSinks[root];
+    HashtagLog* hashtagLog = _hashtagLogs[root].get();
+    IngestJournal* journal = _journals[root].get();
+
+    std::vector<Post> newPosts;
+    std::vector<Post> changedPosts;
+
+    std::vector<Post> pendingPosts;
+    std::vector<FileTask> submissions;
+    std::vector<IngestJournal::Intent> intents;
+    std::vector<FileTask> tasks;
+    std::vector<Post> deferred;
+    std::vector<Post> failedPosts;
+    std::set<uint64_t> pendingIds;
+
+    while (!batch.empty())
+    {
+        for (auto& newPost: batch)
+        {
+            // A post found by two clients must see the first copy on disk.
+            if (pendingIds.find(newPost.id()) != pendingIds.end())
+            {
+                deferred.push_back(std::move(newPost));
+                continue;
+            }
+
+            try
+            {
+                // A resharder may be moving the post, so look for it under its lock.
+                std::unique_lock<std::mutex> lock(_store->mutexFor(newPost.id()));
+
+                std::filesystem::path newPath;
+                bool found = _store->find(newPost, newPath);
+
+                // Move the post in place, keeping the client's path as the source.
+                std::filesystem::path sourcePath = std::move(newPost._path);
+                newPost._path = newPath;
+
+                std::filesystem::path jsonPath = newPath;
+                jsonPath.replace_extension(".json.gz");
+
+                if (!found)
+                {
+                    if (std::filesystem::exists(jsonPath))
+                    {
+                        ofLogError("HashtagClientManager::_write") << "No image, but was json - overwriting.";
+                    }
+
+                    ofJson metadata = Post::toJSON(newPost);
+
+                    // The metadata is renamed into place last, so it is
+                    // never there without its image.
+                    std::filesystem::path temporaryJSONPath = IngestJournal::temporaryPathFor(jsonPath);
+
+                    FileTask task;
+                    task.tag = pendingPosts.size();
+                    task.operations.push_back(FileOperation::createDirectories(newPath.parent_path()));
+                    task.operations.push_back(FileOperation::writeJSON(temporaryJSONPath, metadata));
+                    task.operations.push_back(FileOperation::move(sourcePath, newPath));
+                    task.operations.push_back(FileOperation::move(temporaryJSONPath, jsonPath));
+
+                    if (journal)
+                    {
+                        IngestJournal::Intent intent;
+                        intent.id = newPost.id();
+                        intent.source = sourcePath;
+                        intent.image = newPath;
+                        intent.json = jsonPath;
+                        intent.metadata = std::move(metadata);
+                        intents.push_back(std::move(intent));
+                    }
+
+                    // Written without the lock, so the checker leaves
+                    // it alone until the task is done.
+                    _store->beginWrite(newPost.id());
+
+                    pendingIds.insert(newPost.id());
+                    pendingPosts.push_back(std::move(newPost));
+                    submissions.push_back(std::move(task));
+                }
+                else
+                {
+                    TraceSpan mergeSpan("merge_existing");
+
+                    Post existingPost;
+                    bool loaded = _postCache->get(newPost.id(), existingPost);
+
+                    if (!loaded)
+                    {
+                        ofJson existingPostJson;
+
+                        if (ofx::IO::JSONUtils::loadJSON(jsonPath, existingPostJson))
+                        {
+                            // fromJSON() logs a parse error and returns a
+                            // post without an id rather than throwing.
+                            existingPost = Post::fromJSON(existingPostJson);
+                            loaded = existingPost.id() == newPost.id();
+
+                            if (!loaded)
+                            {
+                                ofLogError("HashtagClientManager::_write") << "Invalid json for " << newPost.id() << ", saving afterall.";
+                            }
+                        }
+                        else
+                        {
+                            ofLogError("HashtagClientManager::_write") << "Image, but invalid json, saving afterall.";
+                        }
+
+                        if (loaded && hashtagLog)
+                        {
+                            auto logged = hashtagLog->hashtags(newPost.id());
+                            existingPost._hashtags.insert(logged.begin(), logged.end());
+                        }
+                    }
+
+                    if (!loaded)
+                    {
+                        IngestJournal::replaceJSON(jsonPath, Post::toJSON(newPost));
+                        std::filesystem::remove(sourcePath);
+                        changedPosts.push_back(std::move(newPost));
+                        continue;
+                    }
+
+                    std::set<std::string> added;
+
+                    std::set_difference(newPost._hashtags.begin(), newPost._hashtags.end(),
+                                        existingPost._hashtags.begin(), existingPost._hashtags.end(),
+                                        std::inserter(added, added.end()));
+
+                    if (!added.empty())
+                    {
+                        existingPost._hashtags.insert(added.begin(), added.end());
+                        existingPost._downloadTime = newPost._downloadTime;
+
+                        // Appending to the log is much cheaper than
+                        // rewriting the .json.gz, which is left to the
+                        // compactor.
+                        if (hashtagLog)
+                        {
+                            hashtagLog->add(existingPost.id(), added);
+                        }
+                        else
+                        {
+                            IngestJournal::replaceJSON(jsonPath, Post::toJSON(existingPost));
+                        }
+
+                        // Keep the merged view for duplicates later in this batch.
+                        _postCache->put(existingPost);
+
+                        changedPosts.push_back(std::move(existingPost));
+                    }
+
+                    // The client's copy is only needed until the post is in
+                    // the store, so that a restart can send it again.
+                    std::filesystem::remove(sourcePath);
+                }
+            }
+            catch (const std::exception& exc)
+            {
+                ofLogError("HashtagClientManager::_write") << "Unable to write post: " << exc.what();
+                failedPosts.push_back(std::move(newPost));
+            }
+        }
+
+        // Journal the whole pass with one write before any file is touched.
+        if (journal)
+        {
+            TraceSpan journalSpan("journal");
+            journalSpan.setCount(intents.size());
+            journal->begin(intents);
+            intents.clear();
+        }
+
+        for (auto& task: submissions)
+        {
+            fileSink.submit(std::move(task));
+        }
+
+        submissions.clear();
+
+        // Wait for this pass, then run any deferred duplicates.
+        TraceSpan drainSpan("write_files");
+        tasks.clear();
+        fileSink.drain(tasks);
+        drainSpan.setCount(tasks.size());
+        drainSpan.end();
+
+        for (const auto& task: tasks)
+        {
+            if (task.success)
+            {
+                newPosts.push_back(std::move(pendingPosts[task.tag]));
+            }
+            else
+            {
+                ofLogError("HashtagClientManager::_write") << "Unable to write post: " << task.error;
+
+                std::filesystem::path jsonPath = pendingPosts[task.tag].path();
+                jsonPath.replace_extension(".json.gz");
+
+                try
+                {
+                    std::filesystem::remove(IngestJournal::temporaryPathFor(jsonPath));
+                }
+                catch (const std::exception&)
+                {
+                }
+
+                failedPosts.push_back(std::move(pendingPosts[task.tag]));
+            }
+        }
+
+        if (journal)
+        {
+            journal->commit();
+        }
+
+        for (auto id: pendingIds)
+        {
+            _store->endWrite(id);
+        }
+
+        pendingPosts.clear();
+        pendingIds.clear();
+
+        batch.swap(deferred);
+        deferred.clear();
+    }
+
+    if (!failedPosts.empty()) _rejected(failedPosts);
+
+    TraceSpan cacheSpan("cache");
+    _cache(newPosts);
+    _cache(changedPosts);
+    cacheSpan.end();
+
+    if (_reaper)
+    {
+        TraceSpan indexSpan("retention_index");
+        _reaper->add(root, newPosts);
+        _reaper->add(root, changedPosts);
+    }
+
+    TraceSpan sendSpan("send");
+
+    // Hand off everything written in this batch with a single lock per channel.
+    if (!newPosts.empty()) _send(newPosts);
+    if (!changedPosts.empty()) _deliver(changedPosts, SharedFeed::Kind::UPDATED);
+}
+
+
+void HashtagClientManager::_writePacked(PackStore& packStore, std::vector<Post>& batch)
+{
+    std::vector<Post> newPosts;
+    std::vector<Post> changedPosts;
+    std::vector<Post> failedPosts;
+
+    for (auto& newPost: batch)
+    {
+        try
+        {
+            std::filesystem::path sourcePath = std::move(newPost._path);
+
+            // There is no file to point at. The locator keeps the extension,
+            // which exportTo() needs.
+            newPost._path = PackStore::locatorFor(newPost.id(), sourcePath.extension());
+
+            ofJson existingPostJson;
+
+            if (!packStore.getMetadata(newPost.id(), existingPostJson))
+            {
+                packStore.append(newPost.id(), sourcePath, Post::toJSON(newPost));
+                std::filesystem::remove(sourcePath);
+                newPosts.push_back(std::move(newPost));
+                continue;
+            }
+
+            Post existingPost = Post::fromJSON(existingPostJson);
+
+            auto oldNumHashtags = existingPost._hashtags.size();
+
+            existingPost._hashtags.insert(newPost._hashtags.begin(),
+                                          newPost._hashtags.end());
+
+            if (oldNumHashtags != existingPost._hashtags.size())
+            {
+                existingPost._downloadTime = newPost._downloadTime;
+                packStore.updateMetadata(existingPost.id(), Post::toJSON(existingPost));
+                changedPosts.push_back(std::move(existingPost));
+            }
+
+            std::filesystem::remove(sourcePath);
+        }
+        catch (const std::exception& exc)
+        {
+            ofLogError("HashtagClientManager::_writePacked") << "Unable to write post: " << exc.what();
+            failedPosts.push_back(std::move(newPost));
+        }
+    }
+
+    if (!failedPosts.empty()) _rejected(failedPosts);
+
+    _cache(newPosts);
+    _cache(changedPosts);
+
+    if (!newPosts.empty()) _send(newPosts);
+    if (!changedPosts.empty()) _deliver(changedPosts, SharedFeed::Kind::UPDATED);
+}
+
+
+void HashtagClientManager::_rejected(const std::vector<Post>& batch)
+{
+    // The clients of the post's hashtags restage it. Posts of a stopped
+    // client are recovered from their staged copies on the next start.
+    std::unique_lock<std::mutex> lock(_clientsMutex);
+
+    for (const auto& post: batch)
+    {
+        for (auto& client: _clients)
+        {
+            if (post.hashtags().find(client->getHashtag()) != post.hashtags().end())
+            {
+                client->storeFailed(post.id());
+            }
+        }
+    }
+}
+
+
+void HashtagClientManager::_send(std::vector<Post>& batch)
+{
+    if (!_merger)
+    {
+        _deliver(batch, SharedFeed::Kind::NEW);
+        return;
+    }
+
+    std::vector<Post> ready;
+
+    std::unique_lock<std::mutex> lock(_mergerMutex);
+    _merger->push(batch, ofGetElapsedTimeMillis(), ready);
+
+    if (!ready.empty()) _deliver(ready, SharedFeed::Kind::NEW);
+}
+
+
+void HashtagClientManager::_deliver(std::vector<Post>& batch, SharedFeed::Kind kind)
+{
+    // Published first, as the batch is moved into the channel.
+    if (_feed) _feed->publish(batch, kind);
+
+    if (kind == SharedFeed::Kind::UPDATED)
+    {
+        updatedPosts.sendBatch(std::move(batch));
+    }
+    else
+    {
+        posts.sendBatch(std::move(batch));
+    }
+}
+
+
+void HashtagClientManager::_cache(const std::vector<Post>& batch)
+{
+    for (const auto& post: batch)
+    {
+        std::shared_ptr<const std::string> image;
+
+        if (_cacheImages)
+        {
+            PackStore* packStore = _store->packStore(_store->locate(post.id()));
+
+            if (packStore)
+            {
+                PackStore::Record record;
+
+                if (packStore->get(post.id(), record))
+                {
+                    image = std::make_shared<std::string>(record.image.data, record.image.size);
+                }
+            }
+            else
+            {
+                std::ifstream input(post.path().string(), std::ios::binary);
+                std::ostringstream buffer;
+                buffer << input.rdbuf();
+
+                if (input)
+                {
+                    image = std::make_shared<std::string>(buffer.str());
+                }
+            }
+        }
+
+        _postCache->put(post, image);
+    }
+}
+
+
+bool HashtagClientManager::_load(uint64_t id, Post& post) const
+{
+    if (!_store)
+    {
+        return false;
+    }
+
+    std::size_t root = _store->locate(id);
+
+    if (_load(root, id, post))
+    {
+        return true;
+    }
+
+    // Stored before the store was sharded, so it stays in the first root.
+    return root != 0 && _store->isUnrecorded(id) && _load(0, id, post);
+}
+
+
+bool HashtagClientManager::_load(std::size_t root, uint64_t id, Post& post) const
+{
+    ofJson json;
+
+    PackStore* packStore = _store->packStore(root);
+
+    if (packStore)
+    {
+        if (!packStore->getMetadata(id, json))
+        {
+            return false;
+        }
+
+        post = Post::fromJSON(json);
+        return true;
+    }
+
+    std::filesystem::path jsonPath;
+
+    if (!_findJSON(root, id, jsonPath) || !ofx::IO::JSONUtils::loadJSON(jsonPath, json))
+    {
+        return false;
+    }
+
+    post = Post::fromJSON(json);
+
+    if (_hashtagLogs[root])
+    {
+        auto logged = _hashtagLogs[root]->hashtags(id);
+        post._hashtags.insert(logged.begin(), logged.end());
+    }
+
+    return true;
+}
+
+
+bool HashtagClientManager::_findJSON(std::size_t root,
+                                     uint64_t id,
+                                     std::filesystem::path& jsonPath) const
+{
+    // The filename also holds the user id and timestamp, so list the
+    // post's directory, which is small.
+    std::vector<StoreLayout> layouts = { _store->layout() };
+
+    if (_store->isResharding())
+    {
+        layouts.push_back(_store->previousLayout());
+    }
+
+    std::string prefix = std::to_string(id) + ".";
+
+    for (const auto& layout: layouts)
+    {
+        try
+        {
+            std::filesystem::path directory = _store->savePath(root) / layout.directoryFor(id);
+
+            if (!std::filesystem::is_directory(directory))
+            {
+                continue;
+            }
+
+            std::filesystem::directory_iterator iter(directory), end;
+
+            for (; iter != end; ++iter)
+            {
+                std::string name = iter->path().filename().string();
+
+                if (name.compare(0, prefix.size(), prefix) == 0 &&
+                    iter->path().extension() == ".gz")
+                {
+                    jsonPath = iter->path();
+                    return true;
+                }
+            }
+        }
+        catch (const std::exception& exc)
+        {
+            ofLogError("HashtagClientManager::_findJSON") << "Unable to list the directory of " << id << ": " << exc.what();
+        }
+    }
+
+    return false;
+}
+
+
+void HashtagClientManager::_compact()
+{
+    for (std::size_t i = 0; i < _hashtagLogs.size(); ++i)
+    {
+        if (!_hashtagLogs[i] || _hashtagLogs[i]->size() == 0)
+        {
+            continue;
+        }
+
+        uint64_t startTime = ofGetElapsedTimeMillis();
+
+        std::size_t applied = _hashtagLogs[i]->compact([this, i](uint64_t id, const std::set<std::string>& hashtags) {
+            return _applyHashtags(i, id, hashtags);
+        });
+
+        ofLogVerbose("HashtagClientManager::_compact") << "Folded hashtags into " << applied << " posts in " << (ofGetElapsedTimeMillis() - startTime) << " ms, " << _hashtagLogs[i]->size() << " left.";
+    }
+}
+
+
+void HashtagClientManager::_reap()
+{
+    if (Trace::isEnabled()) Trace::setThreadName("Reaper");
+
+    if (!_reaperThreadPolicyApplied)
+    {
+        _threadPolicy.applyToThread();
+        _reaperThreadPolicyApplied = true;
+    }
+
+    _reaper->reap(std::time(nullptr), [this](std::vector<Post>& removed) {
+        _removed(removed);
+    });
+}
+
+
+void HashtagClientManager::_removed(std::vector<Post>& batch)
+{
+    for (const auto& post: batch)
+    {
+        _postCache->remove(post.id());
+    }
+
+    if (_feed) _feed->publish(batch, SharedFeed::Kind::REMOVED);
+
+    removedPosts.sendBatch(std::move(batch));
+}
+
+
+bool HashtagClientManager::_applyHashtags(std::size_t root,
+                                          uint64_t id,
+                                          const std::set<std::string>& hashtags)
+{
+    // Writers and the resharder hold the same lock while they use the file.
+    std::unique_lock<std::mutex> lock(_store->mutexFor(id));
+
+    std::filesystem::path jsonPath;
+
+    if (!_findJSON(root, id, jsonPath))
+    {
+        ofLogWarning("HashtagClientManager::_applyHashtags") << "Dropping hashtags of missing post " << id << ".";
+        return true;
+    }
+
+    ofJson json;
+
+    if (!ofx::IO::JSONUtils::loadJSON(jsonPath, json))
+    {
+        ofLogError("HashtagClientManager::_applyHashtags") << "Unable to load " << jsonPath;
+        return false;
+    }
+
+    try
+    {
+        Post post = Post::fromJSON(json);
+
+        auto oldNumHashtags = post._hashtags.size();
+
+        post._hashtags.insert(hashtags.begin(), hashtags.end());
+
+        if (oldNumHashtags == post._hashtags.size())
+        {
+            return true;
+        }
+
+        // Replace atomically, readers may load the file at any time.
+        if (!IngestJournal::replaceJSON(jsonPath, Post::toJSON(post)))
+        {
+            ofLogError("HashtagClientManager::_applyHashtags") << "Unable to write " << jsonPath;
+            return false;
+        }
+
+        return true;
+    }
+    catch (const std::exception& exc)
+    {
+        ofLogError("HashtagClientManager::_applyHashtags") << "Unable to update " << jsonPath << ": " << exc.what();
+        return false;
     }
 }
 
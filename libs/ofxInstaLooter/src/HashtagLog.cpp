@@ -0,0 +1,268 @@
+//
+// Copyright (c) 2017 Christopher Baker <https://christopherbaker.net>
+//
+// SPDX-License-Identifier:	MIT
+//
+
+
+#include "ofx/InstaLooter/HashtagLog.h"
+#include <sstream>
+#include "Poco/Exception.h"
+#include "ofLog.h"
+
+
+namespace ofx {
+namespace InstaLooter {
+
+
+const std::string HashtagLog::FILENAME = "hashtags.log";
+const std::size_t HashtagLog::MAX_ATTEMPTS = 5;
+
+
+HashtagLog::HashtagLog(const std::filesystem::path& path):
+    _path(path)
+{
+    _read(_compactingPath(), _compacting);
+    _read(_path, _pending);
+
+    _stream.open(_path.string(), std::ios::binary | std::ios::app);
+
+    if (!_stream)
+    {
+        throw Poco::IOException("Unable to open " + _path.string());
+    }
+}
+
+
+std::filesystem::path HashtagLog::path() const
+{
+    return _path;
+}
+
+
+void HashtagLog::add(uint64_t id, const std::set<std::string>& hashtags)
+{
+    if (hashtags.empty())
+    {
+        return;
+    }
+
+    std::unique_lock<std::mutex> lock(_mutex);
+
+    _writeLine(_stream, id, hashtags);
+    _stream.flush();
+
+    if (!_stream)
+    {
+        ofLogError("HashtagLog::add") << "Unable to write to " << _path;
+        _stream.clear();
+    }
+
+    _pending[id].insert(hashtags.begin(), hashtags.end());
+}
+
+
+std::set<std::string> HashtagLog::hashtags(uint64_t id) const
+{
+    std::set<std::string> result;
+
+    std::unique_lock<std::mutex> lock(_mutex);
+
+    auto iter = _compacting.find(id);
+
+    if (iter != _compacting.end())
+    {
+        result = iter->second;
+    }
+
+    iter = _pending.find(id);
+
+    if (iter != _pending.end())
+    {
+        result.insert(iter->second.begin(), iter->second.end());
+    }
+
+    return result;
+}
+
+
+std::size_t HashtagLog::size() const
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    return _pending.size() + _compacting.size();
+}
+
+
+std::size_t HashtagLog::compact(const Apply& apply)
+{
+    std::unique_lock<std::mutex> compactionLock(_compactionMutex);
+
+    Additions additions;
+
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+
+        // Only start on the current log once the last one is finished.
+        if (_compacting.empty() && !_pending.empty())
+        {
+            _stream.close();
+
+            try
+            {
+                std::filesystem::rename(_path, _compactingPath());
+                _compacting.swap(_pending);
+            }
+            catch (const std::exception& exc)
+            {
+                ofLogError("HashtagLog::compact") << "Unable to move " << _path << " aside: " << exc.what();
+            }
+
+            _stream.open(_path.string(), std::ios::binary | std::ios::app);
+        }
+
+        additions = _compacting;
+    }
+
+    std::size_t applied = 0;
+    std::size_t dropped = 0;
+
+    for (const auto& addition: additions)
+    {
+        if (!apply(addition.first, addition.second))
+        {
+            // Otherwise one bad post would hold back every later compaction.
+            if (++_attempts[addition.first] < MAX_ATTEMPTS)
+            {
+                continue;
+            }
+
+            // The line as it was in the log, so it can be added back by hand.
+            std::stringstream line;
+            _writeLine(line, addition.first, addition.second);
+
+            std::string text = line.str();
+            text.pop_back();
+
+            ofLogError("HashtagLog::compact") << "Dropping hashtags after " << MAX_ATTEMPTS << " failed attempts: " << text;
+
+            ++dropped;
+        }
+        else
+        {
+            ++applied;
+        }
+
+        _attempts.erase(addition.first);
+
+        std::unique_lock<std::mutex> lock(_mutex);
+        _compacting.erase(addition.first);
+    }
+
+    std::unique_lock<std::mutex> lock(_mutex);
+
+    if (_compacting.empty())
+    {
+        std::filesystem::remove(_compactingPath());
+    }
+    else if (applied + dropped > 0)
+    {
+        // Keep only what is left, so a restart does not redo the rest.
+        std::filesystem::path temporaryPath = _compactingPath();
+        temporaryPath += ".tmp";
+
+        {
+            std::ofstream stream(temporaryPath.string(), std::ios::binary | std::ios::trunc);
+            _write(stream, _compacting);
+        }
+
+        std::filesystem::rename(temporaryPath, _compactingPath());
+    }
+
+    return applied;
+}
+
+
+std::filesystem::path HashtagLog::_compactingPath() const
+{
+    std::filesystem::path path = _path;
+    path += ".compacting";
+    return path;
+}
+
+
+void HashtagLog::_writeLine(std::ostream& stream,
+                            uint64_t id,
+                            const std::set<std::string>& hashtags)
+{
+    stream << id;
+
+    for (const auto& hashtag: hashtags)
+    {
+        stream << " " << hashtag;
+    }
+
+    stream << "\n";
+}
+
+
+void HashtagLog::_write(std::ostream& stream, const Additions& additions)
+{
+    for (const auto& addition: additions)
+    {
+        _writeLine(stream, addition.first, addition.second);
+    }
+}
+
+
+void HashtagLog::_read(const std::filesystem::path& path, Additions& additions)
+{
+    if (!std::filesystem::exists(path))
+    {
+        return;
+    }
+
+    std::string contents;
+
+    {
+        std::ifstream log(path.string(), std::ios::binary);
+        std::stringstream buffer;
+        buffer << log.rdbuf();
+        contents = buffer.str();
+    }
+
+    std::size_t end = contents.rfind('\n');
+    std::size_t complete = (end == std::string::npos) ? 0 : end + 1;
+
+    if (complete != contents.size())
+    {
+        // Drop a line torn by a crash so later appends start a new line.
+        ofLogWarning("HashtagLog::_read") << "Truncating partial line in " << path;
+        std::filesystem::resize_file(path, complete);
+        contents.resize(complete);
+    }
+
+    std::stringstream lines(contents);
+    std::string line;
+
+    while (std::getline(lines, line))
+    {
+        std::stringstream tokens(line);
+
+        uint64_t id = 0;
+        std::string hashtag;
+
+        if (!(tokens >> id))
+        {
+            ofLogWarning("HashtagLog::_read") << "Ignoring invalid line in " << path << ": " << line;
+            continue;
+        }
+
+        while (tokens >> hashtag)
+        {
+            additions[id].insert(hashtag);
+        }
+    }
+}
+
+
+} } // ofx::InstaLooter
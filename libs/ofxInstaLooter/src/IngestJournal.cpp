@@ -0,0 +1,265 @@
+//
+// Copyright (c) 2017 Christopher Baker <https://christopherbaker.net>
+//
+// SPDX-License-Identifier:	MIT
+//
+
+
+#include "ofx/InstaLooter/IngestJournal.h"
+#include <sstream>
+#include "Poco/Exception.h"
+#include "ofLog.h"
+#include "ofx/IO/JSONUtils.h"
+
+
+namespace ofx {
+namespace InstaLooter {
+
+
+const std::string IngestJournal::FILENAME = "ingest.journal";
+
+
+ofJson IngestJournal::Intent::toJSON(const Intent& intent)
+{
+    ofJson json;
+    json["id"] = intent.id;
+    json["source"] = intent.source.string();
+    json["image"] = intent.image.string();
+    json["json"] = intent.json.string();
+    json["metadata"] = intent.metadata;
+    return json;
+}
+
+
+IngestJournal::Intent IngestJournal::Intent::fromJSON(const ofJson& json)
+{
+    Intent intent;
+    intent.id = json.at("id").get<uint64_t>();
+    intent.source = json.at("source").get<std::string>();
+    intent.image = json.at("image").get<std::string>();
+    intent.json = json.at("json").get<std::string>();
+    intent.metadata = json.at("metadata");
+    return intent;
+}
+
+
+IngestJournal::IngestJournal(const std::filesystem::path& path):
+    _path(path)
+{
+    std::vector<Intent> intents;
+
+    if (std::filesystem::exists(_path))
+    {
+        std::ifstream journal(_path.string(), std::ios::binary);
+        std::string line;
+
+        while (std::getline(journal, line))
+        {
+            try
+            {
+                intents.push_back(Intent::fromJSON(ofJson::parse(line)));
+            }
+            catch (const std::exception&)
+            {
+                // Torn by a crash while the batch began, before any of its
+                // files were touched.
+                ofLogWarning("IngestJournal::IngestJournal") << "Ignoring invalid line in " << _path << ".";
+            }
+        }
+    }
+
+    std::vector<Intent> failed;
+
+    for (const auto& intent: intents)
+    {
+        if (!_recover(intent))
+        {
+            failed.push_back(intent);
+        }
+    }
+
+    _recovery.failed = failed.size();
+
+    // Keep only what failed, so the next start tries it again.
+    _stream.open(_path.string(), std::ios::binary | std::ios::trunc);
+
+    if (!_stream)
+    {
+        throw Poco::IOException("Unable to open " + _path.string());
+    }
+
+    if (!intents.empty())
+    {
+        ofLogNotice("IngestJournal::IngestJournal") << "Recovered " << _path << ": " << _recovery.replayed << " posts finished, " << _recovery.rolledBack << " rolled back, " << _recovery.failed << " failed.";
+    }
+
+    for (const auto& intent: failed)
+    {
+        _retained += Intent::toJSON(intent).dump() + "\n";
+    }
+
+    _stream << _retained;
+    _stream.flush();
+}
+
+
+std::filesystem::path IngestJournal::path() const
+{
+    return _path;
+}
+
+
+IngestJournal::Recovery IngestJournal::recovery() const
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    return _recovery;
+}
+
+
+bool IngestJournal::begin(const std::vector<Intent>& intents)
+{
+    if (intents.empty())
+    {
+        return true;
+    }
+
+    // Built first, so the batch goes out in a single write.
+    std::ostringstream lines;
+
+    for (const auto& intent: intents)
+    {
+        lines << Intent::toJSON(intent).dump() << "\n";
+    }
+
+    std::unique_lock<std::mutex> lock(_mutex);
+
+    _stream << lines.str();
+    _stream.flush();
+    _open = true;
+
+    if (!_stream)
+    {
+        ofLogError("IngestJournal::begin") << "Unable to write to " << _path << ", the batch is not journaled.";
+        _stream.clear();
+        return false;
+    }
+
+    return true;
+}
+
+
+void IngestJournal::commit()
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+
+    if (!_open)
+    {
+        return;
+    }
+
+    _stream.close();
+    _stream.open(_path.string(), std::ios::binary | std::ios::trunc);
+    _stream << _retained;
+    _stream.flush();
+    _open = false;
+
+    if (!_stream)
+    {
+        ofLogError("IngestJournal::commit") << "Unable to empty " << _path;
+        _stream.clear();
+    }
+}
+
+
+bool IngestJournal::replaceJSON(const std::filesystem::path& jsonPath, const ofJson& json)
+{
+    std::filesystem::path temporaryPath = temporaryPathFor(jsonPath);
+
+    if (!IO::JSONUtils::saveJSON(temporaryPath, json))
+    {
+        return false;
+    }
+
+    try
+    {
+        std::filesystem::rename(temporaryPath, jsonPath);
+        return true;
+    }
+    catch (const std::exception& exc)
+    {
+        ofLogError("IngestJournal::replaceJSON") << "Unable to replace " << jsonPath << ": " << exc.what();
+        return false;
+    }
+}
+
+
+std::filesystem::path IngestJournal::temporaryPathFor(const std::filesystem::path& jsonPath)
+{
+    return jsonPath.parent_path() / ("." + jsonPath.filename().string() + ".tmp.gz");
+}
+
+
+bool IngestJournal::_recover(const Intent& intent)
+{
+    try
+    {
+        std::filesystem::path temporaryPath = temporaryPathFor(intent.json);
+
+        if (std::filesystem::exists(temporaryPath))
+        {
+            std::filesystem::remove(temporaryPath);
+        }
+
+        if (std::filesystem::exists(intent.source))
+        {
+            // The image was not moved, or a copy across volumes was cut
+            // short, so move it again.
+            std::filesystem::create_directories(intent.image.parent_path());
+
+            if (std::filesystem::exists(intent.image))
+            {
+                std::filesystem::remove(intent.image);
+            }
+
+            try
+            {
+                std::filesystem::rename(intent.source, intent.image);
+            }
+            catch (const std::filesystem::filesystem_error&)
+            {
+                std::filesystem::copy_file(intent.source, intent.image);
+                std::filesystem::remove(intent.source);
+            }
+        }
+
+        if (std::filesystem::exists(intent.image))
+        {
+            // Rewritten even if present, as it may predate the batch.
+            if (!replaceJSON(intent.json, intent.metadata))
+            {
+                return false;
+            }
+
+            ++_recovery.replayed;
+            return true;
+        }
+
+        ofLogWarning("IngestJournal::_recover") << "The image of post " << intent.id << " is gone, rolling it back.";
+
+        if (std::filesystem::exists(intent.json))
+        {
+            std::filesystem::remove(intent.json);
+        }
+
+        ++_recovery.rolledBack;
+        return true;
+    }
+    catch (const std::exception& exc)
+    {
+        ofLogError("IngestJournal::_recover") << "Unable to recover post " << intent.id << ": " << exc.what();
+        return false;
+    }
+}
+
+
+} } // ofx::InstaLooter
@@ -0,0 +1,874 @@
+//
+// Copyright (c) 2017 Christopher Baker <https://christopherbaker.net>
+//
+// SPDX-License-Identifier:	MIT
+//
+
+
+#include "ofx/InstaLooter/IoUringFileSink.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include "Poco/Exception.h"
+#include "ofLog.h"
+
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define OFX_INSTALOOTER_HAVE_IO_URING 1
+#endif
+#endif
+
+
+#if defined(OFX_INSTALOOTER_HAVE_IO_URING)
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+
+namespace ofx {
+namespace InstaLooter {
+
+
+#if defined(OFX_INSTALOOTER_HAVE_IO_URING)
+
+
+namespace {
+
+
+int ioUringSetup(unsigned entries, io_uring_params* params)
+{
+    return static_cast<int>(::syscall(__NR_io_uring_setup, entries, params));
+}
+
+
+int ioUringEnter(int fd, unsigned toSubmit, unsigned minComplete, unsigned flags)
+{
+    return static_cast<int>(::syscall(__NR_io_uring_enter, fd, toSubmit, minComplete, flags, nullptr, 0));
+}
+
+
+int ioUringRegister(int fd, unsigned opcode, const void* arg, unsigned count)
+{
+    return static_cast<int>(::syscall(__NR_io_uring_register, fd, opcode, arg, count));
+}
+
+
+std::string errorString(int result)
+{
+    return std::strerror(-result);
+}
+
+
+} // namespace
+
+
+/// \brief The mapped submission and completion queues.
+struct IoUringFileSink::Ring
+{
+    ~Ring()
+    {
+        if (sqes) ::munmap(sqes, sqesSize);
+        if (cqMap && cqMap != sqMap) ::munmap(cqMap, cqMapSize);
+        if (sqMap) ::munmap(sqMap, sqMapSize);
+        if (fd >= 0) ::close(fd);
+    }
+
+    /// \returns the number of free submission queue entries.
+    unsigned space() const
+    {
+        return sqEntries - (localTail - __atomic_load_n(sqHead, __ATOMIC_ACQUIRE));
+    }
+
+    /// \returns a cleared submission queue entry.
+    io_uring_sqe* next()
+    {
+        unsigned index = localTail & *sqMask;
+        io_uring_sqe* sqe = &sqes[index];
+        std::memset(sqe, 0, sizeof(io_uring_sqe));
+        sqArray[index] = index;
+        ++localTail;
+        ++toSubmit;
+        return sqe;
+    }
+
+    int fd = -1;
+
+    unsigned sqEntries = 0;
+
+    void* sqMap = nullptr;
+    std::size_t sqMapSize = 0;
+    void* cqMap = nullptr;
+    std::size_t cqMapSize = 0;
+    io_uring_sqe* sqes = nullptr;
+    std::size_t sqesSize = 0;
+
+    unsigned* sqHead = nullptr;
+    unsigned* sqTail = nullptr;
+    unsigned* sqMask = nullptr;
+    unsigned* sqArray = nullptr;
+
+    unsigned* cqHead = nullptr;
+    unsigned* cqTail = nullptr;
+    unsigned* cqMask = nullptr;
+    io_uring_cqe* cqes = nullptr;
+
+    /// \brief The tail including prepared but unpublished entries.
+    unsigned localTail = 0;
+
+    /// \brief The number of prepared entries not yet submitted.
+    unsigned toSubmit = 0;
+
+};
+
+
+/// \brief A task in flight and the state of its current operation.
+struct IoUringFileSink::Slot
+{
+    /// \brief The task.
+    FileTask task;
+
+    /// \brief The index of the current operation.
+    std::size_t step = 0;
+
+    /// \brief Paths referenced by submitted entries.
+    std::vector<std::string> strings;
+
+    /// \brief The result of each entry of the current chain.
+    std::vector<int> results;
+
+    /// \brief The read buffer for COPY.
+    std::string buffer;
+
+    /// \brief The number of bytes a read or write must transfer.
+    uint64_t expected = 0;
+
+    /// \brief The number of entries that have not completed.
+    std::size_t pending = 0;
+
+    /// \brief True if the operation opened direct descriptors.
+    bool usesFiles = false;
+
+    /// \brief True while the direct descriptors are being closed.
+    bool closing = false;
+
+    /// \brief The error of the operation, kept while closing.
+    std::string error;
+
+};
+
+
+IoUringFileSink::IoUringFileSink(std::size_t queueDepth)
+{
+    queueDepth = std::max(queueDepth, std::size_t(1));
+
+    unsigned entries = 64;
+    while (entries < queueDepth * 4 && entries < 4096) entries *= 2;
+
+    io_uring_params params;
+    std::memset(&params, 0, sizeof(params));
+    params.flags = IORING_SETUP_CQSIZE;
+    params.cq_entries = entries * 4;
+
+    _ring = std::make_unique<Ring>();
+    _ring->fd = ioUringSetup(entries, &params);
+
+    if (_ring->fd < 0)
+    {
+        throw Poco::IOException("io_uring_setup failed: " + std::string(std::strerror(errno)));
+    }
+
+    _ring->sqEntries = params.sq_entries;
+    _ring->sqMapSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    _ring->cqMapSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+
+    if (params.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        _ring->sqMapSize = _ring->cqMapSize = std::max(_ring->sqMapSize, _ring->cqMapSize);
+    }
+
+    _ring->sqMap = ::mmap(nullptr, _ring->sqMapSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _ring->fd, IORING_OFF_SQ_RING);
+
+    if (_ring->sqMap == MAP_FAILED)
+    {
+        _ring->sqMap = nullptr;
+        throw Poco::IOException("Unable to map io_uring submission queue.");
+    }
+
+    if (params.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        _ring->cqMap = _ring->sqMap;
+    }
+    else
+    {
+        _ring->cqMap = ::mmap(nullptr, _ring->cqMapSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _ring->fd, IORING_OFF_CQ_RING);
+
+        if (_ring->cqMap == MAP_FAILED)
+        {
+            _ring->cqMap = nullptr;
+            throw Poco::IOException("Unable to map io_uring completion queue.");
+        }
+    }
+
+    _ring->sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+
+    void* sqes = ::mmap(nullptr, _ring->sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _ring->fd, IORING_OFF_SQES);
+
+    if (sqes == MAP_FAILED)
+    {
+        throw Poco::IOException("Unable to map io_uring submission entries.");
+    }
+
+    _ring->sqes = static_cast<io_uring_sqe*>(sqes);
+
+    char* sq = static_cast<char*>(_ring->sqMap);
+    _ring->sqHead = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+    _ring->sqTail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+    _ring->sqMask = reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+    _ring->sqArray = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+    _ring->localTail = *_ring->sqTail;
+
+    char* cq = static_cast<char*>(_ring->cqMap);
+    _ring->cqHead = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+    _ring->cqTail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+    _ring->cqMask = reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+    _ring->cqes = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+
+    // Two direct descriptor slots per task, all empty to start with.
+    std::vector<int> files(queueDepth * 2, -1);
+
+    if (ioUringRegister(_ring->fd, IORING_REGISTER_FILES, files.data(), static_cast<unsigned>(files.size())) < 0)
+    {
+        throw Poco::IOException("Unable to register io_uring files: " + std::string(std::strerror(errno)));
+    }
+
+    for (std::size_t i = 0; i < queueDepth; ++i)
+    {
+        _slots.push_back(std::make_unique<Slot>());
+        _freeSlots.push_back(queueDepth - i - 1);
+    }
+}
+
+
+IoUringFileSink::~IoUringFileSink()
+{
+    // Entries in flight reference slot memory, so they must finish first.
+    while (_freeSlots.size() < _slots.size())
+    {
+        _enter(1);
+        _reap();
+    }
+}
+
+
+void IoUringFileSink::submit(FileTask&& task)
+{
+    while (_freeSlots.empty())
+    {
+        _enter(1);
+        _reap();
+    }
+
+    std::size_t slotIndex = _freeSlots.back();
+    _freeSlots.pop_back();
+
+    Slot& slot = *_slots[slotIndex];
+    slot.task = std::move(task);
+    slot.step = 0;
+
+    _advance(slotIndex);
+}
+
+
+std::size_t IoUringFileSink::complete(std::vector<FileTask>& tasks, bool wait)
+{
+    _enter(0);
+    _reap();
+
+    while (wait && _completed.empty() && _freeSlots.size() < _slots.size())
+    {
+        _enter(1);
+        _reap();
+    }
+
+    std::size_t count = _completed.size();
+
+    for (auto& task: _completed)
+    {
+        tasks.push_back(std::move(task));
+    }
+
+    _completed.clear();
+    return count;
+}
+
+
+std::size_t IoUringFileSink::inFlight() const
+{
+    return _slots.size() - _freeSlots.size() + _completed.size();
+}
+
+
+std::string IoUringFileSink::name() const
+{
+    return "io_uring";
+}
+
+
+bool IoUringFileSink::isAvailable()
+{
+    static const bool available = [](){
+        io_uring_params params;
+        std::memset(&params, 0, sizeof(params));
+
+        int fd = ioUringSetup(4, &params);
+
+        if (fd < 0)
+        {
+            return false;
+        }
+
+        const std::size_t numOps = 256;
+        std::vector<char> buffer(sizeof(io_uring_probe) + numOps * sizeof(io_uring_probe_op), 0);
+        io_uring_probe* probe = reinterpret_cast<io_uring_probe*>(buffer.data());
+
+        bool supported = ioUringRegister(fd, IORING_REGISTER_PROBE, probe, numOps) >= 0;
+
+        for (int op: { IORING_OP_OPENAT,
+                       IORING_OP_CLOSE,
+                       IORING_OP_READ,
+                       IORING_OP_WRITE,
+                       IORING_OP_RENAMEAT,
+                       IORING_OP_UNLINKAT,
+                       IORING_OP_MKDIRAT })
+        {
+            supported = supported &&
+                        op <= probe->last_op &&
+                        (probe->ops[op].flags & IO_URING_OP_SUPPORTED);
+        }
+
+        ::close(fd);
+
+        return supported;
+    }();
+
+    return available;
+}
+
+
+void IoUringFileSink::_advance(std::size_t slotIndex)
+{
+    Slot& slot = *_slots[slotIndex];
+
+    unsigned firstFile = static_cast<unsigned>(slotIndex * 2);
+
+    while (slot.step < slot.task.operations.size())
+    {
+        const FileOperation& operation = slot.task.operations[slot.step];
+
+        slot.strings.clear();
+        slot.results.clear();
+        slot.usesFiles = false;
+        slot.closing = false;
+        slot.error.clear();
+
+        std::vector<std::string> strings;
+        std::size_t count = 0;
+
+        switch (operation.type)
+        {
+            case FileOperation::SET_WRITE_TIME:
+            {
+                try
+                {
+                    std::filesystem::last_write_time(operation.path, operation.time);
+                }
+                catch (const std::exception& exc)
+                {
+                    _finish(slotIndex, exc.what());
+                    return;
+                }
+
+                ++slot.step;
+                continue;
+            }
+            case FileOperation::CREATE_DIRECTORIES:
+            {
+                std::filesystem::path current;
+
+                for (const auto& part: operation.path)
+                {
+                    current /= part;
+
+                    if (current == current.root_path()) continue;
+
+                    std::string directory = current.string();
+
+                    if (_knownDirectories.find(directory) == _knownDirectories.end())
+                    {
+                        strings.push_back(directory);
+                    }
+                }
+
+                count = strings.size();
+
+                if (count == 0)
+                {
+                    ++slot.step;
+                    continue;
+                }
+                else if (count > _ring->sqEntries)
+                {
+                    // Too deep for one chain.
+                    FileTask task;
+                    task.operations.push_back(operation);
+                    run(task);
+
+                    if (!task.success)
+                    {
+                        _finish(slotIndex, task.error);
+                        return;
+                    }
+
+                    ++slot.step;
+                    continue;
+                }
+                break;
+            }
+            case FileOperation::MOVE:
+            case FileOperation::COPY:
+                strings = { operation.path.string(), operation.target.string() };
+                count = operation.type == FileOperation::MOVE ? 1 : 4;
+                break;
+            case FileOperation::WRITE:
+                strings = { operation.path.string() };
+                count = 2;
+                break;
+            case FileOperation::REMOVE:
+                strings = { operation.path.string() };
+                count = 1;
+                break;
+        }
+
+        if (operation.type == FileOperation::COPY)
+        {
+            try
+            {
+                slot.expected = std::filesystem::file_size(operation.path);
+                slot.buffer.resize(slot.expected);
+            }
+            catch (const std::exception& exc)
+            {
+                _finish(slotIndex, exc.what());
+                return;
+            }
+        }
+
+        // A chain must be submitted in one go.
+        if (_ring->space() < count)
+        {
+            _enter(0);
+        }
+
+        // Moving the vector keeps each string at the same address.
+        slot.strings = std::move(strings);
+        slot.results.assign(count, 0);
+        slot.pending = count;
+
+        auto prepare = [&](uint8_t opcode, std::size_t position) {
+            io_uring_sqe* sqe = _ring->next();
+            sqe->opcode = opcode;
+            sqe->user_data = (static_cast<uint64_t>(slotIndex) << 16) | position;
+            if (position + 1 < count) sqe->flags |= IOSQE_IO_LINK;
+            return sqe;
+        };
+
+        switch (operation.type)
+        {
+            case FileOperation::CREATE_DIRECTORIES:
+            {
+                for (std::size_t i = 0; i < count; ++i)
+                {
+                    io_uring_sqe* sqe = prepare(IORING_OP_MKDIRAT, i);
+                    // Existing parents fail with EEXIST, which must not
+                    // cancel the rest of the chain.
+                    if (i + 1 < count) sqe->flags = IOSQE_IO_HARDLINK;
+                    sqe->fd = AT_FDCWD;
+                    sqe->addr = reinterpret_cast<uint64_t>(slot.strings[i].c_str());
+                    sqe->len = 0755;
+                }
+                break;
+            }
+            case FileOperation::MOVE:
+            {
+                io_uring_sqe* sqe = prepare(IORING_OP_RENAMEAT, 0);
+                sqe->fd = AT_FDCWD;
+                sqe->addr = reinterpret_cast<uint64_t>(slot.strings[0].c_str());
+                sqe->len = static_cast<uint32_t>(AT_FDCWD);
+                sqe->addr2 = reinterpret_cast<uint64_t>(slot.strings[1].c_str());
+                break;
+            }
+            case FileOperation::REMOVE:
+            {
+                io_uring_sqe* sqe = prepare(IORING_OP_UNLINKAT, 0);
+                sqe->fd = AT_FDCWD;
+                sqe->addr = reinterpret_cast<uint64_t>(slot.strings[0].c_str());
+                break;
+            }
+            case FileOperation::WRITE:
+            {
+                slot.usesFiles = true;
+                slot.expected = operation.data.size();
+
+                io_uring_sqe* sqe = prepare(IORING_OP_OPENAT, 0);
+                sqe->fd = AT_FDCWD;
+                sqe->addr = reinterpret_cast<uint64_t>(slot.strings[0].c_str());
+                sqe->len = 0644;
+                sqe->open_flags = O_WRONLY | O_CREAT | O_TRUNC;
+                sqe->file_index = firstFile + 1;
+
+                sqe = prepare(IORING_OP_WRITE, 1);
+                sqe->fd = static_cast<int32_t>(firstFile);
+                sqe->flags |= IOSQE_FIXED_FILE;
+                sqe->addr = reinterpret_cast<uint64_t>(operation.data.data());
+                sqe->len = static_cast<uint32_t>(operation.data.size());
+                break;
+            }
+            case FileOperation::COPY:
+            {
+                slot.usesFiles = true;
+
+                io_uring_sqe* sqe = prepare(IORING_OP_OPENAT, 0);
+                sqe->fd = AT_FDCWD;
+                sqe->addr = reinterpret_cast<uint64_t>(slot.strings[0].c_str());
+                sqe->open_flags = O_RDONLY;
+                sqe->file_index = firstFile + 1;
+
+                // Like copy_file, refuse to overwrite an existing target.
+                sqe = prepare(IORING_OP_OPENAT, 1);
+                sqe->fd = AT_FDCWD;
+                sqe->addr = reinterpret_cast<uint64_t>(slot.strings[1].c_str());
+                sqe->len = 0644;
+                sqe->open_flags = O_WRONLY | O_CREAT | O_EXCL;
+                sqe->file_index = firstFile + 2;
+
+                sqe = prepare(IORING_OP_READ, 2);
+                sqe->fd = static_cast<int32_t>(firstFile);
+                sqe->flags |= IOSQE_FIXED_FILE;
+                sqe->addr = reinterpret_cast<uint64_t>(&slot.buffer[0]);
+                sqe->len = static_cast<uint32_t>(slot.expected);
+
+                sqe = prepare(IORING_OP_WRITE, 3);
+                sqe->fd = static_cast<int32_t>(firstFile + 1);
+                sqe->flags |= IOSQE_FIXED_FILE;
+                sqe->addr = reinterpret_cast<uint64_t>(slot.buffer.data());
+                sqe->len = static_cast<uint32_t>(slot.expected);
+                break;
+            }
+            case FileOperation::SET_WRITE_TIME:
+                break;
+        }
+
+        return;
+    }
+
+    _finish(slotIndex, "");
+}
+
+
+void IoUringFileSink::_evaluate(std::size_t slotIndex)
+{
+    Slot& slot = *_slots[slotIndex];
+
+    if (slot.closing)
+    {
+        slot.closing = false;
+
+        if (!slot.error.empty())
+        {
+            _finish(slotIndex, slot.error);
+            return;
+        }
+
+        ++slot.step;
+        _advance(slotIndex);
+        return;
+    }
+
+    const FileOperation& operation = slot.task.operations[slot.step];
+
+    std::string error;
+
+    if (operation.type == FileOperation::CREATE_DIRECTORIES)
+    {
+        // Only the deepest directory matters, its parents may have existed.
+        int result = slot.results.back();
+
+        if (result < 0 && result != -EEXIST)
+        {
+            error = "Unable to create " + operation.path.string() + ": " + errorString(result);
+        }
+        else
+        {
+            _knownDirectories.insert(slot.strings.begin(), slot.strings.end());
+        }
+    }
+    else if (operation.type == FileOperation::MOVE && slot.results[0] == -EXDEV)
+    {
+        // Different volumes, so fall back to copy and remove.
+        FileTask task;
+        task.operations.push_back(operation);
+        run(task);
+        error = task.error;
+    }
+    else
+    {
+        // The write of a copy is submitted with the size the source had, so
+        // a source that shrank since must not be padded with a stale buffer.
+        // The link already cancels the write, this names the cause.
+        if (operation.type == FileOperation::COPY && slot.results[2] >= 0 && static_cast<uint64_t>(slot.results[2]) != slot.expected)
+        {
+            error = "Short read from " + operation.path.string();
+        }
+
+        for (std::size_t i = 0; i < slot.results.size() && error.empty(); ++i)
+        {
+            if (slot.results[i] < 0)
+            {
+                error = operation.path.string() + ": " + errorString(slot.results[i]);
+            }
+        }
+
+        if (error.empty() && slot.usesFiles && static_cast<uint64_t>(slot.results.back()) != slot.expected)
+        {
+            error = "Short write to " + (operation.type == FileOperation::COPY ? operation.target : operation.path).string();
+        }
+
+        if (!error.empty() && operation.type == FileOperation::COPY && slot.results[1] >= 0)
+        {
+            // The target was created, and would refuse the next attempt.
+            try
+            {
+                std::filesystem::remove(operation.target);
+            }
+            catch (const std::exception&)
+            {
+            }
+        }
+    }
+
+    if (slot.usesFiles)
+    {
+        // Always release the direct descriptors, whatever happened.
+        if (_ring->space() < 2)
+        {
+            _enter(0);
+        }
+
+        slot.error = error;
+        slot.closing = true;
+        slot.results.assign(2, 0);
+        slot.pending = 2;
+
+        for (unsigned i = 0; i < 2; ++i)
+        {
+            io_uring_sqe* sqe = _ring->next();
+            sqe->opcode = IORING_OP_CLOSE;
+            sqe->file_index = static_cast<unsigned>(slotIndex * 2) + i + 1;
+            sqe->user_data = (static_cast<uint64_t>(slotIndex) << 16) | i;
+        }
+
+        return;
+    }
+
+    if (!error.empty())
+    {
+        _finish(slotIndex, error);
+        return;
+    }
+
+    ++slot.step;
+    _advance(slotIndex);
+}
+
+
+void IoUringFileSink::_finish(std::size_t slotIndex, const std::string& error)
+{
+    Slot& slot = *_slots[slotIndex];
+
+    slot.task.success = error.empty();
+    slot.task.error = error;
+
+    _completed.push_back(std::move(slot.task));
+
+    slot.task = FileTask();
+    slot.strings.clear();
+    slot.results.clear();
+    slot.buffer.clear();
+    slot.buffer.shrink_to_fit();
+    slot.pending = 0;
+
+    _freeSlots.push_back(slotIndex);
+}
+
+
+void IoUringFileSink::_enter(unsigned minComplete)
+{
+    if (_ring->toSubmit == 0 && minComplete == 0)
+    {
+        return;
+    }
+
+    __atomic_store_n(_ring->sqTail, _ring->localTail, __ATOMIC_RELEASE);
+
+    while (true)
+    {
+        int result = ioUringEnter(_ring->fd,
+                                  _ring->toSubmit,
+                                  minComplete,
+                                  minComplete > 0 ? IORING_ENTER_GETEVENTS : 0);
+
+        if (result >= 0)
+        {
+            _ring->toSubmit -= std::min(static_cast<unsigned>(result), _ring->toSubmit);
+            return;
+        }
+        else if (errno != EINTR)
+        {
+            // EBUSY / EAGAIN: completions must be reaped before more can be
+            // submitted, which the caller does next.
+            if (errno != EBUSY && errno != EAGAIN)
+            {
+                ofLogError("IoUringFileSink::_enter") << "io_uring_enter failed: " << std::strerror(errno);
+            }
+
+            return;
+        }
+    }
+}
+
+
+void IoUringFileSink::_reap()
+{
+    std::vector<std::size_t> ready;
+
+    unsigned head = *_ring->cqHead;
+    unsigned tail = __atomic_load_n(_ring->cqTail, __ATOMIC_ACQUIRE);
+
+    while (head != tail)
+    {
+        const io_uring_cqe& cqe = _ring->cqes[head & *_ring->cqMask];
+
+        std::size_t slotIndex = static_cast<std::size_t>(cqe.user_data >> 16);
+        std::size_t position = static_cast<std::size_t>(cqe.user_data & 0xffff);
+
+        Slot& slot = *_slots[slotIndex];
+        slot.results[position] = cqe.res;
+
+        if (--slot.pending == 0)
+        {
+            ready.push_back(slotIndex);
+        }
+
+        ++head;
+    }
+
+    __atomic_store_n(_ring->cqHead, head, __ATOMIC_RELEASE);
+
+    for (auto slotIndex: ready)
+    {
+        _evaluate(slotIndex);
+    }
+}
+
+
+#else
+
+
+struct IoUringFileSink::Ring
+{
+};
+
+
+struct IoUringFileSink::Slot
+{
+};
+
+
+IoUringFileSink::IoUringFileSink(std::size_t)
+{
+    throw Poco::IOException("io_uring is not available on this platform.");
+}
+
+
+IoUringFileSink::~IoUringFileSink()
+{
+}
+
+
+void IoUringFileSink::submit(FileTask&& task)
+{
+    run(task);
+    _completed.push_back(std::move(task));
+}
+
+
+std::size_t IoUringFileSink::complete(std::vector<FileTask>& tasks, bool)
+{
+    std::size_t count = _completed.size();
+    for (auto& task: _completed) tasks.push_back(std::move(task));
+    _completed.clear();
+    return count;
+}
+
+
+std::size_t IoUringFileSink::inFlight() const
+{
+    return _completed.size();
+}
+
+
+std::string IoUringFileSink::name() const
+{
+    return "io_uring";
+}
+
+
+bool IoUringFileSink::isAvailable()
+{
+    return false;
+}
+
+
+void IoUringFileSink::_advance(std::size_t)
+{
+}
+
+
+void IoUringFileSink::_evaluate(std::size_t)
+{
+}
+
+
+void IoUringFileSink::_finish(std::size_t, const std::string&)
+{
+}
+
+
+void IoUringFileSink::_enter(unsigned)
+{
+}
+
+
+void IoUringFileSink::_reap()
+{
+}
+
+
+#endif
+
+
+} } // ofx::InstaLooter
@@ -0,0 +1,161 @@
+//
+// Copyright (c) 2017 Christopher Baker <https://christopherbaker.net>
+//
+// SPDX-License-Identifier:	MIT
+//
+
+
+#include "ofx/InstaLooter/LoadReport.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <sstream>
+
+
+namespace ofx {
+namespace InstaLooter {
+
+
+LoadReport::LoadReport()
+{
+}
+
+
+void LoadReport::record(const Post& post)
+{
+    record(post, now());
+}
+
+
+void LoadReport::record(const Post& post, uint64_t now)
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+
+    if (_count == 0)
+    {
+        _firstTime = now;
+    }
+
+    _lastTime = std::max(_lastTime, now);
+    ++_count;
+
+    for (const auto& hashtag: post.hashtags())
+    {
+        ++_hashtagCounts[hashtag];
+    }
+
+    if (post.downloadTime() > 0)
+    {
+        // Clocks with a coarse file time resolution may put the download
+        // slightly in the future.
+        _latencies.push_back(now > post.downloadTime() ? now - post.downloadTime() : 0);
+        _sorted = false;
+    }
+}
+
+
+void LoadReport::reset()
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    _firstTime = 0;
+    _lastTime = 0;
+    _count = 0;
+    _hashtagCounts.clear();
+    _latencies.clear();
+    _sorted = true;
+}
+
+
+uint64_t LoadReport::count() const
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    return _count;
+}
+
+
+double LoadReport::throughput() const
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+
+    uint64_t elapsed = _lastTime - _firstTime;
+
+    if (elapsed == 0)
+    {
+        return 0;
+    }
+
+    return _count * 1000.0 / elapsed;
+}
+
+
+uint64_t LoadReport::latency(double percentile) const
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    return _latency(percentile);
+}
+
+
+ofJson LoadReport::toJSON() const
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+
+    uint64_t elapsed = _lastTime - _firstTime;
+
+    ofJson json;
+    json["count"] = _count;
+    json["duration_ms"] = elapsed;
+    json["posts_per_second"] = elapsed > 0 ? _count * 1000.0 / elapsed : 0.0;
+    json["latency_ms"]["samples"] = _latencies.size();
+    json["latency_ms"]["p50"] = _latency(50);
+    json["latency_ms"]["p90"] = _latency(90);
+    json["latency_ms"]["p99"] = _latency(99);
+    json["latency_ms"]["max"] = _latency(100);
+    json["hashtags"] = _hashtagCounts;
+    return json;
+}
+
+
+std::string LoadReport::toString() const
+{
+    ofJson json = toJSON();
+
+    std::stringstream ss;
+    ss << json["count"] << " posts in " << json["duration_ms"] << " ms (";
+    ss << json["posts_per_second"].get<double>() << " posts/s), latency ms";
+    ss << " p50: " << json["latency_ms"]["p50"];
+    ss << " p90: " << json["latency_ms"]["p90"];
+    ss << " p99: " << json["latency_ms"]["p99"];
+    ss << " max: " << json["latency_ms"]["max"];
+    return ss.str();
+}
+
+
+uint64_t LoadReport::now()
+{
+    return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+
+uint64_t LoadReport::_latency(double percentile) const
+{
+    if (_latencies.empty())
+    {
+        return 0;
+    }
+
+    if (!_sorted)
+    {
+        std::sort(_latencies.begin(), _latencies.end());
+        _sorted = true;
+    }
+
+    // Nearest rank.
+    double rank = std::ceil(std::min(std::max(percentile, 0.0), 100.0) / 100.0 * _latencies.size());
+
+    std::size_t index = rank < 1 ? 0 : static_cast<std::size_t>(rank) - 1;
+
+    return _latencies[std::min(index, _latencies.size() - 1)];
+}
+
+
+} } // ofx::InstaLooter
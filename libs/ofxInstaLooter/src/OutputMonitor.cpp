@@ -0,0 +1,283 @@
+//
+// Copyright (c) 2017 Christopher Baker <https://christopherbaker.net>
+//
+// SPDX-License-Identifier:	MIT
+//
+
+
+#include "ofx/InstaLooter/OutputMonitor.h"
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
+#include <sstream>
+
+
+namespace ofx {
+namespace InstaLooter {
+
+
+namespace {
+
+
+bool contains(const std::string& text, const char* word)
+{
+    return text.find(word) != std::string::npos;
+}
+
+
+/// \returns true if the text has the number, not as part of a longer one.
+bool containsNumber(const std::string& text, const char* number)
+{
+    std::size_t length = std::strlen(number);
+    std::size_t position = text.find(number);
+
+    while (position != std::string::npos)
+    {
+        bool digitBefore = position > 0 && std::isdigit(static_cast<unsigned char>(text[position - 1]));
+        bool digitAfter = position + length < text.size() && std::isdigit(static_cast<unsigned char>(text[position + length]));
+
+        if (!digitBefore && !digitAfter) return true;
+
+        position = text.find(number, position + 1);
+    }
+
+    return false;
+}
+
+
+/// \returns true if the text reports an HTTP status, e.g. "HTTP Error 429"
+/// or "status 429", rather than only having the number, e.g. in a count.
+bool isStatusLine(const std::string& text, const char* status)
+{
+    return containsNumber(text, status) &&
+           (contains(text, "http") ||
+            contains(text, "status") ||
+            contains(text, "error") ||
+            contains(text, "response"));
+}
+
+
+/// \brief Parse a progress bar count such as "12/50 [" or "12it [".
+/// \returns true if the line has one.
+bool parseProgress(const std::string& line, uint64_t& items, uint64_t& total)
+{
+    std::size_t bracket = line.rfind(" [");
+
+    while (bracket != std::string::npos && bracket > 0)
+    {
+        std::size_t end = bracket;
+
+        if (end >= 2 && line.compare(end - 2, 2, "it") == 0) end -= 2;
+
+        std::size_t start = end;
+
+        while (start > 0 && (std::isdigit(static_cast<unsigned char>(line[start - 1])) || line[start - 1] == '/'))
+        {
+            --start;
+        }
+
+        std::string token = line.substr(start, end - start);
+        std::size_t slash = token.find('/');
+
+        if (!token.empty() && std::isdigit(static_cast<unsigned char>(token[0])))
+        {
+            items = std::strtoull(token.c_str(), nullptr, 10);
+            total = slash != std::string::npos ? std::strtoull(token.c_str() + slash + 1, nullptr, 10) : 0;
+            return true;
+        }
+
+        bracket = line.rfind(" [", bracket - 1);
+    }
+
+    return false;
+}
+
+
+}
+
+
+const std::size_t OutputMonitor::DEFAULT_TAIL_SIZE = 50;
+const std::size_t OutputMonitor::MAX_LINE_LENGTH = 1024;
+
+
+OutputMonitor::OutputMonitor(std::size_t tailSize):
+    _tailSize(std::max(tailSize, std::size_t(1))),
+    _lines(0),
+    _items(0),
+    _total(0),
+    _errors(0),
+    _rateLimits(0),
+    _authErrors(0),
+    _networkErrors(0)
+{
+}
+
+
+void OutputMonitor::write(const std::string& data)
+{
+    for (char c: data)
+    {
+        if (c == '\n' || c == '\r')
+        {
+            // A "\r\n" or a progress bar redraw does not make an empty line.
+            if (!_partial.empty()) _line(_partial);
+        }
+        else if (_partial.size() < MAX_LINE_LENGTH)
+        {
+            _partial.push_back(c);
+        }
+    }
+}
+
+
+void OutputMonitor::writeLine(const std::string& line)
+{
+    flush();
+    _partial = line.substr(0, MAX_LINE_LENGTH);
+    _line(_partial);
+}
+
+
+void OutputMonitor::flush()
+{
+    if (!_partial.empty()) _line(_partial);
+}
+
+
+void OutputMonitor::reset()
+{
+    _partial.clear();
+
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _tail.clear();
+        _tailEndsWithProgress = false;
+    }
+
+    _lines = 0;
+    _items = 0;
+    _total = 0;
+    _errors = 0;
+    _rateLimits = 0;
+    _authErrors = 0;
+    _networkErrors = 0;
+}
+
+
+FetchProgress OutputMonitor::progress() const
+{
+    FetchProgress progress;
+    progress.lines = _lines;
+    progress.items = _items;
+    progress.total = _total;
+    progress.errors = _errors;
+    progress.rateLimits = _rateLimits;
+    progress.authErrors = _authErrors;
+    progress.networkErrors = _networkErrors;
+    return progress;
+}
+
+
+std::vector<std::string> OutputMonitor::tail() const
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    return std::vector<std::string>(_tail.begin(), _tail.end());
+}
+
+
+std::string OutputMonitor::tailString() const
+{
+    std::stringstream ss;
+
+    for (const auto& line: tail())
+    {
+        ss << line << "\n";
+    }
+
+    return ss.str();
+}
+
+
+void OutputMonitor::_line(std::string& line)
+{
+    ++_lines;
+
+    std::string lower = line;
+    std::transform(lower.begin(), lower.end(), lower.begin(), [](unsigned char c) {
+        return static_cast<char>(std::tolower(c));
+    });
+
+    uint64_t items = 0;
+    uint64_t total = 0;
+
+    bool isProgress = parseProgress(line, items, total);
+
+    if (isProgress)
+    {
+        // Bars restart per page, so only ever move forward.
+        if (items > _items) _items = items;
+        if (total > 0) _total = total;
+    }
+    else if (line.compare(0, 11, "Downloaded ") == 0)
+    {
+        ++_items;
+    }
+    else if (isStatusLine(lower, "429") ||
+             contains(lower, "rate limit") ||
+             contains(lower, "too many requests") ||
+             contains(lower, "please wait a few minutes"))
+    {
+        ++_rateLimits;
+    }
+    else if (contains(lower, "login failed") ||
+             contains(lower, "login_required") ||
+             contains(lower, "checkpoint_required") ||
+             contains(lower, "checkpoint required") ||
+             contains(lower, "challenge_required") ||
+             contains(lower, "incorrect password") ||
+             contains(lower, "bad password"))
+    {
+        ++_authErrors;
+        ++_errors;
+    }
+    else if (contains(lower, "connectionerror") ||
+             contains(lower, "connection refused") ||
+             contains(lower, "connection reset") ||
+             contains(lower, "max retries exceeded") ||
+             contains(lower, "name or service not known") ||
+             contains(lower, "temporary failure in name resolution") ||
+             contains(lower, "network is unreachable") ||
+             contains(lower, "connecttimeout"))
+    {
+        ++_networkErrors;
+        ++_errors;
+    }
+    else if (contains(lower, "error"))
+    {
+        ++_errors;
+    }
+
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+
+        // Progress bar redraws would push everything else out.
+        if (isProgress && _tailEndsWithProgress && !_tail.empty())
+        {
+            _tail.back().swap(line);
+        }
+        else
+        {
+            _tail.push_back(std::move(line));
+        }
+
+        _tailEndsWithProgress = isProgress;
+
+        while (_tail.size() > _tailSize) _tail.pop_front();
+    }
+
+    line.clear();
+}
+
+
+} } // ofx::InstaLooter
@@ -0,0 +1,636 @@
+//
+// Copyright (c) 2017 Christopher Baker <https://christopherbaker.net>
+//
+// SPDX-License-Identifier:	MIT
+//
+
+
+#include "ofx/InstaLooter/PackStore.h"
+#include <algorithm>
+#include <cstdio>
+#include <limits>
+#include <sstream>
+#include "Poco/Exception.h"
+#include "Poco/File.h"
+#include "ofLog.h"
+#include "ofx/IO/JSONUtils.h"
+#include "ofx/InstaLooter/HashtagClient.h"
+
+
+namespace ofx {
+namespace InstaLooter {
+
+
+namespace {
+
+
+/// \brief "ILPK", the first field of every record.
+const uint32_t RECORD_MAGIC = 0x4b504c49;
+
+/// \brief "ILPX", the first field of every sealed index.
+const uint32_t INDEX_MAGIC = 0x58504c49;
+
+const uint32_t INDEX_VERSION = 1;
+
+
+/// \brief The header before the image and metadata of each record.
+struct RecordHeader
+{
+    uint32_t magic = RECORD_MAGIC;
+    uint32_t imageLength = 0;
+    uint32_t metadataLength = 0;
+    uint32_t reserved = 0;
+    uint64_t id = 0;
+};
+
+
+/// \brief The header of a sealed index, followed by sorted entries.
+struct IndexHeader
+{
+    uint32_t magic = INDEX_MAGIC;
+    uint32_t version = INDEX_VERSION;
+    uint64_t size = 0;
+};
+
+
+static_assert(sizeof(RecordHeader) == 24, "Unexpected record header size.");
+static_assert(sizeof(IndexHeader) == 16, "Unexpected index header size.");
+
+
+} // namespace
+
+
+const uint64_t PackStore::DEFAULT_SEGMENT_SIZE = uint64_t(1) << 30;
+const std::string PackStore::LOCATOR_PREFIX = "pack:";
+
+
+PackStore::PackStore(const std::filesystem::path& path, uint64_t segmentSize):
+    _path(path),
+    _segmentSize(segmentSize)
+{
+    static_assert(sizeof(Entry) == 40, "Unexpected index entry size.");
+
+    std::filesystem::create_directories(_path);
+
+    std::vector<uint32_t> numbers;
+
+    std::filesystem::directory_iterator iter(_path), end;
+
+    for (; iter != end; ++iter)
+    {
+        std::string name = iter->path().filename().string();
+
+        if (name.compare(0, 8, "segment-") == 0 && iter->path().extension() == ".pack")
+        {
+            numbers.push_back(static_cast<uint32_t>(std::stoul(name.substr(8))));
+        }
+    }
+
+    std::sort(numbers.begin(), numbers.end());
+
+    std::unique_lock<std::mutex> lock(_mutex);
+
+    for (std::size_t i = 0; i < numbers.size(); ++i)
+    {
+        Segment segment;
+        segment.number = numbers[i];
+        segment.size = std::filesystem::file_size(_segmentPath(segment.number));
+        segment.sealed = std::filesystem::exists(_indexPath(segment.number));
+
+        _segments.push_back(segment);
+
+        Segment& added = _segments.back();
+
+        if (added.sealed)
+        {
+            _mapIndex(added);
+        }
+        else
+        {
+            _scan(added);
+
+            // Only the last segment may be active, older ones were being
+            // sealed when the application stopped.
+            if (i + 1 < numbers.size())
+            {
+                _writeIndex(added);
+                _active.clear();
+            }
+        }
+    }
+
+    if (_segments.empty() || _segments.back().sealed)
+    {
+        _openSegment(_segments.empty() ? 1 : _segments.back().number + 1);
+    }
+    else
+    {
+        _stream.open(_segmentPath(_segments.back().number).string(),
+                     std::ios::binary | std::ios::app);
+
+        if (!_stream)
+        {
+            throw Poco::IOException("Unable to open " + _segmentPath(_segments.back().number).string());
+        }
+    }
+}
+
+
+PackStore::~PackStore()
+{
+    _stream.close();
+}
+
+
+std::filesystem::path PackStore::path() const
+{
+    return _path;
+}
+
+
+bool PackStore::contains(uint64_t id) const
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    Entry entry;
+    return _find(id, entry);
+}
+
+
+bool PackStore::get(uint64_t id, Record& record) const
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+
+    Entry entry;
+
+    if (!_find(id, entry))
+    {
+        return false;
+    }
+
+    record.image = _span(entry.imageSegment, entry.imageOffset, entry.imageLength);
+    record.metadata = _span(entry.metadataSegment, entry.metadataOffset, entry.metadataLength);
+    return true;
+}
+
+
+bool PackStore::getMetadata(uint64_t id, ofJson& metadata) const
+{
+    Record record;
+
+    if (!get(id, record))
+    {
+        return false;
+    }
+
+    try
+    {
+        metadata = ofJson::parse(record.metadata.data, record.metadata.data + record.metadata.size);
+    }
+    catch (const std::exception& exc)
+    {
+        ofLogError("PackStore::getMetadata") << "Invalid metadata for " << id << ": " << exc.what();
+        return false;
+    }
+
+    return true;
+}
+
+
+void PackStore::append(uint64_t id,
+                       const std::filesystem::path& image,
+                       const ofJson& metadata)
+{
+    std::ifstream input(image.string(), std::ios::binary);
+
+    if (!input)
+    {
+        throw Poco::IOException("Unable to read " + image.string());
+    }
+
+    std::ostringstream buffer;
+    buffer << input.rdbuf();
+
+    std::string data = buffer.str();
+
+    if (data.empty())
+    {
+        throw Poco::IOException("Empty image " + image.string());
+    }
+
+    std::unique_lock<std::mutex> lock(_mutex);
+    _append(id, data, metadata.dump());
+}
+
+
+void PackStore::updateMetadata(uint64_t id, const ofJson& metadata)
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+
+    Entry entry;
+
+    if (!_find(id, entry))
+    {
+        throw Poco::InvalidArgumentException("Unknown id " + std::to_string(id));
+    }
+
+    _append(id, "", metadata.dump());
+}
+
+
+void PackStore::seal()
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+
+    if (_segments.back().size > 0)
+    {
+        _seal();
+    }
+}
+
+
+std::size_t PackStore::numSegments() const
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    return _segments.size();
+}
+
+
+std::filesystem::path PackStore::locatorFor(uint64_t id,
+                                            const std::filesystem::path& extension)
+{
+    return LOCATOR_PREFIX + std::to_string(id) + extension.string();
+}
+
+
+bool PackStore::isLocator(const std::filesystem::path& path)
+{
+    return path.string().compare(0, LOCATOR_PREFIX.size(), LOCATOR_PREFIX) == 0;
+}
+
+
+std::size_t PackStore::exportTo(const std::filesystem::path& savePath,
+                                const StoreLayout& layout) const
+{
+    std::map<uint64_t, Entry> entries;
+
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+
+        // Oldest first, so the latest entry of each id wins.
+        for (const auto& segment: _segments)
+        {
+            if (!segment.index) continue;
+
+            const Entry* first = reinterpret_cast<const Entry*>(segment.index->begin() + sizeof(IndexHeader));
+
+            for (uint64_t i = 0; i < segment.indexSize; ++i) entries[first[i].id] = first[i];
+        }
+
+        for (const auto& entry: _active) entries[entry.first] = entry.second;
+    }
+
+    std::size_t count = 0;
+
+    for (const auto& iter: entries)
+    {
+        const Entry& entry = iter.second;
+
+        Record record;
+
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            record.image = _span(entry.imageSegment, entry.imageOffset, entry.imageLength);
+            record.metadata = _span(entry.metadataSegment, entry.metadataOffset, entry.metadataLength);
+        }
+
+        try
+        {
+            ofJson json = ofJson::parse(record.metadata.data, record.metadata.data + record.metadata.size);
+
+            Post post = Post::fromJSON(json);
+
+            std::filesystem::path path = savePath / Post::relativeStorePathForImage(post, layout);
+
+            if (std::filesystem::exists(path))
+            {
+                continue;
+            }
+
+            std::filesystem::create_directories(path.parent_path());
+
+            std::ofstream output(path.string(), std::ios::binary);
+            output.write(record.image.data, record.image.size);
+            output.close();
+
+            if (!output)
+            {
+                throw Poco::IOException("Unable to write " + path.string());
+            }
+
+            std::filesystem::last_write_time(path, static_cast<std::time_t>(post.timestamp()));
+
+            std::filesystem::path jsonPath = path;
+            jsonPath.replace_extension(".json.gz");
+
+            json["path"] = path.string();
+            IO::JSONUtils::saveJSON(jsonPath, json);
+
+            ++count;
+        }
+        catch (const std::exception& exc)
+        {
+            ofLogError("PackStore::exportTo") << "Unable to export " << entry.id << ": " << exc.what();
+        }
+    }
+
+    return count;
+}
+
+
+bool PackStore::_find(uint64_t id, Entry& entry) const
+{
+    auto activeIter = _active.find(id);
+
+    if (activeIter != _active.end())
+    {
+        entry = activeIter->second;
+        return true;
+    }
+
+    for (auto iter = _segments.rbegin(); iter != _segments.rend(); ++iter)
+    {
+        if (!iter->index) continue;
+
+        const Entry* first = reinterpret_cast<const Entry*>(iter->index->begin() + sizeof(IndexHeader));
+        const Entry* last = first + iter->indexSize;
+
+        const Entry* found = std::lower_bound(first, last, id, [](const Entry& e, uint64_t value) {
+            return e.id < value;
+        });
+
+        if (found != last && found->id == id)
+        {
+            entry = *found;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+
+PackStore::Span PackStore::_span(uint32_t number, uint64_t offset, uint32_t length) const
+{
+    Span span;
+
+    if (length == 0)
+    {
+        return span;
+    }
+
+    auto iter = std::lower_bound(_segments.begin(), _segments.end(), number, [](const Segment& s, uint32_t value) {
+        return s.number < value;
+    });
+
+    if (iter == _segments.end() || iter->number != number)
+    {
+        throw Poco::IOException("Missing segment " + std::to_string(number));
+    }
+
+    const Segment& segment = *iter;
+
+    // The active segment grows, so map it again when reading past the end.
+    if (!segment.data || static_cast<uint64_t>(segment.data->end() - segment.data->begin()) < offset + length)
+    {
+        segment.data = std::make_shared<Poco::SharedMemory>(Poco::File(_segmentPath(number).string()),
+                                                            Poco::SharedMemory::AM_READ);
+    }
+
+    span.data = segment.data->begin() + offset;
+    span.size = length;
+    span.mapping = segment.data;
+    return span;
+}
+
+
+void PackStore::_append(uint64_t id, const std::string& image, const std::string& metadata)
+{
+    if (image.size() > std::numeric_limits<uint32_t>::max() ||
+        metadata.size() > std::numeric_limits<uint32_t>::max())
+    {
+        throw Poco::IOException("Record too large for " + std::to_string(id));
+    }
+
+    uint64_t recordSize = sizeof(RecordHeader) + image.size() + metadata.size();
+
+    if (_segments.back().size > 0 && _segments.back().size + recordSize > _segmentSize)
+    {
+        _seal();
+    }
+
+    Segment& segment = _segments.back();
+
+    Entry entry;
+
+    if (image.empty())
+    {
+        _find(id, entry);
+    }
+    else
+    {
+        entry.id = id;
+        entry.imageSegment = segment.number;
+        entry.imageOffset = segment.size + sizeof(RecordHeader);
+        entry.imageLength = static_cast<uint32_t>(image.size());
+    }
+
+    entry.metadataSegment = segment.number;
+    entry.metadataOffset = segment.size + sizeof(RecordHeader) + image.size();
+    entry.metadataLength = static_cast<uint32_t>(metadata.size());
+
+    RecordHeader header;
+    header.imageLength = static_cast<uint32_t>(image.size());
+    header.metadataLength = static_cast<uint32_t>(metadata.size());
+    header.id = id;
+
+    _stream.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    _stream.write(image.data(), image.size());
+    _stream.write(metadata.data(), metadata.size());
+    _stream.flush();
+
+    if (!_stream)
+    {
+        // Cut off the partial record so later offsets stay correct.
+        std::filesystem::path path = _segmentPath(segment.number);
+        _stream.close();
+        std::filesystem::resize_file(path, segment.size);
+        _stream.clear();
+        _stream.open(path.string(), std::ios::binary | std::ios::app);
+        throw Poco::IOException("Unable to write " + path.string());
+    }
+
+    segment.size += recordSize;
+    _active[id] = entry;
+}
+
+
+void PackStore::_seal()
+{
+    _stream.close();
+    _writeIndex(_segments.back());
+    _active.clear();
+    _openSegment(_segments.back().number + 1);
+}
+
+
+void PackStore::_writeIndex(Segment& segment)
+{
+    std::filesystem::path path = _indexPath(segment.number);
+    std::filesystem::path temporaryPath = path;
+    temporaryPath += ".tmp";
+
+    IndexHeader header;
+    header.size = _active.size();
+
+    std::ofstream output(temporaryPath.string(), std::ios::binary | std::ios::trunc);
+    output.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+    // The map is sorted by id, so the entries can be binary searched.
+    for (const auto& entry: _active)
+    {
+        output.write(reinterpret_cast<const char*>(&entry.second), sizeof(Entry));
+    }
+
+    output.close();
+
+    if (!output)
+    {
+        throw Poco::IOException("Unable to write " + temporaryPath.string());
+    }
+
+    std::filesystem::rename(temporaryPath, path);
+
+    segment.sealed = true;
+    _mapIndex(segment);
+}
+
+
+void PackStore::_openSegment(uint32_t number)
+{
+    Segment segment;
+    segment.number = number;
+    _segments.push_back(segment);
+
+    _stream.clear();
+    _stream.open(_segmentPath(number).string(), std::ios::binary | std::ios::app);
+
+    if (!_stream)
+    {
+        throw Poco::IOException("Unable to open " + _segmentPath(number).string());
+    }
+}
+
+
+void PackStore::_scan(Segment& segment)
+{
+    std::ifstream input(_segmentPath(segment.number).string(), std::ios::binary);
+
+    uint64_t offset = 0;
+
+    RecordHeader header;
+
+    while (offset + sizeof(RecordHeader) <= segment.size &&
+           input.read(reinterpret_cast<char*>(&header), sizeof(header)) &&
+           header.magic == RECORD_MAGIC)
+    {
+        uint64_t end = offset + sizeof(RecordHeader) + header.imageLength + header.metadataLength;
+
+        if (end > segment.size)
+        {
+            break;
+        }
+
+        Entry entry;
+
+        if (header.imageLength > 0)
+        {
+            entry.id = header.id;
+            entry.imageSegment = segment.number;
+            entry.imageOffset = offset + sizeof(RecordHeader);
+            entry.imageLength = header.imageLength;
+        }
+        else if (!_find(header.id, entry))
+        {
+            ofLogWarning("PackStore::_scan") << "Ignoring metadata for unknown id " << header.id << ".";
+            offset = end;
+            input.seekg(static_cast<std::streamoff>(end));
+            continue;
+        }
+
+        entry.metadataSegment = segment.number;
+        entry.metadataOffset = offset + sizeof(RecordHeader) + header.imageLength;
+        entry.metadataLength = header.metadataLength;
+
+        _active[header.id] = entry;
+
+        offset = end;
+        input.seekg(static_cast<std::streamoff>(end));
+    }
+
+    if (offset < segment.size)
+    {
+        // Drop a record torn by a crash so later appends stay aligned.
+        ofLogWarning("PackStore::_scan") << "Truncating partial record in " << _segmentPath(segment.number);
+        input.close();
+        std::filesystem::resize_file(_segmentPath(segment.number), offset);
+        segment.size = offset;
+    }
+}
+
+
+void PackStore::_mapIndex(Segment& segment)
+{
+    std::filesystem::path path = _indexPath(segment.number);
+
+    uint64_t size = std::filesystem::file_size(path);
+
+    auto index = std::make_shared<Poco::SharedMemory>(Poco::File(path.string()),
+                                                      Poco::SharedMemory::AM_READ);
+
+    IndexHeader header;
+
+    if (size >= sizeof(IndexHeader))
+    {
+        std::copy(index->begin(), index->begin() + sizeof(IndexHeader), reinterpret_cast<char*>(&header));
+    }
+
+    if (size < sizeof(IndexHeader) ||
+        header.magic != INDEX_MAGIC ||
+        header.version != INDEX_VERSION ||
+        size != sizeof(IndexHeader) + header.size * sizeof(Entry))
+    {
+        throw Poco::IOException("Invalid index " + path.string());
+    }
+
+    segment.index = index;
+    segment.indexSize = header.size;
+}
+
+
+std::filesystem::path PackStore::_segmentPath(uint32_t number) const
+{
+    char name[32];
+    std::snprintf(name, sizeof(name), "segment-%06u.pack", number);
+    return _path / name;
+}
+
+
+std::filesystem::path PackStore::_indexPath(uint32_t number) const
+{
+    char name[32];
+    std::snprintf(name, sizeof(name), "segment-%06u.idx", number);
+    return _path / name;
+}
+
+
+} } // ofx::InstaLooter
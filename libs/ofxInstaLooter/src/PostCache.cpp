@@ -0,0 +1,322 @@
+//
+// Copyright (c) 2017 Christopher Baker <https://christopherbaker.net>
+//
+// SPDX-License-Identifier:	MIT
+//
+
+
+#include "ofx/InstaLooter/PostCache.h"
+#include <algorithm>
+#include <unordered_set>
+
+
+namespace ofx {
+namespace InstaLooter {
+
+
+const std::size_t PostCache::DEFAULT_CAPACITY = 4096;
+const std::size_t PostCache::DEFAULT_NUM_SHARDS = 16;
+
+
+PostCache::PostCache(std::size_t capacity,
+                     std::size_t imageCapacity,
+                     std::size_t numShards):
+    _numShards(std::max(numShards, std::size_t(1))),
+    _recentCapacity(capacity),
+    _hits(0),
+    _misses(0)
+{
+    _shardCapacity = std::max((capacity + _numShards - 1) / _numShards, std::size_t(1));
+    _shardImageCapacity = imageCapacity / _numShards;
+    _shards.reset(new Shard[_numShards]);
+}
+
+
+void PostCache::put(const Post& post, std::shared_ptr<const std::string> image)
+{
+    _put(post, image);
+
+    std::unique_lock<std::mutex> lock(_recentMutex);
+
+    for (const auto& hashtag: post.hashtags())
+    {
+        auto& ids = _recent[hashtag];
+        ids.push_front(post.id());
+
+        if (ids.size() > _recentCapacity) ids.pop_back();
+    }
+}
+
+
+void PostCache::fill(const Post& post)
+{
+    _put(post, nullptr);
+}
+
+
+bool PostCache::get(uint64_t id, Post& post) const
+{
+    Shard& shard = _shard(id);
+
+    std::unique_lock<std::mutex> lock(shard.mutex);
+
+    Entry* entry = _find(shard, id);
+
+    if (!entry)
+    {
+        ++_misses;
+        return false;
+    }
+
+    ++_hits;
+    post = entry->post;
+    return true;
+}
+
+
+std::shared_ptr<const std::string> PostCache::getImage(uint64_t id) const
+{
+    Shard& shard = _shard(id);
+
+    std::unique_lock<std::mutex> lock(shard.mutex);
+
+    Entry* entry = _find(shard, id);
+
+    if (!entry || !entry->image)
+    {
+        ++_misses;
+        return nullptr;
+    }
+
+    ++_hits;
+    return entry->image;
+}
+
+
+std::vector<Post> PostCache::recent(const std::string& hashtag, std::size_t count) const
+{
+    std::vector<uint64_t> ids;
+
+    {
+        std::unique_lock<std::mutex> lock(_recentMutex);
+
+        auto iter = _recent.find(hashtag);
+
+        if (iter != _recent.end())
+        {
+            ids.assign(iter->second.begin(), iter->second.end());
+        }
+    }
+
+    std::vector<Post> posts;
+    std::unordered_set<uint64_t> seen;
+
+    for (auto id: ids)
+    {
+        if (posts.size() >= count) break;
+
+        // Updated posts appear more than once.
+        if (!seen.insert(id).second) continue;
+
+        const Shard& shard = _shard(id);
+
+        std::unique_lock<std::mutex> lock(shard.mutex);
+
+        // Evicted posts are skipped. Listing them is not a use, so neither
+        // the LRU order nor the hit rate change.
+        const Entry* entry = _peek(shard, id);
+
+        if (entry)
+        {
+            posts.push_back(entry->post);
+        }
+    }
+
+    return posts;
+}
+
+
+void PostCache::remove(uint64_t id)
+{
+    Shard& shard = _shard(id);
+
+    std::unique_lock<std::mutex> lock(shard.mutex);
+
+    auto iter = shard.index.find(id);
+
+    if (iter == shard.index.end())
+    {
+        return;
+    }
+
+    // Its recent entries are skipped like those of evicted posts.
+    if (iter->second->image) shard.imageBytes -= iter->second->image->size();
+    shard.entries.erase(iter->second);
+    shard.index.erase(iter);
+}
+
+
+void PostCache::clear()
+{
+    for (std::size_t i = 0; i < _numShards; ++i)
+    {
+        std::unique_lock<std::mutex> lock(_shards[i].mutex);
+        _shards[i].entries.clear();
+        _shards[i].index.clear();
+        _shards[i].imageBytes = 0;
+    }
+
+    std::unique_lock<std::mutex> lock(_recentMutex);
+    _recent.clear();
+}
+
+
+std::size_t PostCache::size() const
+{
+    std::size_t size = 0;
+
+    for (std::size_t i = 0; i < _numShards; ++i)
+    {
+        std::unique_lock<std::mutex> lock(_shards[i].mutex);
+        size += _shards[i].entries.size();
+    }
+
+    return size;
+}
+
+
+std::size_t PostCache::imageBytes() const
+{
+    std::size_t bytes = 0;
+
+    for (std::size_t i = 0; i < _numShards; ++i)
+    {
+        std::unique_lock<std::mutex> lock(_shards[i].mutex);
+        bytes += _shards[i].imageBytes;
+    }
+
+    return bytes;
+}
+
+
+uint64_t PostCache::hits() const
+{
+    return _hits;
+}
+
+
+uint64_t PostCache::misses() const
+{
+    return _misses;
+}
+
+
+std::unique_ptr<PostCache> PostCache::fromJSON(const ofJson& settings)
+{
+    if (!settings.is_object())
+    {
+        return std::make_unique<PostCache>();
+    }
+
+    std::size_t imageCapacityMB = settings.value("image_capacity_mb", 0);
+
+    return std::make_unique<PostCache>(settings.value("capacity", DEFAULT_CAPACITY),
+                                       imageCapacityMB << 20,
+                                       settings.value("shards", DEFAULT_NUM_SHARDS));
+}
+
+
+PostCache::Shard& PostCache::_shard(uint64_t id) const
+{
+    return _shards[id % _numShards];
+}
+
+
+void PostCache::_put(const Post& post, std::shared_ptr<const std::string> image)
+{
+    Shard& shard = _shard(post.id());
+
+    std::unique_lock<std::mutex> lock(shard.mutex);
+
+    Entry* entry = _find(shard, post.id());
+
+    if (entry)
+    {
+        entry->post = post;
+    }
+    else
+    {
+        Entry newEntry;
+        newEntry.id = post.id();
+        newEntry.post = post;
+        shard.entries.push_front(std::move(newEntry));
+        shard.index[post.id()] = shard.entries.begin();
+        entry = &shard.entries.front();
+    }
+
+    // Images larger than a whole shard are never cached.
+    if (image && image->size() <= _shardImageCapacity)
+    {
+        if (entry->image) shard.imageBytes -= entry->image->size();
+        entry->image = image;
+        shard.imageBytes += image->size();
+    }
+
+    _evict(shard);
+}
+
+
+PostCache::Entry* PostCache::_find(Shard& shard, uint64_t id) const
+{
+    auto iter = shard.index.find(id);
+
+    if (iter == shard.index.end())
+    {
+        return nullptr;
+    }
+
+    // Move to the front without invalidating the iterator.
+    shard.entries.splice(shard.entries.begin(), shard.entries, iter->second);
+
+    return &shard.entries.front();
+}
+
+
+const PostCache::Entry* PostCache::_peek(const Shard& shard, uint64_t id) const
+{
+    auto iter = shard.index.find(id);
+
+    if (iter == shard.index.end())
+    {
+        return nullptr;
+    }
+
+    return &*iter->second;
+}
+
+
+void PostCache::_evict(Shard& shard)
+{
+    while (shard.entries.size() > _shardCapacity)
+    {
+        const Entry& entry = shard.entries.back();
+        if (entry.image) shard.imageBytes -= entry.image->size();
+        shard.index.erase(entry.id);
+        shard.entries.pop_back();
+    }
+
+    // Drop the images of the least recently used posts, keeping the posts.
+    for (auto iter = shard.entries.rbegin();
+         iter != shard.entries.rend() && shard.imageBytes > _shardImageCapacity;
+         ++iter)
+    {
+        if (iter->image)
+        {
+            shard.imageBytes -= iter->image->size();
+            iter->image.reset();
+        }
+    }
+}
+
+
+} } // ofx::InstaLooter
@@ -0,0 +1,191 @@
+//
+// Copyright (c) 2017 Christopher Baker <https://christopherbaker.net>
+//
+// SPDX-License-Identifier:	MIT
+//
+
+
+#include "ofx/InstaLooter/PostMerger.h"
+#include <algorithm>
+
+
+namespace ofx {
+namespace InstaLooter {
+
+
+const uint64_t PostMerger::DEFAULT_WINDOW_MS = 5000;
+const std::size_t PostMerger::DEFAULT_WINDOW_SIZE = 1000;
+
+
+PostMerger::PostMerger(uint64_t windowMs, std::size_t windowSize):
+    _windowMs(windowMs),
+    _windowSize(std::max(windowSize, std::size_t(1)))
+{
+}
+
+
+void PostMerger::push(std::vector<Post>& posts, uint64_t now, std::vector<Post>& ready)
+{
+    // instaLooter downloads newest first, so sorting first makes most
+    // inserts appends.
+    std::sort(posts.begin(), posts.end(), _before);
+
+    for (auto& post: posts)
+    {
+        if (_released && _key(post) < _lastReleased)
+        {
+            // Too late to be merged, so do not hold it back as well.
+            ++_late;
+            ready.push_back(std::move(post));
+            continue;
+        }
+
+        const auto& hashtags = post.hashtags();
+        auto& stream = _streams[hashtags.empty() ? std::string() : *hashtags.begin()];
+
+        if (stream.empty())
+        {
+            ++_nonEmptyStreams;
+        }
+
+        Entry entry;
+        entry.post = std::move(post);
+        entry.arrival = now;
+
+        auto iter = std::upper_bound(stream.begin(), stream.end(), entry, [](const Entry& a, const Entry& b) {
+            return _before(a.post, b.post);
+        });
+
+        stream.insert(iter, std::move(entry));
+        _arrivals.insert(now);
+    }
+
+    posts.clear();
+
+    _release(now, ready, false);
+}
+
+
+void PostMerger::poll(uint64_t now, std::vector<Post>& ready)
+{
+    _release(now, ready, false);
+}
+
+
+void PostMerger::flush(std::vector<Post>& ready)
+{
+    _release(0, ready, true);
+}
+
+
+void PostMerger::removeStream(const std::string& hashtag)
+{
+    _removedStreams.insert(hashtag);
+
+    auto iter = _streams.find(hashtag);
+
+    if (iter != _streams.end() && iter->second.empty())
+    {
+        _streams.erase(iter);
+    }
+}
+
+
+void PostMerger::addStream(const std::string& hashtag)
+{
+    _removedStreams.erase(hashtag);
+}
+
+
+std::size_t PostMerger::size() const
+{
+    return _arrivals.size();
+}
+
+
+uint64_t PostMerger::late() const
+{
+    return _late;
+}
+
+
+std::unique_ptr<PostMerger> PostMerger::fromJSON(const ofJson& settings)
+{
+    if (!settings.is_object() || !settings.value("enabled", true))
+    {
+        return nullptr;
+    }
+
+    return std::make_unique<PostMerger>(settings.value("window_ms", DEFAULT_WINDOW_MS),
+                                        settings.value("window_size", DEFAULT_WINDOW_SIZE));
+}
+
+
+void PostMerger::_release(uint64_t now, std::vector<Post>& ready, bool all)
+{
+    while (!_arrivals.empty())
+    {
+        bool merged = _nonEmptyStreams == _streams.size();
+        bool full = _arrivals.size() > _windowSize;
+        bool expired = *_arrivals.begin() + _windowMs <= now;
+
+        if (!all && !merged && !full && !expired)
+        {
+            break;
+        }
+
+        Streams::iterator stream = _oldest();
+
+        Entry& entry = stream->second.front();
+        _arrivals.erase(_arrivals.find(entry.arrival));
+        _lastReleased = _key(entry.post);
+        _released = true;
+        ready.push_back(std::move(entry.post));
+        stream->second.pop_front();
+
+        if (stream->second.empty())
+        {
+            --_nonEmptyStreams;
+
+            // Otherwise an empty stream of a removed search would stop the
+            // merge for good.
+            if (_removedStreams.find(stream->first) != _removedStreams.end())
+            {
+                _streams.erase(stream);
+            }
+        }
+    }
+}
+
+
+PostMerger::Streams::iterator PostMerger::_oldest()
+{
+    Streams::iterator oldest = _streams.end();
+
+    // There is one stream per hashtag, so a scan is cheaper than a heap.
+    for (auto iter = _streams.begin(); iter != _streams.end(); ++iter)
+    {
+        if (!iter->second.empty() &&
+            (oldest == _streams.end() || _before(iter->second.front().post, oldest->second.front().post)))
+        {
+            oldest = iter;
+        }
+    }
+
+    return oldest;
+}
+
+
+PostMerger::Key PostMerger::_key(const Post& post)
+{
+    return Key(post.timestamp(), post.id());
+}
+
+
+bool PostMerger::_before(const Post& a, const Post& b)
+{
+    return _key(a) < _key(b);
+}
+
+
+} } // ofx::InstaLooter
@@ -0,0 +1,797 @@
+//
+// Copyright (c) 2017 Christopher Baker <https://christopherbaker.net>
+//
+// SPDX-License-Identifier:	MIT
+//
+
+
+#include "ofx/InstaLooter/Reaper.h"
+#include <algorithm>
+#include <sstream>
+#include <unordered_set>
+#include "Poco/Exception.h"
+#include "ofLog.h"
+#include "ofUtils.h"
+#include "ofx/InstaLooter/Trace.h"
+
+
+namespace ofx {
+namespace InstaLooter {
+
+
+bool RetentionPolicy::isEnabled() const
+{
+    return maxAge > 0 || maxPostsPerHashtag > 0 || maxBytes > 0;
+}
+
+
+RetentionPolicy RetentionPolicy::fromJSON(const ofJson& settings)
+{
+    RetentionPolicy policy;
+
+    if (!settings.is_object())
+    {
+        return policy;
+    }
+
+    uint64_t maxAgeHours = settings.value("max_age_hours", 0);
+    uint64_t maxSizeMB = settings.value("max_size_mb", 0);
+
+    policy.maxAge = maxAgeHours * 60 * 60;
+    policy.maxPostsPerHashtag = settings.value("max_posts_per_hashtag", 0);
+    policy.maxBytes = maxSizeMB << 20;
+    return policy;
+}
+
+
+const std::string RetentionIndex::FILENAME = "retention.index";
+const std::size_t RetentionIndex::MIN_COMPACTION_LINES = 65536;
+
+
+RetentionIndex::RetentionIndex(const std::filesystem::path& path):
+    _path(path)
+{
+    _read(_path);
+    _numLogLines += _read(_compactingPath());
+    _numLogLines += _read(_logPath());
+
+    _stream.open(_logPath().string(), std::ios::binary | std::ios::app);
+
+    if (!_stream)
+    {
+        throw Poco::IOException("Unable to open " + _logPath().string());
+    }
+
+    // Finish a compaction interrupted by a crash.
+    if (std::filesystem::exists(_compactingPath()))
+    {
+        compact();
+    }
+}
+
+
+std::filesystem::path RetentionIndex::path() const
+{
+    return _path;
+}
+
+
+void RetentionIndex::add(const std::vector<Record>& records)
+{
+    if (records.empty())
+    {
+        return;
+    }
+
+    std::unique_lock<std::mutex> lock(_mutex);
+
+    for (const auto& record: records)
+    {
+        Entry entry;
+        entry.timestamp = record.timestamp;
+        entry.bytes = record.bytes;
+        entry.root = static_cast<uint32_t>(record.root);
+
+        for (const auto& hashtag: record.hashtags)
+        {
+            entry.hashtags.push_back(_intern(hashtag));
+        }
+
+        std::sort(entry.hashtags.begin(), entry.hashtags.end());
+
+        _writeLine(_stream, record.id, entry, _hashtags);
+        _add(record.id, std::move(entry));
+    }
+
+    _numLogLines += records.size();
+    _stream.flush();
+
+    if (!_stream)
+    {
+        ofLogError("RetentionIndex::add") << "Unable to write to " << _logPath();
+        _stream.clear();
+    }
+}
+
+
+void RetentionIndex::remove(const std::vector<uint64_t>& ids)
+{
+    if (ids.empty())
+    {
+        return;
+    }
+
+    bool needsCompaction = false;
+
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+
+        for (auto id: ids)
+        {
+            _stream << "- " << id << "\n";
+            _remove(id);
+        }
+
+        _numLogLines += ids.size();
+        _stream.flush();
+
+        if (!_stream)
+        {
+            ofLogError("RetentionIndex::remove") << "Unable to write to " << _logPath();
+            _stream.clear();
+        }
+
+        needsCompaction = _numLogLines > std::max(MIN_COMPACTION_LINES, _entries.size());
+    }
+
+    if (needsCompaction)
+    {
+        compact();
+    }
+}
+
+
+std::vector<RetentionIndex::Record> RetentionIndex::select(const RetentionPolicy& policy,
+                                                           uint64_t now,
+                                                           std::size_t count) const
+{
+    std::vector<Record> result;
+
+    if (count == 0)
+    {
+        return result;
+    }
+
+    std::unique_lock<std::mutex> lock(_mutex);
+
+    // What is already chosen counts as removed for the later limits.
+    std::unordered_set<uint64_t> chosen;
+    std::vector<std::size_t> chosenPerHashtag(_byHashtag.size(), 0);
+    uint64_t chosenBytes = 0;
+
+    // Returns true once the result is full.
+    auto choose = [&](const Key& key)
+    {
+        if (!chosen.insert(key.second).second)
+        {
+            return false;
+        }
+
+        const Entry& entry = _entries.at(key.second);
+
+        for (auto hashtag: entry.hashtags)
+        {
+            ++chosenPerHashtag[hashtag];
+        }
+
+        chosenBytes += entry.bytes;
+        result.push_back(_record(key.second, entry));
+        return result.size() >= count;
+    };
+
+    if (policy.maxAge > 0 && now > policy.maxAge)
+    {
+        uint64_t cutoff = now - policy.maxAge;
+
+        for (const auto& key: _byTime)
+        {
+            if (key.first >= cutoff) break;
+            if (choose(key)) return result;
+        }
+    }
+
+    if (policy.maxPostsPerHashtag > 0)
+    {
+        for (std::size_t i = 0; i < _byHashtag.size(); ++i)
+        {
+            const auto& keys = _byHashtag[i];
+
+            for (auto iter = keys.begin();
+                 iter != keys.end() && keys.size() - chosenPerHashtag[i] > policy.maxPostsPerHashtag;
+                 ++iter)
+            {
+                if (choose(*iter)) return result;
+            }
+        }
+    }
+
+    if (policy.maxBytes > 0)
+    {
+        for (const auto& key: _byTime)
+        {
+            if (_bytes - chosenBytes <= policy.maxBytes) break;
+            if (choose(key)) return result;
+        }
+    }
+
+    return result;
+}
+
+
+std::size_t RetentionIndex::size() const
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    return _entries.size();
+}
+
+
+uint64_t RetentionIndex::bytes() const
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    return _bytes;
+}
+
+
+std::size_t RetentionIndex::count(const std::string& hashtag) const
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+
+    auto iter = _hashtagIndices.find(hashtag);
+
+    return iter == _hashtagIndices.end() ? 0 : _byHashtag[iter->second].size();
+}
+
+
+void RetentionIndex::compact()
+{
+    std::unique_lock<std::mutex> compactionLock(_compactionMutex);
+
+    std::vector<std::pair<uint64_t, Entry>> entries;
+    std::vector<std::string> hashtags;
+
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+
+        _stream.close();
+
+        bool moved = false;
+
+        try
+        {
+            if (!std::filesystem::exists(_compactingPath()))
+            {
+                std::filesystem::rename(_logPath(), _compactingPath());
+            }
+            else
+            {
+                // The last compaction failed, so keep its log too.
+                {
+                    std::ifstream log(_logPath().string(), std::ios::binary);
+                    std::ofstream compacting(_compactingPath().string(), std::ios::binary | std::ios::app);
+                    compacting << log.rdbuf();
+                }
+
+                std::filesystem::remove(_logPath());
+            }
+
+            _numLogLines = 0;
+            moved = true;
+        }
+        catch (const std::exception& exc)
+        {
+            ofLogError("RetentionIndex::compact") << "Unable to move " << _logPath() << " aside: " << exc.what();
+        }
+
+        _stream.open(_logPath().string(), std::ios::binary | std::ios::app);
+
+        if (!moved)
+        {
+            return;
+        }
+
+        // Copied, so the snapshot is written without holding up add().
+        entries.assign(_entries.begin(), _entries.end());
+        hashtags = _hashtags;
+    }
+
+    std::filesystem::path temporaryPath = _path;
+    temporaryPath += ".tmp";
+
+    try
+    {
+        {
+            std::ofstream stream(temporaryPath.string(), std::ios::binary | std::ios::trunc);
+
+            for (const auto& entry: entries)
+            {
+                _writeLine(stream, entry.first, entry.second, hashtags);
+            }
+
+            stream.flush();
+
+            if (!stream)
+            {
+                throw Poco::IOException("Unable to write " + temporaryPath.string());
+            }
+        }
+
+        std::filesystem::rename(temporaryPath, _path);
+        std::filesystem::remove(_compactingPath());
+    }
+    catch (const std::exception& exc)
+    {
+        ofLogError("RetentionIndex::compact") << "Unable to write " << _path << ": " << exc.what();
+    }
+}
+
+
+void RetentionIndex::_add(uint64_t id, Entry entry)
+{
+    auto iter = _entries.find(id);
+
+    if (iter != _entries.end())
+    {
+        std::vector<uint32_t> hashtags;
+
+        std::set_union(iter->second.hashtags.begin(), iter->second.hashtags.end(),
+                       entry.hashtags.begin(), entry.hashtags.end(),
+                       std::back_inserter(hashtags));
+
+        entry.hashtags.swap(hashtags);
+
+        _remove(id);
+    }
+
+    Key key(entry.timestamp, id);
+
+    _byTime.insert(key);
+
+    for (auto hashtag: entry.hashtags)
+    {
+        _byHashtag[hashtag].insert(key);
+    }
+
+    _bytes += entry.bytes;
+    _entries[id] = std::move(entry);
+}
+
+
+void RetentionIndex::_remove(uint64_t id)
+{
+    auto iter = _entries.find(id);
+
+    if (iter == _entries.end())
+    {
+        return;
+    }
+
+    Key key(iter->second.timestamp, id);
+
+    _byTime.erase(key);
+
+    for (auto hashtag: iter->second.hashtags)
+    {
+        _byHashtag[hashtag].erase(key);
+    }
+
+    _bytes -= iter->second.bytes;
+    _entries.erase(iter);
+}
+
+
+uint32_t RetentionIndex::_intern(const std::string& hashtag)
+{
+    auto iter = _hashtagIndices.find(hashtag);
+
+    if (iter != _hashtagIndices.end())
+    {
+        return iter->second;
+    }
+
+    uint32_t index = static_cast<uint32_t>(_hashtags.size());
+
+    _hashtags.push_back(hashtag);
+    _byHashtag.push_back(std::set<Key>());
+    _hashtagIndices[hashtag] = index;
+    return index;
+}
+
+
+RetentionIndex::Record RetentionIndex::_record(uint64_t id, const Entry& entry) const
+{
+    Record record;
+    record.id = id;
+    record.timestamp = entry.timestamp;
+    record.bytes = entry.bytes;
+    record.root = entry.root;
+
+    for (auto hashtag: entry.hashtags)
+    {
+        record.hashtags.insert(_hashtags[hashtag]);
+    }
+
+    return record;
+}
+
+
+std::size_t RetentionIndex::_read(const std::filesystem::path& path)
+{
+    if (!std::filesystem::exists(path))
+    {
+        return 0;
+    }
+
+    std::string contents;
+
+    {
+        std::ifstream file(path.string(), std::ios::binary);
+        std::stringstream buffer;
+        buffer << file.rdbuf();
+        contents = buffer.str();
+    }
+
+    std::size_t end = contents.rfind('\n');
+    std::size_t complete = (end == std::string::npos) ? 0 : end + 1;
+
+    if (complete != contents.size())
+    {
+        // Drop a line torn by a crash so later appends start a new line.
+        ofLogWarning("RetentionIndex::_read") << "Truncating partial line in " << path;
+        std::filesystem::resize_file(path, complete);
+        contents.resize(complete);
+    }
+
+    std::stringstream lines(contents);
+    std::string line;
+    std::size_t numLines = 0;
+
+    while (std::getline(lines, line))
+    {
+        std::stringstream tokens(line);
+
+        std::string operation;
+        uint64_t id = 0;
+
+        if (!(tokens >> operation >> id))
+        {
+            ofLogWarning("RetentionIndex::_read") << "Ignoring invalid line in " << path << ": " << line;
+            continue;
+        }
+
+        if (operation == "-")
+        {
+            _remove(id);
+        }
+        else if (operation == "+")
+        {
+            Entry entry;
+
+            if (!(tokens >> entry.timestamp >> entry.bytes >> entry.root))
+            {
+                ofLogWarning("RetentionIndex::_read") << "Ignoring invalid line in " << path << ": " << line;
+                continue;
+            }
+
+            std::string hashtag;
+
+            while (tokens >> hashtag)
+            {
+                entry.hashtags.push_back(_intern(hashtag));
+            }
+
+            std::sort(entry.hashtags.begin(), entry.hashtags.end());
+            entry.hashtags.erase(std::unique(entry.hashtags.begin(), entry.hashtags.end()),
+                                 entry.hashtags.end());
+
+            _add(id, std::move(entry));
+        }
+        else
+        {
+            ofLogWarning("RetentionIndex::_read") << "Ignoring invalid line in " << path << ": " << line;
+            continue;
+        }
+
+        ++numLines;
+    }
+
+    return numLines;
+}
+
+
+void RetentionIndex::_writeLine(std::ostream& stream,
+                                uint64_t id,
+                                const Entry& entry,
+                                const std::vector<std::string>& hashtags)
+{
+    stream << "+ " << id << " " << entry.timestamp << " " << entry.bytes << " " << entry.root;
+
+    for (auto hashtag: entry.hashtags)
+    {
+        stream << " " << hashtags[hashtag];
+    }
+
+    stream << "\n";
+}
+
+
+std::filesystem::path RetentionIndex::_logPath() const
+{
+    std::filesystem::path path = _path;
+    path += ".log";
+    return path;
+}
+
+
+std::filesystem::path RetentionIndex::_compactingPath() const
+{
+    std::filesystem::path path = _logPath();
+    path += ".compacting";
+    return path;
+}
+
+
+const std::size_t Reaper::DEFAULT_BATCH_SIZE = 256;
+const uint64_t Reaper::DEFAULT_INTERVAL = 60000;
+
+
+Reaper::Reaper(Store& store,
+               const RetentionPolicy& policy,
+               std::size_t batchSize):
+    _store(store),
+    _policy(policy),
+    _batchSize(std::max(batchSize, std::size_t(1))),
+    _index(store.savePath(0) / RetentionIndex::FILENAME),
+    _cancelled(false)
+{
+}
+
+
+void Reaper::add(std::size_t root, const std::vector<Post>& posts)
+{
+    if (posts.empty() || _store.packStore(root))
+    {
+        return;
+    }
+
+    std::vector<RetentionIndex::Record> records;
+    records.reserve(posts.size());
+
+    for (const auto& post: posts)
+    {
+        RetentionIndex::Record record;
+        record.id = post.id();
+        record.timestamp = post.timestamp();
+        record.root = root;
+        record.hashtags = post.hashtags();
+
+        try
+        {
+            std::filesystem::path jsonPath = post.path();
+            jsonPath.replace_extension(".json.gz");
+
+            record.bytes = std::filesystem::file_size(post.path());
+
+            if (std::filesystem::exists(jsonPath))
+            {
+                record.bytes += std::filesystem::file_size(jsonPath);
+            }
+        }
+        catch (const std::exception&)
+        {
+            // Already removed, or moved by a resharder.
+            continue;
+        }
+
+        records.push_back(std::move(record));
+    }
+
+    _index.add(records);
+}
+
+
+std::size_t Reaper::reap(uint64_t now, const Handler& handler)
+{
+    uint64_t startTime = ofGetElapsedTimeMillis();
+    std::size_t numRemoved = 0;
+    uint64_t bytesRemoved = 0;
+
+    std::vector<uint64_t> ids;
+    std::vector<Post> removed;
+
+    while (!_cancelled)
+    {
+        std::vector<RetentionIndex::Record> records = _index.select(_policy, now, _batchSize);
+
+        if (records.empty())
+        {
+            break;
+        }
+
+        TraceSpan batchSpan("reap");
+        batchSpan.setCount(records.size());
+
+        ids.clear();
+        removed.clear();
+
+        for (auto& record: records)
+        {
+            std::filesystem::path imagePath;
+
+            _removeFiles(record, imagePath);
+
+            ids.push_back(record.id);
+            bytesRemoved += record.bytes;
+
+            removed.push_back(Post(std::move(imagePath),
+                                   record.id,
+                                   0,
+                                   record.timestamp,
+                                   0,
+                                   0,
+                                   std::move(record.hashtags)));
+        }
+
+        // Only dropped from the index once the files are gone, so a crash
+        // leaves them to be removed again.
+        _index.remove(ids);
+
+        numRemoved += ids.size();
+
+        batchSpan.end();
+
+        if (handler) handler(removed);
+    }
+
+    uint64_t duration = ofGetElapsedTimeMillis() - startTime;
+
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _stats.passes++;
+        _stats.posts += numRemoved;
+        _stats.bytes += bytesRemoved;
+        _stats.duration += duration;
+        _stats.lastPosts = numRemoved;
+        _stats.lastDuration = duration;
+    }
+
+    if (numRemoved > 0)
+    {
+        double rate = duration > 0 ? numRemoved * 1000.0 / duration : 0;
+
+        ofLogNotice("Reaper::reap") << "Removed " << numRemoved << " posts (" << (bytesRemoved >> 20) << " MB) in " << duration << " ms (" << rate << " posts/s), " << _index.size() << " left.";
+    }
+
+    return numRemoved;
+}
+
+
+void Reaper::cancel()
+{
+    _cancelled = true;
+}
+
+
+void Reaper::resume()
+{
+    _cancelled = false;
+}
+
+
+const RetentionPolicy& Reaper::policy() const
+{
+    return _policy;
+}
+
+
+const RetentionIndex& Reaper::index() const
+{
+    return _index;
+}
+
+
+Reaper::Stats Reaper::stats() const
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    return _stats;
+}
+
+
+std::unique_ptr<Reaper> Reaper::fromJSON(const ofJson& settings, Store& store)
+{
+    if (!settings.is_object() || !settings.value("enabled", true))
+    {
+        return nullptr;
+    }
+
+    if (store.packStore(0))
+    {
+        // Segments are append only, so nothing could ever be removed.
+        ofLogWarning("Reaper::fromJSON") << "Retention does not apply to pack stores, keeping every post.";
+        return nullptr;
+    }
+
+    RetentionPolicy policy = RetentionPolicy::fromJSON(settings);
+
+    if (!policy.isEnabled())
+    {
+        ofLogWarning("Reaper::fromJSON") << "Retention has no limits, keeping every post.";
+        return nullptr;
+    }
+
+    return std::make_unique<Reaper>(store,
+                                    policy,
+                                    settings.value("batch_size", DEFAULT_BATCH_SIZE));
+}
+
+
+void Reaper::_removeFiles(const RetentionIndex::Record& record,
+                          std::filesystem::path& imagePath)
+{
+    // Writers and the resharder hold the same lock while they use the files.
+    std::unique_lock<std::mutex> lock(_store.mutexFor(record.id));
+
+    std::vector<StoreLayout> layouts = { _store.layout() };
+
+    if (_store.isResharding())
+    {
+        layouts.push_back(_store.previousLayout());
+    }
+
+    // The filenames also hold the user id and timestamp, so list the
+    // post's directory, which is small.
+    std::string prefix = std::to_string(record.id) + ".";
+
+    for (const auto& layout: layouts)
+    {
+        try
+        {
+            std::filesystem::path directory = _store.savePath(record.root) / layout.directoryFor(record.id);
+
+            if (!std::filesystem::is_directory(directory))
+            {
+                continue;
+            }
+
+            std::vector<std::filesystem::path> paths;
+
+            std::filesystem::directory_iterator iter(directory), end;
+
+            for (; iter != end; ++iter)
+            {
+                if (iter->path().filename().string().compare(0, prefix.size(), prefix) == 0)
+                {
+                    paths.push_back(iter->path());
+                }
+            }
+
+            for (const auto& path: paths)
+            {
+                if (path.extension() != ".gz")
+                {
+                    imagePath = path;
+                }
+
+                std::filesystem::remove(path);
+            }
+        }
+        catch (const std::exception& exc)
+        {
+            // Dropped from the index anyway, so it does not hold up the
+            // rest. A store check finds what is left.
+            ofLogError("Reaper::_removeFiles") << "Unable to remove post " << record.id << ": " << exc.what();
+        }
+    }
+}
+
+
+} } // ofx::InstaLooter
@@ -0,0 +1,259 @@
+//
+// Copyright (c) 2017 Christopher Baker <https://christopherbaker.net>
+//
+// SPDX-License-Identifier:	MIT
+//
+
+
+#include "ofx/InstaLooter/ResourcePolicy.h"
+#include <cerrno>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <mutex>
+#include <set>
+#include <sys/resource.h>
+#include "ofFileUtils.h"
+#include "ofLog.h"
+
+#if defined(__linux__)
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+
+namespace ofx {
+namespace InstaLooter {
+
+
+namespace {
+
+
+/// \brief Log each distinct problem once, as policies are applied every poll.
+void warnOnce(const std::string& message)
+{
+    static std::mutex mutex;
+    static std::set<std::string> warned;
+
+    std::unique_lock<std::mutex> lock(mutex);
+
+    if (warned.insert(message).second)
+    {
+        ofLogWarning("ResourcePolicy") << message;
+    }
+}
+
+
+std::string lastError()
+{
+    return std::strerror(errno);
+}
+
+
+#if defined(__linux__)
+
+/// \brief Apply nice, IO class and affinity to a thread or process.
+/// \param tid The thread id, which is the process id of a new process.
+void applyToTask(const ResourcePolicy& policy, pid_t tid)
+{
+    if (policy.hasNice && ::setpriority(PRIO_PROCESS, tid, policy.nice) != 0)
+    {
+        warnOnce("Unable to set nice " + std::to_string(policy.nice) + ": " + lastError());
+    }
+
+    if (policy.ioClass != ResourcePolicy::IO_CLASS_NONE)
+    {
+        // IOPRIO_WHO_PROCESS and IOPRIO_PRIO_VALUE from linux/ioprio.h.
+        int value = (static_cast<int>(policy.ioClass) << 13) | (policy.ioLevel & 7);
+
+        if (::syscall(SYS_ioprio_set, 1, tid, value) != 0)
+        {
+            warnOnce("Unable to set the IO class: " + lastError());
+        }
+    }
+
+    if (!policy.cpus.empty())
+    {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+
+        for (int cpu: policy.cpus)
+        {
+            if (cpu >= 0 && cpu < CPU_SETSIZE) CPU_SET(cpu, &set);
+        }
+
+        if (::sched_setaffinity(tid, sizeof(set), &set) != 0)
+        {
+            warnOnce("Unable to set the CPU affinity: " + lastError());
+        }
+    }
+}
+
+
+bool writeControl(const std::filesystem::path& path, const std::string& value)
+{
+    std::ofstream stream(path.string());
+    stream << value;
+    stream.flush();
+    return static_cast<bool>(stream);
+}
+
+
+void applyCgroup(const ResourcePolicy& policy, pid_t pid)
+{
+    std::filesystem::path path = std::filesystem::path(ResourcePolicy::CGROUP_ROOT) / policy.cgroup;
+
+    try
+    {
+        std::filesystem::create_directories(path);
+    }
+    catch (const std::exception& exc)
+    {
+        warnOnce("Unable to create cgroup " + path.string() + ": " + exc.what());
+        return;
+    }
+
+    // Written every time, so edited limits apply to the next launch.
+    std::string memoryMax = policy.memoryMax > 0 ? std::to_string(policy.memoryMax) : "max";
+
+    if (!writeControl(path / "memory.max", memoryMax))
+    {
+        warnOnce("Unable to limit the memory of cgroup " + path.string() + ", is the memory controller enabled?");
+    }
+
+    uint64_t quota = static_cast<uint64_t>(std::llround(policy.cpuMax * ResourcePolicy::CGROUP_CPU_PERIOD));
+    std::string cpuMax = (quota > 0 ? std::to_string(quota) : "max") + " " + std::to_string(ResourcePolicy::CGROUP_CPU_PERIOD);
+
+    if (!writeControl(path / "cpu.max", cpuMax))
+    {
+        warnOnce("Unable to limit the CPU of cgroup " + path.string() + ", is the cpu controller enabled?");
+    }
+
+    if (!writeControl(path / "cgroup.procs", std::to_string(pid)))
+    {
+        warnOnce("Unable to move processes into cgroup " + path.string() + ".");
+    }
+}
+
+#endif
+
+
+}
+
+
+const std::string ResourcePolicy::CGROUP_ROOT = "/sys/fs/cgroup";
+const uint64_t ResourcePolicy::CGROUP_CPU_PERIOD = 100000;
+
+
+bool ResourcePolicy::isEmpty() const
+{
+    return !hasNice && ioClass == IO_CLASS_NONE && cpus.empty() && cgroup.empty();
+}
+
+
+void ResourcePolicy::applyToProcess(pid_t pid) const
+{
+    if (pid <= 0 || isEmpty())
+    {
+        return;
+    }
+
+#if defined(__linux__)
+    // The process is already running, so it is moved into the cgroup
+    // first, before its nice, IO class and affinity are set.
+    if (!cgroup.empty())
+    {
+        applyCgroup(*this, pid);
+    }
+
+    applyToTask(*this, pid);
+#else
+    if (hasNice && ::setpriority(PRIO_PROCESS, pid, nice) != 0)
+    {
+        warnOnce("Unable to set nice " + std::to_string(nice) + ": " + lastError());
+    }
+
+    if (ioClass != IO_CLASS_NONE || !cpus.empty() || !cgroup.empty())
+    {
+        warnOnce("IO classes, CPU affinity and cgroups are only supported on Linux.");
+    }
+#endif
+}
+
+
+void ResourcePolicy::applyToThread() const
+{
+    if (isEmpty())
+    {
+        return;
+    }
+
+#if defined(__linux__)
+    applyToTask(*this, static_cast<pid_t>(::syscall(SYS_gettid)));
+#else
+    warnOnce("Thread priorities and affinity are only supported on Linux.");
+#endif
+}
+
+
+ResourcePolicy ResourcePolicy::fromJSON(const ofJson& settings)
+{
+    return fromJSON(settings, ResourcePolicy());
+}
+
+
+ResourcePolicy ResourcePolicy::fromJSON(const ofJson& settings,
+                                        const ResourcePolicy& defaults)
+{
+    ResourcePolicy policy = defaults;
+
+    if (!settings.is_object())
+    {
+        return policy;
+    }
+
+    auto niceIter = settings.find("nice");
+
+    if (niceIter != settings.end())
+    {
+        policy.hasNice = true;
+        policy.nice = niceIter->get<int>();
+    }
+
+    auto ioClassIter = settings.find("io_class");
+
+    if (ioClassIter != settings.end())
+    {
+        std::string ioClass = ioClassIter->get<std::string>();
+
+        if (ioClass == "realtime") policy.ioClass = IO_CLASS_REALTIME;
+        else if (ioClass == "best-effort") policy.ioClass = IO_CLASS_BEST_EFFORT;
+        else if (ioClass == "idle") policy.ioClass = IO_CLASS_IDLE;
+        else if (ioClass == "none") policy.ioClass = IO_CLASS_NONE;
+        else ofLogWarning("ResourcePolicy::fromJSON") << "Unknown io_class " << ioClass << ", ignoring.";
+    }
+
+    policy.ioLevel = settings.value("io_priority", policy.ioLevel);
+
+    auto cpusIter = settings.find("cpus");
+
+    if (cpusIter != settings.end())
+    {
+        policy.cpus = cpusIter->get<std::vector<int>>();
+    }
+
+    auto cgroupIter = settings.find("cgroup");
+
+    if (cgroupIter != settings.end() && cgroupIter->is_object())
+    {
+        policy.cgroup = cgroupIter->value("path", policy.cgroup);
+        policy.memoryMax = cgroupIter->value("memory_max_mb", policy.memoryMax / (1024 * 1024)) * 1024 * 1024;
+        policy.cpuMax = cgroupIter->value("cpu_max", policy.cpuMax);
+    }
+
+    return policy;
+}
+
+
+} } // ofx::InstaLooter
@@ -0,0 +1,684 @@
+//
+// Copyright (c) 2017 Christopher Baker <https://christopherbaker.net>
+//
+// SPDX-License-Identifier:	MIT
+//
+
+
+#include "ofx/InstaLooter/SharedFeed.h"
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <signal.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "Poco/File.h"
+#include "ofLog.h"
+#include "ofUtils.h"
+
+
+namespace ofx {
+namespace InstaLooter {
+
+
+namespace {
+
+
+static_assert(ATOMIC_LLONG_LOCK_FREE == 2, "The feed needs lock-free 64-bit atomics to be shared between processes.");
+
+
+const char MAGIC[8] = { 'I', 'L', 'F', 'E', 'E', 'D', '0', '1' };
+const uint32_t VERSION = 1;
+const std::size_t HEADER_SIZE = 128;
+const std::size_t CONSUMER_SIZE = 64;
+const std::size_t SLOT_HEADER_SIZE = 16;
+
+/// \brief The size of a post without its path and hashtags.
+const std::size_t POST_SIZE = 6 * sizeof(uint64_t) + 2 * sizeof(uint32_t);
+
+
+struct Header
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t slotSize;
+    uint32_t numSlots;
+    uint32_t numConsumers;
+    std::atomic<uint64_t> head;
+};
+
+
+struct Consumer
+{
+    std::atomic<uint64_t> pid;
+    std::atomic<uint64_t> cursor;
+    std::atomic<uint64_t> dropped;
+    std::atomic<uint64_t> lastSeen;
+};
+
+
+struct Slot
+{
+    /// \brief 2 * n + 1 while post n is written, 2 * n + 2 once it is.
+    std::atomic<uint64_t> sequence;
+    uint32_t length;
+    uint32_t kind;
+};
+
+
+static_assert(sizeof(Header) <= HEADER_SIZE, "The header must fit.");
+static_assert(sizeof(Consumer) <= CONSUMER_SIZE, "A consumer must fit.");
+static_assert(sizeof(Slot) == SLOT_HEADER_SIZE, "The slot header must fit.");
+
+
+Header* header(char* data)
+{
+    return reinterpret_cast<Header*>(data);
+}
+
+
+Consumer* consumer(char* data, std::size_t index)
+{
+    return reinterpret_cast<Consumer*>(data + HEADER_SIZE + index * CONSUMER_SIZE);
+}
+
+
+Slot* slot(char* data, uint64_t sequence)
+{
+    Header* h = header(data);
+    return reinterpret_cast<Slot*>(data + HEADER_SIZE +
+                                   h->numConsumers * CONSUMER_SIZE +
+                                   (sequence % h->numSlots) * h->slotSize);
+}
+
+
+std::size_t mappingSize(std::size_t numSlots, std::size_t slotSize, std::size_t numConsumers)
+{
+    return HEADER_SIZE + numConsumers * CONSUMER_SIZE + numSlots * slotSize;
+}
+
+
+/// \returns true if a mapping holds a whole feed.
+bool isValid(char* data, std::size_t size)
+{
+    if (size < HEADER_SIZE)
+    {
+        return false;
+    }
+
+    Header* h = header(data);
+
+    return std::memcmp(h->magic, MAGIC, sizeof(MAGIC)) == 0 &&
+           h->version == VERSION &&
+           h->numSlots > 0 &&
+           h->slotSize > SLOT_HEADER_SIZE + POST_SIZE &&
+           size >= mappingSize(h->numSlots, h->slotSize, h->numConsumers);
+}
+
+
+uint64_t now()
+{
+    return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+
+template <typename T>
+char* put(char* out, T value)
+{
+    std::memcpy(out, &value, sizeof(T));
+    return out + sizeof(T);
+}
+
+
+char* put(char* out, const std::string& value)
+{
+    out = put(out, static_cast<uint32_t>(value.size()));
+    std::memcpy(out, value.data(), value.size());
+    return out + value.size();
+}
+
+
+template <typename T>
+bool get(const char*& in, const char* end, T& value)
+{
+    if (end - in < static_cast<std::ptrdiff_t>(sizeof(T))) return false;
+    std::memcpy(&value, in, sizeof(T));
+    in += sizeof(T);
+    return true;
+}
+
+
+bool get(const char*& in, const char* end, std::string& value)
+{
+    uint32_t length = 0;
+    if (!get(in, end, length) || end - in < static_cast<std::ptrdiff_t>(length)) return false;
+    value.assign(in, length);
+    in += length;
+    return true;
+}
+
+
+/// \returns true if a process exists.
+bool isAlive(uint64_t pid)
+{
+    return ::kill(static_cast<pid_t>(pid), 0) == 0 || errno != ESRCH;
+}
+
+
+}
+
+
+#if defined(__linux__)
+const std::string SharedFeed::DEFAULT_PATH = "/dev/shm/instalooter-feed";
+#else
+const std::string SharedFeed::DEFAULT_PATH = "/tmp/instalooter-feed";
+#endif
+const std::size_t SharedFeed::DEFAULT_NUM_SLOTS = 4096;
+const std::size_t SharedFeed::DEFAULT_SLOT_SIZE = 2048;
+const std::size_t SharedFeed::MAX_CONSUMERS = 32;
+
+
+SharedFeed::SharedFeed(const std::filesystem::path& path,
+                       std::size_t numSlots,
+                       std::size_t slotSize):
+    _path(path)
+{
+    // Slots are cache line aligned, so neighbouring slots written and read
+    // at once do not share a line.
+    slotSize = (std::max(slotSize, SLOT_HEADER_SIZE + POST_SIZE + 64) + 63) / 64 * 64;
+
+    if (!_open(std::max(numSlots, std::size_t(1)), slotSize))
+    {
+        _data = nullptr;
+    }
+}
+
+
+bool SharedFeed::isOpen() const
+{
+    return _data != nullptr;
+}
+
+
+void SharedFeed::publish(const std::vector<Post>& posts, Kind kind)
+{
+    if (!_data)
+    {
+        return;
+    }
+
+    std::unique_lock<std::mutex> lock(_mutex);
+
+    Header* h = header(_data);
+    uint64_t sequence = h->head.load(std::memory_order_relaxed);
+
+    for (const auto& post: posts)
+    {
+        std::string path = post._path.string();
+        std::size_t size = POST_SIZE + path.size();
+
+        for (const auto& hashtag: post._hashtags)
+        {
+            size += sizeof(uint32_t) + hashtag.size();
+        }
+
+        if (SLOT_HEADER_SIZE + size > h->slotSize)
+        {
+            if (!_warnedSize)
+            {
+                ofLogWarning("SharedFeed::publish") << "Post " << post.id() << " needs " << SLOT_HEADER_SIZE + size << " bytes, more than a slot of " << h->slotSize << ". Posts that do not fit are not published.";
+                _warnedSize = true;
+            }
+
+            continue;
+        }
+
+        Slot* s = slot(_data, sequence);
+
+        s->sequence.store(2 * sequence + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+
+        s->length = static_cast<uint32_t>(size);
+        s->kind = static_cast<uint32_t>(kind);
+
+        char* out = reinterpret_cast<char*>(s) + SLOT_HEADER_SIZE;
+        out = put(out, post._id);
+        out = put(out, post._userId);
+        out = put(out, post._timestamp);
+        out = put(out, post._width);
+        out = put(out, post._height);
+        out = put(out, post._downloadTime);
+        out = put(out, path);
+        out = put(out, static_cast<uint32_t>(post._hashtags.size()));
+
+        for (const auto& hashtag: post._hashtags)
+        {
+            out = put(out, hashtag);
+        }
+
+        s->sequence.store(2 * sequence + 2, std::memory_order_release);
+
+        h->head.store(++sequence, std::memory_order_release);
+    }
+}
+
+
+uint64_t SharedFeed::head() const
+{
+    return _data ? header(_data)->head.load(std::memory_order_acquire) : 0;
+}
+
+
+std::vector<SharedFeed::Consumer> SharedFeed::consumers() const
+{
+    std::vector<Consumer> result;
+
+    if (!_data)
+    {
+        return result;
+    }
+
+    uint64_t head = this->head();
+
+    for (std::size_t i = 0; i < header(_data)->numConsumers; ++i)
+    {
+        auto* c = consumer(_data, i);
+
+        Consumer info;
+        info.pid = c->pid.load(std::memory_order_relaxed);
+
+        if (info.pid == 0)
+        {
+            continue;
+        }
+
+        info.cursor = c->cursor.load(std::memory_order_relaxed);
+        info.lag = info.cursor < head ? head - info.cursor : 0;
+        info.dropped = c->dropped.load(std::memory_order_relaxed);
+        info.lastSeen = c->lastSeen.load(std::memory_order_relaxed);
+        result.push_back(info);
+    }
+
+    return result;
+}
+
+
+std::filesystem::path SharedFeed::path() const
+{
+    return _path;
+}
+
+
+std::unique_ptr<SharedFeed> SharedFeed::fromJSON(const ofJson& settings)
+{
+    if (!settings.is_object() || !settings.value("enabled", true))
+    {
+        return nullptr;
+    }
+
+    auto feed = std::make_unique<SharedFeed>(settings.value("path", DEFAULT_PATH),
+                                             settings.value("slots", DEFAULT_NUM_SLOTS),
+                                             settings.value("slot_size", DEFAULT_SLOT_SIZE));
+
+    if (!feed->isOpen())
+    {
+        return nullptr;
+    }
+
+    return feed;
+}
+
+
+bool SharedFeed::_open(std::size_t numSlots, std::size_t slotSize)
+{
+    std::size_t size = mappingSize(numSlots, slotSize, MAX_CONSUMERS);
+
+    try
+    {
+        if (std::filesystem::exists(_path) && std::filesystem::file_size(_path) == size)
+        {
+            Poco::SharedMemory mapping(Poco::File(_path.string()), Poco::SharedMemory::AM_WRITE);
+            Header* h = header(mapping.begin());
+
+            if (isValid(mapping.begin(), mapping.end() - mapping.begin()) &&
+                h->numSlots == numSlots &&
+                h->slotSize == slotSize &&
+                h->numConsumers == MAX_CONSUMERS)
+            {
+                _mapping = mapping;
+                _data = _mapping.begin();
+
+                ofLogNotice("SharedFeed::_open") << "Continuing the feed in " << _path << " at " << h->head.load() << ".";
+                return true;
+            }
+        }
+
+        if (_path.has_parent_path())
+        {
+            std::filesystem::create_directories(_path.parent_path());
+        }
+
+        // Set up aside and renamed into place, so subscribers never map a
+        // feed that is not ready.
+        std::filesystem::path temporaryPath = _path;
+        temporaryPath += ".tmp";
+
+        {
+            std::ofstream create(temporaryPath.string(), std::ios::binary | std::ios::trunc);
+
+            if (!create)
+            {
+                throw std::runtime_error("Unable to create " + temporaryPath.string());
+            }
+        }
+
+        std::filesystem::resize_file(temporaryPath, size);
+
+        Poco::SharedMemory mapping(Poco::File(temporaryPath.string()), Poco::SharedMemory::AM_WRITE);
+        Header* h = header(mapping.begin());
+
+        std::memcpy(h->magic, MAGIC, sizeof(MAGIC));
+        h->version = VERSION;
+        h->slotSize = static_cast<uint32_t>(slotSize);
+        h->numSlots = static_cast<uint32_t>(numSlots);
+        h->numConsumers = static_cast<uint32_t>(MAX_CONSUMERS);
+        h->head.store(0);
+
+        std::filesystem::rename(temporaryPath, _path);
+
+        _mapping = mapping;
+        _data = _mapping.begin();
+
+        ofLogNotice("SharedFeed::_open") << "Created a feed of " << numSlots << " slots of " << slotSize << " bytes in " << _path << ".";
+        return true;
+    }
+    catch (const std::exception& exc)
+    {
+        ofLogError("SharedFeed::_open") << "Unable to map " << _path << ": " << exc.what();
+        return false;
+    }
+}
+
+
+const uint64_t FeedSubscriber::REOPEN_INTERVAL = 1000;
+
+
+FeedSubscriber::FeedSubscriber(const std::filesystem::path& path,
+                               LagPolicy policy,
+                               bool fromOldest):
+    _path(path),
+    _policy(policy),
+    _fromOldest(fromOldest)
+{
+    _lastCheck = ofGetElapsedTimeMillis();
+    _reopen();
+}
+
+
+FeedSubscriber::~FeedSubscriber()
+{
+    _close();
+}
+
+
+bool FeedSubscriber::isOpen() const
+{
+    return _data != nullptr;
+}
+
+
+bool FeedSubscriber::receive(Post& post, SharedFeed::Kind& kind)
+{
+    if (!_data || ofGetElapsedTimeMillis() >= _lastCheck + REOPEN_INTERVAL)
+    {
+        _lastCheck = ofGetElapsedTimeMillis();
+        _reopen();
+
+        if (!_data)
+        {
+            return false;
+        }
+    }
+
+    Header* h = header(_data);
+
+    while (true)
+    {
+        uint64_t head = h->head.load(std::memory_order_acquire);
+
+        if (_cursor >= head)
+        {
+            _cursor = head;
+            break;
+        }
+
+        if (head - _cursor > h->numSlots)
+        {
+            uint64_t resume = _policy == LagPolicy::LATEST ? head - 1 : head - h->numSlots;
+            _dropped += resume - _cursor;
+            _cursor = resume;
+        }
+
+        Slot* s = slot(_data, _cursor);
+
+        uint64_t sequence = s->sequence.load(std::memory_order_acquire);
+        bool read = sequence == 2 * _cursor + 2;
+        uint32_t slotKind = 0;
+
+        if (read)
+        {
+            // The slot may be overwritten while it is read, so every length
+            // is checked against the slot before it is used.
+            uint32_t length = std::min<uint32_t>(s->length, h->slotSize - SLOT_HEADER_SIZE);
+            slotKind = s->kind;
+
+            const char* in = reinterpret_cast<const char*>(s) + SLOT_HEADER_SIZE;
+            const char* end = in + length;
+
+            std::string path;
+            uint32_t numHashtags = 0;
+
+            read = get(in, end, post._id) &&
+                   get(in, end, post._userId) &&
+                   get(in, end, post._timestamp) &&
+                   get(in, end, post._width) &&
+                   get(in, end, post._height) &&
+                   get(in, end, post._downloadTime) &&
+                   get(in, end, path) &&
+                   get(in, end, numHashtags);
+
+            post._hashtags.clear();
+
+            for (uint32_t i = 0; read && i < numHashtags; ++i)
+            {
+                std::string hashtag;
+                read = get(in, end, hashtag);
+                post._hashtags.insert(std::move(hashtag));
+            }
+
+            post._path = path;
+        }
+
+        std::atomic_thread_fence(std::memory_order_acquire);
+
+        if (read && s->sequence.load(std::memory_order_relaxed) == sequence)
+        {
+            kind = static_cast<SharedFeed::Kind>(slotKind);
+            ++_cursor;
+
+            if (_consumer >= 0)
+            {
+                consumer(_data, _consumer)->cursor.store(_cursor, std::memory_order_relaxed);
+            }
+
+            return true;
+        }
+
+        // Overwritten before or while it was read.
+        ++_dropped;
+        ++_cursor;
+    }
+
+    if (_consumer >= 0)
+    {
+        auto* c = consumer(_data, _consumer);
+        c->cursor.store(_cursor, std::memory_order_relaxed);
+        c->dropped.store(_dropped, std::memory_order_relaxed);
+        c->lastSeen.store(now(), std::memory_order_relaxed);
+    }
+
+    return false;
+}
+
+
+std::size_t FeedSubscriber::receiveAll(std::vector<Post>& newPosts,
+                                       std::vector<Post>& updatedPosts,
+                                       std::vector<Post>& removedPosts)
+{
+    std::size_t count = 0;
+    Post post;
+    SharedFeed::Kind kind;
+
+    while (receive(post, kind))
+    {
+        if (kind == SharedFeed::Kind::UPDATED)
+        {
+            updatedPosts.push_back(post);
+        }
+        else if (kind == SharedFeed::Kind::REMOVED)
+        {
+            removedPosts.push_back(post);
+        }
+        else
+        {
+            newPosts.push_back(post);
+        }
+
+        ++count;
+    }
+
+    return count;
+}
+
+
+std::size_t FeedSubscriber::receiveAll(std::vector<Post>& newPosts,
+                                       std::vector<Post>& updatedPosts)
+{
+    std::vector<Post> removedPosts;
+    return receiveAll(newPosts, updatedPosts, removedPosts);
+}
+
+
+uint64_t FeedSubscriber::lag() const
+{
+    if (!_data)
+    {
+        return 0;
+    }
+
+    uint64_t head = header(_data)->head.load(std::memory_order_acquire);
+    return _cursor < head ? head - _cursor : 0;
+}
+
+
+uint64_t FeedSubscriber::dropped() const
+{
+    return _dropped;
+}
+
+
+void FeedSubscriber::_reopen()
+{
+    struct stat info;
+
+    // A feed that was removed stays mapped, a new publisher replaces it.
+    if (::stat(_path.c_str(), &info) != 0 || (_data && static_cast<uint64_t>(info.st_ino) == _inode))
+    {
+        return;
+    }
+
+    try
+    {
+        Poco::SharedMemory mapping(Poco::File(_path.string()), Poco::SharedMemory::AM_WRITE);
+
+        if (!isValid(mapping.begin(), mapping.end() - mapping.begin()))
+        {
+            return;
+        }
+
+        bool replaced = _data != nullptr;
+
+        _close();
+
+        _mapping = mapping;
+        _data = _mapping.begin();
+        _inode = info.st_ino;
+
+        Header* h = header(_data);
+        uint64_t head = h->head.load(std::memory_order_acquire);
+
+        // Everything in a replacement is new to the subscriber.
+        if (_fromOldest || replaced)
+        {
+            _cursor = head > h->numSlots ? head - h->numSlots : 0;
+        }
+        else
+        {
+            _cursor = head;
+        }
+
+        uint64_t pid = static_cast<uint64_t>(::getpid());
+
+        for (int pass = 0; pass < 2 && _consumer < 0; ++pass)
+        {
+            for (std::size_t i = 0; i < h->numConsumers; ++i)
+            {
+                auto* c = consumer(_data, i);
+                uint64_t expected = c->pid.load();
+
+                // First free entries, then those of processes that died
+                // without releasing them.
+                if ((pass == 0 && expected == 0) ||
+                    (pass == 1 && expected != 0 && !isAlive(expected)))
+                {
+                    if (c->pid.compare_exchange_strong(expected, pid))
+                    {
+                        c->cursor.store(_cursor);
+                        c->dropped.store(_dropped);
+                        c->lastSeen.store(now());
+                        _consumer = static_cast<int>(i);
+                        break;
+                    }
+                }
+            }
+        }
+
+        if (_consumer < 0)
+        {
+            ofLogWarning("FeedSubscriber::_reopen") << "Every consumer entry of " << _path << " is taken, reading without registering.";
+        }
+    }
+    catch (const std::exception& exc)
+    {
+        ofLogError("FeedSubscriber::_reopen") << "Unable to map " << _path << ": " << exc.what();
+    }
+}
+
+
+void FeedSubscriber::_close()
+{
+    if (_data && _consumer >= 0)
+    {
+        consumer(_data, _consumer)->pid.store(0);
+    }
+
+    _consumer = -1;
+    _data = nullptr;
+    _mapping = Poco::SharedMemory();
+}
+
+
+} } // ofx::InstaLooter
@@ -0,0 +1,593 @@
+//
+// Copyright (c) 2017 Christopher Baker <https://christopherbaker.net>
+//
+// SPDX-License-Identifier:	MIT
+//
+
+
+#include "ofx/InstaLooter/Store.h"
+#include <algorithm>
+#include "Poco/Exception.h"
+#include "ofx/IO/JSONUtils.h"
+#include "ofLog.h"
+#include "ofUtils.h"
+
+
+namespace ofx {
+namespace InstaLooter {
+
+
+const std::string Store::LOCATION_LOG_FILENAME = "locations.bin";
+const std::string Store::MANIFEST_FILENAME = "manifest.json";
+const std::string Store::PACK_DIRECTORY = "packs";
+const uint64_t Store::FREE_SPACE_UPDATE_INTERVAL = 5000;
+
+
+Store::Store(const std::vector<std::filesystem::path>& roots,
+             Placement placement,
+             const StoreLayout& layout):
+    _roots(roots),
+    _placement(placement),
+    _freeSpace(roots.size(), 0),
+    _currentWeights(roots.size(), 0),
+    _postMutexes(64)
+{
+    if (_roots.empty())
+    {
+        throw Poco::InvalidArgumentException("A store needs at least one root.");
+    }
+
+    for (std::size_t i = 0; i < _roots.size(); ++i)
+    {
+        std::filesystem::create_directories(savePath(i));
+    }
+
+    _loadManifest(layout);
+
+    // A single root never needs to record locations.
+    if (_roots.size() > 1)
+    {
+        _loadLocations();
+
+        _locationLog.open((savePath(0) / LOCATION_LOG_FILENAME).string(),
+                          std::ios::binary | std::ios::app);
+    }
+}
+
+
+Store::~Store()
+{
+}
+
+
+std::size_t Store::size() const
+{
+    return _roots.size();
+}
+
+
+std::filesystem::path Store::root(std::size_t index) const
+{
+    return _roots[index];
+}
+
+
+std::filesystem::path Store::savePath(std::size_t index) const
+{
+    return _roots[index] / "instagram";
+}
+
+
+Store::Placement Store::placement() const
+{
+    return _placement;
+}
+
+
+std::size_t Store::rootFor(const Post& post)
+{
+    if (_roots.size() == 1)
+    {
+        return 0;
+    }
+
+    std::unique_lock<std::mutex> lock(_mutex);
+
+    auto iter = _locations.find(post.id());
+
+    if (iter != _locations.end())
+    {
+        return iter->second;
+    }
+    else if (_placement == Placement::HASH)
+    {
+        // Computable from the id, so nothing to record.
+        return _locate(post.id());
+    }
+
+    std::size_t index = _place(post);
+
+    _record(post.id(), index);
+
+    return index;
+}
+
+
+std::size_t Store::locate(uint64_t id) const
+{
+    if (_roots.size() == 1)
+    {
+        return 0;
+    }
+
+    std::unique_lock<std::mutex> lock(_mutex);
+    return _locate(id);
+}
+
+
+bool Store::isUnrecorded(uint64_t id) const
+{
+    if (_roots.size() == 1)
+    {
+        return false;
+    }
+
+    std::unique_lock<std::mutex> lock(_mutex);
+    return _locations.find(id) == _locations.end();
+}
+
+
+std::filesystem::path Store::pathFor(const Post& post)
+{
+    return savePath(rootFor(post)) / Post::relativeStorePathForImage(post, layout());
+}
+
+
+bool Store::find(const Post& post, std::filesystem::path& path)
+{
+    std::size_t index = rootFor(post);
+
+    if (_find(post, index, path))
+    {
+        return true;
+    }
+
+    std::filesystem::path firstPath;
+
+    // Stored before the store was sharded, so it stays in the first root.
+    if (index != 0 && isUnrecorded(post.id()) && _find(post, 0, firstPath))
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _record(post.id(), 0);
+        path = firstPath;
+        return true;
+    }
+
+    return false;
+}
+
+
+bool Store::_find(const Post& post, std::size_t index, std::filesystem::path& path)
+{
+    if (!_packStores.empty())
+    {
+        path = savePath(index) / Post::relativeStorePathForImage(post, layout());
+        return _packStores[index]->contains(post.id());
+    }
+
+    StoreLayout current;
+    StoreLayout previous;
+    bool resharding = false;
+
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        current = _layout;
+        previous = _previousLayout;
+        resharding = _resharding;
+    }
+
+    path = savePath(index) / Post::relativeStorePathForImage(post, current);
+
+    if (std::filesystem::exists(path))
+    {
+        return true;
+    }
+    else if (resharding)
+    {
+        std::filesystem::path previousPath = savePath(index) / Post::relativeStorePathForImage(post, previous);
+
+        if (std::filesystem::exists(previousPath))
+        {
+            path = previousPath;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+
+std::mutex& Store::mutexFor(uint64_t id)
+{
+    return _postMutexes[id % _postMutexes.size()];
+}
+
+
+void Store::beginWrite(uint64_t id)
+{
+    std::unique_lock<std::mutex> lock(_writingMutex);
+    _writing.insert(id);
+}
+
+
+void Store::endWrite(uint64_t id)
+{
+    std::unique_lock<std::mutex> lock(_writingMutex);
+    _writing.erase(id);
+}
+
+
+bool Store::isWriting(uint64_t id) const
+{
+    std::unique_lock<std::mutex> lock(_writingMutex);
+    return _writing.find(id) != _writing.end();
+}
+
+
+StoreLayout Store::layout() const
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    return _layout;
+}
+
+
+StoreLayout Store::previousLayout() const
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    return _previousLayout;
+}
+
+
+bool Store::isResharding() const
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    return _resharding;
+}
+
+
+void Store::beginReshard(const StoreLayout& layout)
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+
+    if (!_resharding)
+    {
+        if (layout == _layout)
+        {
+            return;
+        }
+
+        _previousLayout = _layout;
+        _resharding = true;
+    }
+
+    _layout = layout;
+    _saveManifest();
+}
+
+
+void Store::finishReshard()
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    _resharding = false;
+    _previousLayout = _layout;
+    _saveManifest();
+}
+
+
+void Store::openPacks(uint64_t segmentSize)
+{
+    _packStores.clear();
+
+    for (std::size_t i = 0; i < _roots.size(); ++i)
+    {
+        _packStores.push_back(std::make_unique<PackStore>(savePath(i) / PACK_DIRECTORY, segmentSize));
+    }
+}
+
+
+PackStore* Store::packStore(std::size_t index) const
+{
+    return index < _packStores.size() ? _packStores[index].get() : nullptr;
+}
+
+
+std::unique_ptr<Store> Store::fromJSON(const ofJson& paths)
+{
+    std::vector<std::filesystem::path> roots;
+
+    auto rootsIter = paths.find("image_store_paths");
+
+    if (rootsIter != paths.end() && rootsIter->is_array())
+    {
+        for (const auto& root: *rootsIter)
+        {
+            roots.push_back(ofToDataPath(root.get<std::string>(), true));
+        }
+    }
+
+    if (roots.empty())
+    {
+        roots.push_back(ofToDataPath(paths.value("image_store_path", ""), true));
+    }
+
+    auto store = std::make_unique<Store>(roots,
+                                         placementFromString(paths.value("placement", "hash")),
+                                         StoreLayout::fromJSON(paths.value("layout", ofJson())));
+
+    std::string backend = paths.value("backend", "files");
+
+    if (backend == "pack")
+    {
+        store->openPacks(paths.value("segment_size", PackStore::DEFAULT_SEGMENT_SIZE));
+    }
+    else if (backend != "files")
+    {
+        ofLogWarning("Store::fromJSON") << "Unknown backend " << backend << ", using files.";
+    }
+
+    return store;
+}
+
+
+Store::Placement Store::placementFromString(const std::string& name)
+{
+    if (name == "free_space")
+    {
+        return Placement::FREE_SPACE;
+    }
+    else if (name == "hashtag")
+    {
+        return Placement::HASHTAG;
+    }
+    else if (name != "hash")
+    {
+        ofLogWarning("Store::placementFromString") << "Unknown placement " << name << ", using hash.";
+    }
+
+    return Placement::HASH;
+}
+
+
+std::size_t Store::_place(const Post& post)
+{
+    switch (_placement)
+    {
+        case Placement::HASH:
+            return post.id() % _roots.size();
+        case Placement::HASHTAG:
+        {
+            // FNV-1a, so placement does not depend on the standard library.
+            uint64_t hash = 14695981039346656037ULL;
+            const auto& hashtags = post.hashtags();
+            std::string hashtag = hashtags.empty() ? "" : *hashtags.begin();
+            for (auto c: hashtag) hash = (hash ^ static_cast<uint8_t>(c)) * 1099511628211ULL;
+            return hash % _roots.size();
+        }
+        case Placement::FREE_SPACE:
+        {
+            _updateFreeSpace();
+
+            // Smooth weighted round-robin, weighted by free MiB.
+            int64_t total = 0;
+            std::size_t best = 0;
+
+            for (std::size_t i = 0; i < _roots.size(); ++i)
+            {
+                int64_t weight = static_cast<int64_t>(_freeSpace[i] >> 20);
+                _currentWeights[i] += weight;
+                total += weight;
+
+                if (_currentWeights[i] > _currentWeights[best])
+                {
+                    best = i;
+                }
+            }
+
+            _currentWeights[best] -= total;
+            return best;
+        }
+    }
+
+    return 0;
+}
+
+
+std::size_t Store::_locate(uint64_t id) const
+{
+    auto iter = _locations.find(id);
+
+    if (iter != _locations.end())
+    {
+        return iter->second;
+    }
+    else if (_placement == Placement::HASH)
+    {
+        return id % _roots.size();
+    }
+
+    return 0;
+}
+
+
+void Store::_record(uint64_t id, std::size_t index)
+{
+    _locations[id] = static_cast<uint32_t>(index);
+
+    uint32_t root = static_cast<uint32_t>(index);
+
+    _locationLog.write(reinterpret_cast<const char*>(&id), sizeof(id));
+    _locationLog.write(reinterpret_cast<const char*>(&root), sizeof(root));
+    _locationLog.flush();
+}
+
+
+void Store::_updateFreeSpace()
+{
+    uint64_t now = ofGetElapsedTimeMillis();
+
+    if (_lastFreeSpaceUpdate != 0 && now < _lastFreeSpaceUpdate + FREE_SPACE_UPDATE_INTERVAL)
+    {
+        return;
+    }
+
+    _lastFreeSpaceUpdate = std::max(now, uint64_t(1));
+
+    for (std::size_t i = 0; i < _roots.size(); ++i)
+    {
+        try
+        {
+            _freeSpace[i] = std::filesystem::space(_roots[i]).available;
+        }
+        catch (const std::exception& exc)
+        {
+            ofLogError("Store::_updateFreeSpace") << "Unable to query " << _roots[i] << ": " << exc.what();
+            _freeSpace[i] = 0;
+        }
+    }
+}
+
+
+void Store::_loadLocations()
+{
+    std::filesystem::path path = savePath(0) / LOCATION_LOG_FILENAME;
+
+    if (!std::filesystem::exists(path))
+    {
+        return;
+    }
+
+    const uint64_t recordSize = sizeof(uint64_t) + sizeof(uint32_t);
+
+    uint64_t fileSize = std::filesystem::file_size(path);
+
+    if (fileSize % recordSize != 0)
+    {
+        // Drop a record torn by a crash so later appends stay aligned.
+        ofLogWarning("Store::_loadLocations") << "Truncating partial record in " << path;
+        std::filesystem::resize_file(path, fileSize - fileSize % recordSize);
+    }
+
+    std::ifstream log(path.string(), std::ios::binary);
+
+    uint64_t id = 0;
+    uint32_t root = 0;
+
+    while (log.read(reinterpret_cast<char*>(&id), sizeof(id)) &&
+           log.read(reinterpret_cast<char*>(&root), sizeof(root)))
+    {
+        if (root < _roots.size())
+        {
+            _locations[id] = root;
+        }
+        else
+        {
+            ofLogWarning("Store::_loadLocations") << "Ignoring id " << id << " on missing root " << root << ".";
+        }
+    }
+}
+
+
+void Store::_loadManifest(const StoreLayout& layout)
+{
+    std::filesystem::path path = savePath(0) / MANIFEST_FILENAME;
+
+    ofJson manifest;
+
+    if (std::filesystem::exists(path) && IO::JSONUtils::loadJSON(path, manifest))
+    {
+        _layout = StoreLayout::fromJSON(manifest["layout"]);
+
+        auto previousIter = manifest.find("previous_layout");
+
+        if (previousIter != manifest.end())
+        {
+            _previousLayout = StoreLayout::fromJSON(*previousIter);
+            _resharding = true;
+        }
+        else
+        {
+            _previousLayout = _layout;
+        }
+
+        if (layout != _layout)
+        {
+            ofLogWarning("Store::_loadManifest") << "The store uses layout " << _layout.toString() << ", not " << layout.toString() << ". Use a StoreResharder to change it.";
+        }
+
+        return;
+    }
+
+    _layout = layout;
+
+    // Stores from before manifests always used the default layout.
+    if (layout != StoreLayout() && _hasUnversionedPosts())
+    {
+        ofLogWarning("Store::_loadManifest") << "The store has posts in the default layout, keeping it. Use a StoreResharder to change it.";
+        _layout = StoreLayout();
+    }
+
+    _previousLayout = _layout;
+
+    std::unique_lock<std::mutex> lock(_mutex);
+    _saveManifest();
+}
+
+
+void Store::_saveManifest()
+{
+    ofJson manifest;
+    manifest["version"] = 1;
+    manifest["layout"] = StoreLayout::toJSON(_layout);
+
+    if (_resharding)
+    {
+        manifest["previous_layout"] = StoreLayout::toJSON(_previousLayout);
+    }
+
+    // Replace atomically, so a crash never leaves a partial manifest.
+    std::filesystem::path path = savePath(0) / MANIFEST_FILENAME;
+    std::filesystem::path temporaryPath = path;
+    temporaryPath += ".tmp";
+
+    if (!IO::JSONUtils::saveJSON(temporaryPath, manifest))
+    {
+        throw Poco::IOException("Unable to write " + temporaryPath.string());
+    }
+
+    std::filesystem::rename(temporaryPath, path);
+}
+
+
+bool Store::_hasUnversionedPosts() const
+{
+    for (std::size_t i = 0; i < _roots.size(); ++i)
+    {
+        std::filesystem::directory_iterator iter(savePath(i)), end;
+
+        for (; iter != end; ++iter)
+        {
+            std::string name = iter->path().filename().string();
+
+            if (std::filesystem::is_directory(iter->path()) &&
+                name.find_first_not_of("0123456789") == std::string::npos)
+            {
+                return true;
+            }
+        }
+    }
+
+    return false;
+}
+
+
+} } // ofx::InstaLooter
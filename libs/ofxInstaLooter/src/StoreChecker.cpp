@@ -0,0 +1,739 @@
+//
+// Copyright (c) 2017 Christopher Baker <https://christopherbaker.net>
+//
+// SPDX-License-Identifier:	MIT
+//
+
+
+#include "ofx/InstaLooter/StoreChecker.h"
+#include <algorithm>
+#include <cctype>
+#include <map>
+#include <set>
+#include <sstream>
+#include "ofLog.h"
+#include "ofUtils.h"
+#include "ofx/IO/ImageUtils.h"
+#include "ofx/IO/JSONUtils.h"
+
+
+namespace ofx {
+namespace InstaLooter {
+
+
+namespace {
+
+
+bool isNumber(const std::string& token)
+{
+    return !token.empty() && token.size() <= 20 && token.find_first_not_of("0123456789") == std::string::npos;
+}
+
+
+bool endsWith(const std::string& text, const std::string& suffix)
+{
+    return text.size() >= suffix.size() && text.compare(text.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+
+bool isImageExtension(std::string extension)
+{
+    std::transform(extension.begin(), extension.end(), extension.begin(), [](unsigned char c) {
+        return static_cast<char>(std::tolower(c));
+    });
+
+    return extension == ".jpg" || extension == ".jpeg" || extension == ".gif" || extension == ".png";
+}
+
+
+/// \returns true if the JSON has every field Post::fromJSON() reads.
+bool isValidPostJSON(const ofJson& json)
+{
+    if (!json.is_object()) return false;
+
+    for (const char* key: { "id", "user_id", "timestamp", "width", "height" })
+    {
+        auto iter = json.find(key);
+        if (iter == json.end() || !iter->is_number_unsigned()) return false;
+    }
+
+    auto path = json.find("path");
+    auto hashtags = json.find("hashtags");
+
+    if (path == json.end() || !path->is_string()) return false;
+    if (hashtags == json.end() || !hashtags->is_array()) return false;
+
+    for (const auto& hashtag: *hashtags)
+    {
+        if (!hashtag.is_string()) return false;
+    }
+
+    return true;
+}
+
+
+/// \brief The number of units each thread should have to pick from.
+const std::size_t UNITS_PER_THREAD = 8;
+
+
+}
+
+
+const std::size_t StoreChecker::DEFAULT_NUM_THREADS = 16;
+const std::string StoreChecker::LOST_AND_FOUND_DIRECTORY = "lost+found";
+
+
+uint64_t StoreChecker::Stats::problems() const
+{
+    return missingJSON + missingImage + invalidJSON + invalidImage + dimensionMismatch + idMismatch + misplaced + wrongRoot + stray;
+}
+
+
+void StoreChecker::Stats::add(const Stats& other)
+{
+    posts += other.posts;
+    directories += other.directories;
+    writing += other.writing;
+    missingJSON += other.missingJSON;
+    missingImage += other.missingImage;
+    invalidJSON += other.invalidJSON;
+    invalidImage += other.invalidImage;
+    dimensionMismatch += other.dimensionMismatch;
+    idMismatch += other.idMismatch;
+    misplaced += other.misplaced;
+    wrongRoot += other.wrongRoot;
+    stray += other.stray;
+    repaired += other.repaired;
+    errors += other.errors;
+}
+
+
+ofJson StoreChecker::Stats::toJSON(const Stats& stats)
+{
+    ofJson json;
+    json["posts"] = stats.posts;
+    json["directories"] = stats.directories;
+    json["writing"] = stats.writing;
+    json["problems"] = stats.problems();
+    json["missing_json"] = stats.missingJSON;
+    json["missing_image"] = stats.missingImage;
+    json["invalid_json"] = stats.invalidJSON;
+    json["invalid_image"] = stats.invalidImage;
+    json["dimension_mismatch"] = stats.dimensionMismatch;
+    json["id_mismatch"] = stats.idMismatch;
+    json["misplaced"] = stats.misplaced;
+    json["wrong_root"] = stats.wrongRoot;
+    json["stray"] = stats.stray;
+    json["repaired"] = stats.repaired;
+    json["errors"] = stats.errors;
+    return json;
+}
+
+
+StoreChecker::StoreChecker(Store& store, std::size_t numThreads):
+    _store(store),
+    _numThreads(std::max(numThreads, std::size_t(1))),
+    _nextUnit(0),
+    _activeThreads(0),
+    _cancelled(false)
+{
+}
+
+
+StoreChecker::~StoreChecker()
+{
+    cancel();
+    wait();
+}
+
+
+void StoreChecker::start(const std::filesystem::path& reportPath, bool repair)
+{
+    if (isRunning())
+    {
+        return;
+    }
+
+    wait();
+
+    _reportPath = reportPath;
+    _reportStream.close();
+    _reportStream.clear();
+    _reportStream.open(_reportPath.string(), std::ios::binary | std::ios::trunc);
+
+    if (!_reportStream)
+    {
+        ofLogError("StoreChecker::start") << "Unable to open " << _reportPath;
+        return;
+    }
+
+    _repair = repair;
+    _layout = _store.layout();
+    _previousLayout = _store.previousLayout();
+    _resharding = _store.isResharding();
+
+    std::size_t depth = std::max(_layout.depth(), _resharding ? _previousLayout.depth() : 0);
+
+    _units.clear();
+
+    for (std::size_t i = 0; i < _store.size(); ++i)
+    {
+        if (_store.packStore(i))
+        {
+            ofLogNotice("StoreChecker::start") << "Skipping the pack store in " << _store.root(i) << ".";
+            continue;
+        }
+
+        if (depth == 0)
+        {
+            _units.push_back({ i, _store.savePath(i), 0, true });
+            continue;
+        }
+
+        try
+        {
+            std::filesystem::directory_iterator iter(_store.savePath(i)), end;
+
+            for (; iter != end; ++iter)
+            {
+                std::string name = iter->path().filename().string();
+
+                if (std::filesystem::is_directory(iter->path()) && _isLevel(name))
+                {
+                    _units.push_back({ i, iter->path(), 1, true });
+                }
+            }
+        }
+        catch (const std::exception& exc)
+        {
+            ofLogError("StoreChecker::start") << "Unable to list " << _store.savePath(i) << ": " << exc.what();
+        }
+    }
+
+    // Ids share their leading digits, so a few top level directories can
+    // hold the whole store. Split them, breadth first, until every thread
+    // has work.
+    for (std::size_t next = 0; next < _units.size() && _units.size() < _numThreads * UNITS_PER_THREAD; ++next)
+    {
+        Unit unit = _units[next];
+
+        if (unit.level >= depth)
+        {
+            continue;
+        }
+
+        try
+        {
+            std::vector<Unit> children;
+
+            std::filesystem::directory_iterator iter(unit.directory), end;
+
+            for (; iter != end; ++iter)
+            {
+                if (std::filesystem::is_directory(iter->path()) && _isLevel(iter->path().filename().string()))
+                {
+                    children.push_back({ unit.root, iter->path(), unit.level + 1, true });
+                }
+            }
+
+            // Its own files are still checked.
+            _units[next].recurse = false;
+            _units.insert(_units.end(), children.begin(), children.end());
+        }
+        catch (const std::exception&)
+        {
+            // Left whole, its walk reports the error.
+        }
+    }
+
+    ofLogNotice("StoreChecker::start") << "Checking " << _units.size() << " directories" << (_repair ? " and repairing" : "") << ", reporting to " << _reportPath << ".";
+
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _stats = Stats();
+    }
+
+    _startTime = ofGetElapsedTimeMillis();
+    _nextUnit = 0;
+    _cancelled = false;
+    _activeThreads = _numThreads;
+
+    for (std::size_t i = 0; i < _numThreads; ++i)
+    {
+        _threads.emplace_back(&StoreChecker::_run, this);
+    }
+}
+
+
+void StoreChecker::cancel()
+{
+    _cancelled = true;
+}
+
+
+void StoreChecker::wait()
+{
+    for (auto& thread: _threads)
+    {
+        thread.join();
+    }
+
+    _threads.clear();
+}
+
+
+bool StoreChecker::isRunning() const
+{
+    return _activeThreads > 0;
+}
+
+
+StoreChecker::Stats StoreChecker::stats() const
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    return _stats;
+}
+
+
+bool StoreChecker::_isLevel(const std::string& name) const
+{
+    return isNumber(name) &&
+           (name.size() == _layout.digitsPerLevel() ||
+            (_resharding && name.size() == _previousLayout.digitsPerLevel()));
+}
+
+
+std::string StoreChecker::toString(Problem problem)
+{
+    switch (problem)
+    {
+        case Problem::MISSING_JSON: return "missing_json";
+        case Problem::MISSING_IMAGE: return "missing_image";
+        case Problem::INVALID_JSON: return "invalid_json";
+        case Problem::INVALID_IMAGE: return "invalid_image";
+        case Problem::DIMENSION_MISMATCH: return "dimension_mismatch";
+        case Problem::ID_MISMATCH: return "id_mismatch";
+        case Problem::MISPLACED: return "misplaced";
+        case Problem::WRONG_ROOT: return "wrong_root";
+        case Problem::STRAY: return "stray";
+    }
+
+    return "unknown";
+}
+
+
+void StoreChecker::_run()
+{
+    while (!_cancelled)
+    {
+        std::size_t index = _nextUnit++;
+
+        if (index >= _units.size())
+        {
+            break;
+        }
+
+        Stats stats;
+
+        _walk(_units[index], stats);
+
+        std::unique_lock<std::mutex> lock(_mutex);
+        _stats.add(stats);
+    }
+
+    if (--_activeThreads == 0)
+    {
+        _finish();
+    }
+}
+
+
+void StoreChecker::_walk(const Unit& unit, Stats& stats)
+{
+    std::size_t depth = std::max(_layout.depth(), _resharding ? _previousLayout.depth() : 0);
+
+    // Sorted, so each post's image and JSON are checked together.
+    std::map<std::string, Entry> entries;
+    std::vector<std::filesystem::path> directories;
+
+    try
+    {
+        ++stats.directories;
+
+        std::filesystem::directory_iterator iter(unit.directory), end;
+
+        for (; iter != end; ++iter)
+        {
+            std::string name = iter->path().filename().string();
+
+            if (std::filesystem::is_directory(iter->path()))
+            {
+                if (unit.recurse && unit.level < depth && _isLevel(name))
+                {
+                    directories.push_back(iter->path());
+                }
+            }
+            else if (unit.level == 0 && !std::isdigit(static_cast<unsigned char>(name[0])))
+            {
+                // The save path also holds logs and downloads.
+            }
+            else if (endsWith(name, ".json.gz") && name[0] != '.')
+            {
+                entries[name.substr(0, name.size() - 8)].json = iter->path();
+            }
+            else if (isImageExtension(iter->path().extension().string()) && name[0] != '.')
+            {
+                entries[iter->path().stem().string()].image = iter->path();
+            }
+            else
+            {
+                // Temporary files of interrupted writes and the like.
+                _report(Problem::STRAY, iter->path(), 0, false, "", stats);
+            }
+        }
+    }
+    catch (const std::exception& exc)
+    {
+        ofLogError("StoreChecker::_walk") << "Unable to list " << unit.directory << ": " << exc.what();
+        ++stats.errors;
+        return;
+    }
+
+    for (const auto& entry: entries)
+    {
+        if (_cancelled) return;
+        _check(unit.root, entry.first, entry.second, stats);
+    }
+
+    entries.clear();
+
+    for (const auto& directory: directories)
+    {
+        if (_cancelled) return;
+        _walk({ unit.root, directory, unit.level + 1, true }, stats);
+    }
+}
+
+
+void StoreChecker::_check(std::size_t root,
+                          const std::string& name,
+                          Entry entry,
+                          Stats& stats)
+{
+    // Store names are <id>.<user id>.<timestamp>.
+    auto tokens = ofSplitString(name, ".");
+
+    if (tokens.size() != 3 || !isNumber(tokens[0]) || !isNumber(tokens[1]) || !isNumber(tokens[2]))
+    {
+        for (const auto& path: { entry.image, entry.json })
+        {
+            if (!path.empty()) _report(Problem::STRAY, path, 0, false, "unexpected name", stats);
+        }
+
+        return;
+    }
+
+    uint64_t id = std::stoull(tokens[0]);
+    uint64_t userId = std::stoull(tokens[1]);
+    uint64_t timestamp = std::stoull(tokens[2]);
+
+    std::filesystem::path savePath = _store.savePath(root);
+
+    try
+    {
+        std::unique_lock<std::mutex> lock(_store.mutexFor(id));
+
+        // Its image or JSON may not be in place yet.
+        if (_store.isWriting(id))
+        {
+            ++stats.writing;
+            return;
+        }
+
+        // Ingest or a resharder may have moved it since the listing.
+        if (!entry.image.empty() && !std::filesystem::exists(entry.image)) entry.image.clear();
+        if (!entry.json.empty() && !std::filesystem::exists(entry.json)) entry.json.clear();
+
+        if (entry.image.empty() && entry.json.empty())
+        {
+            return;
+        }
+
+        ++stats.posts;
+
+        // Unrecorded posts in the first root were stored before sharding.
+        if (_store.size() > 1 && _store.locate(id) != root && !(root == 0 && _store.isUnrecorded(id)))
+        {
+            _report(Problem::WRONG_ROOT, entry.image.empty() ? entry.json : entry.image, id, false, "belongs in " + _store.root(_store.locate(id)).string(), stats);
+        }
+
+        if (entry.image.empty())
+        {
+            _report(Problem::MISSING_IMAGE, entry.json, id, _repair && _quarantine(root, entry.json, stats), "", stats);
+            return;
+        }
+
+        IO::ImageUtils::ImageHeader header;
+
+        if (!IO::ImageUtils::loadHeader(header, entry.image))
+        {
+            bool repaired = _repair && _quarantine(root, entry.image, stats);
+
+            if (repaired && !entry.json.empty())
+            {
+                repaired = _quarantine(root, entry.json, stats);
+            }
+
+            _report(Problem::INVALID_IMAGE, entry.image, id, repaired, "", stats);
+            return;
+        }
+
+        std::filesystem::path directory = entry.image.parent_path();
+        std::filesystem::path expected;
+        std::filesystem::path previous;
+
+        try
+        {
+            expected = savePath / _layout.directoryFor(id);
+
+            if (_resharding) previous = savePath / _previousLayout.directoryFor(id);
+        }
+        catch (const std::exception&)
+        {
+            // Too short for the layout, reported as misplaced below.
+        }
+
+        if (directory != expected && (!_resharding || directory != previous))
+        {
+            // Left to the resharder while it runs.
+            bool repaired = _repair && !_resharding && !expected.empty() && _move(entry, expected, stats);
+            _report(Problem::MISPLACED, directory / entry.image.filename(), id, repaired, expected.empty() ? "id too short for the layout" : "belongs in " + expected.string(), stats);
+        }
+
+        // At most one JSON problem, fixed by rebuilding it from the image.
+        bool rebuild = false;
+        bool keepOld = false;
+        Problem problem = Problem::MISSING_JSON;
+        std::string detail;
+        std::set<std::string> hashtags;
+
+        if (entry.json.empty())
+        {
+            rebuild = true;
+        }
+        else
+        {
+            ofJson json;
+
+            if (!IO::JSONUtils::loadJSON(entry.json, json) || !isValidPostJSON(json))
+            {
+                rebuild = true;
+                keepOld = true;
+                problem = Problem::INVALID_JSON;
+
+                if (json.is_object() && json.count("hashtags") && json["hashtags"].is_array())
+                {
+                    for (const auto& hashtag: json["hashtags"])
+                    {
+                        if (hashtag.is_string()) hashtags.insert(hashtag.get<std::string>());
+                    }
+                }
+            }
+            else
+            {
+                hashtags = json["hashtags"].get<std::set<std::string>>();
+
+                uint64_t width = json["width"];
+                uint64_t height = json["height"];
+
+                if (json["id"].get<uint64_t>() != id)
+                {
+                    rebuild = true;
+                    keepOld = true;
+                    problem = Problem::ID_MISMATCH;
+                    detail = "json id " + std::to_string(json["id"].get<uint64_t>());
+                }
+                else if (width != header.width || height != header.height)
+                {
+                    rebuild = true;
+                    problem = Problem::DIMENSION_MISMATCH;
+
+                    std::stringstream ss;
+                    ss << "json " << width << "x" << height << ", image " << header.width << "x" << header.height;
+                    detail = ss.str();
+                }
+            }
+        }
+
+        if (!rebuild)
+        {
+            return;
+        }
+
+        std::filesystem::path jsonPath = entry.image;
+        jsonPath.replace_extension(".json.gz");
+
+        bool repaired = false;
+
+        // The old JSON is kept, in case the rebuilt one lost something.
+        if (_repair && (!keepOld || _quarantine(root, entry.json, stats)))
+        {
+            Post post(entry.image, id, userId, timestamp, header.width, header.height, hashtags);
+
+            repaired = IO::JSONUtils::saveJSON(jsonPath, Post::toJSON(post));
+
+            if (!repaired)
+            {
+                ofLogError("StoreChecker::_check") << "Unable to write " << jsonPath;
+                ++stats.errors;
+            }
+        }
+
+        _report(problem, entry.json.empty() ? entry.image : entry.json, id, repaired, detail, stats);
+    }
+    catch (const std::exception& exc)
+    {
+        ofLogError("StoreChecker::_check") << "Unable to check " << name << ": " << exc.what();
+        ++stats.errors;
+    }
+}
+
+
+bool StoreChecker::_move(Entry& entry,
+                         const std::filesystem::path& directory,
+                         Stats& stats)
+{
+    std::filesystem::path image = directory / entry.image.filename();
+
+    try
+    {
+        if (std::filesystem::exists(image))
+        {
+            // The copy in the right place wins, this one is left for a look.
+            return false;
+        }
+
+        std::filesystem::create_directories(directory);
+        std::filesystem::rename(entry.image, image);
+        entry.image = image;
+
+        if (!entry.json.empty())
+        {
+            std::filesystem::path json = directory / entry.json.filename();
+            std::filesystem::rename(entry.json, json);
+            entry.json = json;
+        }
+    }
+    catch (const std::exception& exc)
+    {
+        ofLogError("StoreChecker::_move") << "Unable to move " << entry.image << " to " << directory << ": " << exc.what();
+        ++stats.errors;
+        return false;
+    }
+
+    return true;
+}
+
+
+bool StoreChecker::_quarantine(std::size_t root,
+                               const std::filesystem::path& path,
+                               Stats& stats)
+{
+    std::filesystem::path directory = _store.savePath(root) / LOST_AND_FOUND_DIRECTORY;
+    std::filesystem::path target = directory / path.filename();
+
+    try
+    {
+        std::filesystem::create_directories(directory);
+
+        if (std::filesystem::exists(target))
+        {
+            target += "." + std::to_string(ofGetSystemTimeMicros());
+        }
+
+        std::filesystem::rename(path, target);
+    }
+    catch (const std::exception& exc)
+    {
+        ofLogError("StoreChecker::_quarantine") << "Unable to move " << path << " to " << target << ": " << exc.what();
+        ++stats.errors;
+        return false;
+    }
+
+    return true;
+}
+
+
+void StoreChecker::_report(Problem problem,
+                           const std::filesystem::path& path,
+                           uint64_t id,
+                           bool repaired,
+                           const std::string& detail,
+                           Stats& stats)
+{
+    switch (problem)
+    {
+        case Problem::MISSING_JSON: ++stats.missingJSON; break;
+        case Problem::MISSING_IMAGE: ++stats.missingImage; break;
+        case Problem::INVALID_JSON: ++stats.invalidJSON; break;
+        case Problem::INVALID_IMAGE: ++stats.invalidImage; break;
+        case Problem::DIMENSION_MISMATCH: ++stats.dimensionMismatch; break;
+        case Problem::ID_MISMATCH: ++stats.idMismatch; break;
+        case Problem::MISPLACED: ++stats.misplaced; break;
+        case Problem::WRONG_ROOT: ++stats.wrongRoot; break;
+        case Problem::STRAY: ++stats.stray; break;
+    }
+
+    if (repaired)
+    {
+        ++stats.repaired;
+    }
+
+    ofJson json;
+    json["problem"] = toString(problem);
+    json["path"] = path.string();
+
+    if (id > 0) json["id"] = id;
+
+    json["repaired"] = repaired;
+
+    if (!detail.empty()) json["detail"] = detail;
+
+    std::string line = json.dump();
+
+    std::unique_lock<std::mutex> lock(_mutex);
+    _reportStream << line << "\n";
+}
+
+
+void StoreChecker::_finish()
+{
+    Stats result = stats();
+
+    uint64_t elapsed = ofGetElapsedTimeMillis() - _startTime;
+
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+
+        ofJson summary;
+        summary["summary"] = Stats::toJSON(result);
+        summary["summary"]["elapsed_ms"] = elapsed;
+        summary["summary"]["cancelled"] = _cancelled.load();
+        summary["summary"]["repair"] = _repair;
+
+        _reportStream << summary.dump() << "\n";
+        _reportStream.close();
+    }
+
+    double rate = elapsed > 0 ? result.posts * 1000.0 / elapsed : 0;
+
+    ofLogNotice("StoreChecker::_finish") << "Checked " << result.posts << " posts in " << result.directories << " directories in " << elapsed << " ms (" << rate << " posts/s): " << result.problems() << " problems, " << result.repaired << " repaired, " << result.errors << " errors. See " << _reportPath << ".";
+
+    if (_cancelled)
+    {
+        ofLogNotice("StoreChecker::_finish") << "Cancelled, the report only covers part of the store.";
+    }
+}
+
+
+} } // ofx::InstaLooter
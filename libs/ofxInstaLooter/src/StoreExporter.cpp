@@ -0,0 +1,454 @@
+//
+// Copyright (c) 2017 Christopher Baker <https://christopherbaker.net>
+//
+// SPDX-License-Identifier:	MIT
+//
+
+
+#include "ofx/InstaLooter/StoreExporter.h"
+#include <algorithm>
+#include <cctype>
+#include <iomanip>
+#include <sstream>
+#include "ofLog.h"
+#include "ofUtils.h"
+#include "ofx/IO/JSONUtils.h"
+
+
+namespace ofx {
+namespace InstaLooter {
+
+
+namespace {
+
+
+bool isNumber(const std::string& token)
+{
+    return !token.empty() && token.size() <= 20 && token.find_first_not_of("0123456789") == std::string::npos;
+}
+
+
+bool endsWith(const std::string& text, const std::string& suffix)
+{
+    return text.size() >= suffix.size() && text.compare(text.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+
+/// \brief The number of units each thread should have to pick from.
+const std::size_t UNITS_PER_THREAD = 8;
+
+
+}
+
+
+const std::size_t StoreExporter::DEFAULT_NUM_THREADS = 16;
+const std::size_t StoreExporter::BATCH_SIZE = 65536;
+const std::string StoreExporter::STATE_FILENAME = "export.json";
+const std::time_t StoreExporter::TIME_SLACK = 2;
+
+
+void StoreExporter::Stats::add(const Stats& other)
+{
+    posts += other.posts;
+    directories += other.directories;
+    skipped += other.skipped;
+    errors += other.errors;
+}
+
+
+StoreExporter::StoreExporter(Store& store, std::size_t numThreads):
+    _store(store),
+    _numThreads(std::max(numThreads, std::size_t(1))),
+    _nextUnit(0),
+    _activeThreads(0),
+    _cancelled(false)
+{
+}
+
+
+StoreExporter::~StoreExporter()
+{
+    cancel();
+    wait();
+}
+
+
+void StoreExporter::start(const std::filesystem::path& directory, bool incremental)
+{
+    if (isRunning())
+    {
+        return;
+    }
+
+    wait();
+
+    _directory = directory;
+
+    try
+    {
+        std::filesystem::create_directories(_directory);
+    }
+    catch (const std::exception& exc)
+    {
+        ofLogError("StoreExporter::start") << "Unable to create " << _directory << ": " << exc.what();
+        return;
+    }
+
+    std::filesystem::path statePath = _directory / STATE_FILENAME;
+
+    _state = ofJson::object();
+
+    if (std::filesystem::exists(statePath) && !IO::JSONUtils::loadJSON(statePath, _state))
+    {
+        ofLogError("StoreExporter::start") << "Unable to load " << statePath << ", it would lose track of the parts.";
+        return;
+    }
+
+    if (!_state.count("parts") || !_state["parts"].is_array())
+    {
+        _state["parts"] = ofJson::array();
+    }
+
+    _started = std::time(nullptr);
+    _since = 0;
+
+    if (incremental && _state.count("last_started"))
+    {
+        _since = _state["last_started"].get<std::time_t>() - TIME_SLACK;
+    }
+
+    std::ostringstream name;
+    name << "posts-" << std::setw(5) << std::setfill('0') << _state["parts"].size() + 1 << ".ilp";
+
+    _partPath = _directory / name.str();
+    _writer = std::make_unique<ColumnWriter>(_partPath);
+
+    if (!_writer->isGood())
+    {
+        _writer.reset();
+        return;
+    }
+
+    _layout = _store.layout();
+    _previousLayout = _store.previousLayout();
+    _resharding = _store.isResharding();
+    _depth = std::max(_layout.depth(), _resharding ? _previousLayout.depth() : 0);
+
+    _units.clear();
+
+    for (std::size_t i = 0; i < _store.size(); ++i)
+    {
+        if (_store.packStore(i))
+        {
+            ofLogNotice("StoreExporter::start") << "Skipping the pack store in " << _store.root(i) << ".";
+            continue;
+        }
+
+        _units.push_back({ i, _store.savePath(i), 0, true });
+    }
+
+    // Split the roots, breadth first, until every thread has work.
+    for (std::size_t next = 0; next < _units.size() && _units.size() < _numThreads * UNITS_PER_THREAD; ++next)
+    {
+        Unit unit = _units[next];
+
+        if (unit.level >= _depth)
+        {
+            continue;
+        }
+
+        try
+        {
+            std::vector<Unit> children;
+
+            std::filesystem::directory_iterator iter(unit.directory), end;
+
+            for (; iter != end; ++iter)
+            {
+                if (std::filesystem::is_directory(iter->path()) && _isLevel(iter->path().filename().string()))
+                {
+                    children.push_back({ unit.root, iter->path(), unit.level + 1, true });
+                }
+            }
+
+            _units[next].recurse = false;
+            _units.insert(_units.end(), children.begin(), children.end());
+        }
+        catch (const std::exception&)
+        {
+            // Left whole, its walk reports the error.
+        }
+    }
+
+    ofLogNotice("StoreExporter::start") << "Exporting " << (_since > 0 ? "posts written since the last export" : "all posts") << " to " << _partPath << ".";
+
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _stats = Stats();
+    }
+
+    _startTime = ofGetElapsedTimeMillis();
+    _nextUnit = 0;
+    _cancelled = false;
+    _activeThreads = _numThreads;
+
+    for (std::size_t i = 0; i < _numThreads; ++i)
+    {
+        _threads.emplace_back(&StoreExporter::_run, this);
+    }
+}
+
+
+void StoreExporter::cancel()
+{
+    _cancelled = true;
+}
+
+
+void StoreExporter::wait()
+{
+    for (auto& thread: _threads)
+    {
+        thread.join();
+    }
+
+    _threads.clear();
+}
+
+
+bool StoreExporter::isRunning() const
+{
+    return _activeThreads > 0;
+}
+
+
+StoreExporter::Stats StoreExporter::stats() const
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    return _stats;
+}
+
+
+bool StoreExporter::_isLevel(const std::string& name) const
+{
+    return isNumber(name) &&
+           (name.size() == _layout.digitsPerLevel() ||
+            (_resharding && name.size() == _previousLayout.digitsPerLevel()));
+}
+
+
+void StoreExporter::_run()
+{
+    PostColumns batch;
+
+    while (!_cancelled)
+    {
+        std::size_t index = _nextUnit++;
+
+        if (index >= _units.size())
+        {
+            break;
+        }
+
+        Stats stats;
+
+        _walk(_units[index], batch, stats);
+
+        std::unique_lock<std::mutex> lock(_mutex);
+        _stats.add(stats);
+    }
+
+    _writer->write(batch);
+
+    if (--_activeThreads == 0)
+    {
+        _finish();
+    }
+}
+
+
+void StoreExporter::_walk(const Unit& unit, PostColumns& batch, Stats& stats)
+{
+    std::vector<std::filesystem::path> files;
+    std::vector<std::filesystem::path> directories;
+
+    try
+    {
+        // Adding or replacing a file changes its directory's time, so an
+        // unchanged leaf has nothing new.
+        if (_since > 0 && unit.level == _depth && unit.level > 0 &&
+            std::filesystem::last_write_time(unit.directory) < _since)
+        {
+            ++stats.skipped;
+            return;
+        }
+
+        ++stats.directories;
+
+        std::filesystem::directory_iterator iter(unit.directory), end;
+
+        for (; iter != end; ++iter)
+        {
+            std::string name = iter->path().filename().string();
+
+            if (std::filesystem::is_directory(iter->path()))
+            {
+                if (unit.recurse && unit.level < _depth && _isLevel(name))
+                {
+                    directories.push_back(iter->path());
+                }
+            }
+            else if (endsWith(name, ".json.gz") &&
+                     std::isdigit(static_cast<unsigned char>(name[0])) &&
+                     (unit.level > 0 || _depth == 0))
+            {
+                files.push_back(iter->path());
+            }
+        }
+    }
+    catch (const std::exception& exc)
+    {
+        ofLogError("StoreExporter::_walk") << "Unable to list " << unit.directory << ": " << exc.what();
+        ++stats.errors;
+        return;
+    }
+
+    for (const auto& file: files)
+    {
+        if (_cancelled) return;
+        _export(file, batch, stats);
+    }
+
+    files.clear();
+
+    for (const auto& directory: directories)
+    {
+        if (_cancelled) return;
+        _walk({ unit.root, directory, unit.level + 1, true }, batch, stats);
+    }
+}
+
+
+void StoreExporter::_export(const std::filesystem::path& jsonPath,
+                            PostColumns& batch,
+                            Stats& stats)
+{
+    try
+    {
+        if (_since > 0 && std::filesystem::last_write_time(jsonPath) < _since)
+        {
+            return;
+        }
+
+        ofJson json;
+
+        if (!IO::JSONUtils::loadJSON(jsonPath, json) || !json.is_object())
+        {
+            ++stats.errors;
+            return;
+        }
+
+        std::vector<std::string> hashtags;
+        auto hashtagsIter = json.find("hashtags");
+
+        if (hashtagsIter != json.end() && hashtagsIter->is_array())
+        {
+            for (const auto& hashtag: *hashtagsIter)
+            {
+                if (hashtag.is_string()) hashtags.push_back(hashtag.get<std::string>());
+            }
+        }
+
+        batch.add(json.value("id", uint64_t(0)),
+                  json.value("user_id", uint64_t(0)),
+                  json.value("timestamp", uint64_t(0)),
+                  json.value("width", uint32_t(0)),
+                  json.value("height", uint32_t(0)),
+                  hashtags);
+
+        ++stats.posts;
+    }
+    catch (const std::exception& exc)
+    {
+        ofLogError("StoreExporter::_export") << "Unable to export " << jsonPath << ": " << exc.what();
+        ++stats.errors;
+        return;
+    }
+
+    if (batch.size() >= BATCH_SIZE)
+    {
+        _writer->write(batch);
+        batch.clear();
+    }
+}
+
+
+void StoreExporter::_finish()
+{
+    Stats result = stats();
+
+    bool written = _writer->close();
+    uint64_t rows = _writer->rows();
+    uint64_t bytes = _writer->bytes();
+
+    _writer.reset();
+
+    uint64_t elapsed = ofGetElapsedTimeMillis() - _startTime;
+
+    if (_cancelled || !written || rows == 0)
+    {
+        try
+        {
+            std::filesystem::remove(_partPath);
+        }
+        catch (const std::exception& exc)
+        {
+            ofLogError("StoreExporter::_finish") << "Unable to remove " << _partPath << ": " << exc.what();
+        }
+    }
+
+    if (_cancelled || !written)
+    {
+        ofLogNotice("StoreExporter::_finish") << "Export " << (_cancelled ? "cancelled" : "failed") << ", the next one covers its posts.";
+        return;
+    }
+
+    if (rows > 0)
+    {
+        ofJson part;
+        part["path"] = _partPath.filename().string();
+        part["started"] = _started;
+        part["since"] = _since;
+        part["rows"] = rows;
+        part["bytes"] = bytes;
+        _state["parts"].push_back(part);
+    }
+
+    _state["format"] = ColumnWriter::MAGIC;
+    _state["last_started"] = _started;
+
+    std::filesystem::path statePath = _directory / STATE_FILENAME;
+    std::filesystem::path temporaryPath = statePath;
+    temporaryPath += ".tmp";
+
+    try
+    {
+        if (!IO::JSONUtils::saveJSON(temporaryPath, _state))
+        {
+            throw std::runtime_error("Unable to write " + temporaryPath.string());
+        }
+
+        std::filesystem::rename(temporaryPath, statePath);
+    }
+    catch (const std::exception& exc)
+    {
+        ofLogError("StoreExporter::_finish") << "Unable to save " << statePath << ": " << exc.what();
+    }
+
+    double rate = elapsed > 0 ? result.posts * 1000.0 / elapsed : 0;
+
+    ofLogNotice("StoreExporter::_finish") << "Exported " << rows << " posts (" << bytes << " bytes) in " << elapsed << " ms (" << rate << " posts/s): " << result.directories << " directories listed, " << result.skipped << " unchanged, " << result.errors << " errors.";
+}
+
+
+} } // ofx::InstaLooter
@@ -0,0 +1,108 @@
+//
+// Copyright (c) 2017 Christopher Baker <https://christopherbaker.net>
+//
+// SPDX-License-Identifier:	MIT
+//
+
+
+#include "ofx/InstaLooter/StoreLayout.h"
+#include "Poco/Exception.h"
+
+
+namespace ofx {
+namespace InstaLooter {
+
+
+const std::size_t StoreLayout::DEFAULT_DEPTH = 6;
+const std::size_t StoreLayout::DEFAULT_DIGITS_PER_LEVEL = 1;
+
+
+StoreLayout::StoreLayout()
+{
+}
+
+
+StoreLayout::StoreLayout(std::size_t depth, std::size_t digitsPerLevel):
+    _depth(depth),
+    _digitsPerLevel(digitsPerLevel)
+{
+    // Ids are up to 20 digits and at least one must remain for the name.
+    if (_digitsPerLevel == 0 || _depth * _digitsPerLevel > 18)
+    {
+        throw Poco::InvalidArgumentException("Invalid store layout: " + toString());
+    }
+}
+
+
+std::size_t StoreLayout::depth() const
+{
+    return _depth;
+}
+
+
+std::size_t StoreLayout::digitsPerLevel() const
+{
+    return _digitsPerLevel;
+}
+
+
+std::filesystem::path StoreLayout::directoryFor(uint64_t id) const
+{
+    std::filesystem::path path = "";
+
+    std::string digits = std::to_string(id);
+
+    if (digits.length() <= _depth * _digitsPerLevel)
+    {
+        throw Poco::InvalidArgumentException("Invalid ID: " + digits);
+    }
+
+    for (std::size_t i = 0; i < _depth; ++i)
+    {
+        path = path / digits.substr(i * _digitsPerLevel, _digitsPerLevel);
+    }
+
+    return path;
+}
+
+
+std::string StoreLayout::toString() const
+{
+    return std::to_string(_depth) + "x" + std::to_string(_digitsPerLevel);
+}
+
+
+bool StoreLayout::operator == (const StoreLayout& other) const
+{
+    return _depth == other._depth && _digitsPerLevel == other._digitsPerLevel;
+}
+
+
+bool StoreLayout::operator != (const StoreLayout& other) const
+{
+    return !(*this == other);
+}
+
+
+StoreLayout StoreLayout::fromJSON(const ofJson& json)
+{
+    if (!json.is_object())
+    {
+        return StoreLayout();
+    }
+
+    return StoreLayout(json.value("depth", DEFAULT_DEPTH),
+                       json.value("digits_per_level", DEFAULT_DIGITS_PER_LEVEL));
+}
+
+
+ofJson StoreLayout::toJSON(const StoreLayout& layout)
+{
+    ofJson json;
+    json["depth"] = layout._depth;
+    json["digits_per_level"] = layout._digitsPerLevel;
+    return json;
+}
+
+
+} } // ofx::InstaLooter
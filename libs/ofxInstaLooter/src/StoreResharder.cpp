@@ -0,0 +1,345 @@
+//
+// Copyright (c) 2017 Christopher Baker <https://christopherbaker.net>
+//
+// SPDX-License-Identifier:	MIT
+//
+
+
+#include "ofx/InstaLooter/StoreResharder.h"
+#include <algorithm>
+#include "ofLog.h"
+#include "ofUtils.h"
+
+
+namespace ofx {
+namespace InstaLooter {
+
+
+const std::size_t StoreResharder::DEFAULT_NUM_THREADS = 4;
+
+
+double StoreResharder::Stats::operationsPerPost() const
+{
+    if (posts == 0)
+    {
+        return 0;
+    }
+
+    uint64_t operations = directoriesListed + directoriesCreated + directoriesRemoved + renames;
+
+    return static_cast<double>(operations) / posts;
+}
+
+
+StoreResharder::StoreResharder(Store& store, std::size_t numThreads):
+    _store(store),
+    _numThreads(std::max(numThreads, std::size_t(1))),
+    _nextUnit(0),
+    _activeThreads(0),
+    _cancelled(false)
+{
+}
+
+
+StoreResharder::~StoreResharder()
+{
+    cancel();
+    wait();
+}
+
+
+void StoreResharder::start(const StoreLayout& layout)
+{
+    if (isRunning())
+    {
+        return;
+    }
+
+    wait();
+
+    _store.beginReshard(layout);
+
+    if (!_store.isResharding())
+    {
+        ofLogNotice("StoreResharder::start") << "The store already uses layout " << layout.toString() << ".";
+        return;
+    }
+
+    _from = _store.previousLayout();
+    _to = _store.layout();
+
+    _units.clear();
+
+    for (std::size_t i = 0; i < _store.size(); ++i)
+    {
+        if (_from.depth() == 0)
+        {
+            _units.push_back({ i, _store.savePath(i), 0 });
+            continue;
+        }
+
+        std::filesystem::directory_iterator iter(_store.savePath(i)), end;
+
+        for (; iter != end; ++iter)
+        {
+            std::string name = iter->path().filename().string();
+
+            if (std::filesystem::is_directory(iter->path()) &&
+                name.size() == _from.digitsPerLevel() &&
+                name.find_first_not_of("0123456789") == std::string::npos)
+            {
+                _units.push_back({ i, iter->path(), 1 });
+            }
+        }
+    }
+
+    ofLogNotice("StoreResharder::start") << "Resharding " << _units.size() << " directories from " << _from.toString() << " to " << _to.toString() << ".";
+
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _stats = Stats();
+    }
+
+    _startTime = ofGetElapsedTimeMillis();
+    _nextUnit = 0;
+    _cancelled = false;
+    _activeThreads = _numThreads;
+
+    for (std::size_t i = 0; i < _numThreads; ++i)
+    {
+        _threads.emplace_back(&StoreResharder::_run, this);
+    }
+}
+
+
+void StoreResharder::cancel()
+{
+    _cancelled = true;
+}
+
+
+void StoreResharder::wait()
+{
+    for (auto& thread: _threads)
+    {
+        thread.join();
+    }
+
+    _threads.clear();
+}
+
+
+bool StoreResharder::isRunning() const
+{
+    return _activeThreads > 0;
+}
+
+
+StoreResharder::Stats StoreResharder::stats() const
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    return _stats;
+}
+
+
+void StoreResharder::_run()
+{
+    while (!_cancelled)
+    {
+        std::size_t index = _nextUnit++;
+
+        if (index >= _units.size())
+        {
+            break;
+        }
+
+        Stats stats;
+
+        _walk(_units[index], stats);
+
+        std::unique_lock<std::mutex> lock(_mutex);
+        _stats.posts += stats.posts;
+        _stats.skipped += stats.skipped;
+        _stats.errors += stats.errors;
+        _stats.directoriesCreated += stats.directoriesCreated;
+        _stats.directoriesRemoved += stats.directoriesRemoved;
+        _stats.renames += stats.renames;
+        _stats.directoriesListed += stats.directoriesListed;
+    }
+
+    if (--_activeThreads == 0)
+    {
+        _finish();
+    }
+}
+
+
+void StoreResharder::_walk(const Unit& unit, Stats& stats)
+{
+    std::vector<std::filesystem::path> files;
+    std::vector<std::filesystem::path> directories;
+
+    try
+    {
+        ++stats.directoriesListed;
+
+        std::filesystem::directory_iterator iter(unit.directory), end;
+
+        for (; iter != end; ++iter)
+        {
+            std::string name = iter->path().filename().string();
+
+            if (std::filesystem::is_directory(iter->path()))
+            {
+                if (unit.level < _from.depth() &&
+                    name.size() == _from.digitsPerLevel() &&
+                    name.find_first_not_of("0123456789") == std::string::npos)
+                {
+                    directories.push_back(iter->path());
+                }
+            }
+            else if (unit.level == _from.depth() && iter->path().extension() != ".gz")
+            {
+                // JSON is moved along with its image.
+                files.push_back(iter->path());
+            }
+        }
+    }
+    catch (const std::exception& exc)
+    {
+        ofLogError("StoreResharder::_walk") << "Unable to list " << unit.directory << ": " << exc.what();
+        ++stats.errors;
+        return;
+    }
+
+    for (const auto& file: files)
+    {
+        if (_cancelled) return;
+        _move(unit.root, file, stats);
+    }
+
+    for (const auto& directory: directories)
+    {
+        if (_cancelled) return;
+        _walk({ unit.root, directory, unit.level + 1 }, stats);
+    }
+
+    // Keep directories the new layout may be using.
+    if (unit.level > 0 &&
+        (unit.level > _to.depth() || _to.digitsPerLevel() != _from.digitsPerLevel()))
+    {
+        try
+        {
+            if (std::filesystem::is_empty(unit.directory) && std::filesystem::remove(unit.directory))
+            {
+                ++stats.directoriesRemoved;
+            }
+        }
+        catch (const std::exception&)
+        {
+            // Not empty after all, it will be removed by a later run.
+        }
+    }
+}
+
+
+void StoreResharder::_move(std::size_t root,
+                           const std::filesystem::path& path,
+                           Stats& stats)
+{
+    std::string filename = path.filename().string();
+    std::string idToken = filename.substr(0, filename.find('.'));
+
+    if (idToken.empty() || idToken.find_first_not_of("0123456789") != std::string::npos)
+    {
+        return;
+    }
+
+    std::filesystem::path savePath = _store.savePath(root);
+    std::filesystem::path target;
+
+    try
+    {
+        uint64_t id = std::stoull(idToken);
+
+        // Files that do not belong in this directory are left alone.
+        if (path.parent_path() != savePath / _from.directoryFor(id))
+        {
+            return;
+        }
+
+        target = savePath / _to.directoryFor(id) / filename;
+
+        std::filesystem::path jsonPath = path;
+        jsonPath.replace_extension(".json.gz");
+
+        std::filesystem::path targetJsonPath = target;
+        targetJsonPath.replace_extension(".json.gz");
+
+        std::unique_lock<std::mutex> lock(_store.mutexFor(id));
+
+        if (std::filesystem::exists(target))
+        {
+            ++stats.skipped;
+            return;
+        }
+
+        std::vector<std::filesystem::path> missing;
+
+        for (auto parent = target.parent_path(); !std::filesystem::exists(parent); parent = parent.parent_path())
+        {
+            missing.push_back(parent);
+        }
+
+        for (auto iter = missing.rbegin(); iter != missing.rend(); ++iter)
+        {
+            // Another thread may create it first.
+            if (std::filesystem::create_directory(*iter))
+            {
+                ++stats.directoriesCreated;
+            }
+        }
+
+        std::filesystem::rename(path, target);
+        ++stats.renames;
+
+        if (std::filesystem::exists(jsonPath))
+        {
+            std::filesystem::rename(jsonPath, targetJsonPath);
+            ++stats.renames;
+        }
+
+        ++stats.posts;
+    }
+    catch (const std::exception& exc)
+    {
+        ofLogError("StoreResharder::_move") << "Unable to move " << path << " to " << target << ": " << exc.what();
+        ++stats.errors;
+    }
+}
+
+
+void StoreResharder::_finish()
+{
+    Stats result = stats();
+
+    uint64_t elapsed = ofGetElapsedTimeMillis() - _startTime;
+
+    ofLogNotice("StoreResharder::_finish") << "Moved " << result.posts << " posts from " << _from.toString() << " to " << _to.toString() << " in " << elapsed << " ms: " << result.directoriesListed << " listed, " << result.directoriesCreated << " created, " << result.renames << " renamed, " << result.directoriesRemoved << " removed, " << result.operationsPerPost() << " metadata operations per post, " << result.skipped << " skipped, " << result.errors << " errors.";
+
+    if (_cancelled)
+    {
+        ofLogNotice("StoreResharder::_finish") << "Cancelled, start again to resume.";
+    }
+    else if (result.errors > 0)
+    {
+        ofLogWarning("StoreResharder::_finish") << "Some posts could not be moved, start again to retry.";
+    }
+    else
+    {
+        _store.finishReshard();
+    }
+}
+
+
+} } // ofx::InstaLooter
@@ -0,0 +1,409 @@
+//
+// Copyright (c) 2017 Christopher Baker <https://christopherbaker.net>
+//
+// SPDX-License-Identifier:	MIT
+//
+
+
+#include "ofx/InstaLooter/Trace.h"
+#include <algorithm>
+#include <chrono>
+#include "ofLog.h"
+#include "ofUtils.h"
+
+
+namespace ofx {
+namespace InstaLooter {
+
+
+namespace {
+
+
+/// \brief The ring buffer of one thread.
+struct TraceBuffer
+{
+    TraceBuffer(uint64_t id, std::size_t size): id(id), events(size)
+    {
+    }
+
+    /// \brief Guards the buffer, only contended while collecting.
+    std::mutex mutex;
+
+    uint64_t id = 0;
+
+    std::string name;
+
+    std::vector<TraceEvent> events;
+
+    /// \brief The number of events ever recorded.
+    uint64_t written = 0;
+
+    /// \brief True once the thread has exited, after which nothing is
+    /// recorded.
+    std::atomic<bool> exited { false };
+};
+
+
+/// \brief Every buffer, kept after its thread exits so its events are not
+/// lost, until they are streamed or too many threads have exited.
+struct TraceRegistry
+{
+    std::mutex mutex;
+
+    std::vector<std::shared_ptr<TraceBuffer>> buffers;
+
+    std::size_t bufferSize = Trace::DEFAULT_BUFFER_SIZE;
+
+    /// \brief The id of the next buffer, as ids outlive released buffers.
+    uint64_t nextId = 1;
+
+    const std::chrono::steady_clock::time_point epoch = std::chrono::steady_clock::now();
+};
+
+
+TraceRegistry& registry()
+{
+    static TraceRegistry registry;
+    return registry;
+}
+
+
+/// \brief Release the oldest buffers of exited threads beyond
+/// Trace::MAX_EXITED_THREADS. Caller must hold the registry lock.
+void releaseExited(TraceRegistry& r)
+{
+    std::size_t exited = std::count_if(r.buffers.begin(), r.buffers.end(), [](const std::shared_ptr<TraceBuffer>& buffer) {
+        return buffer->exited.load();
+    });
+
+    for (auto iter = r.buffers.begin(); iter != r.buffers.end() && exited > Trace::MAX_EXITED_THREADS;)
+    {
+        if ((*iter)->exited)
+        {
+            iter = r.buffers.erase(iter);
+            --exited;
+        }
+        else
+        {
+            ++iter;
+        }
+    }
+}
+
+
+/// \brief Owns the buffer of a thread and marks it exited with the thread.
+struct ThreadBuffer
+{
+    ~ThreadBuffer()
+    {
+        if (buffer) buffer->exited = true;
+    }
+
+    std::shared_ptr<TraceBuffer> buffer;
+};
+
+
+TraceBuffer& threadBuffer()
+{
+    thread_local ThreadBuffer threadBuffer;
+
+    if (!threadBuffer.buffer)
+    {
+        TraceRegistry& r = registry();
+        std::unique_lock<std::mutex> lock(r.mutex);
+
+        // Threads that come and go, e.g. workers, would otherwise each
+        // leave a whole buffer behind.
+        releaseExited(r);
+
+        threadBuffer.buffer = std::make_shared<TraceBuffer>(r.nextId++, std::max(r.bufferSize, std::size_t(1)));
+        r.buffers.push_back(threadBuffer.buffer);
+    }
+
+    return *threadBuffer.buffer;
+}
+
+
+}
+
+
+const std::size_t Trace::DEFAULT_BUFFER_SIZE = 16384;
+const std::size_t Trace::MAX_EXITED_THREADS = 16;
+std::atomic<bool> Trace::_enabled(false);
+
+
+void Trace::setEnabled(bool enabled)
+{
+    // Start the clock before the first span.
+    registry();
+    _enabled = enabled;
+}
+
+
+void Trace::setBufferSize(std::size_t bufferSize)
+{
+    TraceRegistry& r = registry();
+    std::unique_lock<std::mutex> lock(r.mutex);
+    r.bufferSize = bufferSize;
+}
+
+
+void Trace::setThreadName(const std::string& name)
+{
+    TraceBuffer& buffer = threadBuffer();
+    std::unique_lock<std::mutex> lock(buffer.mutex);
+    buffer.name = name;
+}
+
+
+void Trace::record(const TraceEvent& event)
+{
+    TraceBuffer& buffer = threadBuffer();
+    std::unique_lock<std::mutex> lock(buffer.mutex);
+    buffer.events[buffer.written % buffer.events.size()] = event;
+    ++buffer.written;
+}
+
+
+uint64_t Trace::now()
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - registry().epoch).count();
+}
+
+
+std::vector<TraceThread> Trace::collect(std::map<uint64_t, uint64_t>* cursors)
+{
+    std::vector<std::shared_ptr<TraceBuffer>> buffers;
+
+    {
+        TraceRegistry& r = registry();
+        std::unique_lock<std::mutex> lock(r.mutex);
+        releaseExited(r);
+        buffers = r.buffers;
+    }
+
+    std::vector<TraceThread> threads;
+
+    // Buffers of exited threads whose events have all been streamed.
+    std::vector<std::shared_ptr<TraceBuffer>> collected;
+
+    for (auto& buffer: buffers)
+    {
+        // Read first, so no event can be recorded after the collection.
+        bool exited = buffer->exited;
+
+        std::unique_lock<std::mutex> lock(buffer->mutex);
+
+        uint64_t size = buffer->events.size();
+        uint64_t oldest = buffer->written > size ? buffer->written - size : 0;
+        uint64_t begin = oldest;
+
+        TraceThread thread;
+
+        if (cursors)
+        {
+            uint64_t& cursor = (*cursors)[buffer->id];
+
+            if (cursor < oldest)
+            {
+                thread.dropped = oldest - cursor;
+            }
+
+            begin = std::max(cursor, oldest);
+            cursor = buffer->written;
+
+            if (exited)
+            {
+                collected.push_back(buffer);
+                cursors->erase(buffer->id);
+            }
+        }
+
+        if (begin == buffer->written && thread.dropped == 0)
+        {
+            continue;
+        }
+
+        thread.id = buffer->id;
+        thread.name = buffer->name;
+        thread.events.reserve(buffer->written - begin);
+
+        for (uint64_t i = begin; i < buffer->written; ++i)
+        {
+            thread.events.push_back(buffer->events[i % size]);
+        }
+
+        threads.push_back(std::move(thread));
+    }
+
+    if (!collected.empty())
+    {
+        TraceRegistry& r = registry();
+        std::unique_lock<std::mutex> lock(r.mutex);
+
+        r.buffers.erase(std::remove_if(r.buffers.begin(), r.buffers.end(), [&](const std::shared_ptr<TraceBuffer>& buffer) {
+            return std::find(collected.begin(), collected.end(), buffer) != collected.end();
+        }), r.buffers.end());
+    }
+
+    return threads;
+}
+
+
+void Trace::writeEvents(std::ostream& stream,
+                        const std::vector<TraceThread>& threads,
+                        bool& first)
+{
+    for (const auto& thread: threads)
+    {
+        if (!thread.name.empty())
+        {
+            stream << (first ? "" : ",\n");
+            stream << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << thread.id;
+            stream << ",\"args\":{\"name\":" << ofJson(thread.name).dump() << "}}";
+            first = false;
+        }
+
+        for (const auto& event: thread.events)
+        {
+            stream << (first ? "" : ",\n");
+            stream << "{\"name\":\"" << event.name << "\",\"cat\":\"instalooter\",\"ph\":\"X\"";
+            stream << ",\"pid\":1,\"tid\":" << thread.id;
+            stream << ",\"ts\":" << event.start << ",\"dur\":" << event.duration;
+
+            if (event.count >= 0)
+            {
+                stream << ",\"args\":{\"count\":" << event.count << "}";
+            }
+
+            stream << "}";
+            first = false;
+        }
+    }
+}
+
+
+bool Trace::save(const std::filesystem::path& path)
+{
+    std::vector<TraceThread> threads = collect();
+
+    std::filesystem::path temporaryPath = path;
+    temporaryPath += ".tmp";
+
+    {
+        std::ofstream stream(temporaryPath.string(), std::ios::binary | std::ios::trunc);
+
+        bool first = true;
+
+        stream << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+        writeEvents(stream, threads, first);
+        stream << "\n]}\n";
+
+        if (!stream)
+        {
+            ofLogError("Trace::save") << "Unable to write " << temporaryPath;
+            return false;
+        }
+    }
+
+    try
+    {
+        std::filesystem::rename(temporaryPath, path);
+    }
+    catch (const std::exception& exc)
+    {
+        ofLogError("Trace::save") << "Unable to save " << path << ": " << exc.what();
+        return false;
+    }
+
+    return true;
+}
+
+
+const uint64_t TraceWriter::DEFAULT_INTERVAL = 1000;
+const std::string TraceWriter::DEFAULT_PATH = "trace.json";
+
+
+TraceWriter::TraceWriter(const std::filesystem::path& path, uint64_t interval):
+    IO::PollingThread(std::bind(&TraceWriter::_write, this), interval),
+    _path(path)
+{
+    _stream.open(_path.string(), std::ios::binary | std::ios::trunc);
+
+    if (!_stream)
+    {
+        ofLogError("TraceWriter::TraceWriter") << "Unable to open " << _path;
+    }
+
+    _stream << "[\n";
+
+    // Only what happens from now on is streamed.
+    Trace::collect(&_cursors);
+
+    start();
+}
+
+
+TraceWriter::~TraceWriter()
+{
+    stop();
+    _write();
+}
+
+
+std::filesystem::path TraceWriter::path() const
+{
+    return _path;
+}
+
+
+std::unique_ptr<TraceWriter> TraceWriter::fromJSON(const ofJson& settings)
+{
+    if (!settings.is_object())
+    {
+        return nullptr;
+    }
+
+    Trace::setBufferSize(settings.value("buffer_size", Trace::DEFAULT_BUFFER_SIZE));
+
+    bool enabled = settings.value("enabled", false);
+
+    Trace::setEnabled(enabled);
+
+    if (!enabled || !settings.value("continuous", false))
+    {
+        return nullptr;
+    }
+
+    return std::make_unique<TraceWriter>(ofToDataPath(settings.value("path", DEFAULT_PATH), true),
+                                         settings.value("interval", DEFAULT_INTERVAL));
+}
+
+
+void TraceWriter::_write()
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+
+    std::vector<TraceThread> threads = Trace::collect(&_cursors);
+
+    uint64_t dropped = 0;
+
+    for (const auto& thread: threads)
+    {
+        dropped += thread.dropped;
+    }
+
+    if (dropped > 0)
+    {
+        ofLogWarning("TraceWriter::_write") << "Dropped " << dropped << " events, increase the buffer size or write more often.";
+    }
+
+    if (!threads.empty())
+    {
+        Trace::writeEvents(_stream, threads, _first);
+        _stream.flush();
+    }
+}
+
+
+} } // ofx::InstaLooter
@@ -0,0 +1,324 @@
+//
+// Copyright (c) 2017 Christopher Baker <https://christopherbaker.net>
+//
+// SPDX-License-Identifier:	MIT
+//
+
+
+#include "ofx/InstaLooter/WorkerPool.h"
+#include <algorithm>
+#include <chrono>
+#include <ctime>
+#include "Poco/Exception.h"
+#include "ofLog.h"
+#include "ofUtils.h"
+
+
+namespace ofx {
+namespace InstaLooter {
+
+
+const std::size_t WorkerPool::DEFAULT_SIZE = 2;
+const std::string WorkerPool::DEFAULT_WORKER_PATH = "instalooter_worker.py";
+const uint64_t WorkerPool::POLL_INTERVAL = 100;
+
+
+WorkerPool::WorkerPool(const std::filesystem::path& workerPath,
+                       const std::vector<std::string>& workerArgs,
+                       std::size_t size):
+    _workerPath(workerPath),
+    _workerArgs(workerArgs),
+    _launches(0),
+    _nextJobId(0)
+{
+    for (std::size_t i = 0; i < std::max(size, std::size_t(1)); ++i)
+    {
+        _workers.push_back(std::make_unique<Worker>());
+    }
+}
+
+
+WorkerPool::~WorkerPool()
+{
+    // Kill everything first so the workers exit in parallel.
+    for (auto& worker: _workers)
+    {
+        if (worker->process) worker->process->kill();
+    }
+
+    _workers.clear();
+}
+
+
+FetchResult WorkerPool::run(const FetchJob& job,
+                            uint64_t timeout,
+                            const CancellationToken& token,
+                            OutputMonitor* monitor)
+{
+    FetchResult result;
+
+    OutputMonitor localMonitor;
+    OutputMonitor& output = monitor ? *monitor : localMonitor;
+
+    Worker* worker = _acquire(token);
+
+    if (worker == nullptr)
+    {
+        result.killed = true;
+        return result;
+    }
+
+    bool healthy = false;
+
+    try
+    {
+        _ensureRunning(*worker);
+
+        uint64_t jobId = ++_nextJobId;
+
+        ofJson request = FetchJob::toJSON(job);
+        request["id"] = jobId;
+
+        if (!worker->process->write(request.dump() + "\n"))
+        {
+            throw Poco::IOException("Unable to send job to worker.");
+        }
+
+        auto startTime = std::chrono::steady_clock::now();
+
+        bool done = false;
+
+        while (!done)
+        {
+            auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - startTime);
+
+            if (token.isCancelled())
+            {
+                result.killed = true;
+                break;
+            }
+            else if (static_cast<uint64_t>(elapsed.count()) >= timeout)
+            {
+                ofLogWarning("WorkerPool::run") << "Job timed out, killing worker.";
+                result.killed = true;
+                result.timedOut = true;
+                break;
+            }
+
+            if (!worker->process->read(worker->buffer, POLL_INTERVAL))
+            {
+                ofLogWarning("WorkerPool::run") << "Worker exited during job.";
+                break;
+            }
+
+            std::size_t position = 0;
+            std::size_t newline = std::string::npos;
+
+            while (!done && (newline = worker->buffer.find('\n', position)) != std::string::npos)
+            {
+                std::string line = worker->buffer.substr(position, newline - position);
+                position = newline + 1;
+
+                ofJson message;
+
+                try
+                {
+                    message = ofJson::parse(line);
+                }
+                catch (const std::exception&)
+                {
+                    // Stray output, e.g. from a library printing to stdout.
+                    output.writeLine(line);
+                    continue;
+                }
+
+                if (!message.is_object() || message.value("id", uint64_t(0)) != jobId)
+                {
+                    continue;
+                }
+
+                std::string type = message.value("type", "");
+
+                if (type == "log")
+                {
+                    output.write(message.value("message", "") + "\n");
+                }
+                else if (type == "done")
+                {
+                    result.exitCode = message.value("exit_code", -1);
+
+                    std::string error = message.value("error", "");
+
+                    if (!error.empty())
+                    {
+                        output.writeLine(error);
+                    }
+
+                    healthy = true;
+                    done = true;
+                }
+            }
+
+            worker->buffer.erase(0, position);
+        }
+    }
+    catch (const Poco::Exception& exc)
+    {
+        ofLogError("WorkerPool::run") << exc.displayText();
+    }
+
+    _release(worker, healthy);
+
+    output.flush();
+    result.output = output.tailString();
+    result.progress = output.progress();
+
+    return result;
+}
+
+
+std::size_t WorkerPool::size() const
+{
+    return _workers.size();
+}
+
+
+uint64_t WorkerPool::launches() const
+{
+    return _launches;
+}
+
+
+void WorkerPool::setProcessPolicy(const ResourcePolicy& processPolicy)
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    _processPolicy = processPolicy;
+}
+
+
+ResourcePolicy WorkerPool::getProcessPolicy() const
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    return _processPolicy;
+}
+
+
+std::shared_ptr<WorkerPool> WorkerPool::fromJSON(const ofJson& settings)
+{
+    if (!settings.is_object() || !settings.value("enabled", true))
+    {
+        return nullptr;
+    }
+
+    std::size_t size = settings.value("size", DEFAULT_SIZE);
+
+    if (size == 0)
+    {
+        return nullptr;
+    }
+
+    std::filesystem::path workerPath = ofToDataPath(settings.value("worker_path", DEFAULT_WORKER_PATH), true);
+
+    std::vector<std::string> workerArgs;
+
+    auto argsIter = settings.find("worker_args");
+
+    if (argsIter != settings.end())
+    {
+        workerArgs = argsIter->get<std::vector<std::string>>();
+    }
+
+    if (settings.value("stub", false))
+    {
+        workerArgs.push_back("--stub");
+
+        auto failureIter = settings.find("stub_failure");
+
+        if (failureIter != settings.end() && failureIter->is_object())
+        {
+            workerArgs.push_back("--stub-failure-rate");
+            workerArgs.push_back(ofToString(failureIter->value("rate", 1.0)));
+            workerArgs.push_back("--stub-failure");
+            workerArgs.push_back(failureIter->value("kind", std::string("throttled")));
+        }
+    }
+
+    auto replayIter = settings.find("replay");
+
+    if (replayIter != settings.end() && replayIter->is_object() && replayIter->value("enabled", true))
+    {
+        // Every worker shares the same clock, so posts are replayed once
+        // with their original spacing whichever worker picks up a job.
+        workerArgs.push_back("--replay");
+        workerArgs.push_back(ofToDataPath(replayIter->value("path", std::string("recording/")), true));
+        workerArgs.push_back("--replay-speed");
+        workerArgs.push_back(ofToString(replayIter->value("speed", 1.0)));
+        workerArgs.push_back("--replay-start");
+        workerArgs.push_back(ofToString(std::time(nullptr)));
+    }
+
+    return std::make_shared<WorkerPool>(workerPath, workerArgs, size);
+}
+
+
+WorkerPool::Worker* WorkerPool::_acquire(const CancellationToken& token)
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+
+    while (!token.isCancelled())
+    {
+        for (auto& worker: _workers)
+        {
+            if (!worker->busy)
+            {
+                worker->busy = true;
+                return worker.get();
+            }
+        }
+
+        _condition.wait_for(lock, std::chrono::milliseconds(POLL_INTERVAL));
+    }
+
+    return nullptr;
+}
+
+
+void WorkerPool::_release(Worker* worker, bool healthy)
+{
+    if (!healthy && worker->process)
+    {
+        worker->process.reset();
+    }
+
+    worker->buffer.clear();
+
+    std::unique_lock<std::mutex> lock(_mutex);
+    worker->busy = false;
+    _condition.notify_one();
+}
+
+
+void WorkerPool::_ensureRunning(Worker& worker)
+{
+    if (worker.process && worker.process->isRunning())
+    {
+        return;
+    }
+
+    worker.process = std::make_unique<ChildProcess>();
+    worker.buffer.clear();
+
+    // Standard error stays with the parent so it can't corrupt the protocol.
+    worker.process->launch(_workerPath.string(),
+                           _workerArgs,
+                           ChildProcess::OPTION_PIPE_INPUT | ChildProcess::OPTION_INHERIT_ERROR);
+
+    getProcessPolicy().applyToProcess(worker.process->id());
+
+    ++_launches;
+
+    ofLogVerbose("WorkerPool::_ensureRunning") << "Launched worker " << worker.process->id() << ".";
+}
+
+
+} } // ofx::InstaLooter
@@ -0,0 +1,64 @@
+//
+// Copyright (c) 2017 Christopher Baker <https://christopherbaker.net>
+//
+// SPDX-License-Identifier:	MIT
+//
+
+
+#include "ofx/InstaLooter/WriteQueue.h"
+
+
+namespace ofx {
+namespace InstaLooter {
+
+
+WriteQueue::WriteQueue(Handler handler, const ResourcePolicy& threadPolicy):
+    _handler(handler),
+    _threadPolicy(threadPolicy),
+    _thread(&WriteQueue::_run, this)
+{
+}
+
+
+WriteQueue::~WriteQueue()
+{
+    _posts.close();
+
+    if (_thread.joinable())
+    {
+        _thread.join();
+    }
+}
+
+
+void WriteQueue::send(Post&& post)
+{
+    _posts.send(std::move(post));
+}
+
+
+std::size_t WriteQueue::size() const
+{
+    return _posts.size();
+}
+
+
+void WriteQueue::_run()
+{
+    _threadPolicy.applyToThread();
+
+    std::vector<Post> batch;
+    Post post;
+
+    // Block for the first post, then take the rest of the backlog at once.
+    while (_posts.receive(post))
+    {
+        batch.clear();
+        batch.push_back(std::move(post));
+        _posts.receiveAll(batch);
+        _handler(batch);
+    }
+}
+
+
+} } // ofx::InstaLooter
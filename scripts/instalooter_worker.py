@@ -0,0 +1,317 @@
+#!/usr/bin/env python
+# -*- coding: utf-8 -*-
+#
+# Copyright (c) 2017 Christopher Baker <https://christopherbaker.net>
+#
+# SPDX-License-Identifier:	MIT
+#
+# A persistent instaLooter worker for ofx::InstaLooter::WorkerPool.
+#
+# Reads one JSON job per line on stdin and runs it in this interpreter, so the
+# interpreter start up and module imports are paid once per worker instead of
+# once per poll. Each job is answered on stdout with log lines followed by a
+# done line, all tagged with the job id:
+#
+#   {"id": 1, "type": "log", "message": "..."}
+#   {"id": 1, "type": "done", "exit_code": 0}
+#
+# With --stub, no network access is made. Each hashtag gets a fake feed that
+# gains --stub-rate posts a second, and each job writes its newest posts as
+# small PNG files named with the instaLooter filename template, so the whole
+# pipeline can be exercised offline. Like instaLooter with --new, a job stops
+# at the first post already downloaded, and at the job's cursor, the newest
+# post the client has stored.
+#
+# With --stub-failure-rate, that fraction of stub jobs fail instead, printing
+# an error like instaLooter's for the --stub-failure kind ("throttled",
+# "auth", "network" or "error") and exiting with 1, to exercise the clients'
+# backoff and circuit breakers.
+#
+# With --replay DIR, no network access is made either. DIR is a recorded copy
+# of a store's instagram/downloads directory (copied with modification times
+# kept, e.g. rsync -a), holding DIR/<hashtag>/unsorted/<download>. Each job
+# copies the recorded downloads of its hashtag whose time has come, keeping
+# the original spacing between downloads divided by --replay-speed. Replayed
+# files get their scheduled time as modification time, so latency is measured
+# from when the download would have happened.
+
+from __future__ import print_function
+
+import argparse
+import io
+import json
+import os
+import random
+import shutil
+import struct
+import sys
+import time
+import traceback
+import zlib
+
+
+class LogWriter(io.TextIOBase):
+    """Forwards everything written to it as log messages for a job."""
+
+    def __init__(self, job_id, out):
+        self.job_id = job_id
+        self.out = out
+        self.pending = ""
+
+    def writable(self):
+        return True
+
+    def write(self, text):
+        self.pending += text
+        while "\n" in self.pending:
+            line, self.pending = self.pending.split("\n", 1)
+            send(self.out, self.job_id, "log", message=line)
+        return len(text)
+
+    def flush(self):
+        if self.pending:
+            send(self.out, self.job_id, "log", message=self.pending)
+            self.pending = ""
+
+
+def send(out, job_id, message_type, **fields):
+    fields["id"] = job_id
+    fields["type"] = message_type
+    out.write(json.dumps(fields) + "\n")
+    out.flush()
+
+
+def load_instalooter_main():
+    try:
+        from instalooter.cli import main
+    except ImportError:
+        from instaLooter.cli import main
+    return main
+
+
+def run_instalooter(main, job):
+    try:
+        result = main(job["arguments"])
+        return int(result or 0)
+    except SystemExit as exc:
+        if exc.code is None:
+            return 0
+        return exc.code if isinstance(exc.code, int) else 1
+
+
+def png(width, height):
+    def chunk(kind, data):
+        body = kind + data
+        return struct.pack(">I", len(data)) + body + struct.pack(">I", zlib.crc32(body) & 0xffffffff)
+
+    rows = b"".join(b"\x00" + b"\x80\x80\x80" * width for _ in range(height))
+    return (b"\x89PNG\r\n\x1a\n" +
+            chunk(b"IHDR", struct.pack(">IIBBBBB", width, height, 8, 2, 0, 0, 0)) +
+            chunk(b"IDAT", zlib.compress(rows)) +
+            chunk(b"IEND", b""))
+
+
+STUB_FAILURES = {
+    "throttled": "requests.exceptions.HTTPError: 429 Client Error: Too Many Requests",
+    "auth": "Login failed: checkpoint_required",
+    "network": "requests.exceptions.ConnectionError: Max retries exceeded with url: /explore/tags/",
+    "error": "RuntimeError: stub failure",
+}
+
+
+def cursor_id(job):
+    return int(job.get("cursor", {}).get("id", 0))
+
+
+def run_stub(job, options):
+    directory = job["directory"]
+    count = min(int(job.get("num_images_to_download", 1)), options.stub_count)
+    cursor = cursor_id(job)
+
+    if not os.path.isdir(directory):
+        os.makedirs(directory)
+
+    time.sleep(options.stub_delay)
+
+    if random.random() < options.stub_failure_rate:
+        print(STUB_FAILURES[options.stub_failure])
+        return 1
+
+    # Post n of the feed is posted at n / rate, and ids grow with time as
+    # Instagram's do. The hashtag offsets ids so feeds rarely share posts.
+    rate = options.stub_rate if options.stub_rate > 0 else 1.0
+    offset = sum(ord(c) for c in job["hashtag"]) % 100
+    newest = int(time.time() * rate)
+    existing = set(name.split(".")[0] for name in os.listdir(directory))
+
+    for n in range(newest, max(newest - count, -1), -1):
+        post_id = 1000000000000000000 + n * 100 + offset
+
+        if post_id <= cursor or str(post_id) in existing:
+            break
+
+        posted = time.localtime(n / rate)
+        stamp = "%d-%d-%d %dh%dm%ds0" % (posted.tm_year, posted.tm_mon, posted.tm_mday,
+                                         posted.tm_hour, posted.tm_min, posted.tm_sec)
+        owner_id = 1000000 + (n * 7919) % 999000000
+        name = "%d.%d.%s.png" % (post_id, owner_id, stamp)
+        with open(os.path.join(directory, name), "wb") as f:
+            f.write(png(8, 8))
+        print("Downloaded %s" % name)
+
+    return 0
+
+
+class Replay(object):
+    """Plays back recorded downloads on a shared schedule."""
+
+    def __init__(self, path, speed, start):
+        self.path = path
+        self.speed = speed if speed > 0 else 1.0
+        self.start = start if start > 0 else time.time()
+        self.pending = {}
+        self.origin = None
+
+        for hashtag in sorted(os.listdir(path)):
+            directory = os.path.join(path, hashtag, "unsorted")
+
+            if not os.path.isdir(directory):
+                directory = os.path.join(path, hashtag)
+
+            if not os.path.isdir(directory):
+                continue
+
+            downloads = []
+
+            for name in os.listdir(directory):
+                source = os.path.join(directory, name)
+
+                if os.path.isfile(source) and not name.startswith("."):
+                    downloads.append((os.path.getmtime(source), name, source))
+
+            downloads.sort()
+            self.pending[hashtag] = downloads
+
+            if downloads and (self.origin is None or downloads[0][0] < self.origin):
+                self.origin = downloads[0][0]
+
+    def due(self, hashtag, now):
+        """Removes and returns the downloads of a hashtag scheduled by now."""
+        downloads = self.pending.get(hashtag, [])
+        count = 0
+
+        while count < len(downloads) and self.scheduled(downloads[count][0]) <= now:
+            count += 1
+
+        self.pending[hashtag] = downloads[count:]
+        return downloads[:count]
+
+    def scheduled(self, recorded):
+        return self.start + (recorded - self.origin) / self.speed
+
+    def remaining(self):
+        return sum(len(downloads) for downloads in self.pending.values())
+
+
+def run_replay(job, replay):
+    directory = job["directory"]
+
+    if not os.path.isdir(directory):
+        os.makedirs(directory)
+
+    downloads = replay.due(job["hashtag"], time.time())
+    cursor = cursor_id(job)
+
+    for recorded, name, source in downloads:
+        target = os.path.join(directory, name)
+
+        # Another worker may have replayed it already.
+        if os.path.exists(target):
+            continue
+
+        # Already stored, e.g. when resuming a replay.
+        post_id = name.split(".")[0]
+        if post_id.isdigit() and int(post_id) <= cursor:
+            continue
+
+        # Written under a temporary name, so a poll never sees half a file.
+        partial = os.path.join(directory, "." + name + ".part")
+        shutil.copyfile(source, partial)
+        scheduled = replay.scheduled(recorded)
+        os.utime(partial, (scheduled, scheduled))
+        os.rename(partial, target)
+        print("Downloaded %s" % name)
+
+    print("Replayed %d, %d remaining" % (len(downloads), replay.remaining()))
+    return 0
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Persistent instaLooter worker.")
+    parser.add_argument("--stub", action="store_true",
+                        help="generate fake images instead of contacting Instagram")
+    parser.add_argument("--stub-count", type=int, default=5,
+                        help="the maximum number of fake images per job")
+    parser.add_argument("--stub-delay", type=float, default=0.0,
+                        help="seconds each fake job takes")
+    parser.add_argument("--stub-rate", type=float, default=1.0,
+                        help="fake posts per second on each hashtag")
+    parser.add_argument("--stub-failure-rate", type=float, default=0.0,
+                        help="the fraction of fake jobs that fail")
+    parser.add_argument("--stub-failure", choices=sorted(STUB_FAILURES), default="throttled",
+                        help="how fake jobs fail")
+    parser.add_argument("--replay", metavar="DIR",
+                        help="play back recorded downloads instead of contacting Instagram")
+    parser.add_argument("--replay-speed", type=float, default=1.0,
+                        help="how many times faster than recorded to play back")
+    parser.add_argument("--replay-start", type=float, default=0.0,
+                        help="the shared playback start as a unix time, defaults to now")
+    options = parser.parse_args()
+
+    out = sys.stdout
+    replay = None
+    main_function = None
+
+    if options.replay:
+        replay = Replay(options.replay, options.replay_speed, options.replay_start)
+    elif not options.stub:
+        main_function = load_instalooter_main()
+
+    for line in iter(sys.stdin.readline, ""):
+        line = line.strip()
+
+        if not line:
+            continue
+
+        try:
+            job = json.loads(line)
+        except ValueError:
+            print("Invalid job: " + line, file=sys.stderr)
+            continue
+
+        job_id = job.get("id", 0)
+        writer = LogWriter(job_id, out)
+        error = ""
+
+        saved = sys.stdout, sys.stderr
+        sys.stdout = sys.stderr = writer
+
+        try:
+            if replay:
+                exit_code = run_replay(job, replay)
+            elif options.stub:
+                exit_code = run_stub(job, options)
+            else:
+                exit_code = run_instalooter(main_function, job)
+        except Exception:
+            exit_code = 1
+            error = traceback.format_exc()
+        finally:
+            writer.flush()
+            sys.stdout, sys.stderr = saved
+
+        send(out, job_id, "done", exit_code=exit_code, error=error)
+
+
+if __name__ == "__main__":
+    main()
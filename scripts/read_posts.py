@@ -0,0 +1,160 @@
+#!/usr/bin/env python3
+# -*- coding: utf-8 -*-
+#
+# Copyright (c) 2017 Christopher Baker <https://christopherbaker.net>
+#
+# SPDX-License-Identifier:	MIT
+#
+# Reads post metadata exported by ofx::InstaLooter::StoreExporter.
+#
+# Given an export directory, every part listed in its export.json is read
+# and a post found in several parts keeps its latest row. Given .ilp files,
+# they are read in order. Without other options a summary is printed: the
+# number of posts, posts per day and the most common hashtags and hashtag
+# pairs.
+#
+# As a module, read_part() yields one dictionary of columns per record
+# batch and read_posts() one dictionary per post:
+#
+#   import read_posts
+#   for post in read_posts.read_posts("export/"):
+#       print(post["id"], post["hashtags"])
+
+import argparse
+import array
+import collections
+import itertools
+import json
+import mmap
+import os
+import struct
+import sys
+import time
+
+MAGIC = b"ILPOSTS1"
+
+
+def read_column(data, offset, typecode, count):
+    column = array.array(typecode)
+    end = offset + column.itemsize * count
+    column.frombytes(data[offset:end])
+    if sys.byteorder != "little":
+        column.byteswap()
+    return column, end
+
+
+def read_part(path):
+    """Yields the record batches of a part, each a dict of columns.
+
+    A part cut short by a crash is read up to its last whole batch.
+    """
+    with open(path, "rb") as f:
+        data = mmap.mmap(f.fileno(), 0, access=mmap.ACCESS_READ)
+
+    if data[:8] != MAGIC:
+        raise ValueError("%s is not an exported part" % path)
+
+    dictionary = []
+    offset = 8
+
+    while offset + 12 <= len(data) and data[offset:offset + 4] == b"BTCH":
+        try:
+            rows, added = struct.unpack_from("<II", data, offset + 4)
+            offset += 12
+
+            new_entries = []
+            for _ in range(added):
+                length, = struct.unpack_from("<I", data, offset)
+                new_entries.append(data[offset + 4:offset + 4 + length].decode("utf-8"))
+                offset += 4 + length
+
+            batch = {}
+            batch["id"], offset = read_column(data, offset, "Q", rows)
+            batch["user_id"], offset = read_column(data, offset, "Q", rows)
+            batch["timestamp"], offset = read_column(data, offset, "Q", rows)
+            batch["width"], offset = read_column(data, offset, "I", rows)
+            batch["height"], offset = read_column(data, offset, "I", rows)
+            offsets, offset = read_column(data, offset, "I", rows + 1)
+            ids, offset = read_column(data, offset, "I", offsets[-1])
+        except (struct.error, IndexError, ValueError):
+            break
+
+        if offset > len(data):
+            break
+
+        dictionary.extend(new_entries)
+        batch["hashtags"] = [[dictionary[i] for i in ids[offsets[row]:offsets[row + 1]]]
+                             for row in range(rows)]
+        yield batch
+
+
+def part_paths(path):
+    if not os.path.isdir(path):
+        return [path]
+
+    with open(os.path.join(path, "export.json")) as f:
+        state = json.load(f)
+
+    return [os.path.join(path, part["path"]) for part in state.get("parts", [])]
+
+
+def read_posts(*paths):
+    """Yields each post once, as a dict, from its latest part."""
+    latest = collections.OrderedDict()
+    keys = ("id", "user_id", "timestamp", "width", "height", "hashtags")
+
+    for path in itertools.chain.from_iterable(part_paths(p) for p in paths):
+        for batch in read_part(path):
+            for row in range(len(batch["id"])):
+                post = dict((key, batch[key][row]) for key in keys)
+                latest.pop(post["id"], None)
+                latest[post["id"]] = post
+
+    return iter(latest.values())
+
+
+def summarize(posts, top):
+    days = collections.Counter()
+    hashtags = collections.Counter()
+    pairs = collections.Counter()
+    count = 0
+
+    for post in posts:
+        count += 1
+        days[time.strftime("%Y-%m-%d", time.gmtime(post["timestamp"]))] += 1
+        tags = sorted(set(post["hashtags"]))
+        hashtags.update(tags)
+        pairs.update(itertools.combinations(tags, 2))
+
+    print("posts: %d" % count)
+    print("\nposts per day:")
+    for day in sorted(days):
+        print("  %s %d" % (day, days[day]))
+    print("\nhashtags:")
+    for tag, n in hashtags.most_common(top):
+        print("  %-30s %d" % (tag, n))
+    print("\nhashtag pairs:")
+    for (a, b), n in pairs.most_common(top):
+        print("  %-30s %d" % (a + " + " + b, n))
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Read exported post metadata.")
+    parser.add_argument("paths", nargs="+", help="export directories or .ilp parts")
+    parser.add_argument("--json", action="store_true",
+                        help="print each post as a line of JSON instead of a summary")
+    parser.add_argument("--top", type=int, default=20,
+                        help="the number of hashtags and pairs in the summary")
+    options = parser.parse_args()
+
+    posts = read_posts(*options.paths)
+
+    if options.json:
+        for post in posts:
+            print(json.dumps(post))
+    else:
+        summarize(posts, options.top)
+
+
+if __name__ == "__main__":
+    main()
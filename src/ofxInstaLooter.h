@@ -10,6 +10,11 @@
 
 #include "ofx/InstaLooter/HashtagClient.h"
 #include "ofx/InstaLooter/HashtagClientManager.h"
+#include "ofx/InstaLooter/LoadReport.h"
+#include "ofx/InstaLooter/SharedFeed.h"
+#include "ofx/InstaLooter/StoreChecker.h"
+#include "ofx/InstaLooter/StoreExporter.h"
+#include "ofx/InstaLooter/Trace.h"
 
 
 namespace ofxInstaLooter = ofx::InstaLooter;